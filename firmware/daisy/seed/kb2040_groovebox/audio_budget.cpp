@@ -0,0 +1,36 @@
+#include "audio_budget.h"
+
+void StackMonitor::Paint(uint32_t* bottom, uint32_t* limit, const uint32_t* top)
+{
+    for(uint32_t* p = bottom; p < limit; p++)
+        *p = kPaint;
+    bottom_  = bottom;
+    deepest_ = limit;
+    top_     = top;
+}
+
+uint32_t StackMonitor::HighWater()
+{
+    if(!bottom_)
+        return 0;
+    for(uint32_t* p = bottom_; p < deepest_; p++)
+        if(*p != kPaint)
+        {
+            deepest_ = p;
+            break;
+        }
+    return (uint32_t)((top_ - deepest_) * 4);
+}
+
+uint32_t StackMonitor::EntryDepth() const
+{
+    if(minEntry_ == UINTPTR_MAX)
+        return 0;
+    return (uint32_t)((uintptr_t)top_ - minEntry_);
+}
+
+void WcetTable::Reset()
+{
+    for(Entry& e : entries_)
+        e = Entry();
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+// How close the audio interrupt runs to its limits: stack depth and
+// worst-case execution time.
+//
+// StackMonitor paints the unused part of the main stack at boot and
+// later finds the deepest word that was overwritten. Interrupts run on
+// the same stack as main(), so the high-water mark covers main() plus
+// whatever interrupts stacked on top of it; the audio callback notes the
+// stack pointer it was entered at, which tells how deep main() (and any
+// interrupt it preempted) already was.
+//
+// WcetTable keeps the longest callback per engine feature combination
+// (EngineFeature in groovebox_engine.h), so a new engine shows which
+// combination it pushes toward the block period.
+//
+// No libDaisy dependency; the platform supplies the stack bounds and the
+// clock.
+
+#include <stdint.h>
+
+class StackMonitor
+{
+  public:
+    static const uint32_t kPaint = 0xC5C5C5C5;
+
+    // Fills [bottom, limit) with kPaint; top is where the stack starts.
+    // Call with interrupts off: anything that runs meanwhile pushes into
+    // the range being painted.
+    void Paint(uint32_t* bottom, uint32_t* limit, const uint32_t* top);
+
+    // Audio callback, on entry
+    void NoteEntry(uintptr_t sp)
+    {
+        if(sp < minEntry_)
+            minEntry_ = sp;
+    }
+
+    // main(). Bytes below top the stack has reached since Paint(). Scans
+    // the painted range from the bottom up to the deepest point so far.
+    uint32_t HighWater();
+
+    // Deepest the audio callback was entered at, bytes below top
+    uint32_t EntryDepth() const;
+
+    uint32_t Watched() const { return (uint32_t)((top_ - bottom_) * 4); }
+
+    // The whole painted range has been used: the real high-water mark is
+    // at least Watched() and may have run into whatever lies below
+    bool Exhausted() const { return bottom_ && *bottom_ != kPaint; }
+
+  private:
+    uint32_t*       bottom_   = nullptr;
+    uint32_t*       deepest_  = nullptr;
+    const uint32_t* top_      = nullptr;
+    uintptr_t       minEntry_ = UINTPTR_MAX;
+};
+
+class WcetTable
+{
+  public:
+    static const int kKeys = 1 << 8; // EngineFeature keys are a byte
+
+    struct Entry
+    {
+        uint32_t blocks;
+        uint32_t maxTicks;
+    };
+
+    // Audio callback, after rendering
+    void Record(uint8_t key, uint32_t ticks)
+    {
+        Entry& e = entries_[key];
+        e.blocks++;
+        if(ticks > e.maxTicks)
+            e.maxTicks = ticks;
+    }
+
+    const Entry& At(uint8_t key) const { return entries_[key]; }
+
+    // Not safe against Record(); the audio callback may leave one entry
+    // counted from before the reset
+    void Reset();
+
+  private:
+    Entry entries_[kKeys] = {};
+};
@@ -0,0 +1,87 @@
+#pragma once
+
+// Audio block size and sample rate. main() reads them from QSPI flash at
+// boot (libDaisy PersistentStorage) and sizes everything from them. The
+// KB2040 changes them with the MidiCC::AUDIO_* controllers; the Daisy
+// saves the new values and runs at them from its next boot.
+//
+// Added latency per block size and rate: the block a note waits for plus
+// the one being played out, 1.5 blocks on average and 2 at worst.
+//
+//   rate   block   block ms   latency avg/max ms
+//   32k       8       0.25          0.38 / 0.50
+//   32k      16       0.50          0.75 / 1.00
+//   32k      24       0.75          1.12 / 1.50
+//   32k      32       1.00          1.50 / 2.00
+//   32k      48       1.50          2.25 / 3.00
+//   32k      64       2.00          3.00 / 4.00
+//   32k      96       3.00          4.50 / 6.00
+//   32k     128       4.00          6.00 / 8.00
+//   32k     192       6.00          9.00 / 12.00
+//   32k     256       8.00         12.00 / 16.00
+//   48k       8       0.17          0.25 / 0.33
+//   48k      16       0.33          0.50 / 0.67
+//   48k      24       0.50          0.75 / 1.00
+//   48k      32       0.67          1.00 / 1.33
+//   48k      48       1.00          1.50 / 2.00
+//   48k      64       1.33          2.00 / 2.67
+//   48k      96       2.00          3.00 / 4.00
+//   48k     128       2.67          4.00 / 5.33
+//   48k     192       4.00          6.00 / 8.00
+//   48k     256       5.33          8.00 / 10.67
+//   96k       8       0.08          0.12 / 0.17
+//   96k      16       0.17          0.25 / 0.33
+//   96k      24       0.25          0.38 / 0.50
+//   96k      32       0.33          0.50 / 0.67
+//   96k      48       0.50          0.75 / 1.00
+//   96k      64       0.67          1.00 / 1.33
+//   96k      96       1.00          1.50 / 2.00
+//   96k     128       1.33          2.00 / 2.67
+//   96k     192       2.00          3.00 / 4.00
+//   96k     256       2.67          4.00 / 5.33
+//
+// What each costs in CPU has to be measured on the real engine: firmware/
+// host "make blocks" built against the real DaisySP, or the Seed itself.
+// Smaller blocks cost more there than on a host, which can't see the
+// Seed's fixed cost per callback (DMA interrupt, cache maintenance).
+
+#include "midi_protocol.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct AudioConfig
+{
+    uint8_t blockIndex = MidiAudio::DEFAULT_BLOCK_SIZE;
+    uint8_t rateIndex  = MidiAudio::DEFAULT_SAMPLE_RATE;
+
+    // Flash that was never written, or written by other firmware, fails this
+    bool Valid() const
+    {
+        return blockIndex < MidiAudio::NUM_BLOCK_SIZES
+               && rateIndex < MidiAudio::NUM_SAMPLE_RATES;
+    }
+
+    size_t   BlockSize() const { return MidiAudio::BLOCK_SIZES[blockIndex]; }
+    uint32_t SampleRate() const { return MidiAudio::SAMPLE_RATES[rateIndex]; }
+
+    // Applies an AUDIO_* controller. Returns false for any other one.
+    // Out-of-range values are clamped to the last entry.
+    bool ApplyCC(uint8_t cc, uint8_t val)
+    {
+        if(cc == MidiCC::AUDIO_BLOCK_SIZE)
+            blockIndex = val < MidiAudio::NUM_BLOCK_SIZES ? val : MidiAudio::NUM_BLOCK_SIZES - 1;
+        else if(cc == MidiCC::AUDIO_SAMPLE_RATE)
+            rateIndex = val < MidiAudio::NUM_SAMPLE_RATES ? val : MidiAudio::NUM_SAMPLE_RATES - 1;
+        else
+            return false;
+        return true;
+    }
+
+    // PersistentStorage compares with the flash copy before writing
+    bool operator==(const AudioConfig& o) const
+    {
+        return blockIndex == o.blockIndex && rateIndex == o.rateIndex;
+    }
+    bool operator!=(const AudioConfig& o) const { return !(*this == o); }
+};
@@ -0,0 +1,111 @@
+#include "background.h"
+
+void BgExecutor::Init(const Config& cfg, uint32_t (*nowUs)())
+{
+    cfg_   = cfg;
+    nowUs_ = nowUs;
+    for(int i = 0; i < BG_NUM_PRIORITIES; i++)
+        head_[i] = tail_[i] = nullptr;
+}
+
+bool BgExecutor::Submit(BgJob* job, BgPriority priority)
+{
+    if(!job || !job->step || job->queued)
+        return false;
+    job->priority   = priority;
+    job->queued     = true;
+    job->slices     = 0;
+    job->steps      = 0;
+    job->runUs      = 0;
+    job->maxWaitUs  = 0;
+    job->maxSliceUs = 0;
+    job->waitUs     = nowUs_();
+    Push(job, priority, job->waitUs);
+    return true;
+}
+
+bool BgExecutor::Idle() const
+{
+    for(int i = 0; i < BG_NUM_PRIORITIES; i++)
+        if(head_[i])
+            return false;
+    return true;
+}
+
+void BgExecutor::Push(BgJob* job, uint8_t level, uint32_t now)
+{
+    job->level   = level;
+    job->readyUs = now;
+    job->next    = nullptr;
+    if(tail_[level])
+        tail_[level]->next = job;
+    else
+        head_[level] = job;
+    tail_[level] = job;
+}
+
+BgJob* BgExecutor::Pop(uint8_t level)
+{
+    BgJob* job = head_[level];
+    if(job)
+    {
+        head_[level] = job->next;
+        if(!head_[level])
+            tail_[level] = nullptr;
+        job->next = nullptr;
+    }
+    return job;
+}
+
+// Queues are FIFO, so only the head of each can be the oldest waiter
+void BgExecutor::Age(uint32_t now)
+{
+    for(uint8_t level = 1; level < BG_NUM_PRIORITIES; level++)
+    {
+        BgJob* job = head_[level];
+        if(job && now - job->readyUs >= cfg_.ageUs)
+            Push(Pop(level), level - 1, now);
+    }
+}
+
+bool BgExecutor::RunSlice()
+{
+    uint32_t start = nowUs_();
+    Age(start);
+
+    BgJob* job = nullptr;
+    for(uint8_t level = 0; level < BG_NUM_PRIORITIES && !job; level++)
+        job = Pop(level);
+    if(!job)
+        return false;
+
+    uint32_t wait = start - job->waitUs;
+    if(wait > job->maxWaitUs)
+        job->maxWaitUs = wait;
+
+    // Always at least one step, so a job whose steps exceed the budget
+    // still makes progress
+    bool     done = false;
+    uint32_t now  = start;
+    do
+    {
+        done = job->step(job->ctx);
+        job->steps++;
+        now = nowUs_();
+    } while(!done && now - start < cfg_.sliceUs);
+
+    uint32_t ran = now - start;
+    job->slices++;
+    job->runUs += ran;
+    if(ran > job->maxSliceUs)
+        job->maxSliceUs = ran;
+
+    if(done)
+        job->queued = false;
+    else
+    {
+        job->waitUs = now;
+        Push(job, job->priority, now); // aging lasts one slice
+    }
+    return !Idle();
+}
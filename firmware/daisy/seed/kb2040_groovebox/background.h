@@ -0,0 +1,118 @@
+#pragma once
+
+// Cooperative background executor for main(): work that must never run in
+// the audio callback (preset and loop flash writes, table generation,
+// spectrum FFTs, telemetry encoding).
+//
+// A job is a step function that does a small, bounded piece of work and
+// says when it is finished. main() calls RunSlice() between MIDI drains;
+// each call steps one job until its slice budget is used, then moves it to
+// the back of its queue. Higher priorities run first. A job that has
+// waited longer than the aging limit moves up a level for its next slice,
+// so low-priority work can't starve.
+//
+// Results reach the audio callback through BlockHandoff, which the
+// callback polls once per block. No libDaisy dependency; the platform
+// supplies the microsecond clock.
+
+#include <atomic>
+#include <stdint.h>
+
+enum BgPriority : uint8_t
+{
+    BG_PRIORITY_HIGH   = 0,
+    BG_PRIORITY_NORMAL = 1,
+    BG_PRIORITY_LOW    = 2,
+    BG_NUM_PRIORITIES,
+};
+
+struct BgJob
+{
+    // One bounded step; returns true once the job is done
+    typedef bool (*StepFn)(void* ctx);
+
+    StepFn      step = nullptr;
+    void*       ctx  = nullptr;
+    const char* name = "";
+
+    // Executor state, valid while queued
+    BgPriority priority = BG_PRIORITY_NORMAL; // as submitted
+    uint8_t    level    = 0;                  // current queue, raised by aging
+    bool       queued   = false;
+    uint32_t   readyUs  = 0;                  // joined its current queue
+    uint32_t   waitUs   = 0;                  // queued since (aging kept)
+    BgJob*     next     = nullptr;
+
+    // Totals since the last Submit
+    uint32_t slices     = 0;
+    uint32_t steps      = 0;
+    uint32_t runUs      = 0;
+    uint32_t maxWaitUs  = 0; // longest time queued before a slice
+    uint32_t maxSliceUs = 0;
+};
+
+class BgExecutor
+{
+  public:
+    struct Config
+    {
+        uint32_t sliceUs = 250;   // per RunSlice(); bounds MIDI handling delay
+        uint32_t ageUs   = 20000; // queued this long -> one level up
+    };
+
+    void Init(const Config& cfg, uint32_t (*nowUs)());
+
+    // main() only. Returns false if the job is already queued.
+    bool Submit(BgJob* job, BgPriority priority);
+
+    // Runs one slice of the most urgent job. Returns true if work remains.
+    bool RunSlice();
+
+    bool Idle() const;
+
+  private:
+    void   Push(BgJob* job, uint8_t level, uint32_t now);
+    BgJob* Pop(uint8_t level);
+    void   Age(uint32_t now);
+
+    Config cfg_;
+    uint32_t (*nowUs_)() = nullptr;
+    BgJob* head_[BG_NUM_PRIORITIES] = {};
+    BgJob* tail_[BG_NUM_PRIORITIES] = {};
+};
+
+// Single-slot, lock-free handoff of a result from main() to the audio
+// callback. The callback calls Take() at the top of a block and swaps the
+// value in; it passes the one it replaced to Retire(), and main() gets it
+// back from Reclaim() to reuse or free. Publish() fails while a previous
+// value is still waiting, so nothing is lost or taken twice.
+template <typename T>
+class BlockHandoff
+{
+  public:
+    bool Publish(T* value)
+    {
+        T* expected = nullptr;
+        return pending_.compare_exchange_strong(
+            expected, value, std::memory_order_release, std::memory_order_relaxed);
+    }
+
+    T* Take() { return pending_.exchange(nullptr, std::memory_order_acquire); }
+
+    // Audio side. Returns false (and keeps nothing) if main() hasn't
+    // reclaimed the last one; the caller must then hold on to `old`.
+    bool Retire(T* old)
+    {
+        T* expected = nullptr;
+        return retired_.compare_exchange_strong(
+            expected, old, std::memory_order_release, std::memory_order_relaxed);
+    }
+
+    T* Reclaim() { return retired_.exchange(nullptr, std::memory_order_acquire); }
+
+    bool Pending() const { return pending_.load(std::memory_order_relaxed) != nullptr; }
+
+  private:
+    std::atomic<T*> pending_{nullptr};
+    std::atomic<T*> retired_{nullptr};
+};
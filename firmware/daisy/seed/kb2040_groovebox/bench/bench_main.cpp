@@ -0,0 +1,328 @@
+// Benchmark image of the groovebox engine for an emulated Cortex-M7.
+//
+// A stub stands in for the Seed's audio callback: it feeds scripted MIDI
+// at block boundaries and calls RenderAudio() for a fixed number of
+// blocks. Under QEMU with -icount shift=0 one instruction is one virtual
+// nanosecond, so the SysTick counter measures instructions; a known loop
+// calibrates ticks to instructions at startup.
+//
+// Output (semihosting stdout):
+//   block <n> <render insns> <midi insns>   one line per block
+//   summary <metric> <value>                 compared by compare.sh
+// Scripts may add "storm" lines (storm.h) to flood the MIDI handlers; the
+// midi_* summary lines then give the per-message cost on the target.
+// The GROOVEBOX_PROFILE build reports per-stage totals instead of block
+// lines; its probes cost instructions, so block totals come from the
+// plain build.
+
+#include "groovebox_engine.h"
+#include "groovebox_profile.h"
+#include "semihost.h"
+#include "storm.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+uint32_t ProfileNow();
+
+namespace
+{
+const float  kSampleRate = 48000.0f;
+const size_t kBlockSize  = 48;
+const int    kMaxBlocks  = 4000;
+
+// Used when no script file is given on the command line. Sets up a busy
+// patch, holds a six-note chord with bend and mod sweeps, records and
+// plays the looper, then switches to the drum kit.
+const char kDefaultScript[] = R"(
+blocks 2000
+0    B0 4F 60  B0 50 60  B0 51 70  B0 54 40  B0 55 30
+0    90 30 64  90 37 64  90 3C 64  90 40 64  90 43 64  90 48 64
+50   B0 01 40  B0 21 00
+100  B0 5B 28
+200  E0 00 50
+300  E0 00 30
+400  E0 00 40  B0 01 7F
+600  B0 5B 28
+900  80 30 40  80 37 40  80 3C 40
+1000 B0 5A 7F
+1000 90 24 7F  90 2A 64
+1100 90 26 7F  90 2A 64
+1200 90 24 7F  90 2E 64  90 27 50
+1300 90 26 7F  90 2A 64  90 2D 64  90 2F 64
+1500 B0 5A 00
+1500 90 3C 64  90 3E 64  90 41 64
+1800 B0 40 7F  80 3C 40  80 3E 40  80 41 40
+)";
+
+struct ScriptEvent
+{
+    int     block;
+    uint8_t status, data0, data1;
+};
+
+// "storm <kind> <first block> <last block> <messages per block>"
+struct ScriptStorm
+{
+    StormKind kind;
+    int       first, last, perBlock;
+    uint32_t  sent;
+};
+
+ScriptEvent g_events[1024];
+int         g_numEvents = 0;
+ScriptStorm g_storms[8];
+int         g_numStorms = 0;
+int         g_numBlocks = 1000;
+char        g_scriptBuf[16384];
+
+uint32_t g_blockInsns[kMaxBlocks];
+float    g_out[2][kBlockSize];
+
+// ---- instruction counter --------------------------------------------------
+
+volatile uint32_t* const kSysTickCsr = (volatile uint32_t*)0xE000E010;
+volatile uint32_t* const kSysTickRvr = (volatile uint32_t*)0xE000E014;
+volatile uint32_t* const kSysTickCvr = (volatile uint32_t*)0xE000E018;
+
+uint32_t g_tickHigh = 0;
+uint32_t g_tickLast = 0;
+
+// Instructions per 1024 ticks, from Calibrate()
+uint32_t g_insnsPer1kTicks = 1024;
+
+__attribute__((naked, noinline)) void SpinLoop(uint32_t n)
+{
+    // 2 instructions per iteration
+    asm volatile("1: subs r0, r0, #1\n\t"
+                 "bne 1b\n\t"
+                 "bx lr");
+}
+
+void Calibrate()
+{
+    const uint32_t iterations = 500000;
+    uint32_t       t0         = ProfileNow();
+    SpinLoop(iterations);
+    uint32_t ticks = ProfileNow() - t0;
+    if(ticks > 0)
+        g_insnsPer1kTicks
+            = (uint32_t)(((uint64_t)iterations * 2 * 1024 + ticks / 2) / ticks);
+}
+
+uint32_t TicksToInsns(uint32_t ticks)
+{
+    return (uint32_t)(((uint64_t)ticks * g_insnsPer1kTicks + 512) / 1024);
+}
+
+// ---- script -----------------------------------------------------------------
+
+int DataBytes(uint8_t status)
+{
+    return ((status & 0xE0) == 0xC0) ? 1 : 2;
+}
+
+// Parses "<block> <hex bytes...>", "blocks <n>" and "storm ..." lines;
+// '#' comments.
+bool ParseScript(const char* text)
+{
+    g_numEvents = 0;
+    g_numStorms = 0;
+    const char* p = text;
+    while(*p)
+    {
+        const char* eol = strchr(p, '\n');
+        size_t      len = eol ? (size_t)(eol - p) : strlen(p);
+        char        line[256];
+        if(len >= sizeof(line))
+            len = sizeof(line) - 1;
+        memcpy(line, p, len);
+        line[len] = '\0';
+        p += len + (eol ? 1 : 0);
+
+        if(char* hash = strchr(line, '#'))
+            *hash = '\0';
+        char* tok = strtok(line, " \t\r");
+        if(!tok)
+            continue;
+        if(strcmp(tok, "blocks") == 0)
+        {
+            tok = strtok(nullptr, " \t\r");
+            g_numBlocks = tok ? atoi(tok) : 0;
+            if(g_numBlocks <= 0 || g_numBlocks > kMaxBlocks)
+                return false;
+            continue;
+        }
+        if(strcmp(tok, "storm") == 0)
+        {
+            if(g_numStorms >= (int)(sizeof(g_storms) / sizeof(g_storms[0])))
+                return false;
+            ScriptStorm& st   = g_storms[g_numStorms++];
+            const char*  kind = strtok(nullptr, " \t\r");
+            const char*  a    = strtok(nullptr, " \t\r");
+            const char*  b    = strtok(nullptr, " \t\r");
+            const char*  n    = strtok(nullptr, " \t\r");
+            if(!kind || !n || !StormParse(kind, &st.kind))
+                return false;
+            st.first    = atoi(a);
+            st.last     = atoi(b);
+            st.perBlock = atoi(n);
+            st.sent     = 0;
+            if(st.perBlock <= 0 || st.last < st.first)
+                return false;
+            continue;
+        }
+
+        int     block = atoi(tok);
+        uint8_t msg[3];
+        int     have = 0, need = 0;
+        while((tok = strtok(nullptr, " \t\r")))
+        {
+            uint8_t b = (uint8_t)strtoul(tok, nullptr, 16);
+            if(b & 0x80)
+            {
+                msg[0] = b;
+                have   = 1;
+                need   = 1 + DataBytes(b);
+                continue;
+            }
+            if(have == 0 || have >= need)
+                return false;
+            msg[have++] = b;
+            if(have == need)
+            {
+                if(g_numEvents >= (int)(sizeof(g_events) / sizeof(g_events[0])))
+                    return false;
+                g_events[g_numEvents++]
+                    = {block, msg[0], msg[1], need == 3 ? msg[2] : (uint8_t)0};
+            }
+        }
+    }
+    return true;
+}
+
+void LoadScript()
+{
+    char  cmdline[256];
+    char* path = nullptr;
+    if(SemihostCommandLine(cmdline, sizeof(cmdline)) > 0)
+    {
+        strtok(cmdline, " ");
+        path = strtok(nullptr, " ");
+    }
+    const char* text = kDefaultScript;
+    if(path)
+    {
+        if(SemihostReadFile(path, g_scriptBuf, sizeof(g_scriptBuf)) < 0)
+        {
+            SemihostPrintf("bench: cannot read %s\n", path);
+            SemihostExit(1);
+        }
+        text = g_scriptBuf;
+    }
+    if(!ParseScript(text))
+    {
+        SemihostWrite("bench: bad script\n");
+        SemihostExit(1);
+    }
+}
+
+int CompareU32(const void* a, const void* b)
+{
+    uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+    return (x > y) - (x < y);
+}
+} // namespace
+
+// Free-running 32-bit count from the 24-bit down-counting SysTick. Called
+// far more often than the counter wraps.
+uint32_t ProfileNow()
+{
+    uint32_t now = 0xFFFFFFu - (*kSysTickCvr & 0xFFFFFFu);
+    if(now < g_tickLast)
+        g_tickHigh += 0x1000000u;
+    g_tickLast = now;
+    return g_tickHigh | now;
+}
+
+int main()
+{
+    *kSysTickRvr = 0xFFFFFFu;
+    *kSysTickCvr = 0;
+    *kSysTickCsr = 0x5; // enable, processor clock, no interrupt
+
+    Calibrate();
+    LoadScript();
+    InitSynth(kSampleRate);
+
+    float*   out[2]     = {g_out[0], g_out[1]};
+    int      next       = 0;
+    uint64_t totalMidi  = 0;
+    uint64_t totalBlock = 0;
+    uint32_t maxMidi    = 0;
+    uint32_t numMsgs    = 0;
+
+    for(int b = 0; b < g_numBlocks; b++)
+    {
+        uint32_t t0 = ProfileNow();
+        for(; next < g_numEvents && g_events[next].block <= b; next++, numMsgs++)
+            HandleMidiMessage(g_events[next].status,
+                              g_events[next].data0,
+                              g_events[next].data1);
+        for(int s = 0; s < g_numStorms; s++)
+        {
+            ScriptStorm& st = g_storms[s];
+            if(b < st.first || b > st.last)
+                continue;
+            for(int k = 0; k < st.perBlock; k++)
+            {
+                uint8_t msg[3];
+                StormMessage(st.kind, st.sent++, msg);
+                HandleMidiMessage(msg[0], msg[1], msg[2]);
+            }
+            numMsgs += st.perBlock;
+        }
+        uint32_t t1 = ProfileNow();
+        RenderAudio(out, kBlockSize);
+        uint32_t t2 = ProfileNow();
+
+        uint32_t midi  = TicksToInsns(t1 - t0);
+        uint32_t block = TicksToInsns(t2 - t1);
+        totalMidi += midi;
+        if(midi > maxMidi)
+            maxMidi = midi;
+        totalBlock += block;
+        g_blockInsns[b] = block;
+#ifndef GROOVEBOX_PROFILE
+        SemihostPrintf("block %d %lu %lu\n", b, (unsigned long)block, (unsigned long)midi);
+#endif
+    }
+
+    const unsigned long n = (unsigned long)g_numBlocks;
+    SemihostPrintf("# %lu blocks of %u samples, %lu insns per 1024 ticks\n",
+                   n,
+                   (unsigned)kBlockSize,
+                   (unsigned long)g_insnsPer1kTicks);
+#ifdef GROOVEBOX_PROFILE
+    static const char* const kStageNames[PROF_NUM_STAGES]
+        = {"voices", "drums", "tone", "delay", "reverb", "looper"};
+    for(int s = 0; s < PROF_NUM_STAGES; s++)
+        SemihostPrintf("summary stage_%s_avg %lu\n",
+                       kStageNames[s],
+                       (unsigned long)(TicksToInsns(g_profileTicks[s]) / n));
+    SemihostPrintf("summary profiled_block_avg %lu\n",
+                   (unsigned long)(totalBlock / n));
+#else
+    qsort(g_blockInsns, g_numBlocks, sizeof(uint32_t), CompareU32);
+    SemihostPrintf("summary block_avg %lu\n", (unsigned long)(totalBlock / n));
+    SemihostPrintf("summary block_p50 %lu\n", (unsigned long)g_blockInsns[g_numBlocks / 2]);
+    SemihostPrintf("summary block_p99 %lu\n",
+                   (unsigned long)g_blockInsns[(g_numBlocks * 99) / 100]);
+    SemihostPrintf("summary block_max %lu\n", (unsigned long)g_blockInsns[g_numBlocks - 1]);
+    SemihostPrintf("summary midi_avg %lu\n", (unsigned long)(totalMidi / n));
+    SemihostPrintf("summary midi_block_max %lu\n", (unsigned long)maxMidi);
+    if(numMsgs > 0)
+        SemihostPrintf("summary midi_msg_avg %lu\n", (unsigned long)(totalMidi / numMsgs));
+#endif
+    return 0;
+}
@@ -0,0 +1,34 @@
+#!/bin/sh
+# compare.sh <baseline> <report> [tolerance_percent]
+#
+# Compares the "summary <metric> <value>" lines of a bench report against
+# a baseline. Fails if any metric grew by more than the tolerance
+# (default 2%). Metrics missing from either side are listed, not failed.
+
+if [ $# -lt 2 ]; then
+    echo "usage: $0 <baseline> <report> [tolerance_percent]" >&2
+    exit 2
+fi
+if [ ! -f "$1" ]; then
+    echo "no baseline at $1 (make baseline records one)" >&2
+    exit 2
+fi
+
+awk -v tol="${3:-2}" '
+    FNR == NR && $1 == "summary" { base[$2] = $3; next }
+    $1 == "summary" {
+        seen[$2] = 1
+        if (!($2 in base)) { printf "  new      %-28s %12d\n", $2, $3; next }
+        old = base[$2]
+        pct = old ? 100.0 * ($3 - old) / old : 0
+        tag = "ok"
+        if (pct > tol) { tag = "REGRESS"; bad++ }
+        printf "  %-8s %-28s %12d -> %12d  %+6.2f%%\n", tag, $2, old, $3, pct
+    }
+    END {
+        for (m in base)
+            if (!(m in seen))
+                printf "  missing  %s\n", m
+        if (bad) { printf "%d metric(s) regressed more than %s%%\n", bad, tol; exit 1 }
+    }
+' "$1" "$2"
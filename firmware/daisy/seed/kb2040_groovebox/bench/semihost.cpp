@@ -0,0 +1,85 @@
+#include "semihost.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+namespace
+{
+enum
+{
+    SYS_OPEN        = 0x01,
+    SYS_CLOSE       = 0x02,
+    SYS_WRITE0      = 0x04,
+    SYS_READ        = 0x06,
+    SYS_FLEN        = 0x0C,
+    SYS_GET_CMDLINE = 0x15,
+    SYS_EXIT        = 0x18,
+};
+
+const uint32_t ADP_Stopped_ApplicationExit  = 0x20026;
+const uint32_t ADP_Stopped_RunTimeErrorUnknown = 0x20023;
+
+int Call(int op, const void* arg)
+{
+    register int         r0 asm("r0") = op;
+    register const void* r1 asm("r1") = arg;
+    asm volatile("bkpt 0xAB" : "+r"(r0) : "r"(r1) : "memory");
+    return r0;
+}
+} // namespace
+
+void SemihostWrite(const char* s)
+{
+    Call(SYS_WRITE0, s);
+}
+
+void SemihostPrintf(const char* fmt, ...)
+{
+    char    buf[160];
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+    SemihostWrite(buf);
+}
+
+int SemihostReadFile(const char* path, char* buf, size_t n)
+{
+    uint32_t open[3] = {(uint32_t)path, 0 /* "r" */, (uint32_t)strlen(path)};
+    int      fh      = Call(SYS_OPEN, open);
+    if(fh < 0)
+        return -1;
+    uint32_t flen[1] = {(uint32_t)fh};
+    int      len     = Call(SYS_FLEN, flen);
+    if(len < 0 || (size_t)len >= n)
+        len = (int)n - 1;
+    uint32_t read[3] = {(uint32_t)fh, (uint32_t)buf, (uint32_t)len};
+    int      left    = Call(SYS_READ, read); // bytes NOT read
+    uint32_t close[1] = {(uint32_t)fh};
+    Call(SYS_CLOSE, close);
+    int got  = len - left;
+    buf[got] = '\0';
+    return got;
+}
+
+int SemihostCommandLine(char* buf, size_t n)
+{
+    uint32_t args[2] = {(uint32_t)buf, (uint32_t)n};
+    if(Call(SYS_GET_CMDLINE, args) != 0)
+    {
+        buf[0] = '\0';
+        return -1;
+    }
+    return (int)args[1];
+}
+
+void SemihostExit(int code)
+{
+    // AArch32 SYS_EXIT takes the reason code itself; QEMU exits with
+    // status 0 only for ApplicationExit
+    Call(SYS_EXIT,
+         (const void*)(code == 0 ? ADP_Stopped_ApplicationExit
+                                 : ADP_Stopped_RunTimeErrorUnknown));
+    for(;;) {}
+}
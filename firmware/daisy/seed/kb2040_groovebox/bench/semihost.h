@@ -0,0 +1,20 @@
+#pragma once
+
+// ARM semihosting calls used by the bench image (console, script file,
+// command line and exit). QEMU services them with
+// -semihosting-config enable=on,target=native.
+
+#include <stddef.h>
+#include <stdint.h>
+
+void SemihostWrite(const char* s);
+void SemihostPrintf(const char* fmt, ...) __attribute__((format(printf, 1, 2)));
+
+// Returns the number of bytes read into buf (at most n - 1, terminated),
+// or -1 if the file can't be opened.
+int SemihostReadFile(const char* path, char* buf, size_t n);
+
+// Whitespace-separated command line, argv[0] first
+int SemihostCommandLine(char* buf, size_t n);
+
+[[noreturn]] void SemihostExit(int code);
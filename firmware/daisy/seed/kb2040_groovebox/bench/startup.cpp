@@ -0,0 +1,55 @@
+// Minimal Cortex-M7 startup for the bench image: vector table, FPU
+// enable, .data/.bss init, static constructors, then main().
+
+#include "semihost.h"
+
+#include <stdint.h>
+#include <string.h>
+
+extern uint32_t _estack;
+extern uint32_t _sidata, _sdata, _edata;
+extern uint32_t _sbss, _ebss;
+
+extern "C" void __libc_init_array();
+int             main();
+
+extern "C" [[noreturn]] void Reset_Handler()
+{
+    // CP10/CP11 full access before any float instruction runs
+    volatile uint32_t* cpacr = (volatile uint32_t*)0xE000ED88;
+    *cpacr |= (0xFu << 20);
+    asm volatile("dsb\n\tisb" ::: "memory");
+
+    memcpy(&_sdata, &_sidata, (size_t)((char*)&_edata - (char*)&_sdata));
+    memset(&_sbss, 0, (size_t)((char*)&_ebss - (char*)&_sbss));
+    __libc_init_array();
+
+    SemihostExit(main());
+}
+
+extern "C" [[noreturn]] void Fault_Handler()
+{
+    SemihostWrite("bench: fault\n");
+    SemihostExit(1);
+}
+
+typedef void (*Vector)();
+
+__attribute__((section(".isr_vector"), used)) const Vector g_vectors[16] = {
+    (Vector)&_estack,
+    Reset_Handler,
+    Fault_Handler, // NMI
+    Fault_Handler, // HardFault
+    Fault_Handler, // MemManage
+    Fault_Handler, // BusFault
+    Fault_Handler, // UsageFault
+    nullptr,
+    nullptr,
+    nullptr,
+    nullptr,
+    Fault_Handler, // SVCall
+    Fault_Handler, // DebugMon
+    nullptr,
+    Fault_Handler, // PendSV
+    Fault_Handler, // SysTick (never enabled as an interrupt)
+};
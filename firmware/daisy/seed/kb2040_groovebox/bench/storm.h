@@ -0,0 +1,102 @@
+// Worst-case MIDI streams for stress runs, shared by the bench image
+// (bench_main.cpp, "storm" script lines) and the host flood harness
+// (firmware/host/groovebox_flood.cpp), so both measure the same traffic.
+//
+// Every message carries its status byte (the KB2040 never uses running
+// status) and is on the synth channel.
+#pragma once
+
+#include "midi_protocol.h"
+
+#include <stdint.h>
+#include <string.h>
+
+enum StormKind
+{
+    STORM_NOTES, // overlapping note on/off, voices stolen continuously
+    STORM_CC,    // every engine CC, a new value on each message
+    STORM_BEND,  // 14-bit pitch bend triangle sweep
+    STORM_MIXED, // the three above interleaved
+    STORM_NUM_KINDS,
+};
+
+inline const char* StormName(StormKind kind)
+{
+    static const char* const kNames[STORM_NUM_KINDS]
+        = {"notes", "cc", "bend", "mixed"};
+    return kind < STORM_NUM_KINDS ? kNames[kind] : "?";
+}
+
+inline bool StormParse(const char* name, StormKind* kind)
+{
+    for(int k = 0; k < STORM_NUM_KINDS; k++)
+        if(strcmp(name, StormName((StormKind)k)) == 0)
+        {
+            *kind = (StormKind)k;
+            return true;
+        }
+    return false;
+}
+
+// Message `i` of a storm. Always three bytes.
+inline void StormMessage(StormKind kind, uint32_t i, uint8_t msg[3])
+{
+    const uint8_t ch = MidiCh::SYNTH - 1;
+
+    if(kind == STORM_MIXED)
+        kind = (StormKind)(i % 3);
+
+    switch(kind)
+    {
+        case STORM_NOTES:
+        {
+            // On for note j, off for note j - 5: about five keys held, so
+            // the six voices fill up and then get stolen
+            uint32_t j = i / 2;
+            if((i & 1) == 0)
+            {
+                msg[0] = 0x90 | ch;
+                msg[1] = (uint8_t)(36 + (j * 7) % 48);
+                msg[2] = 100;
+            }
+            else
+            {
+                msg[0] = 0x80 | ch;
+                msg[1] = (uint8_t)(36 + (j * 7 + 48 * 7 - 35) % 48);
+                msg[2] = 64;
+            }
+            break;
+        }
+
+        case STORM_CC:
+        {
+            static const uint8_t kCCs[] = {
+                MidiCC::MODWHEEL,       MidiCC::MODWHEEL_LSB,
+                MidiCC::VOLUME,         MidiCC::CUTOFF,
+                MidiCC::RESONANCE,      MidiCC::ATTACK,
+                MidiCC::DECAY,          MidiCC::SUSTAIN,
+                MidiCC::RELEASE,        MidiCC::VIBRATO_RATE,
+                MidiCC::DELAY_TIME,     MidiCC::DELAY_FEEDBACK,
+                MidiCC::DELAY_MIX,      MidiCC::REVERB_MIX,
+                MidiCC::REVERB_TIME,    MidiCC::BASS_BOOST,
+                MidiCC::DRIVE,          MidiCC::LOOPER_LEVEL,
+            };
+            const uint32_t n = sizeof(kCCs) / sizeof(kCCs[0]);
+            msg[0]           = 0xB0 | ch;
+            msg[1]           = kCCs[i % n];
+            msg[2]           = (uint8_t)((i / n * 37 + i * 11) & 0x7F);
+            break;
+        }
+
+        default:
+        {
+            // Full range up and down in 256 messages
+            uint32_t phase = (i * 128) & 0x7FFF;
+            uint32_t v     = phase < 0x4000 ? phase : 0x7FFF - phase;
+            msg[0]         = 0xE0 | ch;
+            msg[1]         = (uint8_t)(v & 0x7F);
+            msg[2]         = (uint8_t)(v >> 7);
+            break;
+        }
+    }
+}
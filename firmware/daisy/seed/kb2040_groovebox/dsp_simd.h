@@ -0,0 +1,95 @@
+#pragma once
+
+// The Cortex-M7's DSP extension: two 16-bit lanes in a 32-bit register,
+// saturating arithmetic and 32x32 multiplies, one instruction each. On the
+// Seed these are the compiler's ACLE intrinsics (arm_acle.h) or the
+// instruction itself; on any other target, plain C that gives the same
+// result bit for bit, so fixed-point code built on them (voice_q15.h)
+// can be checked on a host. The Q flag the saturating instructions set
+// isn't modelled; nothing here reads it.
+//
+// Host checks (q15_check) run the plain C branch only; the native one is
+// exercised by a Seed build or the bench/ image under QEMU (make q15
+// there).
+//
+// A Q15x2 holds two lanes, lane 0 in the low halfword. Signed right
+// shifts are arithmetic, as GCC and the instructions have them.
+//
+// No libDaisy dependency.
+
+#include <stdint.h>
+
+#if defined(__ARM_FEATURE_DSP) && defined(__ARM_FEATURE_SIMD32)
+#include <arm_acle.h>
+#define DSP_SIMD_NATIVE 1
+#endif
+
+typedef int32_t Q15x2;
+
+namespace dsp
+{
+inline int16_t Lane0(Q15x2 x)
+{
+    return (int16_t)x;
+}
+
+inline int16_t Lane1(Q15x2 x)
+{
+    return (int16_t)((uint32_t)x >> 16);
+}
+
+// PKHBT: GCC emits it for this pattern
+inline Q15x2 Pack(int32_t lane0, int32_t lane1)
+{
+    return (Q15x2)(((uint32_t)lane0 & 0xFFFF) | ((uint32_t)lane1 << 16));
+}
+
+// SSAT #16
+inline int32_t Sat16(int32_t x)
+{
+    return x > 32767 ? 32767 : x < -32768 ? -32768 : x;
+}
+
+// QADD16: lane-wise saturating add
+inline Q15x2 Qadd16(Q15x2 a, Q15x2 b)
+{
+#ifdef DSP_SIMD_NATIVE
+    return __qadd16(a, b);
+#else
+    return Pack(Sat16(Lane0(a) + Lane0(b)), Sat16(Lane1(a) + Lane1(b)));
+#endif
+}
+
+// SMLALD: acc + a0 * b0 + a1 * b1 in 64 bits (SMLAD's long form, for
+// sums that could wrap 32)
+inline int64_t Smlald(Q15x2 a, Q15x2 b, int64_t acc)
+{
+#ifdef DSP_SIMD_NATIVE
+    return (int64_t)__smlald(a, b, (uint64_t)acc);
+#else
+    return acc + (int64_t)(Lane0(a) * Lane0(b)) + (int64_t)(Lane1(a) * Lane1(b));
+#endif
+}
+
+// SMULWB: a * lane 0 of b, top 32 of the 48-bit product
+inline int32_t Smulwb(int32_t a, Q15x2 b)
+{
+#ifdef DSP_SIMD_NATIVE
+    return __smulwb(a, b);
+#else
+    return (int32_t)(((int64_t)a * Lane0(b)) >> 16);
+#endif
+}
+
+// SMMULR: top 32 of a * b, rounded
+inline int32_t Smmulr(int32_t a, int32_t b)
+{
+#ifdef DSP_SIMD_NATIVE
+    int32_t r;
+    __asm__("smmulr %0, %1, %2" : "=r"(r) : "r"(a), "r"(b));
+    return r;
+#else
+    return (int32_t)(((int64_t)a * b + 0x80000000LL) >> 32);
+#endif
+}
+} // namespace dsp
@@ -0,0 +1,330 @@
+#pragma once
+
+// The groovebox engine as an object: voices, drum kit, FX, looper, the
+// MIDI handlers that drive them and every parameter they read. The
+// firmware runs one instance through the functions in groovebox_engine.h;
+// host tools can make as many as they like, and instances share nothing,
+// so each can render on its own thread.
+//
+// An Engine holds its small, hot state itself. That is about 400 kB,
+// mostly ReverbSc's delay memory, so make instances static or put them on
+// the heap, never on a stack. The buffers too big for the Seed's internal
+// SRAM (delay line, looper) come from an EngineArena the platform hands
+// to Init(): SDRAM on the Seed, any memory on the host.
+//
+// Built with GROOVEBOX_Q15_VOICES, the synth voices render in fixed point
+// through voice_q15.h instead of DaisySP's float oscillators and
+// envelopes; the rest of the engine is the same. GROOVEBOX_VOICES sets
+// the polyphony (6 by default; even for the fixed-point voices).
+//
+// One thread per instance: nothing here locks. GROOVEBOX_PROFILE and
+// GROOVEBOX_TRACE builds still write process-wide records
+// (groovebox_profile.h, trace.h), so profile or trace one instance at a
+// time.
+//
+// Depends on DaisySP only (no libDaisy).
+
+#include "groovebox_engine.h"
+
+#include "daisysp.h"
+#include "daisysp/modules/reverbsc.h"
+#ifdef GROOVEBOX_Q15_VOICES
+#include "voice_q15.h"
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+// A bump allocator over memory the caller owns. Reset() frees everything
+// at once; nothing is freed on its own.
+class EngineArena
+{
+  public:
+    EngineArena(void* memory, size_t size)
+    : base_((uint8_t*)memory), size_(size), used_(0)
+    {
+    }
+
+    // count Ts, aligned for T, or null if the arena is full. Not
+    // constructed.
+    template <typename T>
+    T* Alloc(size_t count)
+    {
+        uintptr_t start = (uintptr_t)base_ + used_;
+        size_t    at    = used_ + ((alignof(T) - start % alignof(T)) % alignof(T));
+        if(at > size_ || count > (size_ - at) / sizeof(T))
+            return nullptr;
+        used_ = at + count * sizeof(T);
+        return (T*)(base_ + at);
+    }
+
+    void   Reset() { used_ = 0; }
+    size_t Used() const { return used_; }
+    size_t Size() const { return size_; }
+
+  private:
+    uint8_t* base_;
+    size_t   size_;
+    size_t   used_;
+};
+
+#ifndef GROOVEBOX_VOICES
+#define GROOVEBOX_VOICES 6
+#endif
+
+class Engine
+{
+  public:
+    static const int kNumVoices     = GROOVEBOX_VOICES; // polyphony
+    static const int kNumDrumVoices = 8; // concurrent drum hits
+
+    // Arena bytes Init() takes at a sample rate, and at the rate that
+    // takes the most
+    static size_t       ArenaBytes(float samplerate);
+    static const size_t kMaxArenaBytes;
+
+    // Any rate up to 96 kHz; Render() takes any block size. The buffers
+    // come from the arena, which must have ArenaBytes(samplerate) left;
+    // returns false, and leaves the engine unusable, if it hasn't. May be
+    // called again, with the arena reset, to start over: notes, drum hits
+    // and the looper stop, quality and meters start over, and volume
+    // (CC7), sustain (CC64), instrument mode (CC90) and looper level
+    // (CC92) go back to their defaults. The filter, envelope, vibrato and
+    // FX controllers keep their values, as the firmware's did across a
+    // restart of the synth.
+    bool Init(float samplerate, EngineArena& arena);
+
+    // Channel is 0-based, as in the status byte
+    void HandleNoteOn(uint8_t channel, uint8_t note, uint8_t velocity);
+    void HandleNoteOff(uint8_t channel, uint8_t note, uint8_t velocity);
+    void HandleCC(uint8_t channel, uint8_t cc, uint8_t val);
+    void HandlePitchBend(uint8_t channel, uint8_t lsb, uint8_t msb);
+
+    // Dispatches one complete channel message by status byte
+    void HandleMidiMessage(uint8_t status, uint8_t data0, uint8_t data1);
+
+    // Renders one block into out[0] (left) and out[1] (right)
+    void Render(float** out, size_t size);
+
+    // As SetEngineQuality() and friends in groovebox_engine.h
+    void          SetQuality(EngineQuality quality) { quality_ = quality; }
+    EngineQuality GetQuality() const { return quality_; }
+    uint8_t       TakeFeatures();
+    void          TakeMeters(EngineMeters& m);
+
+  private:
+    enum InstrumentMode
+    {
+        MODE_POLY_SYNTH = 0,
+        MODE_DRUM_KIT   = 1,
+    };
+
+    struct Voice
+    {
+        daisysp::Oscillator osc1;
+        daisysp::Oscillator osc2;
+        daisysp::Adsr       env;
+
+        int   note;      // MIDI note number
+        bool  active;    // envelope still audible
+        bool  gate;      // what we feed into env.Process()
+        bool  keyDown;   // physical key state (from NoteOn/NoteOff)
+        float vel;       // 0..1
+        float level;     // envelope * vel at the last sample
+        bool  shedding;  // fading out early to save CPU
+        float fade;      // 1..0 while shedding
+    };
+
+    struct SimpleEnv
+    {
+        float value;
+        float decay;
+
+        void Init()
+        {
+            value = 0.0f;
+            decay = 0.999f;
+        }
+
+        void Trigger(float amplitude, float seconds, float samplerate);
+
+        float Process()
+        {
+            float out = value;
+            value *= decay;
+            if(value < 1.0e-5f)
+                value = 0.0f;
+            return out;
+        }
+
+        bool Active() const { return value > 1.0e-4f; }
+    };
+
+    enum DrumType
+    {
+        DRUM_KICK = 0,
+        DRUM_SNARE,
+        DRUM_HAT_CLOSED,
+        DRUM_HAT_OPEN,
+        DRUM_TOM_LOW,
+        DRUM_TOM_HIGH,
+        DRUM_CLAP,
+        DRUM_PERC,
+    };
+
+    struct DrumVoice
+    {
+        DrumType  type;
+        SimpleEnv env;
+        SimpleEnv noiseEnv;
+        float     phase;
+        float     freq;
+        float     pitchScale;
+        float     pitchDecay;
+        float     velocity;
+        bool      active;
+    };
+
+    // Buffers are sized for the highest rate Init() accepts
+    static constexpr size_t kMaxSampleRate = 96000;
+    static constexpr size_t kDelayBuffer   = kMaxSampleRate + 1; // 1 s
+    typedef daisysp::DelayLine<float, kDelayBuffer> DelayBuffer;
+
+    // Metering taps (see Render())
+    static constexpr int    kMeterFirstBus = MidiMeter::SYNTH;
+    static constexpr int    kMeterBuses    = MidiMeter::NUM_CHANNELS - kMeterFirstBus;
+    static constexpr size_t kMeterChunk    = 64;
+
+    static size_t   LooperCapacity(float samplerate);
+    static DrumType DrumTypeForNote(int note);
+    static void     SilenceVoice(Voice& v);
+
+    float DecayAt48k(float perSample48k) const;
+    float MidiToHzWithBend(int note, float extraSemi) const;
+    float Noise();
+
+    void UpdateEnvParams();
+    void UpdateFilterParams();
+    void UpdateDelayParams();
+    void UpdateReverbParams();
+
+    void StopLooper();
+    void StartLooperRecord();
+    void FinishLooperRecord();
+    void ToggleLooperPlayback();
+
+    DrumVoice* FindDrumVoice();
+    void       TriggerDrum(int note, float velocity);
+    float      ProcessDrums();
+
+    Voice* FindExistingVoiceForNote(int note);
+    Voice* FindIdleVoice();
+    Voice* StealVoice();
+    Voice* AllocateVoiceForNote(int note);
+    void   ShedVoices();
+
+#ifdef GROOVEBOX_Q15_VOICES
+    static_assert(kNumVoices % 2 == 0 && kNumVoices <= VoiceBankQ15::kMaxVoices,
+                  "fixed-point voices go in pairs");
+
+    // The next n samples of the voices into q15Bus_, bend and vibrato as
+    // they will be at the last of them
+    void RenderVoicesQ15(size_t n, float bendSemi, bool twoOsc);
+#endif
+
+    uint8_t ComputeFeatures(EngineQuality quality) const;
+    void    MeasureBlock(const float* x, size_t n, int channel);
+    void    MeterBuses(size_t n);
+
+    float samplerate_ = 48000.0f;
+
+    // Parameters (controlled from KB2040 CCs)
+    float masterGain_    = 0.4f;    // CC7
+    float cutoff_        = 3000.0f; // Hz (CC70)
+    float resonance_     = 0.25f;   // 0..1 (CC71)
+    float attack_        = 0.01f;   // seconds (CC72)
+    float decay_         = 0.25f;   // seconds (CC73)
+    float sustain_       = 0.8f;    // 0..1 (CC74)
+    float release_       = 0.4f;    // seconds (CC75)
+    float vibratoRate_   = 5.0f;    // Hz (unused for drums)
+    float vibratoDepth_  = 0.25f;   // semitones, scaled by mod wheel (CC1)
+    float modWheel_      = 0.0f;    // 0..1, value the audio is currently at
+    float pitchBendSemi_ = 0.0f;    // -2..+2 semitones, value the audio is currently at
+
+    // Latest values received over MIDI. Render() glides to these across
+    // one block so incoming bend / mod steps don't become audible pitch
+    // steps.
+    float   pitchBendTarget_ = 0.0f;
+    float   modWheelTarget_  = 0.0f;
+    uint8_t modWheelMsb_     = 0; // CC1, combined with CC33 for 14-bit mod
+
+    // FX parameters
+    float delayTimeSec_  = 0.35f; // CC77
+    float delayFeedback_ = 0.35f; // CC78
+    float delayMix_      = 0.25f; // CC79
+    float reverbMix_     = 0.25f; // CC80
+    float reverbTime_    = 0.65f; // CC81
+    float bassBoost_     = 0.6f;  // CC84
+    float driveAmount_   = 0.15f; // CC85
+    float looperLevel_   = 0.7f;  // CC92
+
+    InstrumentMode instrMode_ = MODE_POLY_SYNTH; // CC90
+    bool           sustainOn_ = false;           // CC64 pedal
+
+    Voice voices_[kNumVoices];
+    int   voiceRotate_ = 0; // for voice stealing
+
+#ifdef GROOVEBOX_Q15_VOICES
+    // The voices' oscillators and envelopes; Voice keeps the rest
+    VoiceBankQ15 q15Voices_;
+    float        q15Bus_[VoiceBankQ15::kChunk];
+#endif
+
+    EngineQuality quality_  = QUALITY_FULL;
+    float         fadeStep_ = 0.0f; // per sample, set by Init()
+    uint8_t       features_ = 0;    // EngineFeature bits since TakeFeatures()
+
+    // Global filter and vibrato LFO
+    daisysp::Svf        filter_;
+    daisysp::Oscillator vibrLfo_;
+
+    // Bass enhancement filter
+    daisysp::Svf bassFilter_;
+
+    // Delay (in the arena) / Reverb
+    DelayBuffer*      delayLine_    = nullptr;
+    size_t            delaySamples_ = 0;
+    daisysp::ReverbSc reverb_;
+
+    // The reverb can run on every other sample (input averaged over the
+    // pair), interpolating between its outputs a sample late. Above
+    // 48 kHz it always does, at half the rate, since ReverbSc's fixed
+    // delay memory is sized for 48 kHz. Otherwise only QUALITY_CHEAP_FX
+    // does; the tank was set up for the full rate, so the tail is longer
+    // and darker while the governor holds that level.
+    bool  reverbHalfRate_ = false;
+    bool  reverbOdd_      = false;
+    float reverbIn_       = 0.0f;
+    float reverbPrevL_ = 0.0f, reverbPrevR_ = 0.0f;
+    float reverbLastL_ = 0.0f, reverbLastR_ = 0.0f;
+
+    // Looper (simple mono capture of post-FX signal), buffers in the arena
+    float* looperL_         = nullptr;
+    float* looperR_         = nullptr;
+    size_t looperCapacity_  = 0;
+    size_t looperWrite_     = 0;
+    size_t looperLength_    = 0;
+    size_t looperPlay_      = 0;
+    bool   looperRecording_ = false;
+    bool   looperPlaying_   = false;
+
+    // Metering. Each bus is tapped into a short buffer as the block
+    // renders and measured a chunk at a time, as the outputs are after
+    // the block, so the per-sample loop only pays for the stores.
+    float        meterTap_[kMeterBuses][kMeterChunk];
+    EngineMeters meters_ = {};
+
+    // Drum engine
+    DrumVoice drumVoices_[kNumDrumVoices];
+    uint64_t  noiseState_ = 0;
+};
@@ -0,0 +1,69 @@
+#include "governor.h"
+
+void CpuGovernor::Init(const Config& cfg)
+{
+    cfg_ = cfg;
+    if(cfg_.numLevels < 1)
+        cfg_.numLevels = 1;
+    if(cfg_.numLevels > kMaxLevels)
+        cfg_.numLevels = kMaxLevels;
+    level_   = 0;
+    over_    = 0;
+    under_   = 0;
+    avg_     = 0.0f;
+    sinceUp_ = cfg_.maxHold; // no recovery to undo yet
+    for(int i = 0; i < kMaxLevels; i++)
+        hold_[i] = cfg_.holdBlocks;
+    stats_ = Stats();
+}
+
+uint8_t CpuGovernor::Update(float load)
+{
+    stats_.blocks++;
+    if(load > 1.0f)
+        stats_.overruns++;
+    if(load > stats_.maxLoad)
+        stats_.maxLoad = load;
+    sinceUp_++;
+    avg_ += (load - avg_) * kAvgWeight;
+
+    if(load > cfg_.highLoad)
+    {
+        under_ = 0;
+        // A lone spike (an interrupt burst) doesn't cost a level
+        if(++over_ < cfg_.upBlocks)
+            return level_;
+        over_ = 0;
+        if(level_ + 1 < cfg_.numLevels)
+        {
+            // Straight back over the threshold after recovering: this
+            // level costs more than the headroom, hold it longer next time
+            if(sinceUp_ < hold_[level_ + 1])
+            {
+                uint32_t doubled = (uint32_t)hold_[level_ + 1] * 2;
+                hold_[level_ + 1] = (uint16_t)(doubled < cfg_.maxHold ? doubled : cfg_.maxHold);
+            }
+            level_++;
+            stats_.stepsDown++;
+        }
+        return level_;
+    }
+
+    over_ = 0;
+    if(avg_ >= cfg_.lowLoad || level_ == 0)
+    {
+        under_ = 0;
+        return level_;
+    }
+    if(++under_ < hold_[level_])
+        return level_;
+
+    // Stable long enough at this level: its hold goes back to the default
+    if(sinceUp_ >= 2u * hold_[level_])
+        hold_[level_] = cfg_.holdBlocks;
+    under_   = 0;
+    sinceUp_ = 0;
+    level_--;
+    stats_.stepsUp++;
+    return level_;
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+// CPU governor for the audio callback. The callback reports how much of
+// the block period each block took; past a threshold the governor steps
+// the engine down one quality level (EngineQuality in groovebox_engine.h)
+// at a time, so a heavy patch degrades instead of overrunning.
+//
+// Stepping down takes two blocks in a row over the threshold, so a lone
+// slow block (an interrupt burst) doesn't cost a level. Recovery is
+// hysteretic: a level is only given back after the average load (over
+// about 32 blocks) has stayed under a lower threshold for a hold time. If
+// load climbs straight back over the threshold after a recovery, the hold
+// for that level doubles, so a patch sitting on the edge settles instead
+// of flapping between two levels.
+//
+// The thresholds are starting points, not measured settings. They need
+// checking against the Seed's own block loads (trace overrun events,
+// GetStats()) with the real DaisySP: firmware/host's governor_sim only
+// says how the governor reacts to a load, and its engine costs are those
+// of whichever DaisySP it was built with.
+//
+// No libDaisy dependency; Update() is the only call made per block.
+
+#include <stdint.h>
+
+class CpuGovernor
+{
+  public:
+    struct Config
+    {
+        float    highLoad   = 0.80f; // block load that steps quality down
+        float    lowLoad    = 0.55f; // average load to stay under to step up
+        uint16_t upBlocks   = 2;     // consecutive blocks over highLoad
+        uint16_t holdBlocks = 500;   // blocks under lowLoad per level recovered
+        uint16_t maxHold    = 8000;  // cap for the doubled hold
+        uint8_t  numLevels  = 1;     // levels 0..numLevels-1, 0 = full
+    };
+
+    struct Stats
+    {
+        uint32_t blocks;
+        uint32_t overruns;  // blocks that took longer than the period
+        uint32_t stepsDown;
+        uint32_t stepsUp;
+        float    maxLoad;
+    };
+
+    void Init(const Config& cfg);
+
+    // Audio callback, after rendering. load = block time / block period.
+    // Returns the level for the next block.
+    uint8_t Update(float load);
+
+    uint8_t      Level() const { return level_; }
+    const Stats& GetStats() const { return stats_; }
+
+  private:
+    static const int kMaxLevels = 8;
+    static constexpr float kAvgWeight = 1.0f / 32.0f;
+
+    Config   cfg_;
+    uint8_t  level_ = 0;
+    uint16_t over_  = 0; // consecutive blocks over highLoad
+    uint32_t under_ = 0; // consecutive blocks with avg_ under lowLoad
+    float    avg_   = 0.0f;
+    uint32_t sinceUp_ = 0; // blocks since the last recovery
+    uint16_t hold_[kMaxLevels] = {};
+    Stats    stats_ = {};
+};
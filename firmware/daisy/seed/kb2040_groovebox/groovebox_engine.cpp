@@ -0,0 +1,1219 @@
+#include "engine.h"
+#include "groovebox_profile.h"
+#include "trace.h"
+
+#include "midi_protocol.h"
+
+#include <new>
+
+using namespace daisysp;
+
+// Buffers too big for the Seed's internal SRAM go to the external SDRAM
+// (the section libDaisy's DSY_SDRAM_BSS uses). Host builds keep them in
+// ordinary .bss.
+#ifdef __arm__
+#define ENGINE_SDRAM_BSS __attribute__((section(".sdram_bss")))
+#else
+#define ENGINE_SDRAM_BSS
+#endif
+
+#ifdef GROOVEBOX_PROFILE
+uint32_t g_profileTicks[PROF_NUM_STAGES];
+uint32_t g_profileMark;
+#endif
+
+// ----------------------------------------------------------------------
+// Synth config
+// ----------------------------------------------------------------------
+static const float kPitchBendRange  = 2.0f;  // +/- 2 semitones
+static const float kDetuneSemi      = 0.08f; // osc2 slight detune
+static const float kMaxFilterCutoff = 10000.0f;
+static const float kMinFilterCutoff = 80.0f;
+static const float kPi             = 3.14159265358979323846f;
+static const float kTwoPi          = 2.0f * kPi;
+static const float kMaxDelaySec    = 1.0f;
+
+#ifdef GROOVEBOX_Q15_VOICES
+// The float voices' levels for the fixed-point ones, whose oscillators
+// run at half scale: osc amp 0.6, halved for the pair or * 0.7 alone
+static const float kQ15PairLevel = 0.6f;
+static const float kQ15SawLevel  = 0.84f;
+#endif
+
+// Governor savings (SetQuality)
+static const int   kMinVoices     = 3;      // QUALITY_MIN_VOICES polyphony
+static const float kTailShedLevel = 0.1f;   // -20 dB, QUALITY_SHED_TAILS
+static const float kShedFadeSec   = 0.005f; // shed voices fade, no click
+
+// The looper's buffers are a fixed budget of 8 s at 48 kHz: loops can be
+// 8 s long up to 48 kHz and 4 s at 96 kHz.
+static const size_t kLooperMaxSeconds = 8;
+static const size_t kLooperMaxSamples = 48000 * kLooperMaxSeconds;
+
+// ----------------------------------------------------------------------
+// Helpers
+// ----------------------------------------------------------------------
+// MidiCh numbers are 1-based, like the KB2040 side uses them. Status bytes,
+// and so libDaisy's MidiEvent::channel, carry the 0-based channel.
+static bool IsSynthChannel(uint8_t channel)
+{
+    return channel == MidiCh::SYNTH - 1;
+}
+
+static float CCNorm(uint8_t v)
+{
+    return (float)v / 127.0f;
+}
+
+// Per-sample decay factors below are written for 48 kHz; this gives the
+// same decay time at the running rate
+float Engine::DecayAt48k(float perSample48k) const
+{
+    return powf(perSample48k, 48000.0f / samplerate_);
+}
+
+float Engine::MidiToHzWithBend(int note, float extraSemi) const
+{
+    float n = (float)note + pitchBendSemi_ + extraSemi;
+    return mtof(n);
+}
+
+// White noise for the drums, -1..1. The generator is newlib's rand(),
+// which the firmware used to call, kept per instance so engines on
+// different threads neither race on it nor change each other's hits.
+float Engine::Noise()
+{
+    noiseState_ = noiseState_ * 6364136223846793005ULL + 1;
+    int r       = (int)((noiseState_ >> 32) & 0x7FFFFFFF);
+    return ((float)r / (float)0x7FFFFFFF) * 2.0f - 1.0f;
+}
+
+void Engine::UpdateEnvParams()
+{
+    for(int i = 0; i < kNumVoices; i++)
+    {
+        voices_[i].env.SetTime(ADSR_SEG_ATTACK,  attack_);
+        voices_[i].env.SetTime(ADSR_SEG_DECAY,   decay_);
+        voices_[i].env.SetTime(ADSR_SEG_RELEASE, release_);
+        voices_[i].env.SetSustainLevel(sustain_);
+    }
+#ifdef GROOVEBOX_Q15_VOICES
+    q15Voices_.SetEnvelope(attack_, decay_, sustain_, release_);
+#endif
+}
+
+void Engine::UpdateFilterParams()
+{
+    filter_.SetFreq(cutoff_);
+    filter_.SetRes(resonance_);
+}
+
+void Engine::UpdateDelayParams()
+{
+    size_t minDelay = (size_t)(0.02f * samplerate_);
+    size_t maxDelay = (size_t)(kMaxDelaySec * samplerate_);
+    size_t target   = (size_t)(delayTimeSec_ * samplerate_);
+    if(target < minDelay)
+        target = minDelay;
+    if(target > maxDelay)
+        target = maxDelay;
+    delaySamples_ = target;
+}
+
+void Engine::UpdateReverbParams()
+{
+    float fb = 0.2f + 0.75f * reverbTime_;
+    if(fb > 0.95f)
+        fb = 0.95f;
+    reverb_.SetFeedback(fb);
+}
+
+void Engine::StopLooper()
+{
+    looperRecording_ = false;
+    looperPlaying_   = false;
+    looperWrite_     = 0;
+    looperLength_    = 0;
+    looperPlay_      = 0;
+}
+
+void Engine::StartLooperRecord()
+{
+    looperRecording_ = true;
+    looperPlaying_   = false;
+    looperWrite_     = 0;
+    looperLength_    = 0;
+}
+
+void Engine::FinishLooperRecord()
+{
+    looperRecording_ = false;
+    if(looperWrite_ > 0)
+    {
+        looperLength_ = looperWrite_;
+        looperPlay_   = 0;
+        looperPlaying_ = true;
+    }
+}
+
+void Engine::ToggleLooperPlayback()
+{
+    if(looperLength_ == 0)
+        return;
+    looperPlaying_ = !looperPlaying_;
+    if(looperPlaying_)
+        looperPlay_ = 0;
+}
+
+Engine::DrumVoice* Engine::FindDrumVoice()
+{
+    for(int i = 0; i < kNumDrumVoices; i++)
+    {
+        if(!drumVoices_[i].active)
+            return &drumVoices_[i];
+    }
+    return &drumVoices_[0];
+}
+
+Engine::DrumType Engine::DrumTypeForNote(int note)
+{
+    switch(note)
+    {
+        case 36: return DRUM_KICK;
+        case 38: return DRUM_SNARE;
+        case 39: return DRUM_CLAP;
+        case 41: return DRUM_TOM_LOW;
+        case 43: return DRUM_TOM_LOW;
+        case 45: return DRUM_TOM_HIGH;
+        case 47: return DRUM_TOM_HIGH;
+        case 42: return DRUM_HAT_CLOSED;
+        case 44: return DRUM_HAT_CLOSED;
+        case 46: return DRUM_HAT_OPEN;
+        case 49: return DRUM_PERC;
+        case 51: return DRUM_PERC;
+        default: return DRUM_SNARE;
+    }
+}
+
+void Engine::SimpleEnv::Trigger(float amplitude, float seconds, float samplerate)
+{
+    value = amplitude;
+    if(seconds < 0.001f)
+        seconds = 0.001f;
+    decay = expf(-1.0f / (seconds * samplerate));
+}
+
+void Engine::TriggerDrum(int note, float velocity)
+{
+    DrumVoice* v = FindDrumVoice();
+    v->type      = DrumTypeForNote(note);
+    v->env.Init();
+    v->noiseEnv.Init();
+    v->phase       = 0.0f;
+    v->velocity    = velocity;
+    v->pitchScale  = 1.0f;
+    v->pitchDecay  = 0.0f;
+    v->active      = true;
+
+    switch(v->type)
+    {
+        case DRUM_KICK:
+            v->freq       = 55.0f + 40.0f * velocity;
+            v->pitchScale = 3.0f + 2.0f * velocity;
+            v->pitchDecay = DecayAt48k(0.9994f);
+            v->env.Trigger(1.2f * velocity, 0.35f, samplerate_);
+            v->noiseEnv.Trigger(0.4f * velocity, 0.05f, samplerate_);
+            break;
+        case DRUM_SNARE:
+            v->freq       = 180.0f + 80.0f * velocity;
+            v->pitchScale = 1.0f;
+            v->pitchDecay = 1.0f;
+            v->env.Trigger(0.9f * velocity, 0.25f, samplerate_);
+            v->noiseEnv.Trigger(0.8f * velocity, 0.18f, samplerate_);
+            break;
+        case DRUM_HAT_CLOSED:
+            v->freq       = 6000.0f;
+            v->pitchScale = 1.0f;
+            v->pitchDecay = 1.0f;
+            v->env.Trigger(0.6f * velocity, 0.08f, samplerate_);
+            v->noiseEnv.Trigger(0.7f * velocity, 0.05f, samplerate_);
+            break;
+        case DRUM_HAT_OPEN:
+            v->freq       = 5500.0f;
+            v->pitchScale = 1.0f;
+            v->pitchDecay = 1.0f;
+            v->env.Trigger(0.6f * velocity, 0.25f, samplerate_);
+            v->noiseEnv.Trigger(0.7f * velocity, 0.20f, samplerate_);
+            break;
+        case DRUM_TOM_LOW:
+            v->freq       = 110.0f + 30.0f * velocity;
+            v->pitchScale = 1.8f;
+            v->pitchDecay = DecayAt48k(0.9996f);
+            v->env.Trigger(1.0f * velocity, 0.4f, samplerate_);
+            v->noiseEnv.Trigger(0.4f * velocity, 0.12f, samplerate_);
+            break;
+        case DRUM_TOM_HIGH:
+            v->freq       = 180.0f + 60.0f * velocity;
+            v->pitchScale = 1.6f;
+            v->pitchDecay = DecayAt48k(0.9995f);
+            v->env.Trigger(0.9f * velocity, 0.3f, samplerate_);
+            v->noiseEnv.Trigger(0.4f * velocity, 0.1f, samplerate_);
+            break;
+        case DRUM_CLAP:
+            v->freq       = 800.0f;
+            v->pitchScale = 1.0f;
+            v->pitchDecay = 1.0f;
+            v->env.Trigger(0.8f * velocity, 0.18f, samplerate_);
+            v->noiseEnv.Trigger(1.0f * velocity, 0.12f, samplerate_);
+            break;
+        case DRUM_PERC:
+        default:
+            v->freq       = 430.0f;
+            v->pitchScale = 1.2f;
+            v->pitchDecay = DecayAt48k(0.9996f);
+            v->env.Trigger(0.7f * velocity, 0.22f, samplerate_);
+            v->noiseEnv.Trigger(0.7f * velocity, 0.18f, samplerate_);
+            break;
+    }
+}
+
+float Engine::ProcessDrums()
+{
+    float out = 0.0f;
+    for(int i = 0; i < kNumDrumVoices; i++)
+    {
+        DrumVoice& v = drumVoices_[i];
+        if(!v.active)
+            continue;
+
+        float envOut = v.env.Process();
+        float noiseOut = v.noiseEnv.Process();
+
+        if(envOut <= 0.0f && noiseOut <= 0.0f)
+        {
+            v.active = false;
+            continue;
+        }
+
+        float tone = 0.0f;
+        if(v.type == DRUM_HAT_CLOSED || v.type == DRUM_HAT_OPEN || v.type == DRUM_CLAP)
+        {
+            tone = 0.0f;
+        }
+        else
+        {
+            v.phase += (v.freq * v.pitchScale) / samplerate_;
+            if(v.phase >= 1.0f)
+                v.phase -= 1.0f;
+            tone = sinf(kTwoPi * v.phase);
+            v.pitchScale *= v.pitchDecay;
+            if(v.pitchScale < 1.0f)
+                v.pitchScale = 1.0f;
+        }
+
+        float noise = Noise();
+
+        float mix = 0.0f;
+        switch(v.type)
+        {
+            case DRUM_KICK:
+                mix = tone * envOut + 0.2f * noise * noiseOut;
+                break;
+            case DRUM_SNARE:
+                mix = 0.35f * tone * envOut + noise * noiseOut;
+                break;
+            case DRUM_HAT_CLOSED:
+            case DRUM_HAT_OPEN:
+                mix = noise * (0.6f * envOut + 0.9f * noiseOut);
+                break;
+            case DRUM_TOM_LOW:
+            case DRUM_TOM_HIGH:
+                mix = 0.8f * tone * envOut + 0.3f * noise * noiseOut;
+                break;
+            case DRUM_CLAP:
+                mix = noise * (0.5f * envOut + 1.1f * noiseOut);
+                break;
+            case DRUM_PERC:
+            default:
+                mix = 0.5f * tone * envOut + 0.6f * noise * noiseOut;
+                break;
+        }
+
+        out += mix * v.velocity;
+        v.active = v.active && (v.env.Active() || v.noiseEnv.Active());
+    }
+    return out;
+}
+
+// ----------------------------------------------------------------------
+// Voice allocation with keyDown + sustain-aware gate handling
+// ----------------------------------------------------------------------
+Engine::Voice* Engine::FindExistingVoiceForNote(int note)
+{
+    for(int i = 0; i < kNumVoices; i++)
+    {
+        if(voices_[i].note == note && (voices_[i].active || voices_[i].keyDown))
+            return &voices_[i];
+    }
+    return nullptr;
+}
+
+Engine::Voice* Engine::FindIdleVoice()
+{
+    for(int i = 0; i < kNumVoices; i++)
+    {
+        if(!voices_[i].active && !voices_[i].keyDown)
+            return &voices_[i];
+    }
+    return nullptr;
+}
+
+Engine::Voice* Engine::StealVoice()
+{
+    Voice* v = &voices_[voiceRotate_];
+    voiceRotate_ = (voiceRotate_ + 1) % kNumVoices;
+    TRACE(TRACE_VOICE_STEAL, v - voices_, v->note);
+
+    v->active  = false;
+    v->gate    = false;
+    v->keyDown = false;
+    v->vel     = 0.0f;
+
+    return v;
+}
+
+void Engine::SilenceVoice(Voice& v)
+{
+    v.active   = false;
+    v.gate     = false;
+    v.keyDown  = false;
+    v.shedding = false;
+    v.level    = 0.0f;
+}
+
+// Once per block: picks voices_ to fade out for the current quality level
+void Engine::ShedVoices()
+{
+    if(quality_ < QUALITY_SHED_TAILS)
+        return;
+
+    int sounding = 0;
+    for(int i = 0; i < kNumVoices; i++)
+    {
+        Voice& v = voices_[i];
+        if(!v.active || v.shedding)
+            continue;
+        if(!v.gate && v.level < kTailShedLevel)
+        {
+            TRACE(TRACE_SHED_TAIL, i, v.note);
+            v.shedding = true;
+            v.fade     = 1.0f;
+            continue;
+        }
+        sounding++;
+    }
+
+    if(quality_ < QUALITY_MIN_VOICES)
+        return;
+    for(; sounding > kMinVoices; sounding--)
+    {
+        // Released voices_ go first, then held ones; a voice still in its
+        // attack (a key just pressed) only if nothing else is left
+        Voice* quietest = nullptr;
+        float  lowest   = 0.0f;
+        for(int i = 0; i < kNumVoices; i++)
+        {
+            Voice& v = voices_[i];
+            if(!v.active || v.shedding)
+                continue;
+#ifdef GROOVEBOX_Q15_VOICES
+            bool attacking = q15Voices_.InAttack(i);
+#else
+            bool attacking = v.env.GetCurrentSegment() == ADSR_SEG_ATTACK;
+#endif
+            float rank = v.level + (v.gate ? 1.0f : 0.0f) + (attacking ? 2.0f : 0.0f);
+            if(!quietest || rank < lowest)
+            {
+                quietest = &v;
+                lowest   = rank;
+            }
+        }
+        TRACE(TRACE_SHED_VOICE, quietest - voices_, quietest->note);
+        quietest->shedding = true;
+        quietest->fade     = 1.0f;
+    }
+}
+
+Engine::Voice* Engine::AllocateVoiceForNote(int note)
+{
+    // If we already have this note, reuse that voice
+    Voice* v = FindExistingVoiceForNote(note);
+    if(v)
+        return v;
+
+    // Otherwise find an idle one
+    v = FindIdleVoice();
+    if(v)
+        return v;
+
+    // Otherwise steal one
+    return StealVoice();
+}
+
+// ----------------------------------------------------------------------
+// MIDI handlers
+// ----------------------------------------------------------------------
+void Engine::HandleNoteOn(uint8_t channel, uint8_t note, uint8_t velocity)
+{
+    if(!IsSynthChannel(channel))
+        return;
+
+    if(velocity == 0)
+    {
+        // NoteOn with vel=0 is NoteOff
+        for(int i = 0; i < kNumVoices; i++)
+        {
+            if(voices_[i].note == note && voices_[i].keyDown)
+            {
+                voices_[i].keyDown = false;
+                if(!sustainOn_)
+                    voices_[i].gate = false;
+            }
+        }
+        return;
+    }
+
+    float vel = (float)velocity / 127.0f;
+
+    if(instrMode_ == MODE_DRUM_KIT)
+    {
+        TriggerDrum(note, vel);
+        return;
+    }
+
+    Voice* v = AllocateVoiceForNote(note);
+    if(!v)
+        return;
+
+    v->note    = note;
+    v->vel     = vel;
+    v->keyDown = true;
+    v->gate     = true;
+    v->active   = true;
+    v->shedding = false;
+
+    // Base pitch with bend + detune
+    float baseHz  = MidiToHzWithBend(note, 0.0f);
+    float detuneH = MidiToHzWithBend(note, kDetuneSemi);
+
+    v->osc1.SetFreq(baseHz);
+    v->osc2.SetFreq(detuneH);
+}
+
+void Engine::HandleNoteOff(uint8_t channel, uint8_t note, uint8_t velocity)
+{
+    if(!IsSynthChannel(channel))
+        return;
+
+    if(instrMode_ == MODE_DRUM_KIT)
+    {
+        return;
+    }
+    // Turn off *all* voices_ with this note whose key is down.
+    for(int i = 0; i < kNumVoices; i++)
+    {
+        if(voices_[i].note == note && voices_[i].keyDown)
+        {
+            voices_[i].keyDown = false;
+            if(!sustainOn_)
+                voices_[i].gate = false;
+        }
+    }
+}
+
+void Engine::HandleCC(uint8_t channel, uint8_t cc, uint8_t val)
+{
+    if(!IsSynthChannel(channel))
+        return;
+
+    float n = CCNorm(val);
+
+    switch(cc)
+    {
+        case MidiCC::VOLUME:
+            masterGain_ = powf(n, 1.5f); // nicer taper
+            break;
+
+        case MidiCC::CUTOFF:
+        {
+            float t = n * n; // more resolution at low freqs
+            cutoff_ = kMinFilterCutoff
+                       * powf(kMaxFilterCutoff / kMinFilterCutoff, t);
+            UpdateFilterParams();
+        }
+        break;
+
+        case MidiCC::RESONANCE:
+            resonance_ = 0.1f + 0.9f * n; // 0.1..1.0
+            UpdateFilterParams();
+            break;
+
+        case MidiCC::ATTACK:
+            attack_ = 0.001f + 2.0f * n; // 1ms..2s
+            UpdateEnvParams();
+            break;
+
+        case MidiCC::DECAY:
+            decay_ = 0.01f + 3.0f * n; // 10ms..3s
+            UpdateEnvParams();
+            break;
+
+        case MidiCC::SUSTAIN:
+            sustain_ = n; // 0..1
+            UpdateEnvParams();
+            break;
+
+        case MidiCC::RELEASE:
+            release_ = 0.02f + 4.0f * n; // 20ms..4s
+            UpdateEnvParams();
+            break;
+
+        case MidiCC::DELAY_TIME:
+            delayTimeSec_ = 0.02f + 0.98f * n;
+            UpdateDelayParams();
+            break;
+
+        case MidiCC::DELAY_FEEDBACK:
+            delayFeedback_ = 0.02f + 0.9f * n;
+            if(delayFeedback_ > 0.95f)
+                delayFeedback_ = 0.95f;
+            break;
+
+        case MidiCC::DELAY_MIX:
+            delayMix_ = n;
+            break;
+
+        case MidiCC::REVERB_MIX:
+            reverbMix_ = n;
+            break;
+
+        case MidiCC::REVERB_TIME:
+            reverbTime_ = n;
+            UpdateReverbParams();
+            break;
+
+        case MidiCC::BASS_BOOST:
+            bassBoost_ = n;
+            break;
+
+        case MidiCC::DRIVE:
+            driveAmount_ = n;
+            break;
+
+        case MidiCC::LOOPER_LEVEL:
+            looperLevel_ = n;
+            break;
+
+        case MidiCC::VIBRATO_RATE:
+            vibratoRate_ = 0.1f + 8.0f * n; // 0.1..8 Hz
+            vibrLfo_.SetFreq(vibratoRate_);
+            break;
+
+        case MidiCC::MODWHEEL:
+            // Coarse value now; a following CC33 refines it to 14 bits
+            modWheelMsb_    = val;
+            modWheelTarget_ = n; // 0..1, scales vibrato depth
+            break;
+
+        case MidiCC::MODWHEEL_LSB:
+            modWheelTarget_
+                = (float)(((uint16_t)modWheelMsb_ << 7) | val) / 16383.0f;
+            break;
+
+        case MidiCC::SUSTAIN_PEDAL:
+        {
+            bool newSustain = (val >= 64);
+            if(newSustain && !sustainOn_)
+            {
+                sustainOn_ = true;
+            }
+            else if(!newSustain && sustainOn_)
+            {
+                sustainOn_ = false;
+                // Pedal released: any voices_ with keyUp but gate still on now release
+                for(int i = 0; i < kNumVoices; i++)
+                {
+                    if(!voices_[i].keyDown && voices_[i].gate)
+                        voices_[i].gate = false;
+                }
+            }
+        }
+        break;
+
+        case MidiCC::INSTRUMENT_MODE:
+            instrMode_ = (val >= 64) ? MODE_DRUM_KIT : MODE_POLY_SYNTH;
+            break;
+
+        case MidiCC::LOOPER_CONTROL:
+            if(val < 20)
+            {
+                StopLooper();
+            }
+            else if(val < 80)
+            {
+                if(!looperRecording_)
+                    StartLooperRecord();
+                else
+                    FinishLooperRecord();
+            }
+            else
+            {
+                ToggleLooperPlayback();
+            }
+            break;
+
+        default: break;
+    }
+}
+
+void Engine::HandlePitchBend(uint8_t channel, uint8_t lsb, uint8_t msb)
+{
+    if(!IsSynthChannel(channel))
+        return;
+
+    // 14-bit value 0..16383, center 8192
+    uint16_t value14  = ((uint16_t)msb << 7) | (uint16_t)lsb;
+    int      centered = (int)value14 - 8192; // -8192..+8191
+
+    // Deadzone around center so tiny joystick offsets don't leave
+    // the synth slightly out of tune forever. The deadzone is subtracted
+    // (not snapped) so bending out of it stays continuous.
+    const int dead = 256; // about 1.5% of the range
+    if(centered > -dead && centered < dead)
+    {
+        pitchBendTarget_ = 0.0f; // perfectly back in tune
+        return;
+    }
+
+    float norm = (centered > 0) ? (float)(centered - dead) / (8191.0f - dead)
+                                : (float)(centered + dead) / (8192.0f - dead);
+    if(norm > 1.0f)
+        norm = 1.0f;
+    if(norm < -1.0f)
+        norm = -1.0f;
+
+    pitchBendTarget_ = norm * kPitchBendRange;
+}
+
+void Engine::HandleMidiMessage(uint8_t status, uint8_t data0, uint8_t data1)
+{
+    uint8_t channel = status & 0x0F;
+    switch(status & 0xF0)
+    {
+        case 0x90: HandleNoteOn(channel, data0, data1); break;
+        case 0x80: HandleNoteOff(channel, data0, data1); break;
+        case 0xB0: HandleCC(channel, data0, data1); break;
+        case 0xE0: HandlePitchBend(channel, data0, data1); break;
+        default: break;
+    }
+}
+
+// ----------------------------------------------------------------------
+// Audio rendering
+// ----------------------------------------------------------------------
+// What this block will run, as it starts
+uint8_t Engine::ComputeFeatures(EngineQuality quality) const
+{
+    int sounding = 0;
+    for(int v = 0; v < kNumVoices; v++)
+        if(voices_[v].active || voices_[v].keyDown || voices_[v].gate)
+            sounding++;
+    // Thirds of the polyphony: 1-2, 3-4, 5-6 of six voices
+    uint8_t features = (uint8_t)((sounding * 3 + kNumVoices - 1) / kNumVoices);
+    for(int d = 0; d < kNumDrumVoices; d++)
+        if(drumVoices_[d].active)
+        {
+            features |= FEATURE_DRUMS;
+            break;
+        }
+    if(looperRecording_ || looperPlaying_)
+        features |= FEATURE_LOOPER;
+    return features | (uint8_t)(quality << FEATURE_QUALITY_SHIFT);
+}
+
+// Two renders' features as one: the more voices, either's drums and
+// looper, the later quality (the same within a callback)
+static uint8_t MergeFeatures(uint8_t a, uint8_t b)
+{
+    const uint8_t flags   = FEATURE_DRUMS | FEATURE_LOOPER;
+    const uint8_t quality = (uint8_t)(0xFF << FEATURE_QUALITY_SHIFT);
+    uint8_t       va      = a & FEATURE_VOICES_MASK;
+    uint8_t       vb      = b & FEATURE_VOICES_MASK;
+    return (uint8_t)((va > vb ? va : vb) | ((a | b) & flags) | (b & quality));
+}
+
+uint8_t Engine::TakeFeatures()
+{
+    uint8_t features = features_;
+    features_        = 0;
+    return features;
+}
+
+// Adds the peak and sum of squares of x[0..n) to a meter channel. Four
+// independent accumulators per sum, so the FPU pipelines the adds and
+// max operations (VMAXNM) instead of waiting on one dependency chain;
+// the M7 has no floating-point SIMD.
+void Engine::MeasureBlock(const float* x, size_t n, int channel)
+{
+    float  p0 = 0.0f, p1 = 0.0f, p2 = 0.0f, p3 = 0.0f;
+    float  s0 = 0.0f, s1 = 0.0f, s2 = 0.0f, s3 = 0.0f;
+    size_t i = 0;
+    for(; i + 4 <= n; i += 4)
+    {
+        float a = x[i], b = x[i + 1], c = x[i + 2], d = x[i + 3];
+        p0 = fmaxf(p0, fabsf(a));
+        p1 = fmaxf(p1, fabsf(b));
+        p2 = fmaxf(p2, fabsf(c));
+        p3 = fmaxf(p3, fabsf(d));
+        s0 += a * a;
+        s1 += b * b;
+        s2 += c * c;
+        s3 += d * d;
+    }
+    for(; i < n; i++)
+    {
+        p0 = fmaxf(p0, fabsf(x[i]));
+        s0 += x[i] * x[i];
+    }
+    float peak = fmaxf(fmaxf(p0, p1), fmaxf(p2, p3));
+    if(peak > meters_.peak[channel])
+        meters_.peak[channel] = peak;
+    meters_.sumSq[channel] += (s0 + s1) + (s2 + s3);
+}
+
+void Engine::MeterBuses(size_t n)
+{
+    for(int b = 0; b < kMeterBuses; b++)
+        MeasureBlock(meterTap_[b], n, kMeterFirstBus + b);
+}
+
+void Engine::TakeMeters(EngineMeters& m)
+{
+    m       = meters_;
+    meters_ = EngineMeters();
+}
+
+void Engine::Render(float** out, size_t size)
+{
+    // Glide bend and mod wheel linearly from where the last block ended to
+    // the latest received values, so pitch stays continuous between MIDI
+    // updates.
+    float bendTarget = pitchBendTarget_;
+    float bendStep   = (bendTarget - pitchBendSemi_) / (float)size;
+    float modTarget  = modWheelTarget_;
+    float modStep    = (modTarget - modWheel_) / (float)size;
+
+    // Read once: the governor may change it between blocks
+    const EngineQuality quality    = quality_;
+    const bool          twoOsc     = quality < QUALITY_SINGLE_OSC;
+    const bool          cheapFx    = quality >= QUALITY_CHEAP_FX;
+    const bool          halfReverb = cheapFx || reverbHalfRate_;
+    ShedVoices();
+    features_ = MergeFeatures(features_, ComputeFeatures(quality));
+
+    size_t tap = 0; // next slot in meterTap_
+
+    PROFILE_START();
+    for(size_t i = 0; i < size; i++)
+    {
+        float dry = 0.0f;
+
+        pitchBendSemi_ += bendStep;
+        modWheel_ += modStep;
+        float vibrDepth = vibratoDepth_ * modWheel_; // semitones
+
+        // Vibrato LFO (mono, -1..+1)
+        float vibr = vibrLfo_.Process();
+
+#ifdef GROOVEBOX_Q15_VOICES
+        // A chunk at a time, vibrato as it is at the chunk's first sample
+        if(i % VoiceBankQ15::kChunk == 0)
+        {
+            size_t n = size - i < VoiceBankQ15::kChunk ? size - i : VoiceBankQ15::kChunk;
+            RenderVoicesQ15(n, pitchBendSemi_ + bendStep * (float)(n - 1) + vibr * vibrDepth, twoOsc);
+        }
+        dry = q15Bus_[i % VoiceBankQ15::kChunk];
+#else
+        for(int v = 0; v < kNumVoices; v++)
+        {
+            Voice& voice = voices_[v];
+
+            // Skip truly idle voices_
+            if(!voice.active && !voice.keyDown && !voice.gate)
+                continue;
+
+            float envOut = voice.env.Process(voice.gate);
+
+            // If envelope is fully released and there is no key or gate,
+            // mark as inactive.
+            if(!voice.gate && !voice.keyDown && envOut < 0.0001f)
+            {
+                SilenceVoice(voice);
+                continue;
+            }
+
+            float gain = envOut * voice.vel;
+            voice.level = gain;
+            if(voice.shedding)
+            {
+                voice.fade -= fadeStep_;
+                if(voice.fade <= 0.0f)
+                {
+                    SilenceVoice(voice);
+                    continue;
+                }
+                gain *= voice.fade;
+            }
+
+            // Pitch with bend + vibrato
+            float bendSemi = pitchBendSemi_ + (vibr * vibrDepth);
+            float note     = (float)voice.note + bendSemi;
+            voice.osc1.SetFreq(mtof(note));
+
+            float sig;
+            if(twoOsc)
+            {
+                voice.osc2.SetFreq(mtof(note + kDetuneSemi));
+                sig = (voice.osc1.Process() + voice.osc2.Process()) * 0.5f;
+            }
+            else
+            {
+                sig = voice.osc1.Process() * 0.7f; // about the pair's level
+            }
+
+            dry += sig * gain;
+        }
+#endif
+        PROFILE_MARK(PROF_VOICES);
+
+        meterTap_[MidiMeter::SYNTH - kMeterFirstBus][tap] = dry;
+
+        float drum = ProcessDrums();
+        if(instrMode_ == MODE_DRUM_KIT)
+        {
+            dry += drum;
+        }
+        meterTap_[MidiMeter::DRUMS - kMeterFirstBus][tap]
+            = instrMode_ == MODE_DRUM_KIT ? drum : 0.0f;
+        PROFILE_MARK(PROF_DRUMS);
+
+        // Global filter
+        filter_.Process(dry);
+        float filtered = filter_.Low();
+
+        // Bass boost: add boosted low frequencies
+        bassFilter_.Process(filtered);
+        float low     = bassFilter_.Low();
+        float bassMix = filtered + low * bassBoost_;
+
+        // Drive / saturation
+        float driveGain = 1.0f + driveAmount_ * 6.0f;
+        float driven    = cheapFx ? soft_clip(bassMix * driveGain)
+                                  : tanhf(bassMix * driveGain);
+        PROFILE_MARK(PROF_TONE);
+
+        // Delay
+        delayLine_->SetDelay(delaySamples_);
+        float delayOut = delayLine_->Read();
+        float delayIn  = driven + delayOut * delayFeedback_;
+        delayLine_->Write(delayIn);
+        float delayMix = (1.0f - delayMix_) * driven + delayMix_ * delayOut;
+        meterTap_[MidiMeter::DELAY - kMeterFirstBus][tap] = delayMix_ * delayOut;
+        PROFILE_MARK(PROF_DELAY);
+
+        // Reverb (stereo)
+        float revL, revR;
+        if(!halfReverb)
+        {
+            reverb_.Process(delayMix, delayMix, &revL, &revR);
+            // Interpolate from here if the governor switches mid-tail
+            reverbPrevL_ = reverbLastL_ = revL;
+            reverbPrevR_ = reverbLastR_ = revR;
+        }
+        else if(!reverbOdd_)
+        {
+            reverbIn_ = delayMix;
+            revL       = 0.5f * (reverbPrevL_ + reverbLastL_);
+            revR       = 0.5f * (reverbPrevR_ + reverbLastR_);
+        }
+        else
+        {
+            reverbPrevL_ = reverbLastL_;
+            reverbPrevR_ = reverbLastR_;
+            float in      = 0.5f * (reverbIn_ + delayMix);
+            reverb_.Process(in, in, &reverbLastL_, &reverbLastR_);
+            revL = reverbPrevL_;
+            revR = reverbPrevR_;
+        }
+        reverbOdd_ = !reverbOdd_;
+        float wetL = (1.0f - reverbMix_) * delayMix + reverbMix_ * revL;
+        float wetR = (1.0f - reverbMix_) * delayMix + reverbMix_ * revR;
+        meterTap_[MidiMeter::REVERB - kMeterFirstBus][tap] = reverbMix_ * revL;
+        PROFILE_MARK(PROF_REVERB);
+
+        // Looper record/playback on post-FX signal
+        if(looperRecording_ && looperWrite_ < looperCapacity_)
+        {
+            looperL_[looperWrite_] = wetL;
+            looperR_[looperWrite_] = wetR;
+            looperWrite_++;
+        }
+        else if(looperRecording_ && looperWrite_ >= looperCapacity_)
+        {
+            FinishLooperRecord();
+        }
+
+        float loopL = 0.0f;
+        if(looperPlaying_ && looperLength_ > 0)
+        {
+            loopL = looperL_[looperPlay_] * looperLevel_;
+            wetL += loopL;
+            wetR += looperR_[looperPlay_] * looperLevel_;
+            looperPlay_++;
+            if(looperPlay_ >= looperLength_)
+                looperPlay_ = 0;
+        }
+        meterTap_[MidiMeter::LOOPER - kMeterFirstBus][tap] = loopL;
+
+        // Simple mono out to both channels
+        out[0][i] = wetL * masterGain_;
+        out[1][i] = wetR * masterGain_;
+        PROFILE_MARK(PROF_LOOPER);
+
+        if(++tap == kMeterChunk)
+        {
+            MeterBuses(tap);
+            tap = 0;
+        }
+    }
+    MeterBuses(tap);
+    MeasureBlock(out[0], size, MidiMeter::OUT_L);
+    MeasureBlock(out[1], size, MidiMeter::OUT_R);
+    meters_.samples += (uint32_t)size;
+
+    // Land exactly on the targets (no float drift across blocks)
+    pitchBendSemi_ = bendTarget;
+    modWheel_      = modTarget;
+}
+
+#ifdef GROOVEBOX_Q15_VOICES
+void Engine::RenderVoicesQ15(size_t n, float bendSemi, bool twoOsc)
+{
+    VoiceBankQ15::Control ctl[kNumVoices];
+    const float           level = twoOsc ? kQ15PairLevel : kQ15SawLevel;
+    for(int v = 0; v < kNumVoices; v++)
+    {
+        const Voice&           voice = voices_[v];
+        VoiceBankQ15::Control& c     = ctl[v];
+        c.on = voice.active || voice.keyDown || voice.gate;
+        if(!c.on)
+            continue;
+        float note = (float)voice.note + bendSemi;
+        c.gate     = voice.gate;
+        c.shedding = voice.shedding;
+        c.note     = voice.note;
+        c.inc1     = q15Voices_.Increment(mtof(note));
+        c.inc2     = q15Voices_.Increment(mtof(note + kDetuneSemi));
+        c.amp      = (int16_t)(voice.vel * level * 32767.0f);
+    }
+
+    int64_t mix[VoiceBankQ15::kChunk] = {};
+    q15Voices_.Render(ctl, twoOsc, mix, n);
+
+    for(int v = 0; v < kNumVoices; v++)
+    {
+        if(!ctl[v].on)
+            continue;
+        if(q15Voices_.Done(v))
+            SilenceVoice(voices_[v]);
+        else
+            voices_[v].level = q15Voices_.Envelope(v) * voices_[v].vel;
+    }
+
+    // Q30 to float through Q26, which fits 32 bits at any polyphony
+    for(size_t i = 0; i < n; i++)
+        q15Bus_[i] = (float)(int32_t)(mix[i] >> 4) * (1.0f / 67108864.0f);
+}
+#endif
+
+// ----------------------------------------------------------------------
+// Init
+// ----------------------------------------------------------------------
+size_t Engine::LooperCapacity(float samplerate)
+{
+    size_t capacity = (size_t)(samplerate * kLooperMaxSeconds);
+    return capacity < kLooperMaxSamples ? capacity : kLooperMaxSamples;
+}
+
+// Worst-case padding for each allocation's alignment included
+const size_t Engine::kMaxArenaBytes
+    = sizeof(DelayBuffer) + alignof(DelayBuffer)
+      + 2 * (kLooperMaxSamples * sizeof(float) + alignof(float));
+
+size_t Engine::ArenaBytes(float samplerate)
+{
+    return kMaxArenaBytes
+           - 2 * (kLooperMaxSamples - LooperCapacity(samplerate)) * sizeof(float);
+}
+
+bool Engine::Init(float samplerate, EngineArena& arena)
+{
+    void* delayMem  = arena.Alloc<DelayBuffer>(1);
+    looperCapacity_ = LooperCapacity(samplerate);
+    looperL_        = arena.Alloc<float>(looperCapacity_);
+    looperR_        = arena.Alloc<float>(looperCapacity_);
+    if(!delayMem || !looperL_ || !looperR_)
+    {
+        delayLine_ = nullptr;
+        return false;
+    }
+    delayLine_ = new(delayMem) DelayBuffer;
+
+    noiseState_ = 0x1234;
+    samplerate_ = samplerate;
+
+    for(int i = 0; i < kNumVoices; i++)
+    {
+        voices_[i].osc1.Init(samplerate);
+        voices_[i].osc1.SetWaveform(Oscillator::WAVE_SAW);
+        voices_[i].osc1.SetAmp(0.6f);
+
+        voices_[i].osc2.Init(samplerate);
+        voices_[i].osc2.SetWaveform(Oscillator::WAVE_TRI);
+        voices_[i].osc2.SetAmp(0.6f);
+
+        voices_[i].env.Init(samplerate);
+        voices_[i].env.SetTime(ADSR_SEG_ATTACK,  attack_);
+        voices_[i].env.SetTime(ADSR_SEG_DECAY,   decay_);
+        voices_[i].env.SetTime(ADSR_SEG_RELEASE, release_);
+        voices_[i].env.SetSustainLevel(sustain_);
+
+        voices_[i].note    = 60;
+        voices_[i].active  = false;
+        voices_[i].gate    = false;
+        voices_[i].keyDown = false;
+        voices_[i].vel     = 0.0f;
+        voices_[i].level   = 0.0f;
+        voices_[i].fade    = 1.0f;
+        voices_[i].shedding = false;
+    }
+    fadeStep_ = 1.0f / (kShedFadeSec * samplerate);
+    quality_  = QUALITY_FULL;
+#ifdef GROOVEBOX_Q15_VOICES
+    q15Voices_.Init(kNumVoices, samplerate);
+    q15Voices_.SetEnvelope(attack_, decay_, sustain_, release_);
+    q15Voices_.SetFadeTime(kShedFadeSec);
+#endif
+
+    filter_.Init(samplerate);
+    filter_.SetDrive(0.0f);
+    UpdateFilterParams();
+
+    vibrLfo_.Init(samplerate);
+    vibrLfo_.SetWaveform(Oscillator::WAVE_SIN);
+    vibrLfo_.SetFreq(vibratoRate_);
+    vibrLfo_.SetAmp(1.0f);
+
+    bassFilter_.Init(samplerate);
+    bassFilter_.SetFreq(150.0f);
+    bassFilter_.SetRes(0.5f);
+
+    delayLine_->Init();
+    UpdateDelayParams();
+
+    reverbHalfRate_ = samplerate > 48000.0f;
+    reverb_.Init(reverbHalfRate_ ? samplerate * 0.5f : samplerate);
+    UpdateReverbParams();
+
+    StopLooper();
+
+    for(int i = 0; i < kNumDrumVoices; i++)
+    {
+        drumVoices_[i].env.Init();
+        drumVoices_[i].noiseEnv.Init();
+        drumVoices_[i].active = false;
+        drumVoices_[i].phase  = 0.0f;
+    }
+
+    masterGain_  = 0.4f;
+    sustainOn_   = false;
+    instrMode_   = MODE_POLY_SYNTH;
+    looperLevel_ = 0.7f;
+    meters_      = EngineMeters();
+    return true;
+}
+
+// ----------------------------------------------------------------------
+// The firmware's instance (groovebox_engine.h)
+// ----------------------------------------------------------------------
+// The arena lives in SDRAM, the engine itself in internal SRAM
+static uint8_t ENGINE_SDRAM_BSS g_arenaMemory[Engine::kMaxArenaBytes];
+static EngineArena g_arena(g_arenaMemory, sizeof(g_arenaMemory));
+static Engine      g_engine;
+
+void InitSynth(float samplerate)
+{
+    g_arena.Reset();
+    g_engine.Init(samplerate, g_arena); // the arena fits any rate
+}
+
+void HandleNoteOn(uint8_t channel, uint8_t note, uint8_t velocity)
+{
+    g_engine.HandleNoteOn(channel, note, velocity);
+}
+
+void HandleNoteOff(uint8_t channel, uint8_t note, uint8_t velocity)
+{
+    g_engine.HandleNoteOff(channel, note, velocity);
+}
+
+void HandleCC(uint8_t channel, uint8_t cc, uint8_t val)
+{
+    g_engine.HandleCC(channel, cc, val);
+}
+
+void HandlePitchBend(uint8_t channel, uint8_t lsb, uint8_t msb)
+{
+    g_engine.HandlePitchBend(channel, lsb, msb);
+}
+
+void HandleMidiMessage(uint8_t status, uint8_t data0, uint8_t data1)
+{
+    g_engine.HandleMidiMessage(status, data0, data1);
+}
+
+void RenderAudio(float** out, size_t size)
+{
+    g_engine.Render(out, size);
+}
+
+void SetEngineQuality(EngineQuality quality)
+{
+    g_engine.SetQuality(quality);
+}
+
+EngineQuality GetEngineQuality()
+{
+    return g_engine.GetQuality();
+}
+
+uint8_t TakeEngineFeatures()
+{
+    return g_engine.TakeFeatures();
+}
+
+void TakeEngineMeters(EngineMeters& m)
+{
+    g_engine.TakeMeters(m);
+}
+
@@ -0,0 +1,78 @@
+#pragma once
+
+// DSP core of the groovebox: voices, drum kit, FX, looper and the MIDI
+// handlers that drive them. Depends on DaisySP only (no libDaisy), so the
+// host tools in firmware/host can run the same code the Seed runs.
+//
+// The functions here drive the firmware's one Engine (engine.h), with its
+// buffers in SDRAM. This header needs no DaisySP itself, so code that
+// only talks to the firmware's engine can include it without DaisySP.
+
+#include "midi_protocol.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Any rate up to 96 kHz; RenderAudio() takes any block size
+void InitSynth(float samplerate);
+
+// Channel is 0-based, as in the status byte. The handlers and
+// RenderAudio() must all be called from one context: none of them can
+// interrupt another. In the firmware that is the audio callback (see
+// jitter_buffer.h).
+void HandleNoteOn(uint8_t channel, uint8_t note, uint8_t velocity);
+void HandleNoteOff(uint8_t channel, uint8_t note, uint8_t velocity);
+void HandleCC(uint8_t channel, uint8_t cc, uint8_t val);
+void HandlePitchBend(uint8_t channel, uint8_t lsb, uint8_t msb);
+
+// Dispatches one complete channel message by status byte
+void HandleMidiMessage(uint8_t status, uint8_t data0, uint8_t data1);
+
+// Renders one block into out[0] (left) and out[1] (right)
+void RenderAudio(float** out, size_t size);
+
+// Work levels for the CPU governor (governor.h), cheapest last. Each level
+// keeps the savings of the ones before it.
+enum EngineQuality : uint8_t
+{
+    QUALITY_FULL = 0,
+    QUALITY_SHED_TAILS, // released voices below -20 dB fade out early
+    QUALITY_SINGLE_OSC, // detuned second oscillator off
+    QUALITY_CHEAP_FX,   // half-rate reverb, polynomial drive
+    QUALITY_MIN_VOICES, // at most 3 voices; the quietest others fade out
+    QUALITY_NUM_LEVELS,
+};
+
+// Takes effect at the next RenderAudio()
+void SetEngineQuality(EngineQuality quality);
+EngineQuality GetEngineQuality();
+
+// What RenderAudio() ran, as a key for execution-time tables
+// (audio_budget.h)
+enum EngineFeature : uint8_t
+{
+    FEATURE_VOICES_MASK   = 0x03, // 0, 1-2, 3-4 or 5-6 voices sounding
+    FEATURE_DRUMS         = 0x04, // a drum hit sounding
+    FEATURE_LOOPER        = 0x08, // recording or playing
+    FEATURE_QUALITY_SHIFT = 4,    // EngineQuality in the bits above
+};
+
+// Everything RenderAudio() ran since the last call, and starts over: the
+// most voices any render had sounding, drums or looper if any render ran
+// them. A callback that renders its block in parts (jitter_buffer.h)
+// keys its time on the whole block this way.
+uint8_t TakeEngineFeatures();
+
+// Levels of everything rendered since the last TakeEngineMeters(), per
+// MidiMeter::Channel (midi_protocol.h): the output pair and the buses
+// that feed it
+struct EngineMeters
+{
+    float    peak[MidiMeter::NUM_CHANNELS];  // largest |sample|
+    float    sumSq[MidiMeter::NUM_CHANNELS]; // sum of squared samples
+    uint32_t samples;
+};
+
+// Copies the levels and starts over. Call from the audio callback, or
+// anywhere RenderAudio() can't run at the same time.
+void TakeEngineMeters(EngineMeters& m);
@@ -0,0 +1,43 @@
+#pragma once
+
+// Optional per-stage profiling of RenderAudio(). Builds that define
+// GROOVEBOX_PROFILE supply ProfileNow(), a free-running 32-bit up-counter
+// (cycles on the Seed, the emulated SysTick in the bench). Each mark adds
+// the time since the previous mark to that stage's total; totals only
+// grow, so readers take differences.
+
+#include <stdint.h>
+
+enum ProfileStage
+{
+    PROF_VOICES = 0, // vibrato LFO and synth voices
+    PROF_DRUMS,
+    PROF_TONE,       // filter, bass boost, drive
+    PROF_DELAY,
+    PROF_REVERB,
+    PROF_LOOPER,     // looper and output gain
+    PROF_NUM_STAGES,
+};
+
+#ifdef GROOVEBOX_PROFILE
+
+uint32_t ProfileNow();
+
+extern uint32_t g_profileTicks[PROF_NUM_STAGES];
+extern uint32_t g_profileMark;
+
+#define PROFILE_START() (g_profileMark = ProfileNow())
+#define PROFILE_MARK(stage)                           \
+    do                                                \
+    {                                                 \
+        uint32_t profNow_ = ProfileNow();             \
+        g_profileTicks[stage] += profNow_ - g_profileMark; \
+        g_profileMark = profNow_;                     \
+    } while(0)
+
+#else
+
+#define PROFILE_START() ((void)0)
+#define PROFILE_MARK(stage) ((void)0)
+
+#endif
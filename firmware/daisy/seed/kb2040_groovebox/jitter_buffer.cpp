@@ -0,0 +1,138 @@
+#include "jitter_buffer.h"
+#include "groovebox_engine.h"
+
+namespace
+{
+// Stamps repeat every 2^14 ticks of 64 us
+constexpr uint32_t kStampPeriodUs = (uint32_t)(MidiStamp::MASK + 1) << MidiStamp::UNIT_SHIFT;
+
+// A delay this far above the estimate isn't jitter: the KB2040 restarted
+// or the link stalled. Start over from this message.
+constexpr int32_t kResyncUs = 250000;
+} // namespace
+
+void JitterBuffer::Init(const Config& cfg, float sampleRate)
+{
+    cfg_          = cfg;
+    samplesPerUs_ = sampleRate / 1e6f;
+    synced_       = false;
+    stats_        = Stats();
+}
+
+bool JitterBuffer::Push(const MidiRxEvent& e)
+{
+    // Checked before the clock estimate sees the message, so a retry
+    // counts once
+    if(e.stamped ? queue_.Full() : next_.Full())
+    {
+        stats_.refused++;
+        return false;
+    }
+    if(e.stamped)
+        Schedule(e);
+    else
+        next_.Push({0, e.status, e.data0, e.data1});
+    return true;
+}
+
+void JitterBuffer::Schedule(const MidiRxEvent& e)
+{
+    const uint32_t stampUs = (uint32_t)e.stamp << MidiStamp::UNIT_SHIFT;
+
+    // Unwrap the stamp to the send time nearest the one the current
+    // estimate expects
+    uint32_t sender = stampUs;
+    if(synced_)
+    {
+        uint32_t expected = e.arrivalUs - (uint32_t)offsetUs_;
+        uint32_t diff     = (stampUs - expected) & (kStampPeriodUs - 1);
+        sender            = expected + diff;
+        if(diff >= kStampPeriodUs / 2)
+            sender -= kStampPeriodUs;
+    }
+
+    int32_t delay = (int32_t)(e.arrivalUs - sender);
+    if(!synced_ || delay - offsetUs_ > kResyncUs)
+    {
+        synced_   = true;
+        offsetUs_ = delay;
+        lastDueUs_ = e.arrivalUs;
+    }
+    else if(delay < offsetUs_)
+    {
+        offsetUs_ = delay;
+    }
+    else
+    {
+        uint32_t creep = (uint32_t)((uint64_t)(e.arrivalUs - lastArrival_) * cfg_.creepPpm / 1000000u);
+        offsetUs_      = (delay - offsetUs_ < (int32_t)creep) ? delay : offsetUs_ + (int32_t)creep;
+    }
+    lastArrival_ = e.arrivalUs;
+
+    uint32_t spread = (uint32_t)(delay - offsetUs_);
+    if(spread > stats_.maxSpreadUs)
+        stats_.maxSpreadUs = spread;
+    stats_.offsetUs = offsetUs_;
+
+    // Keep messages in send order even when the estimate steps down
+    uint32_t due = sender + (uint32_t)offsetUs_ + cfg_.latencyUs;
+    if((int32_t)(due - lastDueUs_) < 0)
+        due = lastDueUs_;
+    lastDueUs_ = due;
+
+    queue_.Push({due, e.status, e.data0, e.data1});
+    stats_.scheduled++;
+}
+
+void JitterBuffer::Handle(const Scheduled& s)
+{
+    if(cfg_.handle)
+        cfg_.handle(s.status, s.data0, s.data1);
+    else
+        HandleMidiMessage(s.status, s.data0, s.data1);
+}
+
+void JitterBuffer::Render(float** out, size_t size, uint32_t callbackUs)
+{
+    const uint32_t blockUs = (uint32_t)((float)size / samplesPerUs_);
+    void (*render)(float**, size_t) = cfg_.render ? cfg_.render : RenderAudio;
+    size_t         pos     = 0;
+    Scheduled      s;
+    while(next_.Pop(s))
+        Handle(s);
+    while(queue_.Peek(s))
+    {
+        int32_t dt = (int32_t)(s.dueUs - callbackUs);
+        if(dt >= (int32_t)blockUs)
+            break;
+
+        size_t at = 0;
+        if(dt < 0)
+        {
+            stats_.late++;
+            if((uint32_t)-dt > stats_.maxLateUs)
+                stats_.maxLateUs = (uint32_t)-dt;
+        }
+        else
+        {
+            at = (size_t)((float)dt * samplesPerUs_);
+        }
+        if(at < pos)
+            at = pos;
+        if(at > size)
+            at = size;
+        if(at > pos)
+        {
+            float* part[2] = {out[0] + pos, out[1] + pos};
+            render(part, at - pos);
+            pos = at;
+        }
+        Handle(s);
+        queue_.Pop(s);
+    }
+    if(pos < size)
+    {
+        float* part[2] = {out[0] + pos, out[1] + pos};
+        render(part, size - pos);
+    }
+}
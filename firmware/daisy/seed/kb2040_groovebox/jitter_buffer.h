@@ -0,0 +1,95 @@
+#pragma once
+
+// Constant-latency mode: messages that carry a KB2040 send stamp
+// (MidiStamp in midi_protocol.h) are played at stamp + a fixed latency on
+// the Daisy's clock, not when they happen to arrive, so transport jitter
+// (KB2040 loop, UART queueing, DMA batching) doesn't move notes around.
+//
+// Clock mapping: for each stamped message, arrival - send time is the
+// transport delay plus the unknown offset between the two clocks. Its
+// running minimum (allowed to creep up slowly, for crystal drift)
+// estimates offset + fastest delay. A message is due at its send time
+// plus that estimate plus the latency.
+//
+// main() schedules messages with Push(). The audio callback calls
+// Render(), which splits the block at each due message and handles it
+// there, so timing is sample accurate. A message already due when its
+// block renders plays at the start of the block and counts as late.
+//
+// Every message for the engine comes through here, stamped or not, so
+// the audio callback is the engine's only caller: voice allocation and
+// the sustain pedal's release loop are never entered twice at once.
+// Unstamped messages play at the start of the next block. A stamped
+// message the schedule has no room for is refused rather than played
+// early, ahead of the earlier ones still waiting (a note off before its
+// note on): main() holds it until a block has made room.
+
+#include "midi_rx.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+class JitterBuffer
+{
+  public:
+    struct Config
+    {
+        uint32_t latencyUs = 5000; // on top of the fastest transport delay
+        uint32_t creepPpm  = 200;  // offset estimate drift allowance
+
+        // Takes each message at its sample; HandleMidiMessage() if null
+        void (*handle)(uint8_t status, uint8_t data0, uint8_t data1) = nullptr;
+
+        // Renders the pieces between messages; RenderAudio() if null. A
+        // second scheduler (the MIDI file player) can split them further.
+        void (*render)(float** out, size_t size) = nullptr;
+    };
+
+    struct Stats
+    {
+        uint32_t scheduled;
+        uint32_t late;
+        uint32_t refused;    // its queue full; Push() false
+        uint32_t maxLateUs;
+        uint32_t maxSpreadUs; // largest delay seen above the estimate
+        int32_t  offsetUs;    // current estimate, local - KB2040 clock
+    };
+
+    void Init(const Config& cfg, float sampleRate);
+
+    // main(): schedules a stamped message, or queues any other for the
+    // start of the next block. Returns false, having queued nothing, if
+    // its queue is full; the caller keeps the message, and any after it,
+    // and tries again after the next block.
+    bool Push(const MidiRxEvent& e);
+
+    // Audio callback: renders `size` samples, handling messages due before
+    // callbackUs + one block at their sample. callbackUs is the local
+    // clock on entry to the callback.
+    void Render(float** out, size_t size, uint32_t callbackUs);
+
+    const Stats& GetStats() const { return stats_; }
+
+  private:
+    struct Scheduled
+    {
+        uint32_t dueUs; // unused for the next block's
+        uint8_t  status, data0, data1;
+    };
+
+    void Schedule(const MidiRxEvent& e);
+    void Handle(const Scheduled& s);
+
+    Config cfg_;
+    float  samplesPerUs_ = 0.048f;
+
+    // main() side
+    bool     synced_     = false;
+    uint32_t lastArrival_ = 0;
+    int32_t  offsetUs_   = 0;
+    uint32_t lastDueUs_  = 0;
+
+    SpscRing<Scheduled, 128> queue_;
+    SpscRing<Scheduled, 256> next_; // for the start of the next block
+    Stats                    stats_ = {};
+};
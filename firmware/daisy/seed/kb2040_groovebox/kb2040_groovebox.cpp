@@ -1,922 +1,806 @@
 #include "daisy_seed.h"
-#include "daisysp.h"
-#include "daisysp/modules/reverbsc.h"
-
-#include "midi_protocol.h"
-
+#include "fatfs.h"
+
+#include "audio_budget.h"
+#include "audio_config.h"
+#include "background.h"
+#include "governor.h"
+#include "groovebox_engine.h"
+#include "jitter_buffer.h"
+#include "meter.h"
 #include "midi_protocol.h"
+#include "spectrum.h"
+#include "midi_rx.h"
+#include "recorder.h"
+#include "smf_player.h"
+#include "trace.h"
 
-#include <cstdlib>
+#include <stdio.h>
+#include <string.h>
 
 using namespace daisy;
-using namespace daisysp;
 
 // ----------------------------------------------------------------------
 // Hardware
 // ----------------------------------------------------------------------
-DaisySeed       hw;
-MidiUartHandler midi;
+DaisySeed         hw;
+MidiUartTransport midiUart;
+MidiUsbTransport  midiUsb;
 
 // ----------------------------------------------------------------------
-// Synth config
+// The engine's only way in for MIDI. Its handlers can't interrupt each
+// other, so the audio callback is the only caller: the jitter buffer
+// (MIDI input, below) and the MIDI file player rendering inside it both
+// hand their messages here.
 // ----------------------------------------------------------------------
-static const int   kNumVoices       = 6;     // polyphony
-static const int   kNumDrumVoices   = 8;     // concurrent drum hits
-static const float kPitchBendRange  = 2.0f;  // +/- 2 semitones
-static const float kDetuneSemi      = 0.08f; // osc2 slight detune
-static const float kMaxFilterCutoff = 10000.0f;
-static const float kMinFilterCutoff = 80.0f;
-static const float kPi             = 3.14159265358979323846f;
-static const float kTwoPi          = 2.0f * kPi;
-
-enum InstrumentMode
-{
-    MODE_POLY_SYNTH = 0,
-    MODE_DRUM_KIT   = 1,
-};
+void EngineMidi(uint8_t status, uint8_t data0, uint8_t data1)
+{
+    TRACE(TRACE_HANDLER_BEGIN, status, data0 | data1 << 8);
+    HandleMidiMessage(status, data0, data1);
+    TRACE(TRACE_HANDLER_END, status, 0);
+}
 
-// Global parameters (control from KB2040 CCs)
-float g_masterGain    = 0.4f;   // CC7
-float g_cutoff        = 3000.0f; // Hz (CC70)
-float g_resonance     = 0.25f;  // 0..1 (CC71)
-float g_attack        = 0.01f;  // seconds (CC72)
-float g_decay         = 0.25f;  // seconds (CC73)
-float g_sustain       = 0.8f;   // 0..1 (CC74)
-float g_release       = 0.4f;   // seconds (CC75)
-float g_vibratoRate   = 5.0f;   // Hz (unused for drums)
-float g_vibratoDepth  = 0.25f;  // semitones, scaled by mod wheel (CC1)
-float g_modWheel      = 0.0f;   // 0..1
-float g_pitchBendSemi = 0.0f;   // -2..+2 semitones
-
-// FX parameters
-float g_delayTimeSec   = 0.35f; // CC77
-float g_delayFeedback  = 0.35f; // CC78
-float g_delayMix       = 0.25f; // CC79
-float g_reverbMix      = 0.25f; // CC80
-float g_reverbTime     = 0.65f; // CC81
-float g_bassBoost      = 0.6f;  // CC84
-float g_driveAmount    = 0.15f; // CC85
-float g_looperLevel    = 0.7f;  // CC92
-
-InstrumentMode g_instrMode = MODE_POLY_SYNTH; // CC90
-
-bool  g_sustainOn     = false;  // CC64 pedal
+// ----------------------------------------------------------------------
+// Background work (background.h): runs in main() between MIDI drains
+// ----------------------------------------------------------------------
+BgExecutor background;
+
+uint32_t BackgroundNowUs()
+{
+    return System::GetUs();
+}
 
 // ----------------------------------------------------------------------
-// Voice struct
+// Return line to the KB2040: level meters (meter.h) and, while its
+// analyzer page is open, spectrum frames (spectrum.h)
+//
+// Frames go out on USART1 TX (D13), wired to the KB2040's GP1 RX.
+// libDaisy's MIDI transport only has a blocking Tx(), and a frame is 6 to
+// 14 ms on the wire at 31250 baud, so a DMA stream feeds the data
+// register instead. main() starts a frame once the last one is out and
+// sleeps meanwhile; it notices at the next wakeup (an audio block at the
+// latest), a short gap next to the 33 ms between meter frames. Meter
+// frames go first; spectrum frames take what is left of the line (about
+// 40% of it at their rate).
+//
+// The spectrum FFT runs as a low-priority background job, a step at a
+// time, started every MidiSpectrum::FRAME_US. The audio callback only
+// feeds the tap.
 // ----------------------------------------------------------------------
-struct Voice
+MeterFrames      meters;
+SpectrumTap      spectrumTap;
+SpectrumAnalyzer spectrum;
+BgJob            spectrumJob;
+bool             spectrumOn     = false; // MidiCC::SPECTRUM
+uint32_t         spectrumNextUs = 0;
+
+// The longer of the two. D2 SRAM: uncached, and in DMA2's reach.
+uint8_t DMA_BUFFER_MEM_SECTION returnFrame[MidiSpectrum::FRAME_LEN];
+
+// The stream libDaisy's UART driver gives USART1 TX; MidiUartTransport
+// never starts it. DMA2 streams are DMAMUX1 channels 8-15.
+DMA_Stream_TypeDef* const     returnDma = DMA2_Stream4;
+DMAMUX_Channel_TypeDef* const returnMux = DMAMUX1_Channel12;
+
+// After midiUart.Init(), before its receive interrupts run
+void InitReturnLine()
 {
-    Oscillator osc1;
-    Oscillator osc2;
-    Adsr       env;
+    RCC->AHB1ENR |= RCC_AHB1ENR_DMA2EN;
+    returnDma->CR &= ~DMA_SxCR_EN;
+    while(returnDma->CR & DMA_SxCR_EN) {}
+    returnMux->CCR = DMA_REQUEST_USART1_TX;
+    returnDma->PAR = (uint32_t)&USART1->TDR;
+    returnDma->FCR = 0;                              // direct mode
+    returnDma->CR  = DMA_SxCR_DIR_0 | DMA_SxCR_MINC; // memory to peripheral, bytes
+    USART1->CR3 |= USART_CR3_DMAT;
+}
 
-    int   note;      // MIDI note number
-    bool  active;    // envelope still audible
-    bool  gate;      // what we feed into env.Process()
-    bool  keyDown;   // physical key state (from NoteOn/NoteOff)
-    float vel;       // 0..1
-};
+bool ReturnLineSending()
+{
+    return returnDma->CR & DMA_SxCR_EN; // cleared by the stream at the last byte
+}
+
+void SendReturnLine()
+{
+    if(ReturnLineSending())
+        return;
+    uint16_t len = 0;
+    if(meters.Take(returnFrame))
+        len = MidiMeter::FRAME_LEN;
+    else if(spectrum.Take(returnFrame))
+        len = MidiSpectrum::FRAME_LEN;
+    if(!len)
+        return;
+    DMA2->HIFCR = DMA_HIFCR_CTCIF4 | DMA_HIFCR_CHTIF4 | DMA_HIFCR_CTEIF4 | DMA_HIFCR_CDMEIF4
+                  | DMA_HIFCR_CFEIF4;
+    returnDma->M0AR = (uint32_t)returnFrame;
+    returnDma->NDTR = len;
+    __DSB(); // the frame is in SRAM before the stream reads it
+    returnDma->CR |= DMA_SxCR_EN;
+}
 
-Voice voices[kNumVoices];
-int   voiceRotate = 0; // for voice stealing
+bool SpectrumStep(void* ctx)
+{
+    return spectrum.Step(spectrumTap);
+}
 
-// Global filter and vibrato LFO
-Svf        g_filter;
-Oscillator g_vibrLfo;
+void StartSpectrum()
+{
+    uint32_t now = System::GetUs();
+    if(!spectrumOn || spectrumJob.queued || (int32_t)(now - spectrumNextUs) < 0)
+        return;
+    spectrumNextUs = now + MidiSpectrum::FRAME_US;
+    spectrum.Start();
+    background.Submit(&spectrumJob, BG_PRIORITY_LOW);
+}
 
-// Bass enhancement filter
-Svf g_bassFilter;
+// The KB2040 opening or closing its analyzer page
+bool IsSpectrumSwitch(const MidiRxEvent& e)
+{
+    if(e.status != (0xB0 | (MidiCh::SYNTH - 1)) || e.data0 != MidiCC::SPECTRUM)
+        return false;
+    spectrumOn = e.data1 >= 64;
+    return true;
+}
 
-// Delay / Reverb
-constexpr size_t kDelayBuffer = 48000 * 2; // up to ~2 seconds @48k
-DelayLine<float, kDelayBuffer> g_delayLine;
-size_t                         g_delaySamples = 48000 * 0.35f;
-ReverbSc                       g_reverb;
+// ----------------------------------------------------------------------
+// Recorder (recorder.h): master out to REC000.WAV, REC001.WAV, ... on the
+// SD card
+//
+// MidiCC::RECORD from the KB2040, or 'r' (24-bit) / 'R' (16-bit) over the
+// USB serial port, starts and stops a take. The ring holds about 29 s at
+// 24 bit and 48 kHz, far more than a card's worst write stall. Chunks go
+// out from a high-priority background job; FatFs writes block, so each
+// one holds main() for the few ms the card's DMA transfer takes, and the
+// MIDI queue holds what arrives meanwhile. The summary of a take goes to
+// the USB serial port when its file is closed.
+// ----------------------------------------------------------------------
+const uint32_t kRecordRingBytes = 8u << 20;
 
-// Looper (simple mono capture of post-FX signal)
-constexpr size_t kLooperMaxSeconds = 8;
-constexpr size_t kLooperMaxSamples = 48000 * kLooperMaxSeconds;
-float             g_looperL[kLooperMaxSamples];
-float             g_looperR[kLooperMaxSamples];
-size_t            g_looperWrite = 0;
-size_t            g_looperLength = 0;
-size_t            g_looperPlay = 0;
-bool              g_looperRecording = false;
-bool              g_looperPlaying   = false;
+uint8_t DSY_SDRAM_BSS recordRing[kRecordRingBytes];
 
-// Drum engine -----------------------------------------------------------
-struct SimpleEnv
-{
-    float value;
-    float decay;
+SdmmcHandler   sdmmc;
+FatFSInterface fatfs;
+bool           sdMounted = false;
 
-    void Init()
+class SdStorage : public RecorderStorage
+{
+  public:
+    bool Open(const char* name) override
     {
-        value = 0.0f;
-        decay = 0.999f;
+        return f_open(&file_, name, FA_CREATE_ALWAYS | FA_WRITE) == FR_OK;
     }
 
-    void Trigger(float amplitude, float seconds, float samplerate)
+    bool Write(const uint8_t* data, uint32_t bytes) override
     {
-        value = amplitude;
-        if(seconds < 0.001f)
-            seconds = 0.001f;
-        decay = expf(-1.0f / (seconds * samplerate));
+        UINT written = 0;
+        return f_write(&file_, data, bytes, &written) == FR_OK && written == bytes;
     }
 
-    float Process()
+    bool Rewrite(uint32_t offset, const uint8_t* data, uint32_t bytes) override
     {
-        float out = value;
-        value *= decay;
-        if(value < 1.0e-5f)
-            value = 0.0f;
-        return out;
+        FSIZE_t end     = f_tell(&file_);
+        UINT    written = 0;
+        return f_lseek(&file_, offset) == FR_OK
+               && f_write(&file_, data, bytes, &written) == FR_OK
+               && written == bytes && f_lseek(&file_, end) == FR_OK;
     }
 
-    bool Active() const { return value > 1.0e-4f; }
-};
+    bool Close() override { return f_close(&file_) == FR_OK; }
 
-enum DrumType
-{
-    DRUM_KICK = 0,
-    DRUM_SNARE,
-    DRUM_HAT_CLOSED,
-    DRUM_HAT_OPEN,
-    DRUM_TOM_LOW,
-    DRUM_TOM_HIGH,
-    DRUM_CLAP,
-    DRUM_PERC,
+  private:
+    FIL file_;
 };
 
-struct DrumVoice
-{
-    DrumType type;
-    SimpleEnv env;
-    SimpleEnv noiseEnv;
-    float     phase;
-    float     freq;
-    float     pitchScale;
-    float     pitchDecay;
-    float     velocity;
-    bool      active;
-};
+SdStorage     recordStorage;
+WavRecorder   recorder;
+BgJob         recordJob;
+char          recordName[16] = "";
+bool          recordReported = true;
+volatile int  recordRequest  = -1; // USB: 0 toggle 24-bit, 1 toggle 16-bit
 
-DrumVoice drumVoices[kNumDrumVoices];
-
-float g_samplerate = 48000.0f;
-
-// ----------------------------------------------------------------------
-// Helpers
-// ----------------------------------------------------------------------
-float CCNorm(uint8_t v)
+void MountSdCard()
 {
-    return (float)v / 127.0f;
+    SdmmcHandler::Config sd_config;
+    sd_config.Defaults();
+    sdmmc.Init(sd_config);
+    fatfs.Init(FatFSInterface::Config::MEDIA_SD);
+    sdMounted = f_mount(&fatfs.GetSDFileSystem(), fatfs.GetSDPath(), 1) == FR_OK;
 }
 
-float MidiToHzWithBend(int note, float extraSemi = 0.0f)
+bool RecordStep(void* ctx)
 {
-    float n = (float)note + g_pitchBendSemi + extraSemi;
-    return mtof(n);
+    return recorder.Service();
 }
 
-void UpdateEnvParams()
+void StartRecording(int bits)
 {
-    for(int i = 0; i < kNumVoices; i++)
+    if(recorder.Busy())
+        return;
+    recordName[0] = 0;
+    FILINFO info;
+    for(int n = 0; sdMounted && n < 1000; n++)
     {
-        voices[i].env.SetTime(ADSR_SEG_ATTACK,  g_attack);
-        voices[i].env.SetTime(ADSR_SEG_DECAY,   g_decay);
-        voices[i].env.SetTime(ADSR_SEG_RELEASE, g_release);
-        voices[i].env.SetSustainLevel(g_sustain);
+        snprintf(recordName, sizeof(recordName), "%sREC%03d.WAV", fatfs.GetSDPath(), n);
+        if(f_stat(recordName, &info) == FR_NO_FILE)
+            break;
+        recordName[0] = 0;
+    }
+    if(recordName[0] && recorder.Start(recordName, bits))
+    {
+        recordReported = false;
+        hw.PrintLine("rec %s: %d bit", recordName, bits);
+    }
+    else
+    {
+        hw.PrintLine("rec: %s", sdMounted ? "can't create a file" : "no SD card");
     }
 }
 
-void UpdateFilterParams()
-{
-    g_filter.SetFreq(g_cutoff);
-    g_filter.SetRes(g_resonance);
-}
-
-void UpdateDelayParams()
+void ServiceRecorder()
 {
-    size_t minDelay = (size_t)(0.02f * g_samplerate);
-    size_t maxDelay = (size_t)(1.0f * g_samplerate);
-    size_t target   = (size_t)(g_delayTimeSec * g_samplerate);
-    if(target < minDelay)
-        target = minDelay;
-    if(target > maxDelay)
-        target = maxDelay;
-    g_delaySamples = target;
-}
+    if(recordRequest >= 0)
+    {
+        int bits      = recordRequest ? 16 : 24;
+        recordRequest = -1;
+        if(recorder.Recording())
+            recorder.Stop();
+        else
+            StartRecording(bits);
+    }
+    if(recorder.Pending() && !recordJob.queued)
+        background.Submit(&recordJob, BG_PRIORITY_HIGH);
 
-void UpdateReverbParams()
-{
-    float fb = 0.2f + 0.75f * g_reverbTime;
-    if(fb > 0.95f)
-        fb = 0.95f;
-    g_reverb.SetFeedback(fb);
+    if(recorder.Busy() || recordReported)
+        return;
+    recordReported             = true;
+    const WavRecorder::Stats st = recorder.GetStats();
+    hw.PrintLine("rec %s: %lu ms, %lu writes, ring peak %lu%%, dropped %lu blocks%s",
+                 recordName,
+                 (unsigned long)(recorder.Seconds() * 1000.0f),
+                 (unsigned long)st.writes,
+                 (unsigned long)((uint64_t)st.maxFill * 100 / kRecordRingBytes),
+                 (unsigned long)st.droppedBlocks,
+                 st.writeError ? ", WRITE ERROR" : "");
 }
 
-void StopLooper()
+bool IsRecordSwitch(const MidiRxEvent& e)
 {
-    g_looperRecording = false;
-    g_looperPlaying   = false;
-    g_looperWrite     = 0;
-    g_looperLength    = 0;
-    g_looperPlay      = 0;
+    if(e.status != (0xB0 | (MidiCh::SYNTH - 1)) || e.data0 != MidiCC::RECORD)
+        return false;
+    if(e.data1 < 64)
+        recorder.Stop();
+    else if(!recorder.Recording())
+        StartRecording(e.data1 < 96 ? 16 : 24);
+    return true;
 }
 
-void StartLooperRecord()
-{
-    g_looperRecording = true;
-    g_looperPlaying   = false;
-    g_looperWrite     = 0;
-    g_looperLength    = 0;
-}
+// ----------------------------------------------------------------------
+// MIDI file player (smf_player.h)
+//
+// MidiCC::SMF_PLAY, or 'p' over the USB serial port (SONG000.MID if
+// there is a card, else the demo), plays a file to the engine through
+// the jitter buffer's renderer. The demo lives in the last MB of QSPI,
+// clear of the settings at the start; flash it with
+//   dfu-util -a 0 -s 0x90700000 -D demo.mid
+// The parser reads ahead from a high-priority background job.
+// ----------------------------------------------------------------------
+const uint32_t kDemoSmfAddress = 0x90700000; // QSPI, memory-mapped
+const uint32_t kDemoSmfBytes   = 1u << 20;
 
-void FinishLooperRecord()
+class QspiSmf : public SmfSource
 {
-    g_looperRecording = false;
-    if(g_looperWrite > 0)
+  public:
+    uint32_t Read(uint32_t offset, uint8_t* buf, uint32_t len) override
     {
-        g_looperLength = g_looperWrite;
-        g_looperPlay   = 0;
-        g_looperPlaying = true;
+        if(offset >= kDemoSmfBytes)
+            return 0;
+        if(len > kDemoSmfBytes - offset)
+            len = kDemoSmfBytes - offset;
+        memcpy(buf, (const uint8_t*)kDemoSmfAddress + offset, len);
+        return len;
     }
-}
-
-void ToggleLooperPlayback()
-{
-    if(g_looperLength == 0)
-        return;
-    g_looperPlaying = !g_looperPlaying;
-    if(g_looperPlaying)
-        g_looperPlay = 0;
-}
+};
 
-DrumVoice* FindDrumVoice()
+class SdSmf : public SmfSource
 {
-    for(int i = 0; i < kNumDrumVoices; i++)
+  public:
+    bool Open(const char* name)
     {
-        if(!drumVoices[i].active)
-            return &drumVoices[i];
+        Close();
+        open_ = f_open(&file_, name, FA_READ) == FR_OK;
+        return open_;
     }
-    return &drumVoices[0];
-}
 
-DrumType DrumTypeForNote(int note)
-{
-    switch(note)
+    void Close()
     {
-        case 36: return DRUM_KICK;
-        case 38: return DRUM_SNARE;
-        case 39: return DRUM_CLAP;
-        case 41: return DRUM_TOM_LOW;
-        case 43: return DRUM_TOM_LOW;
-        case 45: return DRUM_TOM_HIGH;
-        case 47: return DRUM_TOM_HIGH;
-        case 42: return DRUM_HAT_CLOSED;
-        case 44: return DRUM_HAT_CLOSED;
-        case 46: return DRUM_HAT_OPEN;
-        case 49: return DRUM_PERC;
-        case 51: return DRUM_PERC;
-        default: return DRUM_SNARE;
+        if(open_)
+            f_close(&file_);
+        open_ = false;
     }
-}
-
-void TriggerDrum(int note, float velocity)
-{
-    DrumVoice* v = FindDrumVoice();
-    v->type      = DrumTypeForNote(note);
-    v->env.Init();
-    v->noiseEnv.Init();
-    v->phase       = 0.0f;
-    v->velocity    = velocity;
-    v->pitchScale  = 1.0f;
-    v->pitchDecay  = 0.0f;
-    v->active      = true;
 
-    switch(v->type)
+    uint32_t Read(uint32_t offset, uint8_t* buf, uint32_t len) override
     {
-        case DRUM_KICK:
-            v->freq       = 55.0f + 40.0f * velocity;
-            v->pitchScale = 3.0f + 2.0f * velocity;
-            v->pitchDecay = 0.9994f;
-            v->env.Trigger(1.2f * velocity, 0.35f, g_samplerate);
-            v->noiseEnv.Trigger(0.4f * velocity, 0.05f, g_samplerate);
-            break;
-        case DRUM_SNARE:
-            v->freq       = 180.0f + 80.0f * velocity;
-            v->pitchScale = 1.0f;
-            v->pitchDecay = 1.0f;
-            v->env.Trigger(0.9f * velocity, 0.25f, g_samplerate);
-            v->noiseEnv.Trigger(0.8f * velocity, 0.18f, g_samplerate);
-            break;
-        case DRUM_HAT_CLOSED:
-            v->freq       = 6000.0f;
-            v->pitchScale = 1.0f;
-            v->pitchDecay = 1.0f;
-            v->env.Trigger(0.6f * velocity, 0.08f, g_samplerate);
-            v->noiseEnv.Trigger(0.7f * velocity, 0.05f, g_samplerate);
-            break;
-        case DRUM_HAT_OPEN:
-            v->freq       = 5500.0f;
-            v->pitchScale = 1.0f;
-            v->pitchDecay = 1.0f;
-            v->env.Trigger(0.6f * velocity, 0.25f, g_samplerate);
-            v->noiseEnv.Trigger(0.7f * velocity, 0.20f, g_samplerate);
-            break;
-        case DRUM_TOM_LOW:
-            v->freq       = 110.0f + 30.0f * velocity;
-            v->pitchScale = 1.8f;
-            v->pitchDecay = 0.9996f;
-            v->env.Trigger(1.0f * velocity, 0.4f, g_samplerate);
-            v->noiseEnv.Trigger(0.4f * velocity, 0.12f, g_samplerate);
-            break;
-        case DRUM_TOM_HIGH:
-            v->freq       = 180.0f + 60.0f * velocity;
-            v->pitchScale = 1.6f;
-            v->pitchDecay = 0.9995f;
-            v->env.Trigger(0.9f * velocity, 0.3f, g_samplerate);
-            v->noiseEnv.Trigger(0.4f * velocity, 0.1f, g_samplerate);
-            break;
-        case DRUM_CLAP:
-            v->freq       = 800.0f;
-            v->pitchScale = 1.0f;
-            v->pitchDecay = 1.0f;
-            v->env.Trigger(0.8f * velocity, 0.18f, g_samplerate);
-            v->noiseEnv.Trigger(1.0f * velocity, 0.12f, g_samplerate);
-            break;
-        case DRUM_PERC:
-        default:
-            v->freq       = 430.0f;
-            v->pitchScale = 1.2f;
-            v->pitchDecay = 0.9996f;
-            v->env.Trigger(0.7f * velocity, 0.22f, g_samplerate);
-            v->noiseEnv.Trigger(0.7f * velocity, 0.18f, g_samplerate);
-            break;
+        UINT got = 0;
+        if(!open_ || f_lseek(&file_, offset) != FR_OK
+           || f_read(&file_, buf, len, &got) != FR_OK)
+            return 0;
+        return got;
     }
-}
-
-float ProcessDrums()
-{
-    float out = 0.0f;
-    for(int i = 0; i < kNumDrumVoices; i++)
-    {
-        DrumVoice& v = drumVoices[i];
-        if(!v.active)
-            continue;
-
-        float envOut = v.env.Process();
-        float noiseOut = v.noiseEnv.Process();
-
-        if(envOut <= 0.0f && noiseOut <= 0.0f)
-        {
-            v.active = false;
-            continue;
-        }
 
-        float tone = 0.0f;
-        if(v.type == DRUM_HAT_CLOSED || v.type == DRUM_HAT_OPEN || v.type == DRUM_CLAP)
-        {
-            tone = 0.0f;
-        }
-        else
-        {
-            v.phase += (v.freq * v.pitchScale) / g_samplerate;
-            if(v.phase >= 1.0f)
-                v.phase -= 1.0f;
-            tone = sinf(kTwoPi * v.phase);
-            v.pitchScale *= v.pitchDecay;
-            if(v.pitchScale < 1.0f)
-                v.pitchScale = 1.0f;
-        }
+  private:
+    FIL  file_;
+    bool open_ = false;
+};
 
-        float noise = ((float)rand() / (float)RAND_MAX) * 2.0f - 1.0f;
+SmfPlayer     smf;
+BgJob         smfJob;
+QspiSmf       demoSmf;
+SdSmf         songSmf;
+int           songRequest       = -1; // -1 none, 0 the demo, n + 1 SONGnnn.MID
+volatile bool smfToggleRequested = false; // USB 'p'
 
-        float mix = 0.0f;
-        switch(v.type)
-        {
-            case DRUM_KICK:
-                mix = tone * envOut + 0.2f * noise * noiseOut;
-                break;
-            case DRUM_SNARE:
-                mix = 0.35f * tone * envOut + noise * noiseOut;
-                break;
-            case DRUM_HAT_CLOSED:
-            case DRUM_HAT_OPEN:
-                mix = noise * (0.6f * envOut + 0.9f * noiseOut);
-                break;
-            case DRUM_TOM_LOW:
-            case DRUM_TOM_HIGH:
-                mix = 0.8f * tone * envOut + 0.3f * noise * noiseOut;
-                break;
-            case DRUM_CLAP:
-                mix = noise * (0.5f * envOut + 1.1f * noiseOut);
-                break;
-            case DRUM_PERC:
-            default:
-                mix = 0.5f * tone * envOut + 0.6f * noise * noiseOut;
-                break;
-        }
+void SmfRender(float** out, size_t size)
+{
+    smf.Render(out, size);
+}
 
-        out += mix * v.velocity;
-        v.active = v.active && (v.env.Active() || v.noiseEnv.Active());
-    }
-    return out;
+bool SmfFillStep(void* ctx)
+{
+    return smf.Fill();
 }
 
-// ----------------------------------------------------------------------
-// Voice allocation with keyDown + sustain-aware gate handling
-// ----------------------------------------------------------------------
-Voice* FindExistingVoiceForNote(int note)
+void PlaySong(int song)
 {
-    for(int i = 0; i < kNumVoices; i++)
+    SmfPlayer::Config config;
+    config.handle = EngineMidi;
+    char              name[24];
+    bool              loaded;
+    if(song == 0)
     {
-        if(voices[i].note == note && (voices[i].active || voices[i].keyDown))
-            return &voices[i];
+        snprintf(name, sizeof(name), "demo");
+        loaded = smf.Load(&demoSmf, hw.AudioSampleRate(), config);
     }
-    return nullptr;
+    else
+    {
+        snprintf(name, sizeof(name), "%sSONG%03d.MID", fatfs.GetSDPath(), song - 1);
+        loaded = sdMounted && songSmf.Open(name)
+                 && smf.Load(&songSmf, hw.AudioSampleRate(), config);
+    }
+    if(loaded && smf.Play())
+        hw.PrintLine("smf %s: playing", name);
+    else
+        hw.PrintLine("smf %s: not a playable MIDI file", name);
 }
 
-Voice* FindIdleVoice()
+// A new song waits for the callback to let go of the last one
+void ServicePlayer()
 {
-    for(int i = 0; i < kNumVoices; i++)
+    if(smfToggleRequested)
     {
-        if(!voices[i].active && !voices[i].keyDown)
-            return &voices[i];
+        smfToggleRequested = false;
+        if(smf.Busy())
+            smf.Stop();
+        else
+            songRequest = sdMounted ? 1 : 0;
     }
-    return nullptr;
+    if(songRequest >= 0 && !smf.Busy())
+    {
+        PlaySong(songRequest);
+        songRequest = -1;
+    }
+    if(smf.NeedsFill() && !smfJob.queued)
+        background.Submit(&smfJob, BG_PRIORITY_HIGH);
 }
 
-Voice* StealVoice()
+bool IsPlayerSwitch(const MidiRxEvent& e)
 {
-    Voice* v = &voices[voiceRotate];
-    voiceRotate = (voiceRotate + 1) % kNumVoices;
-
-    v->active  = false;
-    v->gate    = false;
-    v->keyDown = false;
-    v->vel     = 0.0f;
+    if(e.status != (0xB0 | (MidiCh::SYNTH - 1)) || e.data0 != MidiCC::SMF_PLAY)
+        return false;
+    smf.Stop();
+    songRequest = e.data1 < 64 ? -1 : e.data1 - 64;
+    return true;
+}
 
-    return v;
+// ----------------------------------------------------------------------
+// Trace (trace.h)
+//
+// Records from boot. Sending 'd' over the USB serial port dumps the ring;
+// recording pauses for the dump and then carries on. After an overrun the
+// ring stops by itself half a ring later and keeps the glitch until the
+// next dump. firmware/host trace_decode reads the dump.
+// ----------------------------------------------------------------------
+uint32_t TraceNow()
+{
+    return DWT->CYCCNT;
 }
 
-Voice* AllocateVoiceForNote(int note)
+void StartCycleCounter()
 {
-    // If we already have this note, reuse that voice
-    Voice* v = FindExistingVoiceForNote(note);
-    if(v)
-        return v;
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->LAR = 0xC5ACCE55; // Cortex-M7 lock access key
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
 
-    // Otherwise find an idle one
-    v = FindIdleVoice();
-    if(v)
-        return v;
+TraceDumper   traceDumper;
+BgJob         traceDumpJob;
+volatile bool traceDumpRequested = false;
 
-    // Otherwise steal one
-    return StealVoice();
+void PrintTraceLine(const char* line, void* ctx)
+{
+    hw.PrintLine("%s", line);
 }
 
-// ----------------------------------------------------------------------
-// MIDI handlers
-// ----------------------------------------------------------------------
-void HandleNoteOn(uint8_t channel, uint8_t note, uint8_t velocity)
+bool DumpTrace(void* ctx)
 {
-    if(channel != MidiCh::SYNTH)
-        return;
+    if(!traceDumper.Step(PrintTraceLine, nullptr, 8))
+        return false;
+    g_trace.Resume();
+    return true;
+}
 
-    if(velocity == 0)
-    {
-        // NoteOn with vel=0 is NoteOff
-        for(int i = 0; i < kNumVoices; i++)
-        {
-            if(voices[i].note == note && voices[i].keyDown)
-            {
-                voices[i].keyDown = false;
-                if(!g_sustainOn)
-                    voices[i].gate = false;
-            }
-        }
+void StartTraceDump()
+{
+    traceDumpRequested = false;
+    if(traceDumpJob.queued)
         return;
-    }
-
-    float vel = (float)velocity / 127.0f;
+    TRACE(TRACE_DUMP, 0, 0);
+    g_trace.Stop();
+    traceDumper.Start(&g_trace, SystemCoreClock);
+    background.Submit(&traceDumpJob, BG_PRIORITY_LOW);
+}
 
-    if(g_instrMode == MODE_DRUM_KIT)
-    {
-        TriggerDrum(note, vel);
-        return;
-    }
+// ----------------------------------------------------------------------
+// Audio budget (audio_budget.h)
+//
+// Stack high-water mark, the longest callback per engine feature
+// combination and the spectrum job's step and frame cost. 's' over the
+// USB serial port prints them; 'w' clears the execution-time table.
+// "make stack-report" gives the static picture.
+// ----------------------------------------------------------------------
+extern uint32_t _estack; // linker script: top of the main stack
+extern uint32_t _end;    // linker script: end of .bss, start of the heap
 
-    Voice* v = AllocateVoiceForNote(note);
-    if(!v)
-        return;
+const uint32_t kStackWatchBytes = 16384;
 
-    v->note    = note;
-    v->vel     = vel;
-    v->keyDown = true;
-    v->gate    = true;
-    v->active  = true;
+const char* const kQualityNames[QUALITY_NUM_LEVELS] = {
+    "full", "shed_tails", "single_osc", "cheap_fx", "min_voices"};
 
-    // Base pitch with bend + detune
-    float baseHz  = MidiToHzWithBend(note, 0.0f);
-    float detuneH = MidiToHzWithBend(note, kDetuneSemi);
+StackMonitor  stackMonitor;
+WcetTable     wcet;
+float         blockPeriodUs = 1000.0f;
+BgJob         budgetJob;
+volatile bool budgetRequested = false;
+volatile bool wcetResetRequested = false;
+int           budgetLine = 0; // next line of the page, then table keys
 
-    v->osc1.SetFreq(baseHz);
-    v->osc2.SetFreq(detuneH);
+// Paints what main() isn't using yet of the top kStackWatchBytes
+void PaintStack()
+{
+    uint32_t* top    = &_estack;
+    uint32_t* bottom = top - kStackWatchBytes / 4;
+    uint32_t* end    = &_end;
+    if(end > bottom && end < top) // .bss shares the stack's RAM
+        bottom = end;
+    uint32_t* limit = (uint32_t*)(uintptr_t)__get_MSP() - 64; // clear of main()'s frame
+    __disable_irq();
+    stackMonitor.Paint(bottom, limit, top);
+    __enable_irq();
 }
 
-void HandleNoteOff(uint8_t channel, uint8_t note, uint8_t velocity)
+// One line of the page per call; the table has a line per combination seen
+bool PrintBudgetLine()
 {
-    if(channel != MidiCh::SYNTH)
-        return;
-
-    if(g_instrMode == MODE_DRUM_KIT)
+    if(budgetLine == 0)
     {
-        return;
+        hw.PrintLine("# audio budget");
     }
-    // Turn off *all* voices with this note whose key is down.
-    for(int i = 0; i < kNumVoices; i++)
+    else if(budgetLine == 1)
     {
-        if(voices[i].note == note && voices[i].keyDown)
+        uint32_t high  = stackMonitor.HighWater();
+        uint32_t entry = stackMonitor.EntryDepth();
+        hw.PrintLine("stack   high-water %lu B of %lu watched%s, callback entered at "
+                     "%lu B (callback ~%lu B)",
+                     (unsigned long)high,
+                     (unsigned long)stackMonitor.Watched(),
+                     stackMonitor.Exhausted() ? " (EXHAUSTED)" : "",
+                     (unsigned long)entry,
+                     (unsigned long)(high > entry ? high - entry : 0));
+    }
+    else if(budgetLine == 2)
+    {
+        // Ticks are CPU cycles (TraceNow)
+        const SpectrumAnalyzer::Stats& st = spectrum.GetStats();
+        float usPerTick = 1e6f / (float)SystemCoreClock;
+        hw.PrintLine("fft     %d points %s, %lu frames, %lu steps each: worst step "
+                     "%lu us, frame %lu us (worst %lu us)",
+                     spectrum.Size(),
+                     spectrumOn ? "on" : "off",
+                     (unsigned long)st.frames,
+                     (unsigned long)st.stepsPerFrame,
+                     (unsigned long)(st.maxStepTicks * usPerTick),
+                     (unsigned long)(st.lastFrameTicks * usPerTick),
+                     (unsigned long)(st.maxFrameTicks * usPerTick));
+    }
+    else if(budgetLine == 3)
+    {
+        hw.PrintLine("period  %lu us; worst callback per feature combination:",
+                     (unsigned long)blockPeriodUs);
+        hw.PrintLine("voices drums looper quality        blocks   max us  of period");
+    }
+    else
+    {
+        int key = budgetLine - 4;
+        while(key < WcetTable::kKeys && !wcet.At((uint8_t)key).blocks)
+            key++;
+        if(key >= WcetTable::kKeys)
         {
-            voices[i].keyDown = false;
-            if(!g_sustainOn)
-                voices[i].gate = false;
+            hw.PrintLine("# end");
+            return true;
         }
+        static const char* const kVoices[] = {"0", "1-2", "3-4", "5-6"};
+        const WcetTable::Entry&  e       = wcet.At((uint8_t)key);
+        uint8_t                  quality = key >> FEATURE_QUALITY_SHIFT;
+        float us = (float)e.maxTicks * 1e6f / (float)SystemCoreClock;
+        hw.PrintLine("%-6s %-5s %-6s %-12s %8lu %8lu %8lu%%",
+                     kVoices[key & FEATURE_VOICES_MASK],
+                     key & FEATURE_DRUMS ? "yes" : "-",
+                     key & FEATURE_LOOPER ? "yes" : "-",
+                     quality < QUALITY_NUM_LEVELS ? kQualityNames[quality] : "?",
+                     (unsigned long)e.blocks,
+                     (unsigned long)us,
+                     (unsigned long)(100.0f * us / blockPeriodUs));
+        budgetLine = key + 4;
     }
+    budgetLine++;
+    return false;
 }
 
-void HandleCC(uint8_t channel, uint8_t cc, uint8_t val)
+bool PrintBudget(void* ctx)
 {
-    if(channel != MidiCh::SYNTH)
-        return;
-
-    float n = CCNorm(val);
-
-    switch(cc)
-    {
-        case MidiCC::VOLUME:
-            g_masterGain = powf(n, 1.5f); // nicer taper
-            break;
-
-        case MidiCC::CUTOFF:
-        {
-            float t = n * n; // more resolution at low freqs
-            g_cutoff = kMinFilterCutoff
-                       * powf(kMaxFilterCutoff / kMinFilterCutoff, t);
-            UpdateFilterParams();
-        }
-        break;
-
-        case MidiCC::RESONANCE:
-            g_resonance = 0.1f + 0.9f * n; // 0.1..1.0
-            UpdateFilterParams();
-            break;
-
-        case MidiCC::ATTACK:
-            g_attack = 0.001f + 2.0f * n; // 1ms..2s
-            UpdateEnvParams();
-            break;
-
-        case MidiCC::DECAY:
-            g_decay = 0.01f + 3.0f * n; // 10ms..3s
-            UpdateEnvParams();
-            break;
-
-        case MidiCC::SUSTAIN:
-            g_sustain = n; // 0..1
-            UpdateEnvParams();
-            break;
-
-        case MidiCC::RELEASE:
-            g_release = 0.02f + 4.0f * n; // 20ms..4s
-            UpdateEnvParams();
-            break;
-
-        case MidiCC::DELAY_TIME:
-            g_delayTimeSec = 0.02f + 0.98f * n;
-            UpdateDelayParams();
-            break;
-
-        case MidiCC::DELAY_FEEDBACK:
-            g_delayFeedback = 0.02f + 0.9f * n;
-            if(g_delayFeedback > 0.95f)
-                g_delayFeedback = 0.95f;
-            break;
-
-        case MidiCC::DELAY_MIX:
-            g_delayMix = n;
-            break;
-
-        case MidiCC::REVERB_MIX:
-            g_reverbMix = n;
-            break;
-
-        case MidiCC::REVERB_TIME:
-            g_reverbTime = n;
-            UpdateReverbParams();
-            break;
-
-        case MidiCC::BASS_BOOST:
-            g_bassBoost = n;
-            break;
-
-        case MidiCC::DRIVE:
-            g_driveAmount = n;
-            break;
-
-        case MidiCC::LOOPER_LEVEL:
-            g_looperLevel = n;
-            break;
-
-        case MidiCC::VIBRATO_RATE:
-            g_vibratoRate = 0.1f + 8.0f * n; // 0.1..8 Hz
-            g_vibrLfo.SetFreq(g_vibratoRate);
-            break;
-
-        case MidiCC::MODWHEEL:
-            g_modWheel = n; // 0..1, scales vibrato depth
-            break;
-
-        case MidiCC::SUSTAIN_PEDAL:
-        {
-            bool newSustain = (val >= 64);
-            if(newSustain && !g_sustainOn)
-            {
-                g_sustainOn = true;
-            }
-            else if(!newSustain && g_sustainOn)
-            {
-                g_sustainOn = false;
-                // Pedal released: any voices with keyUp but gate still on now release
-                for(int i = 0; i < kNumVoices; i++)
-                {
-                    if(!voices[i].keyDown && voices[i].gate)
-                        voices[i].gate = false;
-                }
-            }
-        }
-        break;
-
-        case MidiCC::INSTRUMENT_MODE:
-            g_instrMode = (val >= 64) ? MODE_DRUM_KIT : MODE_POLY_SYNTH;
-            break;
-
-        case MidiCC::LOOPER_CONTROL:
-            if(val < 20)
-            {
-                StopLooper();
-            }
-            else if(val < 80)
-            {
-                if(!g_looperRecording)
-                    StartLooperRecord();
-                else
-                    FinishLooperRecord();
-            }
-            else
-            {
-                ToggleLooperPlayback();
-            }
-            break;
-
-        default: break;
-    }
+    for(int i = 0; i < 8; i++)
+        if(PrintBudgetLine())
+            return true;
+    return false;
 }
 
-void HandlePitchBend(uint8_t channel, uint8_t lsb, uint8_t msb)
+void StartBudgetPage()
 {
-    if(channel != MidiCh::SYNTH)
+    budgetRequested = false;
+    if(budgetJob.queued)
         return;
+    budgetLine = 0;
+    background.Submit(&budgetJob, BG_PRIORITY_LOW);
+}
 
-    // 14-bit value 0..16383, center 8192
-    uint16_t value14  = ((uint16_t)msb << 7) | (uint16_t)lsb;
-    int      centered = (int)value14 - 8192; // -8192..+8191
-
-    // Deadzone around center so tiny joystick offsets don't leave
-    // the synth slightly out of tune forever.
-    const int dead = 256; // about 1.5% of the range
-    if(centered > -dead && centered < dead)
+// ----------------------------------------------------------------------
+// USB serial commands: d = trace dump, s = audio budget, w = clear the
+// execution-time table, r / R = start or stop a 24 / 16-bit recording,
+// p = play or stop a MIDI file
+// ----------------------------------------------------------------------
+// USB interrupt
+void UsbRxCallback(uint8_t* buf, uint32_t* len)
+{
+    for(uint32_t i = 0; i < *len; i++)
     {
-        g_pitchBendSemi = 0.0f; // snap perfectly back to in tune
-        return;
+        if(buf[i] == 'd')
+            traceDumpRequested = true;
+        else if(buf[i] == 's')
+            budgetRequested = true;
+        else if(buf[i] == 'w')
+            wcetResetRequested = true;
+        else if(buf[i] == 'r' || buf[i] == 'R')
+            recordRequest = buf[i] == 'R';
+        else if(buf[i] == 'p')
+            smfToggleRequested = true;
     }
+}
 
-    float norm = (float)centered / 8192.0f; // -1..+1
-    if(norm > 1.0f)
-        norm = 1.0f;
-    if(norm < -1.0f)
-        norm = -1.0f;
-
-    g_pitchBendSemi = norm * kPitchBendRange;
+bool UsbCommandPending()
+{
+    return traceDumpRequested || budgetRequested || wcetResetRequested;
 }
 
-void ProcessMidi()
+void RunUsbCommands()
 {
-    midi.Listen();
-    while(midi.HasEvents())
+    if(traceDumpRequested)
+        StartTraceDump();
+    if(budgetRequested)
+        StartBudgetPage();
+    if(wcetResetRequested)
     {
-        auto msg = midi.PopEvent();
-        using MType = MidiMessageType;
-
-        switch(msg.type)
-        {
-            case MType::NoteOn:
-                HandleNoteOn(msg.channel, msg.data[0], msg.data[1]);
-                break;
-
-            case MType::NoteOff:
-                HandleNoteOff(msg.channel, msg.data[0], msg.data[1]);
-                break;
-
-            case MType::ControlChange:
-                HandleCC(msg.channel, msg.data[0], msg.data[1]);
-                break;
-
-            case MType::PitchBend:
-                HandlePitchBend(msg.channel, msg.data[0], msg.data[1]);
-                break;
-
-            default: break;
-        }
+        wcetResetRequested = false;
+        wcet.Reset();
     }
 }
 
 // ----------------------------------------------------------------------
-// Audio callback
+// Audio settings
+//
+// Block size and sample rate (audio_config.h): read at boot, changed by
+// the AUDIO_* controllers, used from the next boot
 // ----------------------------------------------------------------------
-void AudioCallback(AudioHandle::InputBuffer  in,
-                   AudioHandle::OutputBuffer out,
-                   size_t                    size)
-{
-    float vibrDepth = g_vibratoDepth * g_modWheel; // semitones
+PersistentStorage<AudioConfig> audioSettings(hw.qspi);
 
-    for(size_t i = 0; i < size; i++)
-    {
-        float dry = 0.0f;
+// Writing QSPI flash blocks for the sector erase (tens of ms); the MIDI
+// queue holds what arrives meanwhile. Save() skips the write if the
+// flash copy already matches.
+bool SaveAudioSettings(void* ctx)
+{
+    audioSettings.Save();
+    return true;
+}
 
-        // Vibrato LFO (mono, -1..+1)
-        float vibr = g_vibrLfo.Process();
+BgJob saveAudioJob;
 
-        for(int v = 0; v < kNumVoices; v++)
-        {
-            Voice& voice = voices[v];
+SaiHandle::Config::SampleRate SaiRate(uint32_t hz)
+{
+    switch(hz)
+    {
+        case 32000: return SaiHandle::Config::SampleRate::SAI_32KHZ;
+        case 96000: return SaiHandle::Config::SampleRate::SAI_96KHZ;
+        default: return SaiHandle::Config::SampleRate::SAI_48KHZ;
+    }
+}
 
-            // Skip truly idle voices
-            if(!voice.active && !voice.keyDown && !voice.gate)
-                continue;
+bool IsAudioSetting(const MidiRxEvent& e)
+{
+    if(e.status != (0xB0 | (MidiCh::SYNTH - 1))
+       || !audioSettings.GetSettings().ApplyCC(e.data0, e.data1))
+        return false;
+    background.Submit(&saveAudioJob, BG_PRIORITY_LOW);
+    return true;
+}
 
-            float envOut = voice.env.Process(voice.gate);
+// ----------------------------------------------------------------------
+// MIDI input
+//
+// Two sources: the KB2040 on the UART, and a computer (a DAW sequencing
+// the groovebox) on USB MIDI. Each receive callback (an interrupt) parses
+// bytes as they land and queues messages tagged with their source;
+// main() takes them from both in arrival order (midi_rx.h) and sleeps
+// while the queues are empty. main() never calls the engine: every
+// message for it goes through the jitter buffer, which the audio
+// callback drains. Messages with a KB2040 send stamp play at stamp + a
+// fixed latency, the rest at the start of the next block. If the jitter
+// buffer has no room, main() holds the message until a block has taken
+// some.
+//
+// The Daisy's own controllers (IsForeignDaisyCommand()) are taken from
+// the UART only; main() drops a computer's before they reach anything.
+//
+// USB MIDI is on the external USB pins (D29/D30): the on-board port is
+// the serial log and command line.
+// ----------------------------------------------------------------------
+const uint16_t kUartMidiChannels = 0xFFFF;
+const uint16_t kUsbMidiChannels  = 0xFFFF;
 
-            // If envelope is fully released and there is no key or gate,
-            // mark as inactive.
-            if(!voice.gate && !voice.keyDown && envOut < 0.0001f)
-            {
-                voice.active = false;
-                continue;
-            }
+MidiMergeQueue<256> midiQueue;
+MidiRxDecoder       midiDecoders[MIDI_NUM_SOURCES]; // each by its callback only
+JitterBuffer        jitter;
+MidiRxEvent         heldMidi; // refused by the jitter buffer; main() only
+bool                midiHeld = false;
 
-            // Pitch with bend + vibrato
-            float bendSemi = g_pitchBendSemi + (vibr * vibrDepth);
-            float note     = (float)voice.note + bendSemi;
-            float baseHz   = mtof(note);
-            float detuneHz = mtof(note + kDetuneSemi);
+void ParseMidi(MidiSource source, const uint8_t* data, size_t size)
+{
+    uint32_t    now = System::GetUs();
+    MidiRxEvent e;
+    for(size_t i = 0; i < size; i++)
+        if(midiDecoders[source].Feed(data[i], now, e))
+        {
+            bool queued = midiQueue.Push(source, e);
+            if(queued || midiQueue.Accepts(source, e.status))
+                TRACE(queued ? TRACE_MIDI_RX : TRACE_MIDI_DROP, e.status, e.data0 | e.data1 << 8);
+        }
+}
 
-            voice.osc1.SetFreq(baseHz);
-            voice.osc2.SetFreq(detuneHz);
+void MidiRxCallback(uint8_t* data, size_t size, void* context)
+{
+    ParseMidi(MIDI_SOURCE_UART, data, size);
+}
 
-            float sig = (voice.osc1.Process() + voice.osc2.Process()) * 0.5f;
-            sig *= envOut * voice.vel;
+void UsbMidiRxCallback(uint8_t* data, size_t size, void* context)
+{
+    ParseMidi(MIDI_SOURCE_USB, data, size);
+}
 
-            dry += sig;
-        }
+void StartMidiRx()
+{
+    midiDecoders[MIDI_SOURCE_UART] = MidiRxDecoder();
+    midiUart.FlushRx();
+    midiUart.StartRx(MidiRxCallback, nullptr);
+}
 
-        float drum = ProcessDrums();
-        if(g_instrMode == MODE_DRUM_KIT)
-        {
-            dry += drum;
-        }
+void StartUsbMidiRx()
+{
+    midiDecoders[MIDI_SOURCE_USB] = MidiRxDecoder();
+    midiUsb.FlushRx();
+    midiUsb.StartRx(UsbMidiRxCallback, nullptr);
+}
 
-        // Global filter
-        g_filter.Process(dry);
-        float filtered = g_filter.Low();
-
-        // Bass boost: add boosted low frequencies
-        g_bassFilter.Process(filtered);
-        float low     = g_bassFilter.Low();
-        float bassMix = filtered + low * g_bassBoost;
-
-        // Drive / saturation
-        float driveGain = 1.0f + g_driveAmount * 6.0f;
-        float driven    = tanhf(bassMix * driveGain);
-
-        // Delay
-        g_delayLine.SetDelay(g_delaySamples);
-        float delayOut = g_delayLine.Read();
-        float delayIn  = driven + delayOut * g_delayFeedback;
-        g_delayLine.Write(delayIn);
-        float delayMix = (1.0f - g_delayMix) * driven + g_delayMix * delayOut;
-
-        // Reverb (stereo)
-        float revL, revR;
-        g_reverb.Process(delayMix, delayMix, &revL, &revR);
-        float wetL = (1.0f - g_reverbMix) * delayMix + g_reverbMix * revL;
-        float wetR = (1.0f - g_reverbMix) * delayMix + g_reverbMix * revR;
-
-        // Looper record/playback on post-FX signal
-        if(g_looperRecording && g_looperWrite < kLooperMaxSamples)
-        {
-            g_looperL[g_looperWrite] = wetL;
-            g_looperR[g_looperWrite] = wetR;
-            g_looperWrite++;
-        }
-        else if(g_looperRecording && g_looperWrite >= kLooperMaxSamples)
+void ProcessMidi()
+{
+    // The UART disables itself on an error (usually overrun); restart it
+    if(!midiUart.RxActive())
+        StartMidiRx();
+    if(!midiUsb.RxActive())
+        StartUsbMidiRx();
+
+    MidiRxEvent e;
+    for(;;)
+    {
+        if(midiHeld)
         {
-            FinishLooperRecord();
+            e        = heldMidi;
+            midiHeld = false;
         }
-
-        if(g_looperPlaying && g_looperLength > 0)
+        else if(!midiQueue.Pop(e))
+            break;
+        else if(IsForeignDaisyCommand(e))
+            continue;
+        else if(IsAudioSetting(e) || IsSpectrumSwitch(e) || IsRecordSwitch(e)
+                || IsPlayerSwitch(e))
+            continue;
+        if(!jitter.Push(e))
         {
-            wetL += g_looperL[g_looperPlay] * g_looperLevel;
-            wetR += g_looperR[g_looperPlay] * g_looperLevel;
-            g_looperPlay++;
-            if(g_looperPlay >= g_looperLength)
-                g_looperPlay = 0;
+            heldMidi = e;
+            midiHeld = true;
+            break;
         }
-
-        // Simple mono out to both channels
-        out[0][i] = wetL * g_masterGain;
-        out[1][i] = wetR * g_masterGain;
     }
 }
 
 // ----------------------------------------------------------------------
-// Init
+// Audio callback
+//
+// Each block's render time, as a fraction of the block period, feeds the
+// CPU governor, which sets the engine quality for the next block.
+//
+// A block that took longer than its period means the next callback was
+// due while it still ran; that one starts late and traces the overrun.
 // ----------------------------------------------------------------------
-void InitSynth(float samplerate)
-{
-    srand(0x1234);
-
-    g_samplerate = samplerate;
+CpuGovernor governor;
+float       samplesPerUs = 0.048f; // block period = size / samplesPerUs
+uint32_t    overrunUs    = 0;      // the last block ran this far past its period
 
-    for(int i = 0; i < kNumVoices; i++)
-    {
-        voices[i].osc1.Init(samplerate);
-        voices[i].osc1.SetWaveform(Oscillator::WAVE_SAW);
-        voices[i].osc1.SetAmp(0.6f);
-
-        voices[i].osc2.Init(samplerate);
-        voices[i].osc2.SetWaveform(Oscillator::WAVE_TRI);
-        voices[i].osc2.SetAmp(0.6f);
-
-        voices[i].env.Init(samplerate);
-        voices[i].env.SetTime(ADSR_SEG_ATTACK,  g_attack);
-        voices[i].env.SetTime(ADSR_SEG_DECAY,   g_decay);
-        voices[i].env.SetTime(ADSR_SEG_RELEASE, g_release);
-        voices[i].env.SetSustainLevel(g_sustain);
-
-        voices[i].note    = 60;
-        voices[i].active  = false;
-        voices[i].gate    = false;
-        voices[i].keyDown = false;
-        voices[i].vel     = 0.0f;
-    }
-
-    g_filter.Init(samplerate);
-    g_filter.SetDrive(0.0f);
-    UpdateFilterParams();
-
-    g_vibrLfo.Init(samplerate);
-    g_vibrLfo.SetWaveform(Oscillator::WAVE_SIN);
-    g_vibrLfo.SetFreq(g_vibratoRate);
-    g_vibrLfo.SetAmp(1.0f);
-
-    g_bassFilter.Init(samplerate);
-    g_bassFilter.SetFreq(150.0f);
-    g_bassFilter.SetRes(0.5f);
-
-    g_delayLine.Init();
-    UpdateDelayParams();
-
-    g_reverb.Init(samplerate);
-    UpdateReverbParams();
-
-    StopLooper();
-
-    for(int i = 0; i < kNumDrumVoices; i++)
+void AudioCallback(AudioHandle::InputBuffer  in,
+                   AudioHandle::OutputBuffer out,
+                   size_t                    size)
+{
+    uint32_t start  = System::GetUs();
+    uint32_t cycles = TraceNow();
+    stackMonitor.NoteEntry(__get_MSP());
+    TRACE(TRACE_CALLBACK_BEGIN, 0, size);
+    if(overrunUs)
     {
-        drumVoices[i].env.Init();
-        drumVoices[i].noiseEnv.Init();
-        drumVoices[i].active = false;
-        drumVoices[i].phase  = 0.0f;
+        TRACE(TRACE_OVERRUN, 0, overrunUs < 0xFFFF ? overrunUs : 0xFFFF);
+        g_trace.Trigger();
+        overrunUs = 0;
     }
 
-    g_masterGain   = 0.4f;
-    g_sustainOn    = false;
-    g_instrMode    = MODE_POLY_SYNTH;
-    g_looperLevel  = 0.7f;
+    jitter.Render(out, size, start);
+
+    EngineMeters levels;
+    TakeEngineMeters(levels);
+    meters.Add(levels);
+    spectrumTap.Push(out[0], out[1], size);
+    recorder.Push(out[0], out[1], size);
+
+    uint32_t us   = System::GetUs() - start;
+    float    load = (float)us * samplesPerUs / (float)size;
+    if(load > 1.0f)
+        overrunUs = us - (uint32_t)((float)size / samplesPerUs);
+
+    uint8_t  level    = governor.Update(load);
+    uint32_t permille = (uint32_t)(load * 1000.0f);
+    if(permille > 0xFFFF)
+        permille = 0xFFFF;
+    if(level != GetEngineQuality())
+        TRACE(TRACE_QUALITY, level, permille);
+    SetEngineQuality((EngineQuality)level);
+    TRACE(TRACE_CALLBACK_END, level, permille);
+    wcet.Record(TakeEngineFeatures(), TraceNow() - cycles);
 }
 
 // ----------------------------------------------------------------------
@@ -925,21 +809,103 @@ void InitSynth(float samplerate)
 int main(void)
 {
     hw.Init();
-    hw.SetAudioBlockSize(48);
-    float samplerate = hw.AudioSampleRate();
+    StartCycleCounter();
+    PaintStack();
+
+    audioSettings.Init(AudioConfig());
+    AudioConfig audio = audioSettings.GetSettings();
+    if(!audio.Valid())
+        audio = AudioConfig();
+    hw.SetAudioBlockSize(audio.BlockSize());
+    hw.SetAudioSampleRate(SaiRate(audio.SampleRate()));
+    float  samplerate = hw.AudioSampleRate();
+    size_t blockSize  = audio.BlockSize();
+    float  blockUs    = 1e6f * (float)blockSize / samplerate;
 
     InitSynth(samplerate);
 
+    // A stamped note can arrive just after a callback started, so the
+    // latency has to cover a whole block on top of the transport
+    JitterBuffer::Config jitter_config;
+    if(jitter_config.latencyUs < (uint32_t)(2.0f * blockUs))
+        jitter_config.latencyUs = (uint32_t)(2.0f * blockUs);
+    jitter_config.render = SmfRender;
+    jitter_config.handle = EngineMidi;
+    jitter.Init(jitter_config, samplerate);
+
+    // Governor holds are in blocks; keep them at the same time at any
+    // block size
+    CpuGovernor::Config governor_config;
+    uint32_t            hold = (uint32_t)(500000.0f / blockUs);
+    governor_config.numLevels  = QUALITY_NUM_LEVELS;
+    governor_config.holdBlocks = (uint16_t)(hold < 4000 ? hold : 4000);
+    governor_config.maxHold    = (uint16_t)(governor_config.holdBlocks * 16);
+    governor.Init(governor_config);
+    samplesPerUs  = samplerate / 1e6f;
+    blockPeriodUs = blockUs;
+    meters.Init(samplerate);
+    spectrumTap.Init(samplerate);
+    spectrum.Init(SpectrumAnalyzer::kMaxSize, spectrumTap.Rate(), TraceNow);
+    recorder.Init(recordRing, kRecordRingBytes, samplerate, &recordStorage);
+
+    saveAudioJob.step = SaveAudioSettings;
+    saveAudioJob.name = "audio settings";
+    traceDumpJob.step = DumpTrace;
+    traceDumpJob.name = "trace dump";
+    budgetJob.step    = PrintBudget;
+    budgetJob.name    = "audio budget";
+    spectrumJob.step  = SpectrumStep;
+    spectrumJob.name  = "spectrum";
+    recordJob.step    = RecordStep;
+    recordJob.name    = "recorder";
+    smfJob.step       = SmfFillStep;
+    smfJob.name       = "midi file";
+
+    // USB serial: trace dumps out, commands in. Doesn't wait for a host.
+    hw.StartLog(false);
+    hw.usb_handle.SetReceiveCallback(UsbRxCallback, UsbHandle::FS_INTERNAL);
+
     // MIDI UART configuration: use default USART1 (Daisy Seed DIN pins).
-    // You wired KB2040 TX to Daisy D14 (USART1 RX), which matches this.
-    MidiUartHandler::Config midi_config;
-    midi.Init(midi_config);
-    midi.StartReceive();
+    // You wired KB2040 TX to Daisy D14 (USART1 RX), which matches this;
+    // D13 (USART1 TX) back to KB2040 GP1 is the return line.
+    MidiUartTransport::Config midi_config;
+    midiUart.Init(midi_config);
+    InitReturnLine();
+    midiQueue.SetChannels(MIDI_SOURCE_UART, kUartMidiChannels);
+    StartMidiRx();
+
+    // Class-compliant USB MIDI device for a computer
+    MidiUsbTransport::Config usb_midi_config;
+    usb_midi_config.periph = MidiUsbTransport::Config::EXTERNAL;
+    midiUsb.Init(usb_midi_config);
+    midiQueue.SetChannels(MIDI_SOURCE_USB, kUsbMidiChannels);
+    StartUsbMidiRx();
+
+    background.Init(BgExecutor::Config(), BackgroundNowUs);
+    MountSdCard();
 
     hw.StartAudio(AudioCallback);
 
     while(1)
     {
         ProcessMidi();
+        StartSpectrum();
+        SendReturnLine();
+        ServiceRecorder();
+        ServicePlayer();
+        if(UsbCommandPending())
+            RunUsbCommands();
+        if(background.RunSlice())
+            continue;
+
+        // Nothing left to do: sleep until the next interrupt (UART DMA,
+        // USB, audio or SysTick); a return frame goes out meanwhile. With
+        // interrupts masked, one arriving after the check still ends WFI
+        // and runs once they are unmasked. A held message waits for the
+        // audio callback anyway.
+        __disable_irq();
+        if((midiHeld || midiQueue.Empty()) && background.Idle() && !UsbCommandPending())
+            __WFI();
+        __enable_irq();
     }
 }
@@ -0,0 +1,53 @@
+#include "meter.h"
+
+#include <math.h>
+
+namespace
+{
+// Half-dB steps below full scale, 127 = 0 dBFS. power is the squared
+// amplitude, so 10 * log10 gives dB.
+uint8_t LevelByte(float power)
+{
+    if(!(power > 1e-7f)) // also catches NaN; -70 dB reads as 0 anyway
+        return 0;
+    float steps = (float)MidiMeter::LEVEL_MAX + 20.0f * log10f(power);
+    if(steps <= 0.0f)
+        return 0;
+    if(steps >= (float)MidiMeter::LEVEL_MAX)
+        return MidiMeter::LEVEL_MAX;
+    return (uint8_t)(steps + 0.5f);
+}
+} // namespace
+
+void MeterFrames::Init(float sampleRate, uint32_t frameUs)
+{
+    frameSamples_ = (uint32_t)(sampleRate * 1e-6f * (float)frameUs);
+    if(frameSamples_ == 0)
+        frameSamples_ = 1;
+    acc_ = EngineMeters();
+    full_.store(false, std::memory_order_relaxed);
+}
+
+bool MeterFrames::Take(uint8_t* out)
+{
+    if(!full_.load(std::memory_order_acquire))
+        return false;
+    EngineMeters m = ready_;
+    full_.store(false, std::memory_order_release);
+
+    uint8_t clip = 0;
+    out[0]       = 0xF0;
+    out[1]       = MidiMeter::SYSEX_ID;
+    out[2]       = MidiMeter::TYPE;
+    for(int c = 0; c < MidiMeter::NUM_CHANNELS; c++)
+    {
+        if(m.peak[c] >= 1.0f)
+            clip |= (uint8_t)(1u << c);
+        float meanSq = m.samples ? m.sumSq[c] / (float)m.samples : 0.0f;
+        out[MidiMeter::HEADER_LEN + 2 * c]     = LevelByte(m.peak[c] * m.peak[c]);
+        out[MidiMeter::HEADER_LEN + 2 * c + 1] = LevelByte(meanSq);
+    }
+    out[3]                        = clip;
+    out[MidiMeter::FRAME_LEN - 1] = 0xF7;
+    return true;
+}
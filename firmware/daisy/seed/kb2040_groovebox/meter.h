@@ -0,0 +1,62 @@
+#pragma once
+
+// Level meter frames for the KB2040's display (MidiMeter in
+// midi_protocol.h). The audio callback adds what the engine measured each
+// block; once a frame's worth of samples (about 1/30 s) is in, the totals
+// are handed to main(), which converts them to dB and sends the frame.
+//
+// The handoff is a single slot: if main() hasn't taken the last frame
+// when the next one completes, the new one is dropped. The display only
+// wants the latest levels at a steady rate, so nothing queues up behind a
+// busy main loop. No libDaisy dependency.
+
+#include "groovebox_engine.h"
+#include "midi_protocol.h"
+
+#include <atomic>
+#include <stdint.h>
+
+class MeterFrames
+{
+  public:
+    void Init(float sampleRate, uint32_t frameUs = MidiMeter::FRAME_US);
+
+    // Audio callback, once per block after rendering
+    void Add(const EngineMeters& m)
+    {
+        for(int c = 0; c < MidiMeter::NUM_CHANNELS; c++)
+        {
+            if(m.peak[c] > acc_.peak[c])
+                acc_.peak[c] = m.peak[c];
+            acc_.sumSq[c] += m.sumSq[c];
+        }
+        acc_.samples += m.samples;
+        if(acc_.samples < frameSamples_)
+            return;
+        if(!full_.load(std::memory_order_acquire))
+        {
+            ready_ = acc_;
+            full_.store(true, std::memory_order_release);
+        }
+        else
+        {
+            dropped_++;
+        }
+        acc_ = EngineMeters();
+    }
+
+    // main(): encodes the latest finished frame into out, which holds
+    // MidiMeter::FRAME_LEN bytes. False if none finished since the last
+    // call.
+    bool Take(uint8_t* out);
+
+    // Frames the callback finished while main() still had the last one
+    uint32_t Dropped() const { return dropped_; }
+
+  private:
+    EngineMeters      acc_   = {}; // audio callback only
+    EngineMeters      ready_ = {}; // owned by whoever full_ says
+    std::atomic<bool> full_{false};
+    uint32_t          frameSamples_ = 1600;
+    uint32_t          dropped_      = 0;
+};
@@ -0,0 +1,299 @@
+#pragma once
+
+// MIDI receive path. Each transport's receive callback (the UART DMA from
+// the KB2040, USB MIDI from a computer) parses bytes as they arrive and
+// queues complete channel messages; main() drains the queues as one and
+// sleeps in WFI while they are empty. No libDaisy dependency, so the host
+// models use the same parser and queues.
+
+#include "midi_protocol.h"
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+// Running-status parser for channel messages and send stamps
+// (MidiStamp::STATUS, reported like a message). SysEx and other system
+// common bytes are skipped; real-time bytes may appear anywhere and are
+// ignored.
+class MidiByteParser
+{
+  public:
+    // Returns true when `b` completes a message
+    bool Feed(uint8_t b)
+    {
+        if(b >= 0xF8)
+            return false;
+        if(b & 0x80)
+        {
+            sysex_ = (b == 0xF0);
+            if(b == MidiStamp::STATUS)
+            {
+                running_ = b;
+                need_    = 2;
+                have_    = 0;
+                return false;
+            }
+            if(b >= 0xF0)
+            {
+                running_ = 0;
+                need_    = 0;
+                return false;
+            }
+            running_ = b;
+            need_    = ((b & 0xE0) == 0xC0) ? 1 : 2; // Cn/Dn take one data byte
+            have_    = 0;
+            return false;
+        }
+        if(sysex_ || !running_)
+            return false;
+        if(have_ == need_)
+            have_ = 0; // running status: a new message with the same status
+        data[have_++] = b;
+        if(have_ < need_)
+            return false;
+        status = running_;
+        if(need_ == 1)
+            data[1] = 0;
+        if(running_ >= 0xF0)
+            running_ = 0; // no running status for system common
+        return true;
+    }
+
+    uint8_t status  = 0;
+    uint8_t data[2] = {0, 0};
+
+  private:
+    uint8_t running_ = 0;
+    int     need_    = 0;
+    int     have_    = 0;
+    bool    sysex_   = false;
+};
+
+// Where a message came in
+enum MidiSource : uint8_t
+{
+    MIDI_SOURCE_UART, // the KB2040
+    MIDI_SOURCE_USB,  // a computer, as a USB MIDI device
+    MIDI_NUM_SOURCES,
+};
+
+struct MidiRxEvent
+{
+    uint8_t  status;
+    uint8_t  data0;
+    uint8_t  data1;
+    uint8_t  source;    // MidiSource, set by MidiMergeQueue::Push
+    bool     stamped;   // a send stamp applies
+    uint16_t stamp;     // MidiStamp ticks, KB2040 clock
+    uint32_t arrivalUs; // local clock, when the receive callback parsed it
+};
+
+// Controllers from MidiCC::AUDIO_BLOCK_SIZE up are commands to the Daisy
+// itself (audio setup, spectrum, recorder, player), not to the engine.
+// Only the KB2040 sends them: a computer on USB that did could rewrite
+// the stored audio setup or start a recording, so main() drops those.
+inline bool IsForeignDaisyCommand(const MidiRxEvent& e)
+{
+    return e.source != MIDI_SOURCE_UART && (e.status & 0xF0) == 0xB0
+           && e.data0 >= MidiCC::AUDIO_BLOCK_SIZE;
+}
+
+// Bytes -> channel messages, tagging note on/off with the latest send
+// stamp unless that stamp has gone stale
+class MidiRxDecoder
+{
+  public:
+    // Returns true when `b` completes a channel message
+    bool Feed(uint8_t b, uint32_t nowUs, MidiRxEvent& out)
+    {
+        if(!parser_.Feed(b))
+            return false;
+        if(parser_.status == MidiStamp::STATUS)
+        {
+            stamp_   = (uint16_t)((parser_.data[0] | (parser_.data[1] << 7)) & MidiStamp::MASK);
+            stampUs_ = nowUs;
+            haveStamp_ = true;
+            return false;
+        }
+        out.status    = parser_.status;
+        out.data0     = parser_.data[0];
+        out.data1     = parser_.data[1];
+        bool note     = (out.status & 0xE0) == 0x80; // 8n / 9n
+        out.stamped   = note && haveStamp_ && nowUs - stampUs_ < MidiStamp::STALE_US;
+        out.stamp     = stamp_;
+        out.arrivalUs = nowUs;
+        return true;
+    }
+
+  private:
+    MidiByteParser parser_;
+    uint16_t       stamp_     = 0;
+    uint32_t       stampUs_   = 0;
+    bool           haveStamp_ = false;
+};
+
+// Single-producer / single-consumer ring (an interrupt and main(), or
+// main() and the audio callback). N must be a power of two. A full ring
+// drops the new item and counts it.
+template <typename T, size_t N>
+class SpscRing
+{
+    static_assert((N & (N - 1)) == 0, "SpscRing size must be a power of two");
+
+  public:
+    bool Push(const T& e)
+    {
+        uint32_t head = head_.load(std::memory_order_relaxed);
+        if(head - tail_.load(std::memory_order_acquire) >= N)
+        {
+            dropped_.store(dropped_.load(std::memory_order_relaxed) + 1,
+                           std::memory_order_relaxed);
+            return false;
+        }
+        buf_[head & (N - 1)] = e;
+        head_.store(head + 1, std::memory_order_release);
+        uint32_t size = head + 1 - tail_.load(std::memory_order_relaxed);
+        if(size > highWater_)
+            highWater_ = size;
+        return true;
+    }
+
+    bool Pop(T& e)
+    {
+        if(!Peek(e))
+            return false;
+        tail_.store(tail_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        return true;
+    }
+
+    // The oldest item, left in place
+    bool Peek(T& e) const
+    {
+        uint32_t tail = tail_.load(std::memory_order_relaxed);
+        if(tail == head_.load(std::memory_order_acquire))
+            return false;
+        e = buf_[tail & (N - 1)];
+        return true;
+    }
+
+    bool Empty() const
+    {
+        return head_.load(std::memory_order_acquire)
+               == tail_.load(std::memory_order_relaxed);
+    }
+
+    size_t   Size() const { return head_.load() - tail_.load(); }
+    bool     Full() const { return Size() >= N; }
+    uint32_t Dropped() const { return dropped_.load(std::memory_order_relaxed); }
+    uint32_t HighWater() const { return highWater_; } // written by Push only
+
+  private:
+    T                     buf_[N];
+    std::atomic<uint32_t> head_{0};
+    std::atomic<uint32_t> tail_{0};
+    std::atomic<uint32_t> dropped_{0};
+    uint32_t              highWater_ = 0;
+};
+
+template <size_t N>
+using MidiRxQueue = SpscRing<MidiRxEvent, N>;
+
+
+// The receive queue for every source. Each source's callback is its own
+// interrupt, so each gets its own ring with that callback as the only
+// producer; main() pops them as one queue in arrival order. A callback
+// stamps a batch with the time it was entered and main() can't run
+// until it returns, so whatever main() pops later arrived no earlier:
+// the merge never reorders. Ties go to the lower source, so the KB2040's
+// keys win against a computer.
+//
+// Each source has a channel filter, applied before a message takes a
+// slot. Channel 1 is bit 0.
+template <size_t N>
+class MidiMergeQueue
+{
+  public:
+    struct SourceStats
+    {
+        uint32_t queued;
+        uint32_t filtered; // channel not enabled for the source
+        uint32_t dropped;  // ring full
+        uint32_t highWater;
+    };
+
+    // Any context; applies from the next message
+    void SetChannels(MidiSource s, uint16_t mask)
+    {
+        channels_[s].store(mask, std::memory_order_relaxed);
+    }
+    uint16_t Channels(MidiSource s) const
+    {
+        return channels_[s].load(std::memory_order_relaxed);
+    }
+
+    // The source's channel filter passes the message
+    bool Accepts(MidiSource s, uint8_t status) const
+    {
+        return Channels(s) >> (status & 0x0F) & 1;
+    }
+
+    // The source's receive callback. Returns false if the message was
+    // filtered out (see Accepts) or the ring was full.
+    bool Push(MidiSource s, MidiRxEvent e)
+    {
+        if(!Accepts(s, e.status))
+        {
+            filtered_[s].store(filtered_[s].load(std::memory_order_relaxed) + 1,
+                               std::memory_order_relaxed);
+            return false;
+        }
+        e.source = s;
+        if(!rings_[s].Push(e))
+            return false;
+        queued_[s].store(queued_[s].load(std::memory_order_relaxed) + 1,
+                         std::memory_order_relaxed);
+        return true;
+    }
+
+    // main(): the earliest arrival of all sources
+    bool Pop(MidiRxEvent& e)
+    {
+        int         best = -1;
+        MidiRxEvent head;
+        for(int s = 0; s < MIDI_NUM_SOURCES; s++)
+            if(rings_[s].Peek(head)
+               && (best < 0 || (int32_t)(head.arrivalUs - e.arrivalUs) < 0))
+            {
+                best = s;
+                e    = head;
+            }
+        if(best < 0)
+            return false;
+        return rings_[best].Pop(e);
+    }
+
+    bool Empty() const
+    {
+        for(int s = 0; s < MIDI_NUM_SOURCES; s++)
+            if(!rings_[s].Empty())
+                return false;
+        return true;
+    }
+
+    SourceStats GetStats(MidiSource s) const
+    {
+        SourceStats st;
+        st.queued    = queued_[s].load(std::memory_order_relaxed);
+        st.filtered  = filtered_[s].load(std::memory_order_relaxed);
+        st.dropped   = rings_[s].Dropped();
+        st.highWater = rings_[s].HighWater();
+        return st;
+    }
+
+  private:
+    SpscRing<MidiRxEvent, N> rings_[MIDI_NUM_SOURCES];
+    std::atomic<uint16_t>    channels_[MIDI_NUM_SOURCES] = {{0xFFFF}, {0xFFFF}};
+    std::atomic<uint32_t>    queued_[MIDI_NUM_SOURCES]   = {};
+    std::atomic<uint32_t>    filtered_[MIDI_NUM_SOURCES] = {};
+};
\ No newline at end of file
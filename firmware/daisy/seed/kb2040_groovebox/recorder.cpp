@@ -0,0 +1,192 @@
+#include "recorder.h"
+
+#include <string.h>
+
+namespace
+{
+// A take stops on its own before the RIFF size (32 bits) would wrap
+const uint32_t kMaxDataBytes = 0xFFFFFFFFu - WavRecorder::kHeaderBytes
+                               - WavRecorder::kChunkBytes;
+
+void Put16(uint8_t* p, uint32_t v)
+{
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+}
+
+void Put32(uint8_t* p, uint32_t v)
+{
+    Put16(p, v);
+    Put16(p + 2, v >> 16);
+}
+} // namespace
+
+void WavRecorder::Init(uint8_t*         ring,
+                       uint32_t         ringBytes,
+                       float            sampleRate,
+                       RecorderStorage* storage)
+{
+    ring_       = ring;
+    ringBytes_  = ringBytes;
+    mask_       = ringBytes - 1;
+    sampleRate_ = (uint32_t)(sampleRate + 0.5f);
+    storage_    = storage;
+    armed_.store(false);
+    state_ = STATE_IDLE;
+}
+
+bool WavRecorder::Start(const char* name, int bits)
+{
+    if(state_ != STATE_IDLE || !ring_ || !storage_)
+        return false;
+    bits_       = bits == 16 ? 16 : 24;
+    frameBytes_ = (uint32_t)bits_ / 8 * 2;
+
+    uint8_t header[kHeaderBytes];
+    BuildHeader(header, 0);
+    if(!storage_->Open(name))
+        return false;
+    if(!storage_->Write(header, kHeaderBytes))
+    {
+        storage_->Close();
+        return false;
+    }
+
+    // The callback isn't pushing (armed_ is clear), so main() owns both
+    // indices until it is armed
+    write_.store(0, std::memory_order_relaxed);
+    read_.store(0, std::memory_order_relaxed);
+    droppedBlocks_ = 0;
+    droppedFrames_ = 0;
+    maxFill_       = 0;
+    dataBytes_     = 0;
+    writes_        = 1;
+    writeError_    = false;
+    state_         = STATE_RECORDING;
+    armed_.store(true, std::memory_order_release);
+    return true;
+}
+
+void WavRecorder::Stop()
+{
+    armed_.store(false, std::memory_order_release);
+    if(state_ == STATE_RECORDING)
+        state_ = STATE_STOPPING;
+}
+
+bool WavRecorder::Pending() const
+{
+    if(state_ == STATE_STOPPING)
+        return true;
+    if(state_ != STATE_RECORDING)
+        return false;
+    uint32_t fill = write_.load(std::memory_order_acquire)
+                    - read_.load(std::memory_order_relaxed);
+    return fill >= kChunkBytes;
+}
+
+bool WavRecorder::Service()
+{
+    if(state_ == STATE_IDLE)
+        return true;
+
+    uint32_t fill = write_.load(std::memory_order_acquire)
+                    - read_.load(std::memory_order_relaxed);
+    if(fill >= kChunkBytes)
+    {
+        if(!WriteRing(kChunkBytes))
+            return true;
+        if(dataBytes_ >= kMaxDataBytes)
+            Stop();
+        return false;
+    }
+    if(state_ == STATE_RECORDING)
+        return true;
+
+    // Stopped: the tail, then the real sizes in the header
+    if(fill && !WriteRing(fill))
+        return true;
+    Finish();
+    return true;
+}
+
+float WavRecorder::Seconds() const
+{
+    return (float)(dataBytes_ / frameBytes_) / (float)sampleRate_;
+}
+
+WavRecorder::Stats WavRecorder::GetStats() const
+{
+    Stats s;
+    s.droppedBlocks = droppedBlocks_;
+    s.droppedFrames = droppedFrames_;
+    s.writes        = writes_;
+    s.maxFill       = maxFill_;
+    s.dataBytes     = dataBytes_;
+    s.writeError    = writeError_;
+    return s;
+}
+
+// RIFF, fmt, JUNK up to the last 8 bytes of the sector, then the data
+// chunk's header, so the samples start at kHeaderBytes
+void WavRecorder::BuildHeader(uint8_t* out, uint32_t dataBytes) const
+{
+    const uint32_t junkBytes = kHeaderBytes - 12 - 24 - 8 - 8;
+    memset(out, 0, kHeaderBytes);
+    memcpy(out, "RIFF", 4);
+    Put32(out + 4, kHeaderBytes - 8 + dataBytes);
+    memcpy(out + 8, "WAVE", 4);
+
+    uint8_t* fmt = out + 12;
+    memcpy(fmt, "fmt ", 4);
+    Put32(fmt + 4, 16);
+    Put16(fmt + 8, 1); // PCM
+    Put16(fmt + 10, 2);
+    Put32(fmt + 12, sampleRate_);
+    Put32(fmt + 16, sampleRate_ * frameBytes_);
+    Put16(fmt + 20, frameBytes_);
+    Put16(fmt + 22, (uint32_t)bits_);
+
+    uint8_t* junk = fmt + 24;
+    memcpy(junk, "JUNK", 4);
+    Put32(junk + 4, junkBytes);
+
+    uint8_t* data = junk + 8 + junkBytes;
+    memcpy(data, "data", 4);
+    Put32(data + 4, dataBytes);
+}
+
+// bytes from the read index; the ring is a whole number of chunks, so
+// only the tail of a take can wrap
+bool WavRecorder::WriteRing(uint32_t bytes)
+{
+    uint32_t r     = read_.load(std::memory_order_relaxed);
+    uint32_t pos   = r & mask_;
+    uint32_t first = bytes < ringBytes_ - pos ? bytes : ringBytes_ - pos;
+    bool     ok    = storage_->Write(ring_ + pos, first);
+    if(ok && first < bytes)
+        ok = storage_->Write(ring_, bytes - first);
+    writes_++;
+    if(!ok)
+    {
+        // Keep what made it: the header still gets the sizes so far
+        writeError_ = true;
+        armed_.store(false, std::memory_order_release);
+        Finish();
+        return false;
+    }
+    read_.store(r + bytes, std::memory_order_release);
+    dataBytes_ += bytes;
+    return true;
+}
+
+void WavRecorder::Finish()
+{
+    uint8_t header[kHeaderBytes];
+    BuildHeader(header, dataBytes_);
+    if(!storage_->Rewrite(0, header, kHeaderBytes))
+        writeError_ = true;
+    if(!storage_->Close())
+        writeError_ = true;
+    state_ = STATE_IDLE;
+}
@@ -0,0 +1,170 @@
+#pragma once
+
+// Master-out recorder: stereo WAV, 16 or 24 bit, streamed to storage for
+// as long as there is room on it.
+//
+// The audio callback only converts each block to PCM and copies it into a
+// large ring (SDRAM on the Seed; several seconds of audio). main() drains
+// the ring through a background job (background.h) in whole chunks of
+// kChunkBytes, a multiple of the 512-byte sector. The header is padded
+// with a JUNK chunk to one full sector, so every chunk lands on a sector
+// boundary in the file as well and the card never has to read-modify-write.
+// SD cards stall now and then for tens to hundreds of ms while they erase;
+// the ring rides that out. If it fills anyway, the callback drops the
+// whole block and counts it, it never waits.
+//
+// Stop() ends the take: the job writes what is left in the ring, then goes
+// back and fills in the RIFF and data sizes in the header.
+//
+// No libDaisy dependency; the platform supplies the ring and the storage.
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+// A file on the card (FatFs on the Seed, stdio on the host). Calls come
+// from main() only and may block.
+class RecorderStorage
+{
+  public:
+    virtual bool Open(const char* name) = 0; // create, or truncate
+    virtual bool Write(const uint8_t* data, uint32_t bytes) = 0; // at the end
+    virtual bool Rewrite(uint32_t offset, const uint8_t* data, uint32_t bytes) = 0;
+    virtual bool Close() = 0;
+
+  protected:
+    ~RecorderStorage() = default;
+};
+
+class WavRecorder
+{
+  public:
+    static const uint32_t kHeaderBytes = 512;   // one sector, JUNK-padded
+    static const uint32_t kChunkBytes  = 16384; // per write, 32 sectors
+
+    struct Stats
+    {
+        uint32_t droppedBlocks; // the ring was full when they arrived
+        uint32_t droppedFrames;
+        uint32_t writes;
+        uint32_t maxFill;       // most bytes waiting in the ring
+        uint32_t dataBytes;     // PCM in the file so far
+        bool     writeError;    // the take was cut short
+    };
+
+    // ringBytes is a power of two and a multiple of kChunkBytes
+    void Init(uint8_t* ring, uint32_t ringBytes, float sampleRate, RecorderStorage* storage);
+
+    // main(): opens name and writes a placeholder header. bits is 16 or
+    // 24. False if a take is still being written out, or the file can't
+    // be opened.
+    bool Start(const char* name, int bits);
+
+    // main(): no more blocks after this one; the job finishes the file.
+    // Must not run while Push() does, which holds on the Seed, where
+    // Push() runs in the audio interrupt.
+    void Stop();
+
+    // Audio callback, once per block after rendering
+    void Push(const float* left, const float* right, size_t size)
+    {
+        if(!armed_.load(std::memory_order_acquire))
+            return;
+        uint32_t w    = write_.load(std::memory_order_relaxed);
+        uint32_t fill = w - read_.load(std::memory_order_acquire);
+        uint32_t need = (uint32_t)size * frameBytes_;
+        if(ringBytes_ - fill < need)
+        {
+            droppedBlocks_++;
+            droppedFrames_ += (uint32_t)size;
+            return;
+        }
+        if(bits_ == 16)
+        {
+            for(size_t i = 0; i < size; i++)
+            {
+                int32_t l = ToPcm(left[i], 32767.0f);
+                int32_t r = ToPcm(right[i], 32767.0f);
+                ring_[w++ & mask_] = (uint8_t)l;
+                ring_[w++ & mask_] = (uint8_t)(l >> 8);
+                ring_[w++ & mask_] = (uint8_t)r;
+                ring_[w++ & mask_] = (uint8_t)(r >> 8);
+            }
+        }
+        else
+        {
+            for(size_t i = 0; i < size; i++)
+            {
+                int32_t l = ToPcm(left[i], 8388607.0f);
+                int32_t r = ToPcm(right[i], 8388607.0f);
+                ring_[w++ & mask_] = (uint8_t)l;
+                ring_[w++ & mask_] = (uint8_t)(l >> 8);
+                ring_[w++ & mask_] = (uint8_t)(l >> 16);
+                ring_[w++ & mask_] = (uint8_t)r;
+                ring_[w++ & mask_] = (uint8_t)(r >> 8);
+                ring_[w++ & mask_] = (uint8_t)(r >> 16);
+            }
+        }
+        write_.store(w, std::memory_order_release);
+        if(fill + need > maxFill_)
+            maxFill_ = fill + need;
+    }
+
+    // main(): true while the job has something to write: a full chunk,
+    // or the end of a stopped take
+    bool Pending() const;
+
+    // Background job step: one chunk, or the tail and the header once
+    // stopped. Returns true when there is nothing more for now.
+    bool Service();
+
+    bool  Recording() const { return armed_.load(std::memory_order_relaxed); }
+    bool  Busy() const { return state_ != STATE_IDLE; } // a file is open
+    int   Bits() const { return bits_; }
+    float Seconds() const; // written to the file so far
+    Stats GetStats() const;
+
+  private:
+    enum State : uint8_t
+    {
+        STATE_IDLE,
+        STATE_RECORDING,
+        STATE_STOPPING,
+    };
+
+    static int32_t ToPcm(float x, float scale)
+    {
+        if(x > 1.0f)
+            x = 1.0f;
+        if(x < -1.0f)
+            x = -1.0f;
+        float s = x * scale;
+        return (int32_t)(s < 0.0f ? s - 0.5f : s + 0.5f);
+    }
+
+    void BuildHeader(uint8_t* out, uint32_t dataBytes) const;
+    bool WriteRing(uint32_t bytes);
+    void Finish();
+
+    uint8_t*         ring_       = nullptr;
+    uint32_t         ringBytes_  = 0;
+    uint32_t         mask_       = 0;
+    uint32_t         sampleRate_ = 48000;
+    RecorderStorage* storage_    = nullptr;
+
+    std::atomic<bool>     armed_{false};
+    std::atomic<uint32_t> write_{0}; // audio callback
+    std::atomic<uint32_t> read_{0};  // main()
+    int                   bits_       = 24;
+    uint32_t              frameBytes_ = 6;
+
+    // Audio callback only; main() reads them for the stats
+    uint32_t droppedBlocks_ = 0;
+    uint32_t droppedFrames_ = 0;
+    uint32_t maxFill_       = 0;
+
+    State    state_      = STATE_IDLE;
+    uint32_t dataBytes_  = 0;
+    uint32_t writes_     = 0;
+    bool     writeError_ = false;
+};
@@ -0,0 +1,517 @@
+#include "smf_player.h"
+#include "groovebox_engine.h"
+
+#include <string.h>
+
+namespace
+{
+const uint32_t kDefaultTempo = 500000; // us per quarter note, 120 bpm
+const int      kEventsPerStep = 32;
+
+uint16_t Get16(const uint8_t* p)
+{
+    return (uint16_t)(p[0] << 8 | p[1]);
+}
+
+uint32_t Get32(const uint8_t* p)
+{
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+// Controllers that mean the same here as in a General MIDI file
+bool PassController(uint8_t cc)
+{
+    return cc == MidiCC::MODWHEEL || cc == MidiCC::MODWHEEL_LSB || cc == MidiCC::VOLUME
+           || cc == MidiCC::SUSTAIN_PEDAL;
+}
+} // namespace
+
+// ---------------------------------------------------------------------
+// main()
+// ---------------------------------------------------------------------
+bool SmfPlayer::Load(SmfSource* source, float sampleRate, const Config& cfg)
+{
+    if(Busy())
+        return false;
+    numTracks_ = 0;
+
+    uint8_t hdr[14];
+    if(source->Read(0, hdr, 14) != 14 || memcmp(hdr, "MThd", 4) || Get32(hdr + 4) < 6)
+        return false;
+    uint16_t format = Get16(hdr + 8);
+    uint16_t ntrks  = Get16(hdr + 10);
+    if(format > 1 || ntrks == 0 || ntrks > kMaxTracks || Get16(hdr + 12) == 0)
+        return false;
+
+    // Chunks other than MTrk are skipped, as the spec asks
+    uint32_t offset = 8 + Get32(hdr + 4);
+    int      found  = 0;
+    uint8_t  chunk[8];
+    while(found < ntrks && source->Read(offset, chunk, 8) == 8)
+    {
+        uint32_t len = Get32(chunk + 4);
+        if(!memcmp(chunk, "MTrk", 4))
+        {
+            tracks_[found].start = offset + 8;
+            tracks_[found].end   = offset + 8 + len;
+            found++;
+        }
+        offset += 8 + len;
+    }
+    if(found == 0)
+        return false;
+
+    source_     = source;
+    cfg_        = cfg;
+    sampleRate_ = sampleRate;
+    division_   = Get16(hdr + 12);
+    numTracks_  = found;
+    return true;
+}
+
+bool SmfPlayer::Play()
+{
+    if(Busy() || numTracks_ == 0)
+        return false;
+
+    // The callback leaves the queue alone while idle; anything a Fill()
+    // cut short by the last stop left in it goes
+    Event e;
+    while(queue_.Pop(e))
+    {
+    }
+    Rewind();
+    anchorSample_ = 0.0;
+    anchorTick_   = 0;
+    SetTempo(0, kDefaultTempo);
+    finished_    = false;
+    havePending_ = false;
+    stats_       = Stats();
+    played_.store(0, std::memory_order_relaxed);
+    state_.store(STATE_PLAYING, std::memory_order_release);
+    return true;
+}
+
+void SmfPlayer::Stop()
+{
+    uint8_t playing = STATE_PLAYING;
+    state_.compare_exchange_strong(playing, STATE_STOPPING, std::memory_order_acq_rel);
+}
+
+bool SmfPlayer::NeedsFill() const
+{
+    if(state_.load(std::memory_order_acquire) != STATE_PLAYING)
+        return false;
+    if(!havePending_)
+        return !finished_;
+    uint32_t horizon = played_.load(std::memory_order_acquire)
+                       + (uint32_t)(sampleRate_ * (float)cfg_.lookaheadMs / 1000.0f);
+    return (int32_t)(pending_.sample - horizon) < 0 && queue_.Size() < 256;
+}
+
+bool SmfPlayer::Fill()
+{
+    for(int i = 0; i < kEventsPerStep; i++)
+    {
+        if(state_.load(std::memory_order_acquire) != STATE_PLAYING)
+            return true;
+        if(!havePending_)
+        {
+            if(!ParseNext(pending_))
+                return true;
+            havePending_ = true;
+        }
+        if(!NeedsFill())
+            return true;
+        queue_.Push(pending_);
+        havePending_ = false;
+    }
+    return false;
+}
+
+uint32_t SmfPlayer::PlayedMs() const
+{
+    return (uint32_t)((float)played_.load(std::memory_order_relaxed) * 1000.0f / sampleRate_);
+}
+
+void SmfPlayer::Rewind()
+{
+    heapSize_   = 0;
+    endTick_    = 0;
+    passEvents_ = 0;
+    for(int i = 0; i < numTracks_; i++)
+    {
+        Track& t  = tracks_[i];
+        t.next    = t.start;
+        t.pos     = 0;
+        t.len     = 0;
+        t.running = 0;
+        t.tick    = 0;
+        t.done    = !ReadDelta(t);
+        if(t.done)
+            continue;
+        heap_[heapSize_] = (uint8_t)i;
+        HeapUp(heapSize_++);
+    }
+}
+
+bool SmfPlayer::ReadByte(Track& t, uint8_t& b)
+{
+    if(t.pos == t.len)
+    {
+        uint32_t n = t.end - t.next;
+        if(n > kTrackBuffer)
+            n = kTrackBuffer;
+        if(n == 0)
+            return false;
+        n = source_->Read(t.next, t.buf, n);
+        stats_.reads++;
+        if(n == 0)
+            return false;
+        t.next += n;
+        t.pos = 0;
+        t.len = (uint16_t)n;
+    }
+    b = t.buf[t.pos++];
+    return true;
+}
+
+bool SmfPlayer::ReadVarLen(Track& t, uint32_t& v)
+{
+    v = 0;
+    for(int i = 0; i < 4; i++)
+    {
+        uint8_t b;
+        if(!ReadByte(t, b))
+            return false;
+        v = (v << 7) | (b & 0x7F);
+        if(!(b & 0x80))
+            return true;
+    }
+    return false;
+}
+
+// Past data nobody plays (sysex, text), without reading it in
+void SmfPlayer::Skip(Track& t, uint32_t n)
+{
+    uint32_t buffered = (uint32_t)(t.len - t.pos);
+    if(n <= buffered)
+    {
+        t.pos += (uint16_t)n;
+        return;
+    }
+    n -= buffered;
+    t.next = n < t.end - t.next ? t.next + n : t.end;
+    t.pos  = 0;
+    t.len  = 0;
+}
+
+bool SmfPlayer::ReadDelta(Track& t)
+{
+    uint32_t delta;
+    if(!ReadVarLen(t, delta))
+        return false;
+    t.tick += delta;
+    return true;
+}
+
+// The event t is at. True if it goes to the engine; tempo changes and the
+// end of the track are taken care of here.
+bool SmfPlayer::ParseEvent(Track& t, Event& e)
+{
+    uint8_t b;
+    if(!ReadByte(t, b))
+    {
+        t.done = true; // truncated
+        return false;
+    }
+
+    if(b == 0xFF)
+    {
+        uint8_t  type;
+        uint32_t len;
+        if(!ReadByte(t, type) || !ReadVarLen(t, len))
+        {
+            t.done = true;
+            return false;
+        }
+        if(type == 0x2F)
+        {
+            t.done = true;
+        }
+        else if(type == 0x51 && len == 3)
+        {
+            uint8_t a, m, l;
+            if(ReadByte(t, a) && ReadByte(t, m) && ReadByte(t, l))
+                SetTempo(t.tick, (uint32_t)a << 16 | (uint32_t)m << 8 | l);
+        }
+        else
+        {
+            Skip(t, len);
+        }
+        stats_.skipped++;
+        return false;
+    }
+    if(b == 0xF0 || b == 0xF7)
+    {
+        uint32_t len;
+        if(!ReadVarLen(t, len))
+        {
+            t.done = true;
+            return false;
+        }
+        Skip(t, len);
+        stats_.skipped++;
+        return false;
+    }
+
+    uint8_t status = t.running;
+    uint8_t d0     = b;
+    if(b & 0x80)
+    {
+        status = t.running = b;
+        if(!ReadByte(t, d0))
+        {
+            t.done = true;
+            return false;
+        }
+    }
+    if(!(status & 0x80))
+    {
+        t.done = true; // data with no running status: not a MIDI file we understand
+        return false;
+    }
+    uint8_t d1   = 0;
+    uint8_t kind = status & 0xF0;
+    if(kind != 0xC0 && kind != 0xD0 && !ReadByte(t, d1))
+    {
+        t.done = true;
+        return false;
+    }
+
+    bool play = (cfg_.channels >> (status & 0x0F)) & 1;
+    if(kind == 0xB0)
+        play = play && PassController(d0);
+    else if(kind != 0x80 && kind != 0x90 && kind != 0xE0)
+        play = false;
+    if(!play)
+    {
+        stats_.skipped++;
+        return false;
+    }
+    e.status = (uint8_t)(kind | (MidiCh::SYNTH - 1));
+    e.data0  = d0 & 0x7F;
+    e.data1  = d1 & 0x7F;
+    return true;
+}
+
+// The next event for the engine, in time order across the tracks; at the
+// end, a status-0 event at the end of the last track, or round again
+bool SmfPlayer::ParseNext(Event& e)
+{
+    while(!finished_)
+    {
+        if(heapSize_ == 0)
+        {
+            // A file with nothing to play would loop here forever
+            if(cfg_.loop && passEvents_ && endTick_)
+            {
+                double end = SampleAt(endTick_);
+                Rewind();
+                anchorSample_ = end;
+                anchorTick_   = 0;
+                SetTempo(0, kDefaultTempo);
+                stats_.loops++;
+                continue;
+            }
+            e.sample  = (uint32_t)(int64_t)(SampleAt(endTick_) + 0.5);
+            e.status  = 0;
+            e.data0   = 0;
+            e.data1   = 0;
+            finished_ = true;
+            return true;
+        }
+
+        Track&   t    = tracks_[heap_[0]];
+        uint32_t tick = t.tick;
+        bool     play = ParseEvent(t, e);
+        if(t.done || !ReadDelta(t))
+        {
+            t.done = true;
+            if(tick > endTick_)
+                endTick_ = tick;
+            heap_[0] = heap_[--heapSize_];
+        }
+        HeapDown(0);
+        if(play)
+        {
+            e.sample = (uint32_t)(int64_t)(SampleAt(tick) + 0.5);
+            passEvents_++;
+            return true;
+        }
+    }
+    return false;
+}
+
+double SmfPlayer::SampleAt(uint32_t tick) const
+{
+    return anchorSample_ + (double)(tick - anchorTick_) * samplesPerTick_;
+}
+
+void SmfPlayer::SetTempo(uint32_t tick, uint32_t usPerQuarter)
+{
+    anchorSample_ = SampleAt(tick);
+    anchorTick_   = tick;
+    if(division_ & 0x8000)
+    {
+        // SMPTE: -frames per second (29 is 29.97 drop frame), ticks per frame
+        int    fps  = -(int8_t)(division_ >> 8);
+        double rate = fps == 29 ? 29.97 : (double)fps;
+        samplesPerTick_ = (double)sampleRate_ / (rate * (double)(division_ & 0xFF));
+        return;
+    }
+    samplesPerTick_ = (double)sampleRate_ * (double)usPerQuarter / (1e6 * (double)division_);
+}
+
+bool SmfPlayer::Before(int a, int b) const
+{
+    const Track& ta = tracks_[heap_[a]];
+    const Track& tb = tracks_[heap_[b]];
+    return ta.tick < tb.tick || (ta.tick == tb.tick && heap_[a] < heap_[b]);
+}
+
+void SmfPlayer::HeapDown(int i)
+{
+    for(;;)
+    {
+        int l = 2 * i + 1, r = l + 1, m = i;
+        if(l < heapSize_ && Before(l, m))
+            m = l;
+        if(r < heapSize_ && Before(r, m))
+            m = r;
+        if(m == i)
+            return;
+        uint8_t x = heap_[i];
+        heap_[i]  = heap_[m];
+        heap_[m]  = x;
+        i         = m;
+    }
+}
+
+void SmfPlayer::HeapUp(int i)
+{
+    while(i > 0 && Before(i, (i - 1) / 2))
+    {
+        int     p = (i - 1) / 2;
+        uint8_t x = heap_[i];
+        heap_[i]  = heap_[p];
+        heap_[p]  = x;
+        i         = p;
+    }
+}
+
+// ---------------------------------------------------------------------
+// Audio callback
+// ---------------------------------------------------------------------
+void SmfPlayer::Render(float** out, size_t size)
+{
+    uint8_t state = state_.load(std::memory_order_acquire);
+    if(state == STATE_STOPPING)
+    {
+        Event e;
+        while(queue_.Pop(e))
+        {
+        }
+        ReleaseAll();
+        state_.store(STATE_IDLE, std::memory_order_release);
+    }
+    if(state != STATE_PLAYING)
+    {
+        RenderAudio(out, size);
+        return;
+    }
+
+    const uint32_t base = played_.load(std::memory_order_relaxed);
+    size_t         pos  = 0;
+    Event          e;
+    while(queue_.Peek(e))
+    {
+        int32_t dt = (int32_t)(e.sample - base);
+        if(dt >= (int32_t)size)
+            break;
+
+        size_t at = 0;
+        if(dt < (int32_t)pos)
+        {
+            // Parsed after the sample it was due at had been rendered
+            uint32_t late = (uint32_t)((int32_t)pos - dt);
+            stats_.late++;
+            if(late > stats_.maxLateSamples)
+                stats_.maxLateSamples = late;
+            at = pos;
+        }
+        else
+        {
+            at = (size_t)dt;
+        }
+        if(at > pos)
+        {
+            float* part[2] = {out[0] + pos, out[1] + pos};
+            RenderAudio(part, at - pos);
+            pos = at;
+        }
+        queue_.Pop(e);
+        if(e.status == 0)
+        {
+            ReleaseAll();
+            state_.store(STATE_IDLE, std::memory_order_release);
+            break;
+        }
+        Dispatch(e);
+    }
+    if(pos < size)
+    {
+        float* part[2] = {out[0] + pos, out[1] + pos};
+        RenderAudio(part, size - pos);
+    }
+    played_.store(base + (uint32_t)size, std::memory_order_release);
+}
+
+void SmfPlayer::Send(uint8_t status, uint8_t data0, uint8_t data1)
+{
+    if(cfg_.handle)
+        cfg_.handle(status, data0, data1);
+    else
+        HandleMidiMessage(status, data0, data1);
+}
+
+void SmfPlayer::Dispatch(const Event& e)
+{
+    uint8_t  kind = e.status & 0xF0;
+    uint32_t bit  = 1u << (e.data0 & 31);
+    if(kind == 0x90 && e.data1)
+        held_[e.data0 >> 5] |= bit;
+    else if(kind == 0x90 || kind == 0x80)
+        held_[e.data0 >> 5] &= ~bit;
+    else if(kind == 0xB0 && e.data0 == MidiCC::SUSTAIN_PEDAL)
+        sustained_ = e.data1 >= 64;
+    else if(kind == 0xE0)
+        bent_ = e.data0 || e.data1 != 0x40;
+    Send(e.status, e.data0, e.data1);
+    stats_.events++;
+}
+
+void SmfPlayer::ReleaseAll()
+{
+    const uint8_t ch = MidiCh::SYNTH - 1;
+    if(sustained_)
+        Send(0xB0 | ch, MidiCC::SUSTAIN_PEDAL, 0);
+    if(bent_)
+        Send(0xE0 | ch, 0, 0x40);
+    for(int n = 0; n < 128; n++)
+        if(held_[n >> 5] & (1u << (n & 31)))
+            Send(0x80 | ch, (uint8_t)n, 0);
+    memset(held_, 0, sizeof(held_));
+    sustained_ = false;
+    bent_      = false;
+}
@@ -0,0 +1,175 @@
+#pragma once
+
+// Standard MIDI File playback, for a backing track or a demo.
+//
+// The file is never loaded whole. Each track keeps a small read-ahead
+// buffer, refilled from the source (memory-mapped QSPI or a file on the
+// SD card) when its parser reaches the end of it. A min-heap of the
+// tracks' next event ticks merges them in time order; ties go to the
+// lower track, so a conductor track's tempo change comes before the notes
+// at the same tick. Tempo events move the tick-to-sample mapping as they
+// pass, which walks the tempo map in order. SMPTE-division files run at
+// their fixed rate.
+//
+// main() parses ahead in a background job (Fill()) into a queue of events
+// stamped with their sample position, up to Config::lookaheadMs ahead of
+// playback. The audio callback renders through Render(), which splits
+// the block at each due event as the jitter buffer does
+// (jitter_buffer.h), so timing is sample accurate. An event the parser
+// got to too late plays at the start of its block and counts as late.
+//
+// Events reach the engine through Config::handle, from Render() only.
+// The firmware renders the player inside the jitter buffer's render, so
+// the audio callback stays the engine's only caller (jitter_buffer.h).
+//
+// The engine only listens on MidiCh::SYNTH, so every played channel is
+// mapped onto it. Controllers other than mod wheel, volume and sustain
+// are skipped: GM files use 91 (reverb send) and friends, which mean
+// something else here (MidiCC). Stopping, or the end of the file,
+// releases whatever the file left held.
+//
+// No libDaisy dependency; the platform supplies the source.
+
+#include "midi_protocol.h"
+#include "midi_rx.h"
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+// Random-access bytes of the file. Calls come from main() only and may
+// block.
+class SmfSource
+{
+  public:
+    // Up to len bytes from offset; returns how many (short at the end)
+    virtual uint32_t Read(uint32_t offset, uint8_t* buf, uint32_t len) = 0;
+
+  protected:
+    ~SmfSource() = default;
+};
+
+class SmfPlayer
+{
+  public:
+    static const int      kMaxTracks   = 16;
+    static const uint32_t kTrackBuffer = 128; // read-ahead per track
+
+    struct Config
+    {
+        uint16_t channels    = 0xFFFF & ~(1u << 9); // file channels played; not GM drums
+        bool     loop        = false;
+        uint32_t lookaheadMs = 200; // parsed ahead of playback
+
+        // Takes each event at its sample; HandleMidiMessage() if null
+        void (*handle)(uint8_t status, uint8_t data0, uint8_t data1) = nullptr;
+    };
+
+    struct Stats
+    {
+        uint32_t events;      // handed to the engine
+        uint32_t late;        // parsed after their block had started
+        uint32_t maxLateSamples;
+        uint32_t skipped;     // meta, sysex, other channels and controllers
+        uint32_t reads;       // from the source
+        uint32_t loops;
+    };
+
+    // main(): reads the header and finds the tracks. False if the player
+    // is busy, or the file isn't format 0 or 1 with 1 to kMaxTracks
+    // tracks.
+    bool Load(SmfSource* source, float sampleRate, const Config& cfg);
+
+    // main(): plays the loaded file from the start. False if none is
+    // loaded or the player is busy.
+    bool Play();
+
+    // main(): the audio callback drops what is queued and releases held
+    // notes at its next block
+    void Stop();
+
+    // main(): the queue is short of the lookahead and the file has more
+    bool NeedsFill() const;
+
+    // Background job step: parses a few events into the queue. Returns
+    // true when there is nothing more to do for now.
+    bool Fill();
+
+    // Audio callback: renders size samples, handling the events due in
+    // them at their sample
+    void Render(float** out, size_t size);
+
+    bool         Busy() const { return state_.load(std::memory_order_acquire) != STATE_IDLE; }
+    uint32_t     PlayedMs() const; // since Play()
+    const Stats& GetStats() const { return stats_; }
+
+  private:
+    enum State : uint8_t
+    {
+        STATE_IDLE,
+        STATE_PLAYING,
+        STATE_STOPPING,
+    };
+
+    struct Event
+    {
+        uint32_t sample; // since Play()
+        uint8_t  status, data0, data1; // status 0: the end of the file
+    };
+
+    struct Track
+    {
+        uint32_t start, end; // event bytes in the file
+        uint32_t next;       // file offset of buf_[len]
+        uint8_t  buf[kTrackBuffer];
+        uint16_t pos, len;
+        uint8_t  running; // running status
+        bool     done;
+        uint32_t tick;    // of the event the parser is at
+    };
+
+    // Parser, main() only
+    void     Rewind();
+    bool     ReadByte(Track& t, uint8_t& b);
+    bool     ReadVarLen(Track& t, uint32_t& v);
+    void     Skip(Track& t, uint32_t n);
+    bool     ReadDelta(Track& t);
+    bool     ParseEvent(Track& t, Event& e);
+    bool     ParseNext(Event& e);
+    double   SampleAt(uint32_t tick) const;
+    void     SetTempo(uint32_t tick, uint32_t usPerQuarter);
+    bool     Before(int a, int b) const;
+    void     HeapDown(int i);
+    void     HeapUp(int i);
+
+    // Audio callback only
+    void Send(uint8_t status, uint8_t data0, uint8_t data1);
+    void Dispatch(const Event& e);
+    void ReleaseAll();
+
+    SmfSource* source_ = nullptr;
+    Config     cfg_;
+    float      sampleRate_ = 48000.0f;
+    uint16_t   division_   = 96;
+    int        numTracks_  = 0;
+    Track      tracks_[kMaxTracks];
+    uint8_t    heap_[kMaxTracks];
+    int        heapSize_   = 0;
+    uint32_t   endTick_    = 0; // latest end of track seen this pass
+    uint32_t   passEvents_ = 0;
+    bool       finished_   = false;
+    double     anchorSample_   = 0.0; // tempo map: SampleAt(anchorTick_)
+    uint32_t   anchorTick_     = 0;
+    double     samplesPerTick_ = 0.0;
+    Event      pending_        = {};
+    bool       havePending_    = false;
+
+    std::atomic<uint8_t>  state_{STATE_IDLE};
+    std::atomic<uint32_t> played_{0}; // samples, written by the callback
+    SpscRing<Event, 256>  queue_;
+
+    uint32_t held_[4]   = {}; // notes on, by the callback
+    bool     sustained_ = false;
+    bool     bent_      = false;
+    Stats    stats_     = {};
+};
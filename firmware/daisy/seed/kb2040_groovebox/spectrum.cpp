@@ -0,0 +1,225 @@
+#include "spectrum.h"
+
+#include <math.h>
+
+namespace
+{
+const float kPi = 3.14159265358979f;
+
+uint32_t BitReverse(uint32_t x, int bits)
+{
+    uint32_t r = 0;
+    for(int b = 0; b < bits; b++, x >>= 1)
+        r = (r << 1) | (x & 1);
+    return r;
+}
+} // namespace
+
+// ---------------------------------------------------------------------
+// SpectrumTap
+// ---------------------------------------------------------------------
+void SpectrumTap::Init(float sampleRate)
+{
+    decimate_ = (uint32_t)(sampleRate / 24000.0f + 0.5f);
+    if(decimate_ < 1)
+        decimate_ = 1;
+    rate_  = sampleRate / (float)decimate_;
+    scale_ = 0.5f / (float)decimate_;
+    count_ = 0;
+    acc_   = 0.0f;
+}
+
+// ---------------------------------------------------------------------
+// SpectrumAnalyzer
+// ---------------------------------------------------------------------
+void SpectrumAnalyzer::Init(int size, float rate, uint32_t (*ticks)())
+{
+    if(size != 256 && size != 512)
+        size = kMaxSize;
+    size_   = size;
+    half_   = size / 2;
+    stages_ = 0;
+    while((1 << stages_) < half_)
+        stages_++;
+    ticks_ = ticks;
+
+    for(int n = 0; n < size_; n++)
+        window_[n] = 0.5f - 0.5f * cosf(2.0f * kPi * (float)n / (float)size_);
+    for(int k = 0; k < half_ / 2; k++)
+    {
+        twRe_[k] = cosf(2.0f * kPi * (float)k / (float)half_);
+        twIm_[k] = -sinf(2.0f * kPi * (float)k / (float)half_);
+    }
+    for(int k = 0; k < half_; k++)
+    {
+        spRe_[k] = cosf(2.0f * kPi * (float)k / (float)size_);
+        spIm_[k] = -sinf(2.0f * kPi * (float)k / (float)size_);
+    }
+
+    // A full-scale sine through the Hann window (gain 1/2) peaks at
+    // size / 4 in its bin
+    fullScale_ = (float)size_ * (float)size_ / 16.0f;
+
+    // Band edges as bin indices; a band narrower than a bin still gets
+    // the one it falls in, so the low bands can repeat a bin
+    const float binHz = rate / (float)size_;
+    const float ratio = MidiSpectrum::HIGH_HZ / MidiSpectrum::LOW_HZ;
+    for(int b = 0; b < MidiSpectrum::NUM_BINS; b++)
+    {
+        float lo = MidiSpectrum::LOW_HZ
+                   * powf(ratio, (float)b / MidiSpectrum::NUM_BINS);
+        float hi = MidiSpectrum::LOW_HZ
+                   * powf(ratio, (float)(b + 1) / MidiSpectrum::NUM_BINS);
+        int   k0 = (int)(lo / binHz + 0.5f);
+        int   k1 = (int)(hi / binHz + 0.5f);
+        if(k0 < 1)
+            k0 = 1;
+        if(k0 > half_ - 1)
+            k0 = half_ - 1;
+        if(k1 <= k0)
+            k1 = k0 + 1;
+        if(k1 > half_)
+            k1 = half_;
+        bandLo_[b] = (uint16_t)k0;
+        bandHi_[b] = (uint16_t)k1;
+    }
+
+    phase_ = PHASE_DONE;
+    ready_ = false;
+    stats_ = Stats();
+}
+
+void SpectrumAnalyzer::Start()
+{
+    phase_      = PHASE_COPY;
+    stage_      = 0;
+    frameTicks_ = 0;
+    frameSteps_ = 0;
+}
+
+bool SpectrumAnalyzer::Step(const SpectrumTap& tap)
+{
+    uint32_t t0 = ticks_();
+    switch(phase_)
+    {
+        case PHASE_COPY:
+            CopyIn(tap);
+            phase_ = PHASE_STAGE;
+            break;
+        case PHASE_STAGE:
+            RunStage(stage_);
+            if(++stage_ == stages_)
+                phase_ = PHASE_SPLIT;
+            break;
+        case PHASE_SPLIT:
+            Split();
+            phase_ = PHASE_BANDS;
+            break;
+        case PHASE_BANDS:
+            Bands();
+            phase_ = PHASE_DONE;
+            break;
+        case PHASE_DONE: return true;
+    }
+    uint32_t dt = ticks_() - t0;
+    frameTicks_ += dt;
+    frameSteps_++;
+    if(dt > stats_.maxStepTicks)
+        stats_.maxStepTicks = dt;
+    if(phase_ != PHASE_DONE)
+        return false;
+
+    stats_.frames++;
+    stats_.stepsPerFrame  = frameSteps_;
+    stats_.lastFrameTicks = frameTicks_;
+    if(frameTicks_ > stats_.maxFrameTicks)
+        stats_.maxFrameTicks = frameTicks_;
+    ready_ = true;
+    return true;
+}
+
+bool SpectrumAnalyzer::Take(uint8_t* out)
+{
+    if(!ready_)
+        return false;
+    ready_ = false;
+    out[0] = 0xF0;
+    out[1] = MidiMeter::SYSEX_ID;
+    out[2] = MidiSpectrum::TYPE;
+    for(int b = 0; b < MidiSpectrum::NUM_BINS; b++)
+        out[3 + b] = levels_[b];
+    out[MidiSpectrum::FRAME_LEN - 1] = 0xF7;
+    return true;
+}
+
+// The latest size_ samples x[], windowed, go in as half_ complex points
+// z[n] = x[2n] + i x[2n+1], in bit-reversed order for the in-place stages
+void SpectrumAnalyzer::CopyIn(const SpectrumTap& tap)
+{
+    uint32_t start = tap.Written() - (uint32_t)size_;
+    for(int n = 0; n < half_; n++)
+    {
+        uint32_t r = BitReverse((uint32_t)n, stages_);
+        re_[r]     = tap.At(start + 2 * n) * window_[2 * n];
+        im_[r]     = tap.At(start + 2 * n + 1) * window_[2 * n + 1];
+    }
+}
+
+void SpectrumAnalyzer::RunStage(int stage)
+{
+    const int len    = 2 << stage;
+    const int span   = len / 2;
+    const int twStep = half_ / len;
+    for(int start = 0; start < half_; start += len)
+    {
+        for(int j = 0; j < span; j++)
+        {
+            float wr = twRe_[j * twStep];
+            float wi = twIm_[j * twStep];
+            int   a  = start + j;
+            int   b  = a + span;
+            float tr = re_[b] * wr - im_[b] * wi;
+            float ti = re_[b] * wi + im_[b] * wr;
+            re_[b]   = re_[a] - tr;
+            im_[b]   = im_[a] - ti;
+            re_[a] += tr;
+            im_[a] += ti;
+        }
+    }
+}
+
+// X[k] = E[k] + e^(-2 pi i k / size) O[k], with the even and odd sample
+// spectra taken apart from Z[k] and conj(Z[half - k])
+void SpectrumAnalyzer::Split()
+{
+    for(int k = 0; k < half_; k++)
+    {
+        int   m   = (half_ - k) & (half_ - 1);
+        float zr  = re_[k], zi = im_[k];
+        float cr  = re_[m], ci = -im_[m];
+        float er  = 0.5f * (zr + cr), ei = 0.5f * (zi + ci);
+        float orr = 0.5f * (zi - ci), oi = -0.5f * (zr - cr);
+        float xr  = er + spRe_[k] * orr - spIm_[k] * oi;
+        float xi  = ei + spRe_[k] * oi + spIm_[k] * orr;
+        power_[k] = xr * xr + xi * xi;
+    }
+}
+
+void SpectrumAnalyzer::Bands()
+{
+    for(int b = 0; b < MidiSpectrum::NUM_BINS; b++)
+    {
+        float peak = 0.0f;
+        for(int k = bandLo_[b]; k < bandHi_[b]; k++)
+            if(power_[k] > peak)
+                peak = power_[k];
+        float steps = 0.0f;
+        if(peak > 0.0f)
+            steps = (float)MidiSpectrum::LEVEL_MAX + 10.0f * log10f(peak / fullScale_);
+        if(steps < 0.0f)
+            steps = 0.0f;
+        if(steps > (float)MidiSpectrum::LEVEL_MAX)
+            steps = (float)MidiSpectrum::LEVEL_MAX;
+        levels_[b] = (uint8_t)(steps + 0.5f);
+    }
+}
@@ -0,0 +1,138 @@
+#pragma once
+
+// Spectrum for the KB2040's analyzer page (MidiSpectrum in
+// midi_protocol.h).
+//
+// SpectrumTap: the audio callback mixes the output to mono, decimates it
+// to about 24 kHz and writes it into a ring. The decimation is a plain
+// average over 1, 2 or 4 samples; the display doesn't need a sharp
+// anti-alias filter.
+//
+// SpectrumAnalyzer: one frame is a series of small steps for a
+// background job (background.h), never the audio callback: copy the
+// latest samples through a Hann window, one radix-2 stage at a time of
+// the half-size complex FFT that carries the real transform, split that
+// into bin powers, reduce them to the log-spaced bands. Each step is
+// timed, so the budget page can show the worst step (how long it can
+// hold up a slice) next to the cost of a whole frame.
+//
+// No libDaisy dependency; the platform supplies the cycle counter.
+
+#include "midi_protocol.h"
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+class SpectrumTap
+{
+  public:
+    static const uint32_t kRingSize = 2048; // twice the largest FFT
+
+    void Init(float sampleRate);
+
+    // Rate of the samples in the ring
+    float Rate() const { return rate_; }
+
+    // Audio callback, once per block after rendering
+    void Push(const float* left, const float* right, size_t size)
+    {
+        uint32_t w = write_.load(std::memory_order_relaxed);
+        for(size_t i = 0; i < size; i++)
+        {
+            acc_ += left[i] + right[i];
+            if(++count_ < decimate_)
+                continue;
+            ring_[w++ & (kRingSize - 1)] = acc_ * scale_;
+            acc_   = 0.0f;
+            count_ = 0;
+        }
+        write_.store(w, std::memory_order_release);
+    }
+
+    // main(): samples written so far, and sample i of them. Reading the
+    // latest kRingSize / 2 is safe while the callback writes the other
+    // half, as long as the reader isn't held up for that many samples.
+    uint32_t Written() const { return write_.load(std::memory_order_acquire); }
+    float    At(uint32_t i) const { return ring_[i & (kRingSize - 1)]; }
+
+  private:
+    float                 ring_[kRingSize] = {};
+    std::atomic<uint32_t> write_{0};
+    uint32_t              decimate_ = 2;
+    uint32_t              count_    = 0;
+    float                 acc_      = 0.0f;
+    float                 scale_    = 0.25f; // averages L + R over decimate_
+    float                 rate_     = 24000.0f;
+};
+
+class SpectrumAnalyzer
+{
+  public:
+    static const int kMaxSize = 1024;
+
+    struct Stats
+    {
+        uint32_t frames;
+        uint32_t stepsPerFrame;
+        uint32_t maxStepTicks;
+        uint32_t lastFrameTicks; // all steps of the last frame
+        uint32_t maxFrameTicks;
+    };
+
+    // size is 256, 512 or 1024 points; rate is the tap's
+    void Init(int size, float rate, uint32_t (*ticks)());
+
+    // main(): begins a frame; Step() until it returns true
+    void Start();
+
+    // One bounded step of the frame in progress. Returns true once it is
+    // finished and its bands are ready for Take().
+    bool Step(const SpectrumTap& tap);
+
+    // Encodes the last finished frame into out (MidiSpectrum::FRAME_LEN
+    // bytes). False if there is none since the last call.
+    bool Take(uint8_t* out);
+
+    int          Size() const { return size_; }
+    const Stats& GetStats() const { return stats_; }
+
+  private:
+    enum Phase : uint8_t
+    {
+        PHASE_COPY,
+        PHASE_STAGE, // stage_ of log2(size_ / 2)
+        PHASE_SPLIT,
+        PHASE_BANDS,
+        PHASE_DONE,
+    };
+
+    void CopyIn(const SpectrumTap& tap);
+    void RunStage(int stage);
+    void Split();
+    void Bands();
+
+    static const int kHalf = kMaxSize / 2;
+
+    int      size_   = kMaxSize;
+    int      half_   = kHalf;
+    int      stages_ = 9;
+    uint32_t (*ticks_)() = nullptr;
+
+    Phase    phase_      = PHASE_DONE;
+    int      stage_      = 0;
+    uint32_t frameTicks_ = 0;
+    uint32_t frameSteps_ = 0;
+    bool     ready_      = false;
+    Stats    stats_      = {};
+
+    float    window_[kMaxSize];
+    float    re_[kHalf], im_[kHalf];             // FFT work, bit-reversed in
+    float    twRe_[kHalf / 2], twIm_[kHalf / 2]; // e^(-2 pi i k / half)
+    float    spRe_[kHalf], spIm_[kHalf];         // e^(-2 pi i k / size)
+    float    power_[kHalf];                      // |X[k]|^2, k < size / 2
+    uint16_t bandLo_[MidiSpectrum::NUM_BINS];    // power_ range of each band
+    uint16_t bandHi_[MidiSpectrum::NUM_BINS];
+    float    fullScale_ = 1.0f;                  // power of a full-scale sine
+    uint8_t  levels_[MidiSpectrum::NUM_BINS] = {};
+};
@@ -0,0 +1,87 @@
+#!/bin/sh
+# stack_report.sh [build_dir] [root_function]
+#
+# Static stack usage from the .su and .ci files that -fstack-usage and
+# -fcallgraph-info=su leave next to each object ("make stack-report").
+# Prints the largest frames, then the deepest call path from the root
+# (default AudioCallback) with its total.
+#
+# Calls into code built without the flags (libDaisy, DaisySP, libc) and
+# calls through function pointers count as zero and are listed, as are
+# dynamic frames and recursion. The interrupt itself stacks 32 bytes, or
+# 104 with the FPU context, on top. Compare with the high-water mark the
+# firmware prints ('s' on the USB serial port).
+
+dir="${1:-build}"
+root="${2:-AudioCallback}"
+
+if ! ls "$dir"/*.su >/dev/null 2>&1; then
+    echo "no .su files in $dir (build with -fstack-usage first)" >&2
+    exit 2
+fi
+
+echo "== largest frames"
+cat "$dir"/*.su | awk -F'\t' '{ n = split($1, p, ":"); sig = p[4]; for (i = 5; i <= n; i++) sig = sig ":" p[i]; printf "%8d  %-16s %s\n", $2, $3, sig }' \
+    | sort -nr | head -15
+
+cat "$dir"/*.ci 2>/dev/null | awk -v root="$root" '
+    function field(s, key,    i, rest) {
+        i = index(s, key ": \"")
+        if (!i) return ""
+        rest = substr(s, i + length(key) + 3)
+        return substr(rest, 1, index(rest, "\"") - 1)
+    }
+    /^node:/ {
+        t = field($0, "title"); l = field($0, "label")
+        sig = l; i = index(sig, "\\n"); if (i) sig = substr(sig, 1, i - 1)
+        # Clones (.part, .constprop) get a useless label; keep the symbol,
+        # c++filt names it below
+        if (sig ~ /^[0-9]+\(\)$/) { sig = t; sub(/.*:/, "", sig) }
+        if (!(t in name) || name[t] == "") name[t] = sig
+        if (match(l, /[0-9]+ bytes \([a-z,]+\)/)) {
+            split(substr(l, RSTART, RLENGTH), w, " ")
+            size[t] = w[1] + 0
+            kind[t] = substr(w[3], 2, length(w[3]) - 2)
+        }
+        next
+    }
+    /^edge:/ {
+        s = field($0, "sourcename"); d = field($0, "targetname")
+        if (!((s, d) in seen)) { seen[s, d] = 1; out[s, ++nout[s]] = d }
+        next
+    }
+    # Deepest stack below f, f included; best[f] is the callee on that path
+    function depth(f,    k, c, d, m) {
+        if (f in memo) return memo[f]
+        if (f in onpath) { recursive[f] = 1; return 0 }
+        if (!(f in size)) { if (!(f in unknown)) nunknown++; unknown[f] = 1; return memo[f] = 0 }
+        if (kind[f] != "static") dynamic[f] = 1
+        onpath[f] = 1
+        m = 0
+        for (k = 1; k <= nout[f]; k++) {
+            c = out[f, k]
+            d = depth(c)
+            if (d > m || !(f in best)) { m = d; best[f] = c }
+        }
+        delete onpath[f]
+        return memo[f] = size[f] + m
+    }
+    END {
+        for (t in size)
+            if (index(name[t], root) && (r == "" || length(name[t]) < length(name[r])))
+                r = t
+        if (r == "") {
+            printf "\nno call graph for %s (build with -fcallgraph-info=su)\n", root
+            exit
+        }
+        total = depth(r)
+        printf "\n== deepest path from %s: %d bytes\n", name[r], total
+        for (f = r; f != ""; f = (f in best) ? best[f] : "")
+            printf "%8s  %s\n", (f in size) ? size[f] : "?", name[f] != "" ? name[f] : f
+        if (nunknown) {
+            printf "\n== reached, not measured (counted as 0)\n"
+            for (f in unknown) printf "          %s\n", name[f] != "" ? name[f] : f
+        }
+        for (f in dynamic) printf "dynamic frame: %s (%s)\n", name[f], kind[f]
+        for (f in recursive) printf "recursion through: %s\n", name[f]
+    }' | if command -v c++filt >/dev/null; then c++filt; else cat; fi
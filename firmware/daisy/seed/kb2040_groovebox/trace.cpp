@@ -0,0 +1,52 @@
+#include "trace.h"
+
+#include <stdio.h>
+
+#ifdef GROOVEBOX_TRACE
+TraceRing g_trace;
+#endif
+
+void TraceDumper::Start(const TraceRing* ring, uint32_t ticksPerSec)
+{
+    ring_   = ring;
+    hz_     = ticksPerSec;
+    end_    = ring->Next();
+    pos_    = end_ - TraceRing::kSize;
+    header_ = false;
+    // Before the ring first wraps, the slots past the last index are empty
+    if(end_ < TraceRing::kSize)
+        pos_ = 0;
+}
+
+bool TraceDumper::Step(LineFn line, void* ctx, int maxLines)
+{
+    char buf[96];
+    if(!header_)
+    {
+        snprintf(buf,
+                 sizeof(buf),
+                 "# groovebox trace hz=%lu records=%lu next=%lu",
+                 (unsigned long)hz_,
+                 (unsigned long)(end_ - pos_),
+                 (unsigned long)end_);
+        line(buf, ctx);
+        header_ = true;
+        maxLines--;
+    }
+    for(; maxLines > 0 && pos_ != end_; maxLines--, pos_++)
+    {
+        const TraceRecord& r = ring_->At(pos_);
+        snprintf(buf,
+                 sizeof(buf),
+                 "%08lx %02x %02x %04x",
+                 (unsigned long)r.time,
+                 r.type,
+                 r.arg0,
+                 r.arg1);
+        line(buf, ctx);
+    }
+    if(pos_ != end_ || maxLines <= 0)
+        return false;
+    line("# end", ctx);
+    return true;
+}
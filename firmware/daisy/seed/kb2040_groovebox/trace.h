@@ -0,0 +1,137 @@
+#pragma once
+
+// Always-on trace ring: a flight recorder for timing problems that only
+// show up on stage. Interrupts and main() append 8-byte binary records
+// (timestamp, type, two arguments) to a RAM ring; the newest kSize are
+// kept. A record is an atomic index bump, a clock read and three stores,
+// about 20 cycles on the Seed, so it can stay in the release build.
+//
+// An overrun calls Trigger(): the ring records half its size more and
+// then stops, so the glitch stays in it with what led up to it and what
+// followed. TraceDumper prints the ring as text (over the Daisy's USB
+// serial); firmware/host trace_decode turns that into timelines.
+//
+// Builds that record supply TraceNow(), a free-running 32-bit up-counter
+// (cycles on the Seed), and define GROOVEBOX_TRACE for the TRACE() macro;
+// in other builds it compiles to nothing. No libDaisy dependency.
+
+#include <atomic>
+#include <stdint.h>
+
+uint32_t TraceNow();
+
+enum TraceType : uint8_t
+{
+    TRACE_NONE = 0,
+    TRACE_MIDI_RX,        // DMA callback parsed a message: status, data0 | data1 << 8
+    TRACE_MIDI_DROP,      // ... and the queue was full: status, data0 | data1 << 8
+    TRACE_HANDLER_BEGIN,  // engine handling a message: status, data0 | data1 << 8
+    TRACE_HANDLER_END,    // status
+    TRACE_CALLBACK_BEGIN, // audio callback: -, block size
+    TRACE_CALLBACK_END,   // quality for the next block, load in 1/1000
+    TRACE_OVERRUN,        // callback started before the last one ended: -, us it ran over
+    TRACE_VOICE_STEAL,    // voice, note it was playing
+    TRACE_SHED_TAIL,      // governor fading a released tail: voice, note
+    TRACE_SHED_VOICE,     // governor fading a sounding voice: voice, note
+    TRACE_QUALITY,        // governor changed level: new level, load in 1/1000
+    TRACE_DUMP,           // a dump started; the last record in it
+    TRACE_NUM_TYPES,
+};
+
+struct TraceRecord
+{
+    uint32_t time;
+    uint8_t  type;
+    uint8_t  arg0;
+    uint16_t arg1;
+};
+
+class TraceRing
+{
+  public:
+    static const uint32_t kSize = 4096; // records, a power of two (32 KB)
+
+    // Any context, including interrupts that preempt each other. Each
+    // writer owns the slot its index bump gave it; a writer preempted
+    // between the bump and the clock read can leave its record a little
+    // out of time order, which the decoder sorts out.
+    void Record(uint8_t type, uint8_t arg0, uint16_t arg1)
+    {
+        if(stopped_.load(std::memory_order_relaxed))
+            return;
+        uint32_t i = next_.fetch_add(1, std::memory_order_relaxed);
+        if(triggered_.load(std::memory_order_relaxed) && i == stopAt_)
+            stopped_.store(true, std::memory_order_relaxed);
+        TraceRecord& r = buf_[i & (kSize - 1)];
+        r.time         = TraceNow();
+        r.type         = type;
+        r.arg0         = arg0;
+        r.arg1         = arg1;
+    }
+
+    // Stops recording once half the ring more has been written. Only the
+    // first trigger counts until Resume().
+    void Trigger()
+    {
+        if(triggered_.load(std::memory_order_relaxed))
+            return;
+        stopAt_ = next_.load(std::memory_order_relaxed) + kSize / 2;
+        triggered_.store(true, std::memory_order_relaxed);
+    }
+
+    // Main loop only. Stop() holds the ring still for a dump; a writer
+    // already past the check finishes its record.
+    void Stop() { stopped_.store(true, std::memory_order_relaxed); }
+    void Resume()
+    {
+        triggered_.store(false, std::memory_order_relaxed);
+        stopped_.store(false, std::memory_order_relaxed);
+    }
+
+    bool     Stopped() const { return stopped_.load(std::memory_order_relaxed); }
+    bool     Triggered() const { return triggered_.load(std::memory_order_relaxed); }
+    uint32_t Next() const { return next_.load(std::memory_order_relaxed); }
+    const TraceRecord& At(uint32_t index) const { return buf_[index & (kSize - 1)]; }
+
+  private:
+    std::atomic<uint32_t> next_{0};
+    std::atomic<bool>     stopped_{false};
+    std::atomic<bool>     triggered_{false};
+    uint32_t              stopAt_ = 0;
+    TraceRecord           buf_[kSize] = {};
+};
+
+// Prints a stopped ring a few lines per call, so a dump can run as a
+// background job (background.h) without holding up MIDI:
+//
+//   # groovebox trace hz=<ticks per second> records=<n> next=<index>
+//   <time> <type> <arg0> <arg1>      one per record, hex, oldest first
+//   # end
+class TraceDumper
+{
+  public:
+    typedef void (*LineFn)(const char* line, void* ctx);
+
+    void Start(const TraceRing* ring, uint32_t ticksPerSec);
+
+    // Prints up to maxLines; returns true once the end line is out
+    bool Step(LineFn line, void* ctx, int maxLines);
+
+  private:
+    const TraceRing* ring_ = nullptr;
+    uint32_t         hz_   = 0;
+    uint32_t         pos_  = 0, end_ = 0;
+    bool             header_ = false;
+};
+
+#ifdef GROOVEBOX_TRACE
+
+extern TraceRing g_trace;
+
+#define TRACE(type, arg0, arg1) g_trace.Record((type), (uint8_t)(arg0), (uint16_t)(arg1))
+
+#else
+
+#define TRACE(type, arg0, arg1) ((void)0)
+
+#endif
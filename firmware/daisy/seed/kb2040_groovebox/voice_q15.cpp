@@ -0,0 +1,215 @@
+#include "voice_q15.h"
+
+#include <math.h>
+
+// Adsr's attack target and its release target, Q30
+static const int32_t kAttackTarget  = (int32_t)(1.01 * (1 << 30));
+static const int32_t kReleaseTarget = -(int32_t)(0.01 * (1 << 30));
+
+// Below this (-80 dB) with the gate off a voice is over, as in the float
+// voices
+static const int32_t kEnvFloor = (int32_t)(0.0001 * (1 << 30));
+
+void VoiceBankQ15::Init(int numVoices, float samplerate)
+{
+    numVoices_  = numVoices < kMaxVoices ? numVoices & ~1 : kMaxVoices;
+    samplerate_ = samplerate;
+    SetEnvelope(0.1f, 0.1f, 0.7f, 0.1f);
+    SetFadeTime(0.005f);
+    for(int v = 0; v < kMaxVoices; v++)
+    {
+        phase1_[v] = phase2_[v] = 0;
+        inc1_[v] = inc2_[v] = 0;
+        step1_[v] = step2_[v] = 0;
+        note_[v]   = -1;
+        env_[v]    = 0;
+        mode_[v]   = IDLE;
+        gate_[v]   = false;
+        fade_[v]   = 0;
+        fading_[v] = false;
+        done_[v]   = false;
+    }
+}
+
+int32_t VoiceBankQ15::Coefficient(float d0)
+{
+    return d0 >= 1.0f ? INT32_MAX : (int32_t)(d0 * 2147483648.0f);
+}
+
+// Adsr's coefficients: the attack covers the way to 1.01 in its time, the
+// others fall by 1/e in theirs. Zero time is an instant step.
+void VoiceBankQ15::SetEnvelope(float attack, float decay, float sustain, float release)
+{
+    float perSecond = samplerate_;
+    attackCoef_
+        = Coefficient(attack > 0.0f ? 1.0f - expf(logf(1.0f - 1.0f / 1.01f) / (attack * perSecond))
+                                    : 1.0f);
+    decayCoef_   = Coefficient(decay > 0.0f ? 1.0f - expf(-1.0f / (decay * perSecond)) : 1.0f);
+    releaseCoef_ = Coefficient(release > 0.0f ? 1.0f - expf(-1.0f / (release * perSecond)) : 1.0f);
+
+    // Adsr sends a zero sustain below zero, so the decay ends the voice
+    if(sustain <= 0.0f)
+        sustain_ = kReleaseTarget;
+    else
+        sustain_ = (int32_t)((sustain < 1.0f ? sustain : 1.0f) * (float)kOne);
+}
+
+void VoiceBankQ15::SetFadeTime(float seconds)
+{
+    fadeStep_ = (int32_t)lrintf(32768.0f / (seconds * samplerate_));
+    if(fadeStep_ < 1)
+        fadeStep_ = 1;
+}
+
+uint32_t VoiceBankQ15::Increment(float hz) const
+{
+    float cycles = hz / samplerate_; // per sample
+    if(cycles <= 0.0f)
+        return 0;
+    if(cycles >= 0.5f)
+        return 0x80000000u;
+    return (uint32_t)(cycles * 4294967296.0f);
+}
+
+// Chunk setup: jumps to a new note's pitch, ramps to the end increments
+// otherwise, and starts or stops the shed fade
+void VoiceBankQ15::Begin(int v, const Control& c, size_t n)
+{
+    done_[v] = false;
+    if(!c.on)
+        return;
+    if(c.note != note_[v])
+    {
+        note_[v] = c.note;
+        inc1_[v] = c.inc1;
+        inc2_[v] = c.inc2;
+    }
+    step1_[v] = (int32_t)(c.inc1 - inc1_[v]) / (int32_t)n;
+    step2_[v] = (int32_t)(c.inc2 - inc2_[v]) / (int32_t)n;
+
+    if(c.shedding && !fading_[v])
+        fade_[v] = 32768;
+    fading_[v] = c.shedding;
+}
+
+// Adsr::Process() in Q30. The coefficient product comes out Q29 (Q31 *
+// Q30 >> 32), so it is doubled back.
+int32_t VoiceBankQ15::StepEnvelope(int v, bool gate)
+{
+    if(gate && !gate_[v])
+        mode_[v] = ATTACK;
+    else if(!gate && gate_[v])
+        mode_[v] = RELEASE;
+    gate_[v] = gate;
+
+    int32_t x = env_[v];
+    switch(mode_[v])
+    {
+        case IDLE: return 0;
+        case ATTACK:
+            x += dsp::Smmulr(attackCoef_, kAttackTarget - x) * 2;
+            if(x > kOne)
+            {
+                mode_[v] = DECAY;
+                x        = kOne;
+            }
+            break;
+        case DECAY:
+        case RELEASE:
+            x += dsp::Smmulr(mode_[v] == DECAY ? decayCoef_ : releaseCoef_,
+                             (mode_[v] == DECAY ? sustain_ : kReleaseTarget) - x)
+                 * 2;
+            if(x < 0)
+            {
+                mode_[v] = IDLE;
+                x        = 0;
+            }
+            break;
+    }
+    env_[v] = x;
+    return x;
+}
+
+// One sample's gain, Q15, or 0 for a voice that is off or over
+int32_t VoiceBankQ15::Gain(int v, const Control& c)
+{
+    if(!c.on || done_[v])
+        return 0;
+    int32_t env = StepEnvelope(v, c.gate);
+    if(!c.gate && env < kEnvFloor)
+    {
+        done_[v] = true;
+        return 0;
+    }
+    int32_t amp = c.amp;
+    if(fading_[v])
+    {
+        fade_[v] -= fadeStep_;
+        if(fade_[v] <= 0)
+        {
+            done_[v] = true;
+            return 0;
+        }
+        amp = (amp * fade_[v]) >> 15;
+    }
+    return dsp::Smulwb(env, amp) >> 14; // Q30 * Q15 >> 16 is Q29
+}
+
+void VoiceBankQ15::Advance(int v, const Control& c, bool twoOsc)
+{
+    if(!c.on || done_[v])
+        return;
+    inc1_[v] += (uint32_t)step1_[v];
+    phase1_[v] += inc1_[v];
+    if(twoOsc)
+    {
+        inc2_[v] += (uint32_t)step2_[v];
+        phase2_[v] += inc2_[v];
+    }
+}
+
+void VoiceBankQ15::Render(const Control* ctl, bool twoOsc, int64_t* mix, size_t n)
+{
+    for(int a = 0; a < numVoices_; a += 2)
+    {
+        const int b = a + 1;
+        Begin(a, ctl[a], n);
+        Begin(b, ctl[b], n);
+        if(!ctl[a].on && !ctl[b].on)
+            continue;
+
+        for(size_t i = 0; i < n; i++)
+        {
+            Q15x2 gain = dsp::Pack(Gain(a, ctl[a]), Gain(b, ctl[b]));
+            Q15x2 sig  = dsp::Pack(Saw(phase1_[a]), Saw(phase1_[b]));
+            if(twoOsc)
+                sig = dsp::Qadd16(sig, dsp::Pack(Tri(phase2_[a]), Tri(phase2_[b])));
+            Advance(a, ctl[a], twoOsc);
+            Advance(b, ctl[b], twoOsc);
+            mix[i] = dsp::Smlald(sig, gain, mix[i]);
+        }
+    }
+}
+
+void VoiceBankQ15::RenderScalar(const Control* ctl, bool twoOsc, int64_t* mix, size_t n)
+{
+    for(int v = 0; v < numVoices_; v++)
+    {
+        Begin(v, ctl[v], n);
+        if(!ctl[v].on)
+            continue;
+
+        for(size_t i = 0; i < n; i++)
+        {
+            int32_t gain = Gain(v, ctl[v]);
+            int32_t sig  = Saw(phase1_[v]);
+            if(twoOsc)
+            {
+                sig += Tri(phase2_[v]);
+                sig = sig > 32767 ? 32767 : sig < -32768 ? -32768 : sig;
+            }
+            Advance(v, ctl[v], twoOsc);
+            mix[i] += (int64_t)sig * gain;
+        }
+    }
+}
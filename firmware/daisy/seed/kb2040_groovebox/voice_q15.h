@@ -0,0 +1,125 @@
+#pragma once
+
+// Fixed-point synth voices: the float voices' two oscillators (a saw, and
+// a triangle detuned above it) and ADSR, in integer arithmetic with two
+// voices to a 32-bit word, so the M7's DSP extension (dsp_simd.h) sums a
+// pair's oscillators with one QADD16 and mixes the pair with one SMLALD.
+// An engine built with GROOVEBOX_Q15_VOICES renders its voices here
+// instead of through DaisySP (see Engine::RenderVoicesQ15()).
+//
+// Formats:
+//   phase        unsigned, 2^32 to a cycle
+//   envelope     Q30, so the attack can aim past full scale as Adsr's does
+//   oscillators  Q15 lanes at half scale, so the pair's sum fits
+//   gain         Q15: envelope * amp * shed fade
+//   mix          Q30 in 64 bits, any number of voices without wrapping
+//
+// The envelope follows DaisySP's Adsr: one-pole segments with its
+// coefficients, the attack aimed at 1.01 and ending at full scale, decay
+// towards the sustain level, release towards -0.01 and ending at zero, and
+// a rising gate restarting the attack from wherever the level is.
+//
+// Pitch is set per chunk of at most kChunk samples: the caller gives each
+// voice's phase increments for the end of the chunk and they ramp there
+// linearly, where the float voices run mtof() per sample per oscillator.
+// A voice given a new note jumps straight to its pitch.
+//
+// Render() and RenderScalar() give the same bits. The second keeps each
+// voice in its own variables and adds it in alone; host checks
+// (q15_check) use it as the model for the packed path.
+//
+// No libDaisy or DaisySP dependency.
+
+#include "dsp_simd.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+class VoiceBankQ15
+{
+  public:
+    static const int    kMaxVoices = 16; // even: voices go in pairs
+    static const size_t kChunk     = 32; // most samples per Render()
+
+    // One voice's inputs for a chunk
+    struct Control
+    {
+        bool     on;       // rendered; off voices add nothing and keep their state
+        bool     gate;     // as Adsr::Process(gate)
+        bool     shedding; // fade out over the fade time
+        int      note;     // a different one jumps to inc1 and inc2
+        uint32_t inc1;     // phase increments for the end of the chunk
+        uint32_t inc2;     // (Increment())
+        int16_t  amp;      // Q15, velocity times the oscillator level
+    };
+
+    // numVoices even, up to kMaxVoices. Envelope times default as Adsr's.
+    void Init(int numVoices, float samplerate);
+
+    // Seconds, and the sustain level 0..1
+    void SetEnvelope(float attack, float decay, float sustain, float release);
+    void SetFadeTime(float seconds);
+
+    uint32_t Increment(float hz) const;
+
+    // Adds n samples (up to kChunk) of the voices into mix, Q30. With
+    // twoOsc false only the saw sounds and the triangle's phase holds.
+    void Render(const Control* ctl, bool twoOsc, int64_t* mix, size_t n);
+    void RenderScalar(const Control* ctl, bool twoOsc, int64_t* mix, size_t n);
+
+    // After a render: the voice released to silence or faded out during
+    // it, and stopped there
+    bool Done(int v) const { return done_[v]; }
+
+    // Envelope at the voice's last sample, 0..1
+    float Envelope(int v) const { return (float)env_[v] * (1.0f / 1073741824.0f); }
+    bool  InAttack(int v) const { return mode_[v] == ATTACK; }
+
+  private:
+    enum Mode : uint8_t
+    {
+        IDLE,
+        ATTACK,
+        DECAY,
+        RELEASE,
+    };
+
+    static const int32_t kOne = 1 << 30; // Q30
+
+    static int32_t Coefficient(float d0);
+
+    void    Begin(int v, const Control& c, size_t n);
+    int32_t StepEnvelope(int v, bool gate);
+    int32_t Gain(int v, const Control& c);
+    void    Advance(int v, const Control& c, bool twoOsc);
+
+    // Half-scale Q15 waveforms, falling saw and triangle as DaisySP's
+    static int32_t Saw(uint32_t phase) { return 16384 - (int32_t)(phase >> 17); }
+    static int32_t Tri(uint32_t phase)
+    {
+        int32_t t = (int32_t)(phase >> 16) - 32768;
+        return (t < 0 ? -t : t) - 16384;
+    }
+
+    int   numVoices_  = 0;
+    float samplerate_ = 48000.0f;
+
+    // Envelope coefficients, Q31, and the sustain level, Q30
+    int32_t attackCoef_  = 0;
+    int32_t decayCoef_   = 0;
+    int32_t releaseCoef_ = 0;
+    int32_t sustain_     = 0;
+    int32_t fadeStep_    = 0; // Q15 per sample
+
+    // Per voice
+    uint32_t phase1_[kMaxVoices], phase2_[kMaxVoices];
+    uint32_t inc1_[kMaxVoices], inc2_[kMaxVoices];
+    int32_t  step1_[kMaxVoices], step2_[kMaxVoices]; // increment ramps
+    int      note_[kMaxVoices];
+    int32_t  env_[kMaxVoices];
+    Mode     mode_[kMaxVoices];
+    bool     gate_[kMaxVoices];
+    int32_t  fade_[kMaxVoices]; // Q15, while fading_
+    bool     fading_[kMaxVoices];
+    bool     done_[kMaxVoices];
+};
@@ -0,0 +1,757 @@
+// batch_render: renders manifests of scenarios through the Daisy engine on
+// every core, for sound design and regression runs.
+//
+//   batch_render [-j threads] [-o dir] [-b 16|24] [-n] [-S] manifest ...
+//
+// Manifest: one command per line, '#' starts a comment:
+//   scenario <name> [seconds] [rate] [block]   (4 s, 48000 Hz, 48 by default)
+//   vary <cc> <value> ...
+//   <t_ms> on <note> <velocity> [length_ms]
+//   <t_ms> off <note>
+//   <t_ms> cc <cc> <value>
+//   <t_ms> ramp <cc> <from> <to> <ms>          (a step per block)
+//   <t_ms> bend <-8192..8191>
+// Commands belong to the scenario line above them. Each vary line
+// multiplies its scenario: one render per value, with the controller set
+// before anything else at 0 ms, and _<cc>-<value> added to the render's
+// name. Several vary lines give every combination, so one scenario can
+// cover every drum kit, a preset grid or a CC sweep. MIDI goes to the
+// synth channel at its exact sample (the block is split there, as the
+// firmware's jitter buffer does).
+//
+// Every render gets a fresh Engine (engine.h); every worker keeps one
+// arena and one WAV recorder. Renders are dealt out round-robin, longest
+// first. Each worker takes its own next longest; one that runs out steals
+// the shortest render left with the worker that has most left, so the
+// long ones start early and the short ones fill in the gaps at the end.
+//
+// Output, in -o (default "."):
+//   <name>.wav    the render, through the firmware's recorder (recorder.h),
+//                 24-bit unless -b 16; -n skips them
+//   results.json  per render: peak and RMS per channel (dBFS, null for
+//                 silence), clipped samples, engine CPU time per sample
+//                 frame (thread time, MIDI included), times real time, a
+//                 hash of the float output, which worker rendered it and
+//                 whether it was stolen; and the batch's totals
+//
+// -S measures scaling instead: the batch without WAVs at 1, 2, 4 ... up to
+// -j workers, with the speedup and efficiency at each, and checks that
+// every render's hash is the same at every worker count.
+//
+// Exits 1 on a bad manifest, a file that can't be written, or (-S) a
+// render that changed with the worker count.
+#include "engine.h"
+#include "midi_protocol.h"
+#include "recorder.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <ctype.h>
+#include <deque>
+#include <math.h>
+#include <memory>
+#include <mutex>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <thread>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <xmmintrin.h>
+#endif
+
+namespace
+{
+const uint32_t kRingBytes = 1u << 20; // per worker's recorder
+
+struct Options
+{
+    int         threads = 0; // 0: one per core
+    std::string outDir  = ".";
+    int         bits    = 24;
+    bool        wavs    = true;
+    bool        scaling = false;
+};
+
+struct Event
+{
+    uint64_t sample;
+    uint8_t  status, data0, data1;
+};
+
+struct Job
+{
+    std::string        name;
+    std::string        manifest;
+    double             seconds;
+    float              rate;
+    size_t             block;
+    std::vector<Event> events; // by sample
+};
+
+struct Result
+{
+    double   peak[2];
+    double   sumSq[2];
+    uint64_t clipped;
+    uint64_t frames;
+    double   cpuNs;
+    uint64_t hash;
+    int      worker;
+    bool     stolen;
+};
+
+// ----------------------------------------------------------------------
+// Manifest
+// ----------------------------------------------------------------------
+struct Command
+{
+    double      tMs;
+    std::string op;
+    int         a, b, c; // the numbers after op, in order
+    double      ms;
+};
+
+struct Scenario
+{
+    std::string                   name;
+    double                        seconds = 4.0;
+    float                         rate    = 48000.0f;
+    size_t                        block   = 48;
+    std::vector<std::vector<int>> vary; // cc, then its values
+    std::vector<Command>          commands;
+};
+
+bool ValidName(const std::string& s)
+{
+    if(s.empty())
+        return false;
+    for(char c : s)
+        if(!isalnum((unsigned char)c) && c != '_' && c != '-' && c != '.')
+            return false;
+    return true;
+}
+
+bool ValidRate(float rate)
+{
+    for(uint32_t r : MidiAudio::SAMPLE_RATES)
+        if(rate == (float)r)
+            return true;
+    return false;
+}
+
+uint64_t ToSample(double ms, float rate)
+{
+    return (uint64_t)llround(ms * (double)rate / 1000.0);
+}
+
+// One render per combination of the vary values
+void Expand(const Scenario& sc, const std::string& manifest, std::vector<Job>& jobs)
+{
+    const uint8_t ch    = MidiCh::SYNTH - 1;
+    size_t        count = 1;
+    for(const auto& v : sc.vary)
+        count *= v.size() - 1;
+    for(size_t n = 0; n < count; n++)
+    {
+        Job job;
+        job.name     = sc.name;
+        job.manifest = manifest;
+        job.seconds  = sc.seconds;
+        job.rate     = sc.rate;
+        job.block    = sc.block;
+        size_t pick  = n;
+        for(const auto& v : sc.vary)
+        {
+            int value = v[1 + pick % (v.size() - 1)];
+            pick /= v.size() - 1;
+            job.name += "_" + std::to_string(v[0]) + "-" + std::to_string(value);
+            job.events.push_back({0, (uint8_t)(0xB0 | ch), (uint8_t)v[0], (uint8_t)value});
+        }
+        for(const Command& c : sc.commands)
+        {
+            uint64_t at = ToSample(c.tMs, sc.rate);
+            if(c.op == "on")
+            {
+                job.events.push_back({at, (uint8_t)(0x90 | ch), (uint8_t)c.a, (uint8_t)c.b});
+                if(c.ms > 0.0)
+                    job.events.push_back({ToSample(c.tMs + c.ms, sc.rate),
+                                          (uint8_t)(0x80 | ch), (uint8_t)c.a, 0});
+            }
+            else if(c.op == "off")
+                job.events.push_back({at, (uint8_t)(0x80 | ch), (uint8_t)c.a, 0});
+            else if(c.op == "cc")
+                job.events.push_back({at, (uint8_t)(0xB0 | ch), (uint8_t)c.a, (uint8_t)c.b});
+            else if(c.op == "bend")
+            {
+                int v = c.a + 8192;
+                job.events.push_back({at, (uint8_t)(0xE0 | ch), (uint8_t)(v & 0x7F), (uint8_t)(v >> 7)});
+            }
+            else // ramp: a value per block, repeats left out
+            {
+                uint64_t end  = ToSample(c.tMs + c.ms, sc.rate);
+                int      last = -1;
+                for(uint64_t s = at; s <= end; s += sc.block)
+                {
+                    double f = end > at ? (double)(s - at) / (double)(end - at) : 1.0;
+                    int    v = (int)lround(c.b + (c.c - c.b) * f);
+                    if(v != last)
+                        job.events.push_back({s, (uint8_t)(0xB0 | ch), (uint8_t)c.a, (uint8_t)v});
+                    last = v;
+                }
+                if(last != c.c)
+                    job.events.push_back({end, (uint8_t)(0xB0 | ch), (uint8_t)c.a, (uint8_t)c.c});
+            }
+        }
+        std::stable_sort(job.events.begin(), job.events.end(), [](const Event& x, const Event& y) {
+            return x.sample < y.sample;
+        });
+        jobs.push_back(job);
+    }
+}
+
+bool LoadManifest(const std::string& path, std::vector<Job>& jobs, std::string& err)
+{
+    FILE* f = fopen(path.c_str(), "r");
+    if(!f)
+    {
+        err = path + ": cannot open";
+        return false;
+    }
+    std::string manifest = path.substr(path.find_last_of('/') + 1);
+    Scenario    sc;
+    bool        have = false;
+    char        line[512];
+    int         lineNo = 0;
+    bool        ok     = true;
+    while(ok && fgets(line, sizeof(line), f))
+    {
+        lineNo++;
+        if(char* hash = strchr(line, '#'))
+            *hash = 0;
+        char* tok[16];
+        int   n = 0;
+        for(char* t = strtok(line, " \t\r\n"); t && n < 16; t = strtok(nullptr, " \t\r\n"))
+            tok[n++] = t;
+        if(n == 0)
+            continue;
+
+        std::string where = path + ":" + std::to_string(lineNo) + ": ";
+        std::string cmd   = tok[0];
+        if(cmd == "scenario")
+        {
+            if(have)
+                Expand(sc, manifest, jobs);
+            sc   = Scenario();
+            have = true;
+            if(n < 2 || n > 5 || !ValidName(tok[1]))
+            {
+                err = where + "scenario <name> [seconds] [rate] [block]";
+                ok  = false;
+                break;
+            }
+            sc.name = tok[1];
+            if(n > 2)
+                sc.seconds = atof(tok[2]);
+            if(n > 3)
+                sc.rate = (float)atof(tok[3]);
+            if(n > 4)
+                sc.block = (size_t)atol(tok[4]);
+            if(sc.seconds <= 0.0 || sc.seconds > 600.0 || !ValidRate(sc.rate) || sc.block < 1
+               || sc.block > 1024)
+            {
+                err = where + "seconds up to 600, a rate the Daisy runs at, block 1 to 1024";
+                ok  = false;
+            }
+            continue;
+        }
+        if(!have)
+        {
+            err = where + "a scenario line comes first";
+            ok  = false;
+            break;
+        }
+        if(cmd == "vary")
+        {
+            std::vector<int> v;
+            for(int i = 1; i < n; i++)
+                v.push_back(atoi(tok[i]));
+            bool inRange = n >= 3;
+            for(int x : v)
+                inRange = inRange && x >= 0 && x <= 127;
+            if(!inRange)
+            {
+                err = where + "vary <cc> <value> ...";
+                ok  = false;
+            }
+            sc.vary.push_back(v);
+            continue;
+        }
+
+        Command c    = {atof(tok[0]), n > 1 ? tok[1] : "", 0, 0, 0, 0.0};
+        int     args = n - 2;
+        c.a          = args > 0 ? atoi(tok[2]) : 0;
+        c.b          = args > 1 ? atoi(tok[3]) : 0;
+        c.c          = args > 2 ? atoi(tok[4]) : 0;
+        bool good = c.tMs >= 0.0;
+        if(c.op == "on")
+        {
+            c.ms = args > 2 ? atof(tok[4]) : 0.0;
+            good = good && (args == 2 || args == 3) && c.a >= 0 && c.a <= 127 && c.b >= 1
+                   && c.b <= 127 && c.ms >= 0.0;
+        }
+        else if(c.op == "off")
+            good = good && args == 1 && c.a >= 0 && c.a <= 127;
+        else if(c.op == "cc")
+            good = good && args == 2 && c.a >= 0 && c.a <= 127 && c.b >= 0 && c.b <= 127;
+        else if(c.op == "bend")
+            good = good && args == 1 && c.a >= -8192 && c.a <= 8191;
+        else if(c.op == "ramp")
+        {
+            c.ms = args == 4 ? atof(tok[5]) : -1.0;
+            good = good && args == 4 && c.a >= 0 && c.a <= 127 && c.b >= 0 && c.b <= 127
+                   && c.c >= 0 && c.c <= 127 && c.ms >= 0.0;
+        }
+        else
+            good = false;
+        if(!good)
+        {
+            err = where + "bad command";
+            ok  = false;
+        }
+        sc.commands.push_back(c);
+    }
+    fclose(f);
+    if(ok && have)
+        Expand(sc, manifest, jobs);
+    if(ok && !have)
+    {
+        err = path + ": no scenarios";
+        ok  = false;
+    }
+    return ok;
+}
+
+// ----------------------------------------------------------------------
+// Work-stealing pool
+// ----------------------------------------------------------------------
+class StealingPool
+{
+  public:
+    explicit StealingPool(int workers) : queues_(workers)
+    {
+        for(auto& q : queues_)
+            q.reset(new Queue);
+    }
+
+    // Round-robin, in the order given (longest first). Before the
+    // workers start.
+    void Deal(const std::vector<int>& order)
+    {
+        for(size_t i = 0; i < order.size(); i++)
+            queues_[i % queues_.size()]->jobs.push_back(order[i]);
+        for(auto& q : queues_)
+            q->left.store(q->jobs.size(), std::memory_order_relaxed);
+    }
+
+    // The worker's next render: its own front, else the back of the
+    // fullest other queue. False when every queue is empty.
+    bool Next(int worker, int& job, bool& stolen)
+    {
+        {
+            Queue&                      own = *queues_[worker];
+            std::lock_guard<std::mutex> lock(own.m);
+            if(!own.jobs.empty())
+            {
+                job = own.jobs.front();
+                own.jobs.pop_front();
+                own.left.store(own.jobs.size(), std::memory_order_relaxed);
+                stolen = false;
+                return true;
+            }
+        }
+        for(;;)
+        {
+            int    victim = -1;
+            size_t most   = 0;
+            for(size_t w = 0; w < queues_.size(); w++)
+            {
+                size_t left = queues_[w]->left.load(std::memory_order_relaxed);
+                if((int)w != worker && left > most)
+                {
+                    victim = (int)w;
+                    most   = left;
+                }
+            }
+            if(victim < 0)
+                return false;
+            Queue&                      q = *queues_[victim];
+            std::lock_guard<std::mutex> lock(q.m);
+            if(q.jobs.empty())
+                continue; // taken meanwhile; look again
+            job = q.jobs.back();
+            q.jobs.pop_back();
+            q.left.store(q.jobs.size(), std::memory_order_relaxed);
+            stolen = true;
+            return true;
+        }
+    }
+
+  private:
+    struct Queue
+    {
+        std::mutex          m;
+        std::deque<int>     jobs;
+        std::atomic<size_t> left{0}; // jobs.size(), for thieves to scan unlocked
+    };
+
+    std::vector<std::unique_ptr<Queue>> queues_;
+};
+
+// ----------------------------------------------------------------------
+// Rendering
+// ----------------------------------------------------------------------
+class FileStorage : public RecorderStorage
+{
+  public:
+    bool Open(const char* name) override
+    {
+        file_ = fopen(name, "w+b");
+        return file_ != nullptr;
+    }
+    bool Write(const uint8_t* data, uint32_t bytes) override
+    {
+        return fwrite(data, 1, bytes, file_) == bytes;
+    }
+    bool Rewrite(uint32_t offset, const uint8_t* data, uint32_t bytes) override
+    {
+        long end = ftell(file_);
+        return fseek(file_, (long)offset, SEEK_SET) == 0
+               && fwrite(data, 1, bytes, file_) == bytes
+               && fseek(file_, end, SEEK_SET) == 0;
+    }
+    bool Close() override
+    {
+        bool ok = fclose(file_) == 0;
+        file_   = nullptr;
+        return ok;
+    }
+
+  private:
+    FILE* file_ = nullptr;
+};
+
+double ThreadNs()
+{
+    timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+// What one worker keeps between renders
+struct Worker
+{
+    std::vector<uint8_t> arena;
+    std::vector<uint8_t> ring;
+    std::vector<float>   l, r;
+    WavRecorder          recorder;
+    FileStorage          storage;
+};
+
+bool Render(const Job& job, const Options& o, bool wav, Worker& w, Result& res)
+{
+    std::unique_ptr<Engine> engine(new Engine);
+    w.arena.resize(std::max(w.arena.size(), Engine::ArenaBytes(job.rate)));
+    EngineArena arena(w.arena.data(), w.arena.size());
+    if(!engine->Init(job.rate, arena))
+        return false;
+
+    std::string path = o.outDir + "/" + job.name + ".wav";
+    if(wav)
+    {
+        w.ring.resize(kRingBytes);
+        w.recorder.Init(w.ring.data(), kRingBytes, job.rate, &w.storage);
+        if(!w.recorder.Start(path.c_str(), o.bits))
+            return false;
+    }
+
+    w.l.resize(job.block);
+    w.r.resize(job.block);
+    uint64_t total = (uint64_t)llround(job.seconds * (double)job.rate);
+    uint64_t hash  = 1469598103934665603ULL; // FNV-1a
+    size_t   next  = 0;
+    res            = Result();
+    for(uint64_t pos = 0; pos < total;)
+    {
+        size_t n     = (size_t)std::min<uint64_t>(job.block, total - pos);
+        double start = ThreadNs();
+        for(size_t done = 0; done < n;)
+        {
+            for(; next < job.events.size() && job.events[next].sample <= pos + done; next++)
+            {
+                const Event& e = job.events[next];
+                engine->HandleMidiMessage(e.status, e.data0, e.data1);
+            }
+            size_t end = n;
+            if(next < job.events.size() && job.events[next].sample < pos + n)
+                end = (size_t)(job.events[next].sample - pos);
+            float* out[2] = {&w.l[done], &w.r[done]};
+            engine->Render(out, end - done);
+            done = end;
+        }
+        res.cpuNs += ThreadNs() - start;
+
+        for(int c = 0; c < 2; c++)
+        {
+            const float* x = c == 0 ? w.l.data() : w.r.data();
+            for(size_t i = 0; i < n; i++)
+            {
+                double a = fabs((double)x[i]);
+                res.peak[c] = std::max(res.peak[c], a);
+                res.sumSq[c] += a * a;
+                res.clipped += a >= 1.0;
+            }
+        }
+        for(size_t i = 0; i < n; i++)
+        {
+            uint32_t bits[2];
+            memcpy(&bits[0], &w.l[i], 4);
+            memcpy(&bits[1], &w.r[i], 4);
+            for(uint32_t b : bits)
+                for(int k = 0; k < 4; k++)
+                    hash = (hash ^ ((b >> (8 * k)) & 0xFF)) * 1099511628211ULL;
+        }
+        if(wav)
+        {
+            w.recorder.Push(w.l.data(), w.r.data(), n);
+            while(w.recorder.Pending())
+                w.recorder.Service();
+        }
+        pos += n;
+    }
+    res.frames = total;
+    res.hash   = hash;
+    if(wav)
+    {
+        w.recorder.Stop();
+        while(w.recorder.Busy())
+            w.recorder.Service();
+        WavRecorder::Stats st = w.recorder.GetStats();
+        if(st.writeError || st.droppedFrames)
+            return false;
+    }
+    return true;
+}
+
+struct Batch
+{
+    std::vector<Result> results;
+    double              wallMs = 0.0;
+    int                 steals = 0;
+    bool                ok     = true;
+};
+
+Batch RunBatch(const std::vector<Job>& jobs, const Options& o, int workers, bool wavs)
+{
+    // Longest first: audio seconds times the rate
+    std::vector<int> order(jobs.size());
+    for(size_t i = 0; i < order.size(); i++)
+        order[i] = (int)i;
+    std::stable_sort(order.begin(), order.end(), [&](int a, int b) {
+        return jobs[a].seconds * jobs[a].rate > jobs[b].seconds * jobs[b].rate;
+    });
+
+    Batch batch;
+    batch.results.resize(jobs.size());
+    StealingPool pool(workers);
+    pool.Deal(order);
+
+    std::atomic<int>         steals{0};
+    std::atomic<bool>        ok{true};
+    std::vector<std::thread> threads;
+    auto                     start = std::chrono::steady_clock::now();
+    for(int t = 0; t < workers; t++)
+        threads.emplace_back([&, t]() {
+#if defined(__x86_64__) || defined(__i386__)
+            _mm_setcsr(_mm_getcsr() | 0x8040); // FTZ | DAZ, see governor_sim
+#endif
+            Worker w;
+            int    job;
+            bool   stolen;
+            while(pool.Next(t, job, stolen))
+            {
+                Result& r = batch.results[job];
+                if(!Render(jobs[job], o, wavs, w, r))
+                {
+                    fprintf(stderr, "%s: cannot render or write %s/%s.wav\n",
+                            jobs[job].manifest.c_str(), o.outDir.c_str(), jobs[job].name.c_str());
+                    ok = false;
+                }
+                r.worker = t;
+                r.stolen = stolen;
+                steals += stolen;
+            }
+        });
+    for(std::thread& th : threads)
+        th.join();
+    batch.wallMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start)
+                       .count();
+    batch.steals = steals;
+    batch.ok     = ok;
+    return batch;
+}
+
+// ----------------------------------------------------------------------
+// Output
+// ----------------------------------------------------------------------
+void PrintDb(FILE* f, double level)
+{
+    if(level > 0.0)
+        fprintf(f, "%.2f", 20.0 * log10(level));
+    else
+        fprintf(f, "null");
+}
+
+bool WriteJson(const std::string& path, const std::vector<Job>& jobs, const Batch& b, int workers)
+{
+    FILE* f = fopen(path.c_str(), "w");
+    if(!f)
+        return false;
+    double cpuMs = 0.0, audioS = 0.0;
+    for(size_t i = 0; i < jobs.size(); i++)
+    {
+        cpuMs += b.results[i].cpuNs / 1e6;
+        audioS += jobs[i].seconds;
+    }
+    fprintf(f, "{\n");
+    fprintf(f, "  \"workers\": %d,\n", workers);
+    fprintf(f, "  \"renders\": %zu,\n", jobs.size());
+    fprintf(f, "  \"steals\": %d,\n", b.steals);
+    fprintf(f, "  \"wall_ms\": %.1f,\n", b.wallMs);
+    fprintf(f, "  \"engine_cpu_ms\": %.1f,\n", cpuMs);
+    fprintf(f, "  \"audio_seconds\": %.1f,\n", audioS);
+    fprintf(f, "  \"results\": [\n");
+    for(size_t i = 0; i < jobs.size(); i++)
+    {
+        const Job&    j = jobs[i];
+        const Result& r = b.results[i];
+        fprintf(f, "    {\"name\": \"%s\", \"manifest\": \"%s\", ", j.name.c_str(), j.manifest.c_str());
+        fprintf(f, "\"seconds\": %g, \"rate\": %.0f, \"block\": %zu, ", j.seconds, j.rate, j.block);
+        fprintf(f, "\"peak_dbfs\": [");
+        PrintDb(f, r.peak[0]);
+        fprintf(f, ", ");
+        PrintDb(f, r.peak[1]);
+        fprintf(f, "], \"rms_dbfs\": [");
+        PrintDb(f, sqrt(r.sumSq[0] / (double)r.frames));
+        fprintf(f, ", ");
+        PrintDb(f, sqrt(r.sumSq[1] / (double)r.frames));
+        fprintf(f, "], \"clipped\": %llu, ", (unsigned long long)r.clipped);
+        fprintf(f, "\"cpu_ns_per_sample\": %.1f, ", r.cpuNs / (double)r.frames);
+        fprintf(f, "\"realtime_x\": %.1f, ", j.seconds * 1e9 / std::max(r.cpuNs, 1.0));
+        fprintf(f, "\"hash\": \"%016llx\", ", (unsigned long long)r.hash);
+        fprintf(f, "\"worker\": %d, \"stolen\": %s}%s\n",
+                r.worker, r.stolen ? "true" : "false", i + 1 < jobs.size() ? "," : "");
+    }
+    fprintf(f, "  ]\n}\n");
+    return fclose(f) == 0;
+}
+
+void Usage()
+{
+    fprintf(stderr, "usage: batch_render [-j threads] [-o dir] [-b 16|24] [-n] [-S] manifest ...\n");
+    exit(2);
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    Options o;
+    int     opt;
+    while((opt = getopt(argc, argv, "j:o:b:nSh")) != -1)
+    {
+        switch(opt)
+        {
+            case 'j': o.threads = atoi(optarg); break;
+            case 'o': o.outDir = optarg; break;
+            case 'b': o.bits = atoi(optarg); break;
+            case 'n': o.wavs = false; break;
+            case 'S': o.scaling = true; break;
+            default: Usage();
+        }
+    }
+    if(optind == argc || o.threads < 0 || (o.bits != 16 && o.bits != 24))
+        Usage();
+    if(o.threads == 0)
+        o.threads = (int)std::max(1u, std::thread::hardware_concurrency());
+
+    std::vector<Job> jobs;
+    for(int i = optind; i < argc; i++)
+    {
+        std::string err;
+        if(!LoadManifest(argv[i], jobs, err))
+        {
+            fprintf(stderr, "%s\n", err.c_str());
+            return 1;
+        }
+    }
+    for(size_t i = 0; i < jobs.size(); i++)
+        for(size_t k = 0; k < i; k++)
+            if(jobs[i].name == jobs[k].name)
+            {
+                fprintf(stderr, "%s: %s rendered twice\n", jobs[i].manifest.c_str(), jobs[i].name.c_str());
+                return 1;
+            }
+    double audioS = 0.0;
+    for(const Job& j : jobs)
+        audioS += j.seconds;
+    printf("%zu renders, %.1f s of audio, %u cores\n",
+           jobs.size(), audioS, std::thread::hardware_concurrency());
+
+    if(o.scaling)
+    {
+        std::vector<int> counts;
+        for(int w = 1; w < o.threads; w *= 2)
+            counts.push_back(w);
+        counts.push_back(o.threads);
+        printf("workers    wall ms   speedup   efficiency   steals\n");
+        Batch base;
+        bool  ok = true;
+        for(int w : counts)
+        {
+            Batch b = RunBatch(jobs, o, w, false);
+            if(w == 1)
+                base = b;
+            double speedup = base.wallMs / b.wallMs;
+            printf("%7d   %8.1f   %6.2fx   %9.0f%%   %6d\n",
+                   w, b.wallMs, speedup, 100.0 * speedup / w, b.steals);
+            ok = ok && b.ok;
+            for(size_t i = 0; i < jobs.size(); i++)
+                if(b.results[i].hash != base.results[i].hash)
+                {
+                    printf("  FAIL: %s renders differently on %d workers\n", jobs[i].name.c_str(), w);
+                    ok = false;
+                }
+        }
+        printf("%s\n", ok ? "ok" : "FAIL");
+        return ok ? 0 : 1;
+    }
+
+    Batch       b    = RunBatch(jobs, o, o.threads, o.wavs);
+    std::string json = o.outDir + "/results.json";
+    if(!WriteJson(json, jobs, b, o.threads))
+    {
+        fprintf(stderr, "cannot write %s\n", json.c_str());
+        return 1;
+    }
+    double cpuMs = 0.0;
+    for(const Result& r : b.results)
+        cpuMs += r.cpuNs / 1e6;
+    printf("%d workers: %.1f ms wall, %.1f ms engine CPU (%.2fx), %d stolen; %s\n",
+           o.threads, b.wallMs, cpuMs, cpuMs / b.wallMs, b.steals, json.c_str());
+    return b.ok ? 0 : 1;
+}
@@ -0,0 +1,144 @@
+// block_bench: latency against CPU for every block size and sample rate
+// the Daisy can boot with (MidiAudio in midi_protocol.h).
+//
+//   block_bench [-t seconds] [-x scale]
+//
+// Each combination renders the same heavy patch through the real engine:
+// six held voices, delay and reverb up, the looper playing back a loop.
+// CPU is thread time per second of audio, best of five runs, relative to
+// the 48 kHz / 48 default. -x (target us per host us) adds each block's
+// load as a share of its period. Added latency is the block a note waits
+// for plus the one being played out: 1.5 blocks on average, 2 at worst.
+//
+// The latency columns are the table in daisy/seed/kb2040_groovebox/
+// audio_config.h. The CPU column means something only in a build against
+// the real DaisySP.
+#include "groovebox_engine.h"
+#include "midi_protocol.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <xmmintrin.h>
+#endif
+
+namespace
+{
+const int kRuns = 5; // best of
+
+double CpuUs()
+{
+    timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (double)ts.tv_sec * 1e6 + (double)ts.tv_nsec / 1e3;
+}
+
+// Heavy patch; the looper records 0.5 s of it and plays it back
+void Render(float rate, size_t block, double seconds, std::vector<float>& l, std::vector<float>& r)
+{
+    static const uint8_t kSetup[][3] = {
+        {0xB0, 78, 100}, {0xB0, 79, 96}, {0xB0, 80, 96},  {0xB0, 81, 112},
+        {0xB0, 84, 64},  {0xB0, 85, 64}, {0x90, 48, 100}, {0x90, 55, 100},
+        {0x90, 60, 100}, {0x90, 64, 100}, {0x90, 67, 100}, {0x90, 72, 100},
+        {0xB0, 91, 40},
+    };
+    float* out[2] = {l.data(), r.data()};
+    size_t blocks = (size_t)(seconds * rate / (double)block);
+    for(size_t k = 0; k < blocks; k++)
+    {
+        if(k == 0)
+            for(const auto& m : kSetup)
+                HandleMidiMessage(m[0], m[1], m[2]);
+        RenderAudio(out, block);
+    }
+}
+
+// Host CPU us per second of audio, one run
+double Measure(float rate, size_t block, double seconds)
+{
+    std::vector<float> l(block), r(block);
+    InitSynth(rate);
+    Render(rate, block, 0.5, l, r);
+    HandleMidiMessage(0xB0, 91, 40); // loop closes, playback starts
+
+    double a = CpuUs();
+    Render(rate, block, seconds, l, r);
+    return (CpuUs() - a) / seconds;
+}
+
+void Usage()
+{
+    fprintf(stderr, "usage: block_bench [-t seconds] [-x scale]\n");
+    exit(2);
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    double seconds = 10.0;
+    double scale   = 0.0;
+    int    opt;
+    while((opt = getopt(argc, argv, "t:x:h")) != -1)
+    {
+        switch(opt)
+        {
+            case 't': seconds = atof(optarg); break;
+            case 'x': scale = atof(optarg); break;
+            default: Usage();
+        }
+    }
+    if(optind != argc || seconds <= 0.0)
+        Usage();
+
+#if defined(__x86_64__) || defined(__i386__)
+    _mm_setcsr(_mm_getcsr() | 0x8040); // FTZ | DAZ, see governor_sim
+#endif
+
+    // Runs go round all combinations in turn, so a slow spell on the host
+    // hits them alike instead of skewing one
+    const int           numRates  = MidiAudio::NUM_SAMPLE_RATES;
+    const int           numBlocks = MidiAudio::NUM_BLOCK_SIZES;
+    std::vector<double> best(numRates * numBlocks, 0.0);
+    for(int run = 0; run < kRuns; run++)
+        for(int ri = 0; ri < numRates; ri++)
+            for(int bi = 0; bi < numBlocks; bi++)
+            {
+                double us = Measure((float)MidiAudio::SAMPLE_RATES[ri],
+                                    MidiAudio::BLOCK_SIZES[bi],
+                                    seconds);
+                double& b = best[ri * numBlocks + bi];
+                if(run == 0 || us < b)
+                    b = us;
+            }
+    const double base = best[MidiAudio::DEFAULT_SAMPLE_RATE * numBlocks
+                             + MidiAudio::DEFAULT_BLOCK_SIZE];
+
+    printf("rate   block   block ms   latency avg/max ms   CPU%s\n",
+           scale > 0.0 ? "     load" : "");
+    for(int ri = 0; ri < numRates; ri++)
+    {
+        float rate = (float)MidiAudio::SAMPLE_RATES[ri];
+        for(int bi = 0; bi < numBlocks; bi++)
+        {
+            size_t block   = MidiAudio::BLOCK_SIZES[bi];
+            double blockMs = 1e3 * (double)block / rate;
+            double us      = best[ri * numBlocks + bi];
+            char   latency[32];
+            snprintf(latency, sizeof(latency), "%.2f / %.2f", 1.5 * blockMs, 2.0 * blockMs);
+            printf("%2.0fk   %5zu   %8.2f   %18s   %4.2f",
+                   rate / 1000.0f,
+                   block,
+                   blockMs,
+                   latency,
+                   us / base);
+            if(scale > 0.0)
+                printf("   %5.1f%%", us * scale / 1e4);
+            printf("\n");
+        }
+    }
+    return 0;
+}
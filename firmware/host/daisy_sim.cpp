@@ -0,0 +1,150 @@
+#include "daisy_sim.h"
+#include "groovebox_engine.h"
+
+namespace dsim
+{
+// ---- Daisy ----------------------------------------------------------------
+
+void Daisy::Reset(const Config& cfg, uint64_t startUs, double phaseUs)
+{
+    cfg_            = cfg;
+    periodUs_       = 1e6 * (double)cfg.blockSize / cfg.sampleRate;
+    nextCallbackUs_ = (double)startUs + phaseUs;
+    blocks_         = 0;
+    byteUs_         = (10ull * 1000000ull) / cfg.uartBaud;
+    pending_.clear();
+    maxPending_    = 0;
+    sinceCallback_ = 0;
+    decoder_       = MidiRxDecoder();
+    held_.clear();
+    msgStarted_    = false;
+    left_.assign(cfg.blockSize, 0.0f);
+    right_.assign(cfg.blockSize, 0.0f);
+    InitSynth(cfg.sampleRate);
+    jitter_.Init(cfg.jitter, cfg.sampleRate);
+}
+
+void Daisy::UartSink(const kbsim::UartByte& b, void* ctx)
+{
+    static_cast<Daisy*>(ctx)->OnUartByte(b);
+}
+
+void Daisy::OnUartByte(const kbsim::UartByte& b)
+{
+    pending_.push_back(b);
+}
+
+void Daisy::SetBlockSink(BlockSink sink, void* ctx)
+{
+    blockSink_ = sink;
+    blockCtx_  = ctx;
+}
+
+void Daisy::SetMessageSink(MessageSink sink, void* ctx)
+{
+    msgSink_ = sink;
+    msgCtx_  = ctx;
+}
+
+double Daisy::OutputDelayUs() const
+{
+    return periodUs_ + 1e6 * cfg_.codecDelaySamples / cfg_.sampleRate;
+}
+
+// Finds the next DMA callback among the pending bytes: the line going idle
+// for rxIdleChars after a byte, or a half buffer filling up.
+bool Daisy::NextDmaCallback(uint64_t& atUs, size_t& count) const
+{
+    const uint64_t idleUs = byteUs_ * cfg_.rxIdleChars;
+    uint32_t       fill   = sinceCallback_;
+    for(size_t i = 0; i < pending_.size(); ++i)
+    {
+        if(++fill % cfg_.rxDmaHalf == 0)
+        {
+            atUs  = pending_[i].wireUs;
+            count = i + 1;
+            return true;
+        }
+        bool last = (i + 1 == pending_.size());
+        if(last || pending_[i + 1].wireUs - byteUs_ >= pending_[i].wireUs + idleUs)
+        {
+            atUs  = pending_[i].wireUs + idleUs;
+            count = i + 1;
+            return true;
+        }
+    }
+    return false;
+}
+
+void Daisy::DmaCallback(uint64_t atUs, size_t count)
+{
+    for(size_t i = 0; i < count; ++i)
+    {
+        const kbsim::UartByte& b = pending_[i];
+        // A message's queue time is that of the byte that opened it: its
+        // status byte, or the first data byte under running status.
+        bool isStatus = (b.byte & 0x80) && b.byte < 0xF8;
+        bool isData   = !(b.byte & 0x80);
+        if(isStatus || (isData && !msgStarted_))
+        {
+            msgQueuedUs_ = b.queuedUs;
+            msgStarted_  = true;
+        }
+        MidiRxEvent e;
+        if(decoder_.Feed(b.byte, (uint32_t)(atUs + cfg_.clockOffsetUs), e))
+        {
+            RxMessage m = {msgQueuedUs_, b.wireUs, atUs, e.status, e.data0, e.data1};
+            msgStarted_ = false;
+            if(!held_.empty() || !jitter_.Push(e))
+                held_.push_back(e);
+            if(msgSink_)
+                msgSink_(m, msgCtx_);
+        }
+    }
+    sinceCallback_ = (uint32_t)((sinceCallback_ + count) % cfg_.rxDmaHalf);
+    pending_.erase(pending_.begin(), pending_.begin() + count);
+}
+
+void Daisy::RenderBlock()
+{
+    while(!held_.empty() && jitter_.Push(held_.front()))
+        held_.pop_front();
+    float* out[2] = {left_.data(), right_.data()};
+    jitter_.Render(out,
+                   cfg_.blockSize,
+                   (uint32_t)((uint64_t)nextCallbackUs_ + cfg_.clockOffsetUs));
+    if(blockSink_)
+        blockSink_((uint64_t)nextCallbackUs_,
+                   nextCallbackUs_ + OutputDelayUs(),
+                   left_.data(),
+                   right_.data(),
+                   cfg_.blockSize,
+                   blockCtx_);
+    blocks_++;
+    nextCallbackUs_ += periodUs_;
+}
+
+void Daisy::AdvanceTo(uint64_t us)
+{
+    for(;;)
+    {
+        if(pending_.size() > maxPending_)
+            maxPending_ = pending_.size();
+
+        uint64_t dmaUs = 0;
+        size_t   count = 0;
+        bool     dma   = NextDmaCallback(dmaUs, count) && dmaUs <= us;
+        bool     audio = nextCallbackUs_ <= (double)us;
+        if(!dma && !audio)
+            return;
+
+        // A message delivered exactly at a block boundary misses that
+        // block: the audio interrupt has already taken the buffer.
+        if(dma && (!audio || (double)dmaUs < nextCallbackUs_))
+            DmaCallback(dmaUs, count);
+        else
+            RenderBlock();
+    }
+}
+
+} // namespace dsim
@@ -0,0 +1,118 @@
+// Host model of the Daisy side of the MIDI link: UART receive timing, the
+// firmware MIDI parser and the audio block schedule, around the real DSP
+// engine (daisy/seed/kb2040_groovebox/groovebox_engine.cpp).
+//
+// Timing model:
+//   - Bytes arrive when their stop bit leaves the KB2040 (kbsim::UartByte).
+//   - MIDI arrives by circular DMA. The DMA callback fires when the line
+//     has been idle for a character, or when half the DMA buffer has
+//     filled during a continuous stream, and parses the bytes (midi_rx.h).
+//   - main() wakes from WFI on that interrupt and drains the queue into
+//     the firmware's jitter buffer at its callback time. The audio
+//     callback hands the messages to the engine: stamped ones inside the
+//     block they are due in, the rest at the start of the next block.
+//   - Audio is double buffered: the block rendered by the callback at t
+//     starts playing at t + one block period, plus the codec's filter
+//     delay.
+#pragma once
+
+#include "jitter_buffer.h"
+#include "kb2040_sim.h"
+#include "midi_rx.h"
+
+#include <deque>
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+namespace dsim
+{
+struct Config
+{
+    float    sampleRate     = 48000.0f;
+    size_t   blockSize      = 48;
+    uint32_t uartBaud       = 31250;
+    uint32_t rxIdleChars    = 1;   // idle-line detection delay
+    uint32_t rxDmaHalf      = 128; // bytes per DMA half-transfer callback
+    uint32_t codecDelaySamples = 20;
+    uint32_t clockOffsetUs     = 1700000; // Daisy clock minus KB2040 clock
+    JitterBuffer::Config jitter;
+};
+
+// Channel message with its timing through the link
+struct RxMessage
+{
+    uint64_t queuedUs;  // first byte handed to the KB2040 UART
+    uint64_t wireUs;    // last byte received
+    uint64_t deliverUs; // DMA callback parsed it
+    uint8_t  status;
+    uint8_t  data0;
+    uint8_t  data1;
+};
+
+// Called for every rendered block: when the callback ran, when its first
+// sample reaches the DAC output, and the samples.
+typedef void (*BlockSink)(uint64_t callbackUs,
+                          double   playUs,
+                          const float* left,
+                          const float* right,
+                          size_t       n,
+                          void*        ctx);
+
+// Called as each message is handed to the jitter buffer
+typedef void (*MessageSink)(const RxMessage& m, void* ctx);
+
+class Daisy
+{
+  public:
+    // Starts the audio clock at startUs + phaseUs and calls InitSynth
+    void Reset(const Config& cfg, uint64_t startUs, double phaseUs);
+
+    // Feed from kbsim::SetUartSink
+    void OnUartByte(const kbsim::UartByte& b);
+
+    // Runs DMA callbacks and audio blocks up to `us`. The KB2040 side
+    // must already have run to `us`, so the idle-line decision for the
+    // last byte is final.
+    void AdvanceTo(uint64_t us);
+
+    void SetBlockSink(BlockSink sink, void* ctx);
+    void SetMessageSink(MessageSink sink, void* ctx);
+
+    double   BlockPeriodUs() const { return periodUs_; }
+    double   OutputDelayUs() const;
+    uint64_t Blocks() const { return blocks_; }
+    size_t   MaxRxPending() const { return maxPending_; }
+    const JitterBuffer::Stats& JitterStats() const { return jitter_.GetStats(); }
+
+    static void UartSink(const kbsim::UartByte& b, void* ctx);
+
+  private:
+    bool NextDmaCallback(uint64_t& atUs, size_t& count) const;
+    void DmaCallback(uint64_t atUs, size_t count);
+    void RenderBlock();
+
+    Config   cfg_;
+    double   periodUs_ = 1000.0;
+    double   nextCallbackUs_ = 0.0;
+    uint64_t blocks_ = 0;
+    uint64_t byteUs_ = 320;
+
+    // Bytes received but not yet seen by a DMA callback
+    std::vector<kbsim::UartByte> pending_;
+    size_t                       maxPending_ = 0;
+    uint32_t                     sinceCallback_ = 0;
+    MidiRxDecoder                decoder_;
+    JitterBuffer                 jitter_;
+    std::deque<MidiRxEvent>      held_; // refused by jitter_, in order
+    uint64_t                     msgQueuedUs_ = 0;
+    bool                         msgStarted_  = false;
+
+    std::vector<float> left_, right_;
+    BlockSink          blockSink_ = nullptr;
+    void*              blockCtx_  = nullptr;
+    MessageSink        msgSink_   = nullptr;
+    void*              msgCtx_    = nullptr;
+};
+
+} // namespace dsim
@@ -0,0 +1,263 @@
+// engine_threads: several engine instances (engine.h) rendering at once on
+// their own threads.
+//
+//   engine_threads [-j threads] [-n instances] [-t seconds] [-b block]
+//
+// Each instance plays its own patch, picked by its number: a held chord
+// through delay, reverb and the looper; the drum kit; or an arpeggio
+// under bend, mod wheel and filter sweeps. Every patch is transposed by
+// the instance number, so no two render the same thing. The instances
+// are rendered one after another on one thread, then all at once on -j
+// threads (default: one per core), each with its own engine and arena.
+//
+// Checks:
+//   - every instance renders bit-identically alone and alongside the
+//     others, so they share no state
+//   - the firmware's instance (groovebox_engine.h) renders instance 0's
+//     patch bit-identically to an Engine of its own
+//
+// Also prints the wall time both ways and the speedup.
+//
+// Exits 1 if a check fails.
+#include "engine.h"
+#include "groovebox_engine.h"
+#include "midi_protocol.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <xmmintrin.h>
+#endif
+
+namespace
+{
+struct Options
+{
+    int    threads   = 0; // 0: one per core
+    int    instances = 8;
+    double seconds   = 4.0;
+    size_t block     = 48;
+    float  rate      = 48000.0f;
+};
+
+struct Output
+{
+    std::vector<float> l, r;
+};
+
+// Either an Engine or the firmware's instance, so both play the same
+// patch through the same code
+struct Target
+{
+    Engine* engine;
+
+    void Midi(uint8_t status, uint8_t data0, uint8_t data1)
+    {
+        if(engine)
+            engine->HandleMidiMessage(status, data0, data1);
+        else
+            HandleMidiMessage(status, data0, data1);
+    }
+
+    void Render(float** out, size_t size)
+    {
+        if(engine)
+            engine->Render(out, size);
+        else
+            RenderAudio(out, size);
+    }
+};
+
+// Instance k's MIDI at the start of block b
+void Play(Target& t, int k, size_t b, size_t blocksPerSecond)
+{
+    uint8_t root = (uint8_t)(36 + k % 24);
+    switch(k % 3)
+    {
+        case 0: // chord, FX up, the looper takes the first second
+            if(b == 0)
+            {
+                static const uint8_t kSetup[][2] = {
+                    {78, 100}, {79, 96}, {80, 96}, {81, 112}, {84, 64}, {85, 64},
+                };
+                for(const auto& cc : kSetup)
+                    t.Midi(0xB0, cc[0], cc[1]);
+                for(int n : {0, 7, 12, 16, 19, 24})
+                    t.Midi(0x90, (uint8_t)(root + n), 100);
+                t.Midi(0xB0, MidiCC::LOOPER_CONTROL, 40);
+            }
+            if(b == blocksPerSecond)
+                t.Midi(0xB0, MidiCC::LOOPER_CONTROL, 40);
+            break;
+
+        case 1: // drum kit, a hit every 1/8 s
+            if(b == 0)
+                t.Midi(0xB0, MidiCC::INSTRUMENT_MODE, 127);
+            if(b % (blocksPerSecond / 8) == 0)
+            {
+                static const uint8_t kPattern[] = {36, 42, 38, 42, 36, 46, 39, 45, 41, 49, 47, 51};
+                size_t  step = b / (blocksPerSecond / 8);
+                uint8_t vel  = (uint8_t)(60 + (step * 37 + k * 11) % 67);
+                t.Midi(0x90, kPattern[(step + k) % sizeof(kPattern)], vel);
+            }
+            break;
+
+        default: // arpeggio under bend, mod and cutoff sweeps
+        {
+            size_t every = blocksPerSecond / 16;
+            if(b % every == 0)
+            {
+                size_t  step = b / every;
+                uint8_t note = (uint8_t)(root + (step % 4) * 4);
+                if(step > 0)
+                    t.Midi(0x80, (uint8_t)(root + ((step - 1) % 4) * 4), 0);
+                t.Midi(0x90, note, 90);
+            }
+            uint16_t bend = (uint16_t)(8192 + 6000 * ((b / 4) % 64 < 32 ? 1 : -1));
+            if(b % 4 == 0)
+            {
+                t.Midi(0xE0, bend & 0x7F, (uint8_t)(bend >> 7));
+                t.Midi(0xB0, MidiCC::MODWHEEL, (uint8_t)((b / 4) % 128));
+                t.Midi(0xB0, MidiCC::CUTOFF, (uint8_t)(127 - (b / 4) % 128));
+            }
+            break;
+        }
+    }
+}
+
+void Render(Target& t, int k, const Options& o, Output& out)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    _mm_setcsr(_mm_getcsr() | 0x8040); // FTZ | DAZ, see governor_sim; per thread
+#endif
+    size_t blocksPerSecond = (size_t)(o.rate / (float)o.block);
+    size_t blocks          = (size_t)(o.seconds * (double)blocksPerSecond);
+    out.l.assign(blocks * o.block, 0.0f);
+    out.r.assign(blocks * o.block, 0.0f);
+    for(size_t b = 0; b < blocks; b++)
+    {
+        Play(t, k, b, blocksPerSecond);
+        float* dst[2] = {&out.l[b * o.block], &out.r[b * o.block]};
+        t.Render(dst, o.block);
+    }
+}
+
+// A fresh engine and arena for instance k
+void RenderInstance(int k, const Options& o, Output& out)
+{
+    std::unique_ptr<Engine> engine(new Engine);
+    std::vector<uint8_t>    memory(Engine::ArenaBytes(o.rate));
+    EngineArena             arena(memory.data(), memory.size());
+    if(!engine->Init(o.rate, arena))
+    {
+        fprintf(stderr, "instance %d: arena too small\n", k);
+        exit(1);
+    }
+    Target t = {engine.get()};
+    Render(t, k, o, out);
+}
+
+// First sample where two renders differ, or -1
+long FirstDifference(const Output& a, const Output& b)
+{
+    if(a.l.size() != b.l.size())
+        return 0;
+    for(size_t i = 0; i < a.l.size(); i++)
+        if(memcmp(&a.l[i], &b.l[i], sizeof(float)) != 0
+           || memcmp(&a.r[i], &b.r[i], sizeof(float)) != 0)
+            return (long)i;
+    return -1;
+}
+
+double Ms(std::chrono::steady_clock::time_point since)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - since)
+        .count();
+}
+
+void Usage()
+{
+    fprintf(stderr, "usage: engine_threads [-j threads] [-n instances] [-t seconds] [-b block]\n");
+    exit(2);
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    Options o;
+    int     opt;
+    while((opt = getopt(argc, argv, "j:n:t:b:h")) != -1)
+    {
+        switch(opt)
+        {
+            case 'j': o.threads = atoi(optarg); break;
+            case 'n': o.instances = atoi(optarg); break;
+            case 't': o.seconds = atof(optarg); break;
+            case 'b': o.block = (size_t)atol(optarg); break;
+            default: Usage();
+        }
+    }
+    if(optind != argc || o.instances < 1 || o.threads < 0 || o.seconds <= 0.0
+       || o.block < 1 || o.block > 1024)
+        Usage();
+    if(o.threads == 0)
+        o.threads = (int)std::max(1u, std::thread::hardware_concurrency());
+
+    printf("%d instances, %.1f s each at %.0f Hz, block %zu, %d threads\n",
+           o.instances, o.seconds, o.rate, o.block, o.threads);
+
+    std::vector<Output> serial(o.instances), parallel(o.instances);
+    auto                start = std::chrono::steady_clock::now();
+    for(int k = 0; k < o.instances; k++)
+        RenderInstance(k, o, serial[k]);
+    double serialMs = Ms(start);
+
+    std::atomic<int>         next{0};
+    std::vector<std::thread> pool;
+    start = std::chrono::steady_clock::now();
+    for(int w = 0; w < o.threads; w++)
+        pool.emplace_back([&]() {
+            for(int k; (k = next.fetch_add(1)) < o.instances;)
+                RenderInstance(k, o, parallel[k]);
+        });
+    for(std::thread& th : pool)
+        th.join();
+    double parallelMs = Ms(start);
+
+    printf("  serial     %8.1f ms\n", serialMs);
+    printf("  parallel   %8.1f ms, %.2fx\n", parallelMs, serialMs / parallelMs);
+
+    bool ok = true;
+    for(int k = 0; k < o.instances; k++)
+    {
+        long at = FirstDifference(serial[k], parallel[k]);
+        if(at >= 0)
+        {
+            printf("  FAIL: instance %d differs alongside the others from sample %ld\n", k, at);
+            ok = false;
+        }
+    }
+
+    Output firmware;
+    Target fw = {nullptr};
+    InitSynth(o.rate);
+    Render(fw, 0, o, firmware);
+    long at = FirstDifference(serial[0], firmware);
+    if(at >= 0)
+    {
+        printf("  FAIL: the firmware's instance differs from an Engine from sample %ld\n", at);
+        ok = false;
+    }
+
+    printf("  %s\n", ok ? "ok" : "FAIL");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,400 @@
+// executor_sim: fairness and starvation checks for the Daisy background
+// executor (daisy/seed/kb2040_groovebox/background.h).
+//
+//   executor_sim [-t seconds] [-a audio load %] [scenario ...]
+//
+// The executor runs on a simulated clock. Each job step advances it by the
+// step's cost. Audio callbacks take their share of every 1 ms block from
+// whatever main() was doing, as the interrupt does on the Seed.
+//
+// Scenarios (default: all):
+//   fair        four equal NORMAL jobs: CPU shares should be equal
+//   priority    HIGH, NORMAL and LOW jobs, all endless: ordering, with
+//               aging still giving NORMAL and LOW slices
+//   flood       eight endless HIGH jobs and one LOW: the LOW job's
+//               longest wait must stay under the aging bound
+//   long_step   a job whose steps overrun the slice next to a short one
+//   handoff     a producer publishing buffers that the audio callback
+//               takes at block boundaries: nothing lost or taken twice
+//
+// Exits 1 if a check fails.
+#include "background.h"
+
+#include <algorithm>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+namespace
+{
+const double kBlockUs = 1000.0;
+
+double   g_nowUs      = 0.0;
+double   g_nextBlock  = kBlockUs;
+double   g_audioLoad  = 0.4;
+uint64_t g_blocks     = 0;
+void (*g_onBlock)()   = nullptr;
+
+uint32_t NowUs()
+{
+    return (uint32_t)g_nowUs;
+}
+
+// main() runs for `us`; audio callbacks that fall due take their share
+void Spend(double us)
+{
+    g_nowUs += us;
+    while(g_nowUs >= g_nextBlock)
+    {
+        g_nowUs += kBlockUs * g_audioLoad;
+        g_nextBlock += kBlockUs;
+        g_blocks++;
+        if(g_onBlock)
+            g_onBlock();
+    }
+}
+
+struct SimJob
+{
+    BgJob    job;
+    double   stepUs;
+    uint32_t stepsLeft; // 0 = endless
+};
+
+bool SimStep(void* ctx)
+{
+    SimJob* j = static_cast<SimJob*>(ctx);
+    Spend(j->stepUs);
+    if(j->stepsLeft == 0)
+        return false;
+    return --j->stepsLeft == 0;
+}
+
+struct Harness
+{
+    BgExecutor           exec;
+    std::vector<SimJob*> jobs;
+    bool                 ok = true;
+
+    Harness()
+    {
+        g_nowUs     = 0.0;
+        g_nextBlock = kBlockUs;
+        g_blocks    = 0;
+        g_onBlock   = nullptr;
+        exec.Init(BgExecutor::Config(), NowUs);
+    }
+
+    ~Harness()
+    {
+        for(SimJob* j : jobs)
+            delete j;
+    }
+
+    SimJob* Add(const char* name, BgPriority pri, double stepUs, uint32_t steps = 0)
+    {
+        SimJob* j    = new SimJob();
+        j->job.step  = SimStep;
+        j->job.ctx   = j;
+        j->job.name  = name;
+        j->stepUs    = stepUs;
+        j->stepsLeft = steps;
+        exec.Submit(&j->job, pri);
+        jobs.push_back(j);
+        return j;
+    }
+
+    void Run(double seconds)
+    {
+        while(g_nowUs < seconds * 1e6)
+            if(!exec.RunSlice())
+                Spend(10.0); // idle: WFI until the next interrupt
+    }
+
+    // Longest a job can wait: aging up from LOW, then a turn behind every
+    // other job, each slice possibly one step over budget; stretched by
+    // the audio callbacks
+    double WaitBound(double maxStepUs) const
+    {
+        BgExecutor::Config cfg;
+        double busy = (BG_NUM_PRIORITIES - 1) * (cfg.ageUs + cfg.sliceUs + maxStepUs)
+                      + jobs.size() * (cfg.sliceUs + maxStepUs);
+        return busy / (1.0 - g_audioLoad) + kBlockUs;
+    }
+
+    void Report(double seconds)
+    {
+        double total = 0.0;
+        for(SimJob* j : jobs)
+            total += j->job.runUs;
+        printf("  %-10s %-6s %8s %9s %11s %11s\n",
+               "job", "prio", "slices", "share", "max wait", "max slice");
+        static const char* const kPri[] = {"high", "normal", "low"};
+        for(SimJob* j : jobs)
+            printf("  %-10s %-6s %8u %8.1f%% %8u us %8u us\n",
+                   j->job.name,
+                   kPri[j->job.priority],
+                   j->job.slices,
+                   total > 0 ? 100.0 * j->job.runUs / total : 0.0,
+                   j->job.maxWaitUs,
+                   j->job.maxSliceUs);
+        printf("  main() busy %.1f%% of %.1f s, %llu audio blocks\n",
+               100.0 * total / (seconds * 1e6),
+               seconds,
+               (unsigned long long)g_blocks);
+    }
+
+    void Check(bool cond, const char* what)
+    {
+        printf("  %-6s %s\n", cond ? "ok" : "FAIL", what);
+        ok = ok && cond;
+    }
+};
+
+// Jain's fairness index: 1 when all shares are equal, 1/n at worst
+double Jain(const std::vector<double>& x)
+{
+    double sum = 0.0, sq = 0.0;
+    for(double v : x)
+    {
+        sum += v;
+        sq += v * v;
+    }
+    return sq > 0.0 ? sum * sum / (x.size() * sq) : 0.0;
+}
+
+// ---- scenarios ----------------------------------------------------------
+
+bool Fair(double seconds)
+{
+    Harness h;
+    const char* names[] = {"a", "b", "c", "d"};
+    double      steps[] = {20.0, 35.0, 50.0, 90.0};
+    for(int i = 0; i < 4; i++)
+        h.Add(names[i], BG_PRIORITY_NORMAL, steps[i]);
+    h.Run(seconds);
+    h.Report(seconds);
+
+    std::vector<double> run;
+    for(SimJob* j : h.jobs)
+        run.push_back(j->job.runUs);
+    char what[96];
+    snprintf(what, sizeof(what), "equal shares (Jain index %.3f >= 0.95)", Jain(run));
+    h.Check(Jain(run) >= 0.95, what);
+    return h.ok;
+}
+
+bool Priority(double seconds)
+{
+    Harness h;
+    SimJob* hi  = h.Add("high", BG_PRIORITY_HIGH, 40.0);
+    SimJob* mid = h.Add("normal", BG_PRIORITY_NORMAL, 40.0);
+    SimJob* lo  = h.Add("low", BG_PRIORITY_LOW, 40.0);
+    h.Run(seconds);
+    h.Report(seconds);
+
+    h.Check(hi->job.runUs > mid->job.runUs && mid->job.runUs >= lo->job.runUs,
+            "higher priority gets more CPU");
+    h.Check(lo->job.slices > 0 && mid->job.slices > 0, "NORMAL and LOW still run");
+    h.Check(lo->job.maxWaitUs <= h.WaitBound(40.0), "LOW wait within the aging bound");
+    return h.ok;
+}
+
+bool Flood(double seconds)
+{
+    Harness h;
+    char names[8][8];
+    for(int i = 0; i < 8; i++)
+    {
+        snprintf(names[i], sizeof(names[i]), "high%d", i);
+        h.Add(names[i], BG_PRIORITY_HIGH, 60.0);
+    }
+    SimJob* lo = h.Add("low", BG_PRIORITY_LOW, 60.0);
+    h.Run(seconds);
+    h.Report(seconds);
+
+    char what[96];
+    snprintf(what,
+             sizeof(what),
+             "LOW max wait %u us <= bound %.0f us",
+             lo->job.maxWaitUs,
+             h.WaitBound(60.0));
+    h.Check(lo->job.slices > 0, "LOW runs under a HIGH flood");
+    h.Check(lo->job.maxWaitUs <= h.WaitBound(60.0), what);
+    return h.ok;
+}
+
+bool LongStep(double seconds)
+{
+    Harness h;
+    SimJob* slow  = h.Add("slow", BG_PRIORITY_NORMAL, 1200.0);
+    SimJob* quick = h.Add("quick", BG_PRIORITY_NORMAL, 30.0, 2000);
+    h.Run(seconds);
+    h.Report(seconds);
+
+    h.Check(slow->job.maxSliceUs >= 1200, "an over-budget step still runs (one per slice)");
+    h.Check(quick->stepsLeft == 0 && !quick->job.queued, "the short job completes");
+    return h.ok;
+}
+
+// Producer: fills a numbered buffer over a few steps, publishes it, and
+// reclaims whatever the audio callback retired
+struct Buffer
+{
+    uint32_t seq;
+};
+
+Buffer               g_buffers[3];
+BlockHandoff<Buffer> g_handoff;
+Buffer*              g_live       = nullptr; // audio side
+Buffer*              g_heldRetire = nullptr; // audio side, Retire() refused
+uint32_t             g_nextSeq    = 1;
+uint32_t             g_published  = 0;
+uint32_t             g_taken      = 0;
+uint32_t             g_reclaimed  = 0;
+bool                 g_inOrder    = true;
+std::vector<Buffer*> g_free;
+
+void AudioBlock()
+{
+    if(g_heldRetire && g_handoff.Retire(g_heldRetire))
+        g_heldRetire = nullptr;
+    if(Buffer* b = g_handoff.Take())
+    {
+        g_taken++;
+        if(g_live && b->seq != g_live->seq + 1)
+            g_inOrder = false;
+        if(g_live)
+        {
+            if(g_heldRetire)
+                g_inOrder = false; // would need a second retire slot
+            else if(!g_handoff.Retire(g_live))
+                g_heldRetire = g_live;
+        }
+        g_live = b;
+    }
+}
+
+bool ProducerStep(void*)
+{
+    static int     stage = 0;
+    static Buffer* work  = nullptr;
+    if(Buffer* back = g_handoff.Reclaim())
+    {
+        g_reclaimed++;
+        g_free.push_back(back);
+    }
+    Spend(80.0);
+    if(!work)
+    {
+        if(g_free.empty())
+            return false;
+        work = g_free.back();
+        g_free.pop_back();
+        stage = 0;
+    }
+    if(++stage < 4)
+        return false;
+    work->seq = g_nextSeq;
+    if(g_handoff.Publish(work))
+    {
+        g_nextSeq++;
+        g_published++;
+        work = nullptr;
+    }
+    return false;
+}
+
+bool Handoff(double seconds)
+{
+    Harness h;
+    g_onBlock = AudioBlock;
+    g_free    = {&g_buffers[0], &g_buffers[1], &g_buffers[2]};
+    SimJob* p = new SimJob();
+    p->job.step = ProducerStep;
+    p->job.ctx  = p;
+    p->job.name = "producer";
+    h.exec.Submit(&p->job, BG_PRIORITY_NORMAL);
+    h.jobs.push_back(p);
+    h.Add("filler", BG_PRIORITY_LOW, 100.0);
+    h.Run(seconds);
+    h.Report(seconds);
+
+    printf("  published %u, taken %u, reclaimed %u\n", g_published, g_taken, g_reclaimed);
+    h.Check(g_published > 100, "buffers keep flowing");
+    h.Check(g_taken == g_published || g_taken + 1 == g_published,
+            "every published buffer taken once");
+    h.Check(g_inOrder, "taken in publish order, none twice");
+    h.Check(g_reclaimed + 3 >= g_taken && g_reclaimed <= g_taken, "retired buffers come back");
+    return h.ok;
+}
+
+struct Scenario
+{
+    const char* name;
+    bool (*run)(double seconds);
+};
+
+const Scenario kScenarios[] = {
+    {"fair", Fair},
+    {"priority", Priority},
+    {"flood", Flood},
+    {"long_step", LongStep},
+    {"handoff", Handoff},
+};
+
+void Usage()
+{
+    fprintf(stderr, "usage: executor_sim [-t seconds] [-a audio load %%] [scenario ...]\n");
+}
+} // namespace
+
+int main(int argc, char** argv)
+{
+    double                   seconds = 2.0;
+    std::vector<std::string> names;
+
+    for(int i = 1; i < argc; ++i)
+    {
+        bool more = i + 1 < argc;
+        if(strcmp(argv[i], "-t") == 0 && more)
+            seconds = atof(argv[++i]);
+        else if(strcmp(argv[i], "-a") == 0 && more)
+            g_audioLoad = atof(argv[++i]) / 100.0;
+        else if(argv[i][0] == '-')
+        {
+            Usage();
+            return 2;
+        }
+        else
+            names.push_back(argv[i]);
+    }
+    if(seconds <= 0.0 || g_audioLoad < 0.0 || g_audioLoad >= 0.95)
+    {
+        Usage();
+        return 2;
+    }
+
+    bool ok = true;
+    for(const Scenario& sc : kScenarios)
+    {
+        if(!names.empty() && std::find(names.begin(), names.end(), sc.name) == names.end())
+            continue;
+        printf("== %s (audio load %.0f%%)\n", sc.name, 100.0 * g_audioLoad);
+        ok = sc.run(seconds) && ok;
+    }
+    for(const std::string& n : names)
+    {
+        bool known = false;
+        for(const Scenario& sc : kScenarios)
+            known = known || n == sc.name;
+        if(!known)
+        {
+            fprintf(stderr, "unknown scenario '%s'\n", n.c_str());
+            ok = false;
+        }
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,262 @@
+// governor_sim: the Daisy CPU governor (daisy/seed/kb2040_groovebox/
+// governor.h) driving the real engine through a patch that overruns at
+// full quality.
+//
+//   governor_sim [-b block] [-l load%] [-x scale] [-o outdir]
+//
+// Timeline (seconds):
+//   0.0  delay, reverb and drive up, 1.3 s release, looper recording
+//   0.2  six-note chord
+//   1.2  looper plays back
+//   2.5  chord released (long tails)
+//   3.0  second six-note chord
+//   4.5  released
+//   5.0  looper stopped; tails die out, load falls
+//   8.0  end
+//
+// A block costs the host's time for RenderAudio() times a scale. By
+// default the scale makes the heaviest stretch (1.2 to 2.5 s) average -l
+// percent (default 130) of the block period at full quality; -x sets it
+// directly (target us per host us). The timeline runs twice: at full
+// quality, then with the governor choosing the level for each block from
+// the cost of the one before. -o writes governor.csv, one row per block.
+//
+// Load and overrun figures are only as real as the DaisySP the tool is
+// built with; against a stand-in they show the governor's behaviour, not
+// the engine's cost on the Seed.
+#include "governor.h"
+#include "groovebox_engine.h"
+
+#include <algorithm>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <string>
+#include <unistd.h>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <xmmintrin.h>
+#endif
+
+namespace
+{
+const float kSampleRate = 48000.0f;
+const double kEndSec    = 8.0;
+const double kHeavyFrom = 1.2, kHeavyTo = 2.5;
+
+const char* const kLevelNames[QUALITY_NUM_LEVELS] = {
+    "full", "shed_tails", "single_osc", "cheap_fx", "min_voices"};
+
+struct Options
+{
+    size_t      blockSize = 48;
+    double      loadPct   = 130.0;
+    double      scale     = 0.0; // 0 = calibrate from the full-quality run
+    std::string outDir;
+};
+
+struct Cue
+{
+    double  sec;
+    uint8_t status, data0, data1;
+};
+
+const Cue kTimeline[] = {
+    {0.0, 0xB0, 75, 40}, {0.0, 0xB0, 78, 100}, {0.0, 0xB0, 79, 96},
+    {0.0, 0xB0, 80, 96},  {0.0, 0xB0, 81, 112}, {0.0, 0xB0, 84, 64},
+    {0.0, 0xB0, 85, 64},  {0.0, 0xB0, 91, 40},  {0.2, 0x90, 48, 100},
+    {0.2, 0x90, 55, 100}, {0.2, 0x90, 60, 100}, {0.2, 0x90, 64, 100},
+    {0.2, 0x90, 67, 100}, {0.2, 0x90, 72, 100}, {1.2, 0xB0, 91, 40},
+    {2.5, 0x80, 48, 64},  {2.5, 0x80, 55, 64},  {2.5, 0x80, 60, 64},
+    {2.5, 0x80, 64, 64},  {2.5, 0x80, 67, 64},  {2.5, 0x80, 72, 64},
+    {3.0, 0x90, 50, 100}, {3.0, 0x90, 57, 100}, {3.0, 0x90, 62, 100},
+    {3.0, 0x90, 65, 100}, {3.0, 0x90, 69, 100}, {3.0, 0x90, 74, 100},
+    {4.5, 0x80, 50, 64},  {4.5, 0x80, 57, 64},  {4.5, 0x80, 62, 64},
+    {4.5, 0x80, 65, 64},  {4.5, 0x80, 69, 64},  {4.5, 0x80, 74, 64},
+    {5.0, 0xB0, 91, 0},
+};
+
+struct Block
+{
+    double  hostUs;
+    uint8_t level;
+};
+
+// Thread CPU time, so the scheduler running something else mid-block
+// doesn't show up as engine cost
+double CpuUs()
+{
+    timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (double)ts.tv_sec * 1e6 + (double)ts.tv_nsec / 1e3;
+}
+
+// Runs the timeline. With a governor, each block's scaled cost picks the
+// next block's level; without one the engine stays at full quality.
+std::vector<Block> Run(const Options& o, double scale, CpuGovernor* governor)
+{
+    InitSynth(kSampleRate);
+    const double periodUs  = 1e6 * (double)o.blockSize / kSampleRate;
+    const size_t numBlocks = (size_t)(kEndSec * 1e6 / periodUs);
+
+    std::vector<float> left(o.blockSize), right(o.blockSize);
+    float*             out[2] = {left.data(), right.data()};
+    std::vector<Block> blocks(numBlocks);
+    size_t             cue = 0;
+    for(size_t k = 0; k < numBlocks; k++)
+    {
+        double sec = (double)k * periodUs / 1e6;
+        for(; cue < sizeof(kTimeline) / sizeof(kTimeline[0]) && kTimeline[cue].sec <= sec; cue++)
+            HandleMidiMessage(kTimeline[cue].status, kTimeline[cue].data0, kTimeline[cue].data1);
+
+        blocks[k].level = GetEngineQuality();
+        double a = CpuUs();
+        RenderAudio(out, o.blockSize);
+        blocks[k].hostUs = CpuUs() - a;
+
+        if(governor)
+            SetEngineQuality((EngineQuality)governor->Update(
+                (float)(blocks[k].hostUs * scale / periodUs)));
+    }
+    return blocks;
+}
+
+void Report(const char*               name,
+            const std::vector<Block>& blocks,
+            double                    scale,
+            double                    periodUs,
+            const CpuGovernor*        governor)
+{
+    double   sum = 0.0, max = 0.0;
+    uint64_t overruns = 0;
+    double   levelSum[QUALITY_NUM_LEVELS]   = {};
+    uint64_t levelCount[QUALITY_NUM_LEVELS] = {};
+    for(const Block& b : blocks)
+    {
+        double load = b.hostUs * scale / periodUs;
+        sum += load;
+        max = std::max(max, load);
+        if(load > 1.0)
+            overruns++;
+        levelSum[b.level] += load;
+        levelCount[b.level]++;
+    }
+
+    printf("== %s: %zu blocks\n", name, blocks.size());
+    printf("  load       avg %.1f%% max %.1f%%, overruns %llu\n",
+           100.0 * sum / blocks.size(),
+           100.0 * max,
+           (unsigned long long)overruns);
+    if(!governor)
+        return;
+
+    const CpuGovernor::Stats& st = governor->GetStats();
+    printf("  governor   %u steps down, %u up\n", st.stepsDown, st.stepsUp);
+    printf("  level          blocks   load avg\n");
+    for(int l = 0; l < QUALITY_NUM_LEVELS; l++)
+        printf("  %-12s %8llu   %6.1f%%\n",
+               kLevelNames[l],
+               (unsigned long long)levelCount[l],
+               levelCount[l] ? 100.0 * levelSum[l] / levelCount[l] : 0.0);
+
+    printf("  changes\n");
+    int shown = 0;
+    for(size_t k = 1; k < blocks.size(); k++)
+    {
+        if(blocks[k].level == blocks[k - 1].level)
+            continue;
+        if(++shown > 24)
+        {
+            printf("    ...\n");
+            break;
+        }
+        printf("    %6.3f s  %s -> %s (load %.0f%%)\n",
+               (double)k * periodUs / 1e6,
+               kLevelNames[blocks[k - 1].level],
+               kLevelNames[blocks[k].level],
+               100.0 * blocks[k - 1].hostUs * scale / periodUs);
+    }
+}
+
+void Usage()
+{
+    fprintf(stderr,
+            "usage: governor_sim [-b block] [-l load%%] [-x scale] [-o outdir]\n");
+    exit(2);
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    Options o;
+    int     opt;
+    while((opt = getopt(argc, argv, "b:l:x:o:h")) != -1)
+    {
+        switch(opt)
+        {
+            case 'b': o.blockSize = (size_t)atoi(optarg); break;
+            case 'l': o.loadPct = atof(optarg); break;
+            case 'x': o.scale = atof(optarg); break;
+            case 'o': o.outDir = optarg; break;
+            default: Usage();
+        }
+    }
+    if(optind != argc || o.blockSize == 0 || o.loadPct <= 0.0)
+        Usage();
+
+#if defined(__x86_64__) || defined(__i386__)
+    // Tails decaying to silence leave denormals in the filter and reverb
+    // state, which x86 handles in microcode at many times the normal cost;
+    // that would swamp the costs this tool compares
+    _mm_setcsr(_mm_getcsr() | 0x8040); // FTZ | DAZ
+#endif
+
+    const double periodUs = 1e6 * (double)o.blockSize / kSampleRate;
+
+    std::vector<Block> full = Run(o, 1.0, nullptr);
+    double             scale = o.scale;
+    if(scale <= 0.0)
+    {
+        size_t from = (size_t)(kHeavyFrom * 1e6 / periodUs);
+        size_t to   = (size_t)(kHeavyTo * 1e6 / periodUs);
+        double sum  = 0.0;
+        for(size_t k = from; k < to; k++)
+            sum += full[k].hostUs;
+        scale = o.loadPct / 100.0 * periodUs / (sum / (double)(to - from));
+    }
+    printf("block %zu @ %.0f Hz, scale %.1f target us per host us\n",
+           o.blockSize,
+           kSampleRate,
+           scale);
+
+    CpuGovernor::Config cfg;
+    cfg.numLevels = QUALITY_NUM_LEVELS;
+    CpuGovernor governor;
+    governor.Init(cfg);
+    std::vector<Block> governed = Run(o, scale, &governor);
+
+    Report("full quality", full, scale, periodUs, nullptr);
+    Report("governed", governed, scale, periodUs, &governor);
+
+    if(o.outDir.empty())
+        return 0;
+    std::string path = o.outDir + "/governor.csv";
+    FILE*       f    = fopen(path.c_str(), "w");
+    if(!f)
+    {
+        fprintf(stderr, "cannot write %s\n", path.c_str());
+        return 1;
+    }
+    fprintf(f, "block,load_full,load_governed,level\n");
+    for(size_t k = 0; k < full.size(); k++)
+        fprintf(f,
+                "%zu,%.4f,%.4f,%u\n",
+                k,
+                full[k].hostUs * scale / periodUs,
+                governed[k].hostUs * scale / periodUs,
+                governed[k].level);
+    fclose(f);
+    return 0;
+}
@@ -0,0 +1,537 @@
+// groovebox_flood: MIDI flood stress test of the Daisy event path.
+//
+//   groovebox_flood [-t seconds] [-b block] [-B baud] [-r msgs/s]
+//                   [-q queue] [-x scale] [-l load%] [-c block:msg]
+//                   [-o outdir] [storm ...]
+//
+// Worst-case streams from bench/storm.h (notes, cc, bend, mixed) arrive on
+// the UART while the engine plays a heavy patch. The model follows the
+// firmware:
+//   - UART bytes land by DMA; the DMA callback (idle line or half buffer,
+//     as in daisy_sim.h) parses them into the firmware's 256-entry
+//     MidiRxQueue (midi_rx.h). A full queue drops the event.
+//   - The callback can't preempt the audio callback. A callback due while
+//     audio renders runs when it returns. If more than the 256-byte DMA
+//     ring arrived by then, the oldest bytes are overwritten (rx lost).
+//   - main() wakes from WFI and moves the events into the jitter buffer's
+//     256-entry queue for the next block (jitter_buffer.h); that costs
+//     next to nothing and isn't timed. What doesn't fit stays in the
+//     receive queue.
+//   - The audio callback hands the queued events to the engine, then
+//     renders, so handler time counts against the block. One that hasn't
+//     finished when the next is due is an overrun.
+//
+// Costs are the host's own time for each HandleMidiMessage() and
+// RenderAudio() call, times -x (target ns per host ns), plus -l percent
+// extra on every block. -c uses the bench image's instruction counts
+// instead (bench/ "make flood"; 480 MHz, one instruction per cycle).
+//
+// Each storm runs in its own process, so engine state can't leak between
+// storms.
+//
+// The run also fills the firmware's trace ring (trace.h) on the model's
+// clock, with the same records at the same points as the firmware; with
+// -o it is dumped to trace_<storm>.txt for firmware/host trace_decode.
+#include "daisy_sim.h"
+#include "groovebox_engine.h"
+#include "storm.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+namespace
+{
+double g_nowUs = 0.0; // model time, for TraceNow()
+}
+
+// Cycles at the Seed's clock, as the firmware records them
+uint32_t TraceNow()
+{
+    return (uint32_t)(uint64_t)(g_nowUs * 480.0);
+}
+
+namespace
+{
+const size_t   kRxRing   = 256; // libDaisy MIDI UART DMA buffer
+const size_t   kNextQueue = 256; // JitterBuffer's, for the next block
+const uint32_t kRxHalf   = 128;
+const double   kStormUs  = 100000.0; // heavy patch settles first
+const double   kTargetMhz = 480.0;
+
+struct Options
+{
+    double   seconds    = 3.0;
+    size_t   blockSize  = 48;
+    float    sampleRate = 48000.0f;
+    uint32_t baud       = 31250;
+    double   rate       = 0.0; // offered msgs/s, 0 = back-to-back on the wire
+    size_t   queue      = 256;
+    double   scale      = 1.0;
+    double   loadPct    = 0.0;
+    double   blockInsns = 0.0; // -c: fixed costs from the bench image
+    double   msgInsns   = 0.0;
+    std::string outDir;
+};
+
+struct RxByte
+{
+    double  wireUs; // stop bit received
+    uint8_t byte;
+};
+
+struct Event
+{
+    uint8_t status, data0, data1;
+    double  wireUs; // last byte received
+};
+
+struct Stats
+{
+    uint64_t offered   = 0;
+    uint64_t handled   = 0;
+    uint64_t dropped   = 0;
+    uint64_t rxLost    = 0;
+    uint64_t overruns  = 0;
+    uint64_t blocks    = 0;
+    size_t   queueHigh = 0;
+    double   handlerUs = 0.0, handlerMaxUs = 0.0;
+    double   renderUs  = 0.0, renderMaxUs  = 0.0;
+    std::vector<double> latencyUs; // wire -> handled
+};
+
+typedef std::chrono::steady_clock Clock;
+
+double HostUs(Clock::time_point a, Clock::time_point b)
+{
+    return std::chrono::duration<double, std::micro>(b - a).count();
+}
+
+// The storm's bytes as they land on the Daisy's RX pin
+std::vector<RxByte> MakeStream(StormKind kind, const Options& o, uint64_t* msgs)
+{
+    const double byteUs = 10.0 * 1e6 / o.baud;
+    const double endUs  = o.seconds * 1e6;
+    const double gapUs  = o.rate > 0.0 ? 1e6 / o.rate : 0.0;
+
+    std::vector<RxByte> out;
+    double              lineUs = kStormUs;
+    uint32_t            i      = 0;
+    for(double sendUs = kStormUs; sendUs < endUs; sendUs += gapUs, i++)
+    {
+        uint8_t msg[3];
+        StormMessage(kind, i, msg);
+        double t = std::max(sendUs, lineUs);
+        if(t >= endUs)
+            break;
+        for(uint8_t b : msg)
+        {
+            t += byteUs;
+            out.push_back({t, b});
+        }
+        lineUs = t;
+        if(gapUs == 0.0)
+            sendUs = t;
+    }
+    *msgs = i;
+    return out;
+}
+
+// Heavy patch, driven directly: FX up, a six-note chord, looper recording
+// from block 0 and playing from block 400
+void Prelude(size_t block)
+{
+    static const uint8_t kSetup[][3] = {
+        {0xB0, 79, 0x60}, {0xB0, 80, 0x60}, {0xB0, 81, 0x70},
+        {0xB0, 84, 0x40}, {0xB0, 85, 0x30}, {0x90, 48, 100},
+        {0x90, 55, 100},  {0x90, 60, 100},  {0x90, 64, 100},
+        {0x90, 67, 100},  {0x90, 72, 100},  {0xB0, 91, 40},
+    };
+    if(block == 0)
+        for(const auto& m : kSetup)
+            HandleMidiMessage(m[0], m[1], m[2]);
+    else if(block == 400)
+        HandleMidiMessage(0xB0, 91, 40);
+}
+
+class FloodSim
+{
+  public:
+    FloodSim(const Options& o, std::vector<RxByte> rx)
+    : o_(o), rx_(std::move(rx))
+    {
+        periodUs_ = 1e6 * (double)o.blockSize / o.sampleRate;
+        idleUs_   = 10.0 * 1e6 / o.baud;
+        left_.assign(o.blockSize, 0.0f);
+        right_.assign(o.blockSize, 0.0f);
+    }
+
+    void Run(Stats& st)
+    {
+        st_ = &st;
+        InitSynth(o_.sampleRate);
+        double audioEnd = 0.0, lastCost = 0.0;
+        size_t numBlocks = (size_t)(o_.seconds * 1e6 / periodUs_);
+        for(size_t k = 0; k < numBlocks; k++)
+        {
+            double due   = (double)k * periodUs_;
+            double start = std::max(due, audioEnd);
+
+            // Callbacks due by now ran before the audio interrupt, and
+            // main() queued their events for this block
+            ServiceRx(start);
+
+            g_nowUs = start;
+            TRACE(TRACE_CALLBACK_BEGIN, 0, o_.blockSize);
+            if(lastCost > periodUs_) // as the firmware sees it
+            {
+                TRACE(TRACE_OVERRUN, 0, std::min(lastCost - periodUs_, 65535.0));
+                g_trace.Trigger();
+            }
+            Prelude(k);
+            double cost = HandleQueued(start);
+            cost += RenderBlock();
+            lastCost    = cost;
+            audioEnd    = start + cost;
+            audioStart_ = start;
+            audioStop_  = audioEnd;
+            if(audioEnd > due + periodUs_)
+                st.overruns++;
+            st.blocks++;
+            g_nowUs = audioEnd;
+            TRACE(TRACE_CALLBACK_END, 0, std::min(cost * 1000.0 / periodUs_, 65535.0));
+        }
+    }
+
+  private:
+    // Next DMA callback among unserviced bytes, as in dsim::Daisy
+    bool NextTrigger(double& atUs) const
+    {
+        uint32_t fill = sinceHalf_;
+        for(size_t i = rxNext_; i < rx_.size(); ++i)
+        {
+            if(++fill % kRxHalf == 0)
+            {
+                atUs = rx_[i].wireUs;
+                return true;
+            }
+            bool last = (i + 1 == rx_.size());
+            if(last || rx_[i + 1].wireUs - idleUs_ >= rx_[i].wireUs + idleUs_)
+            {
+                atUs = rx_[i].wireUs + idleUs_;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Runs DMA callbacks triggered up to `untilUs`. One that fell inside
+    // the last audio callback runs when it returned, and takes everything
+    // the DMA wrote by then.
+    void ServiceRx(double untilUs)
+    {
+        double trig = 0.0;
+        while(NextTrigger(trig) && trig <= untilUs)
+        {
+            double at = trig;
+            if(trig >= audioStart_ && trig < audioStop_)
+                at = audioStop_;
+            size_t end = rxNext_;
+            while(end < rx_.size() && rx_[end].wireUs <= at)
+                end++;
+            size_t count = end - rxNext_;
+            if(count > kRxRing)
+            {
+                st_->rxLost += count - kRxRing;
+                rxNext_ += count - kRxRing;
+                // The parser sees a stream with a hole in it; it resyncs
+                // on the next status byte
+                parser_ = MidiByteParser();
+            }
+            for(; rxNext_ < end; rxNext_++)
+            {
+                if(!parser_.Feed(rx_[rxNext_].byte))
+                    continue;
+                // The first kNextQueue are main()'s in the jitter buffer
+                g_nowUs = at;
+                if(queue_.size() >= o_.queue + kNextQueue)
+                {
+                    TRACE(TRACE_MIDI_DROP, parser_.status, parser_.data[0] | parser_.data[1] << 8);
+                    st_->dropped++;
+                    continue;
+                }
+                TRACE(TRACE_MIDI_RX, parser_.status, parser_.data[0] | parser_.data[1] << 8);
+                queue_.push_back({parser_.status,
+                                  parser_.data[0],
+                                  parser_.data[1],
+                                  rx_[rxNext_].wireUs});
+                if(queue_.size() > kNextQueue)
+                    st_->queueHigh = std::max(st_->queueHigh, queue_.size() - kNextQueue);
+            }
+            sinceHalf_ = (uint32_t)((sinceHalf_ + count) % kRxHalf);
+        }
+    }
+
+    // Audio callback: the engine takes what main() queued for the block.
+    // Returns the time it took.
+    double HandleQueued(double start)
+    {
+        double t = start;
+        for(size_t n = 0; n < kNextQueue && !queue_.empty(); n++)
+        {
+            Event e = queue_.front();
+            queue_.pop_front();
+            g_nowUs = t;
+            TRACE(TRACE_HANDLER_BEGIN, e.status, e.data0 | e.data1 << 8);
+            t += HandleEvent(e);
+            st_->handled++;
+            g_nowUs = t;
+            TRACE(TRACE_HANDLER_END, e.status, 0);
+            st_->latencyUs.push_back(t - e.wireUs);
+        }
+        return t - start;
+    }
+
+    double HandleEvent(const Event& e)
+    {
+        auto   a    = Clock::now();
+        HandleMidiMessage(e.status, e.data0, e.data1);
+        double cost = o_.msgInsns > 0.0 ? o_.msgInsns / kTargetMhz
+                                        : HostUs(a, Clock::now()) * o_.scale;
+        st_->handlerUs += cost;
+        st_->handlerMaxUs = std::max(st_->handlerMaxUs, cost);
+        return cost;
+    }
+
+    double RenderBlock()
+    {
+        float* out[2] = {left_.data(), right_.data()};
+        auto   a      = Clock::now();
+        RenderAudio(out, o_.blockSize);
+        double cost = o_.blockInsns > 0.0 ? o_.blockInsns / kTargetMhz
+                                          : HostUs(a, Clock::now()) * o_.scale;
+        cost += periodUs_ * o_.loadPct / 100.0;
+        st_->renderUs += cost;
+        st_->renderMaxUs = std::max(st_->renderMaxUs, cost);
+        return cost;
+    }
+
+    const Options&      o_;
+    std::vector<RxByte> rx_;
+    double              periodUs_ = 1000.0;
+    double              idleUs_   = 320.0;
+    Stats*              st_       = nullptr;
+
+    size_t               rxNext_    = 0;
+    uint32_t             sinceHalf_ = 0;
+    MidiByteParser parser_;
+    std::deque<Event>    queue_;
+
+    double audioStart_ = -1.0, audioStop_ = -1.0;
+
+    std::vector<float> left_, right_;
+};
+
+double Percentile(std::vector<double> v, double p)
+{
+    if(v.empty())
+        return 0.0;
+    std::sort(v.begin(), v.end());
+    size_t idx = (size_t)(p / 100.0 * (double)(v.size() - 1) + 0.5);
+    return v[idx];
+}
+
+void Report(StormKind kind, const Stats& st, const Options& o)
+{
+    const double periodUs  = 1e6 * (double)o.blockSize / o.sampleRate;
+    const double stormSec  = o.seconds - kStormUs / 1e6;
+    const double loadAvg   = st.blocks ? st.renderUs / st.blocks / periodUs : 0.0;
+    const double handlerAvg = st.handled ? st.handlerUs / st.handled : 0.0;
+    // What the callback could take on with the CPU rendering leaves
+    const double capacity = handlerAvg > 0.0 ? (1.0 - loadAvg) * 1e6 / handlerAvg : 0.0;
+
+    printf("== %s: %.1f s at %u baud, block %zu @ %.0f Hz\n",
+           StormName(kind),
+           o.seconds,
+           o.baud,
+           o.blockSize,
+           o.sampleRate);
+    printf("  messages   offered %llu (%.0f/s), handled %llu, dropped %llu, "
+           "rx bytes lost %llu\n",
+           (unsigned long long)st.offered,
+           st.offered / stormSec,
+           (unsigned long long)st.handled,
+           (unsigned long long)st.dropped,
+           (unsigned long long)st.rxLost);
+    printf("  queue      high-water %zu of %zu\n", st.queueHigh, o.queue);
+    printf("  audio      load avg %.1f%% max %.1f%%, overruns %llu of %llu blocks\n",
+           100.0 * loadAvg,
+           100.0 * st.renderMaxUs / periodUs,
+           (unsigned long long)st.overruns,
+           (unsigned long long)st.blocks);
+    printf("  handler    avg %.2f us max %.2f us, capacity %.0f msgs/s\n",
+           handlerAvg,
+           st.handlerMaxUs,
+           capacity);
+    printf("  latency    wire -> handled p50 %.0f p99 %.0f max %.0f us\n",
+           Percentile(st.latencyUs, 50),
+           Percentile(st.latencyUs, 99),
+           Percentile(st.latencyUs, 100));
+
+    if(o.outDir.empty())
+        return;
+    std::string path = o.outDir + "/flood_" + StormName(kind) + ".csv";
+    FILE*       f    = fopen(path.c_str(), "w");
+    if(!f)
+    {
+        fprintf(stderr, "cannot write %s\n", path.c_str());
+        return;
+    }
+    fprintf(f, "offered,handled,dropped,rx_lost,queue_high,overruns,blocks,"
+               "load_avg,load_max,handler_avg_us,handler_max_us,"
+               "latency_p50_us,latency_p99_us,latency_max_us\n");
+    fprintf(f,
+            "%llu,%llu,%llu,%llu,%zu,%llu,%llu,%.4f,%.4f,%.3f,%.3f,%.1f,%.1f,%.1f\n",
+            (unsigned long long)st.offered,
+            (unsigned long long)st.handled,
+            (unsigned long long)st.dropped,
+            (unsigned long long)st.rxLost,
+            st.queueHigh,
+            (unsigned long long)st.overruns,
+            (unsigned long long)st.blocks,
+            loadAvg,
+            st.renderMaxUs / periodUs,
+            handlerAvg,
+            st.handlerMaxUs,
+            Percentile(st.latencyUs, 50),
+            Percentile(st.latencyUs, 99),
+            Percentile(st.latencyUs, 100));
+    fclose(f);
+}
+
+void PrintTraceLine(const char* line, void* ctx)
+{
+    fprintf((FILE*)ctx, "%s\n", line);
+}
+
+void WriteTrace(StormKind kind, const Options& o)
+{
+    std::string path = o.outDir + "/trace_" + StormName(kind) + ".txt";
+    FILE*       f    = fopen(path.c_str(), "w");
+    if(!f)
+    {
+        fprintf(stderr, "cannot write %s\n", path.c_str());
+        return;
+    }
+    TRACE(TRACE_DUMP, 0, 0);
+    g_trace.Stop();
+    TraceDumper dumper;
+    dumper.Start(&g_trace, (uint32_t)(kTargetMhz * 1e6));
+    while(!dumper.Step(PrintTraceLine, f, 64)) {}
+    fclose(f);
+}
+
+void RunStorm(StormKind kind, const Options& o)
+{
+    Stats    st;
+    FloodSim sim(o, MakeStream(kind, o, &st.offered));
+    sim.Run(st);
+    Report(kind, st, o);
+    if(!o.outDir.empty())
+        WriteTrace(kind, o);
+}
+
+void Usage()
+{
+    fprintf(stderr,
+            "usage: groovebox_flood [-t seconds] [-b block] [-B baud] "
+            "[-r msgs/s] [-q queue] [-x scale] [-l load%%] [-c block:msg] "
+            "[-o outdir] [storm ...]\n");
+}
+} // namespace
+
+int main(int argc, char** argv)
+{
+    Options                o;
+    std::vector<StormKind> kinds;
+
+    for(int i = 1; i < argc; ++i)
+    {
+        bool more = i + 1 < argc;
+        if(strcmp(argv[i], "-t") == 0 && more)
+            o.seconds = atof(argv[++i]);
+        else if(strcmp(argv[i], "-b") == 0 && more)
+            o.blockSize = (size_t)atoi(argv[++i]);
+        else if(strcmp(argv[i], "-B") == 0 && more)
+            o.baud = (uint32_t)strtoul(argv[++i], nullptr, 0);
+        else if(strcmp(argv[i], "-r") == 0 && more)
+            o.rate = atof(argv[++i]);
+        else if(strcmp(argv[i], "-q") == 0 && more)
+            o.queue = (size_t)atoi(argv[++i]);
+        else if(strcmp(argv[i], "-x") == 0 && more)
+            o.scale = atof(argv[++i]);
+        else if(strcmp(argv[i], "-l") == 0 && more)
+            o.loadPct = atof(argv[++i]);
+        else if(strcmp(argv[i], "-c") == 0 && more)
+        {
+            if(sscanf(argv[++i], "%lf:%lf", &o.blockInsns, &o.msgInsns) != 2)
+            {
+                Usage();
+                return 2;
+            }
+        }
+        else if(strcmp(argv[i], "-o") == 0 && more)
+            o.outDir = argv[++i];
+        else if(argv[i][0] == '-')
+        {
+            Usage();
+            return 2;
+        }
+        else
+        {
+            StormKind k;
+            if(!StormParse(argv[i], &k))
+            {
+                fprintf(stderr, "unknown storm '%s'\n", argv[i]);
+                return 2;
+            }
+            kinds.push_back(k);
+        }
+    }
+    if(o.blockSize == 0 || o.baud == 0 || o.queue == 0
+       || o.seconds * 1e6 <= kStormUs)
+    {
+        Usage();
+        return 2;
+    }
+    if(kinds.empty())
+        for(int k = 0; k < STORM_NUM_KINDS; k++)
+            kinds.push_back((StormKind)k);
+
+    for(StormKind k : kinds)
+    {
+        fflush(stdout);
+        pid_t pid = fork();
+        if(pid == 0)
+        {
+            RunStorm(k, o);
+            fflush(stdout);
+            _exit(0);
+        }
+        int status = 0;
+        if(pid < 0 || waitpid(pid, &status, 0) < 0 || status != 0)
+        {
+            fprintf(stderr, "storm %s failed\n", StormName(k));
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,394 @@
+// groovebox_latency: key-to-sound latency across both firmwares.
+//
+//   groovebox_latency [-n trials] [-b block] [-s seed] [-j] [-o outdir]
+//                     [scenario ...]
+//
+// The KB2040 sketch runs in the host simulator (kb2040_sim.h). Its UART
+// bytes feed the Daisy model (daisy_sim.h), which runs the real DSP engine.
+// For each trial a random key is pressed at a random time. Latency is
+// measured from the MCP23017 pin going low to the first output sample
+// above -60 dBFS at the DAC.
+//
+// Scenarios (default: all):
+//   single         one note per key
+//   chord          chord mode (gamepad A), 3 notes per key
+//   encoder_flood  encoders spinning continuously, UART near saturation
+//   oled_redraw    debug page toggled every 40 ms, full-screen flushes
+//
+// -j turns on the KB2040's send stamps (serial 't'), so the Daisy plays
+// notes through its jitter buffer at stamp + a fixed latency.
+//
+// Each scenario runs in its own process. Each trial restarts the engine
+// with InitSynth() so earlier release and FX tails can't be mistaken for
+// the new note.
+#include "daisy_sim.h"
+#include "groovebox_engine.h"
+#include "kb2040_sim.h"
+
+#include <algorithm>
+#include <math.h>
+#include <random>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+namespace
+{
+const float kSilence = 0.001f; // -60 dBFS
+
+const uint32_t kBtnA     = 1u << 5;
+const uint32_t kBtnStart = 1u << 16;
+
+struct Trial
+{
+    int      key;
+    uint64_t pressUs;
+    uint64_t queuedUs;   // first NoteOn handed to the KB2040 UART
+    uint64_t wireUs;     // its last byte received by the Daisy
+    uint64_t deliverUs;  // parsed in the DMA callback
+    uint64_t lastDeliverUs;
+    uint64_t blockUs;    // first audio callback after deliverUs
+    double   allNotesUs; // first block with every NoteOn of the press
+    double   onsetUs;    // first sample above kSilence at the DAC
+    int      notes;
+};
+
+struct Scenario
+{
+    const char* name;
+    void (*setup)(uint64_t startUs);
+    void (*tick)(uint64_t ms);
+};
+
+// Sim state shared with the sinks
+dsim::Daisy g_daisy;
+Trial*      g_trial  = nullptr;
+uint64_t    g_tickMs = 0; // next background tick due
+bool        g_stamps = false;
+
+void OnMessage(const dsim::RxMessage& m, void*)
+{
+    Trial* t = g_trial;
+    if(!t || (m.status & 0xF0) != 0x90 || m.data1 == 0 || m.queuedUs < t->pressUs)
+        return;
+    if(t->notes == 0)
+    {
+        t->queuedUs  = m.queuedUs;
+        t->wireUs    = m.wireUs;
+        t->deliverUs = m.deliverUs;
+    }
+    t->lastDeliverUs = m.deliverUs;
+    t->notes++;
+}
+
+void OnBlock(uint64_t     callbackUs,
+             double       playUs,
+             const float* left,
+             const float* right,
+             size_t       n,
+             void*)
+{
+    Trial* t = g_trial;
+    if(!t || t->notes == 0 || callbackUs < t->deliverUs)
+        return;
+    if(t->blockUs == 0)
+        t->blockUs = callbackUs;
+    if(t->allNotesUs == 0.0 && callbackUs > t->lastDeliverUs)
+        t->allNotesUs = playUs;
+    if(t->onsetUs != 0.0)
+        return;
+    const double sampleUs = g_daisy.BlockPeriodUs() / (double)n;
+    for(size_t i = 0; i < n; ++i)
+    {
+        if(fabsf(left[i]) > kSilence || fabsf(right[i]) > kSilence)
+        {
+            t->onsetUs = playUs + sampleUs * (double)i;
+            return;
+        }
+    }
+}
+
+// Runs both sides up to `us` in 1 ms steps, calling the scenario's
+// background tick once per simulated millisecond.
+void Advance(const Scenario& sc, uint64_t us)
+{
+    while(kbsim::NowUs() < us)
+    {
+        uint64_t now  = kbsim::NowUs();
+        uint64_t next = std::min(us, (now / 1000 + 1) * 1000);
+        for(; g_tickMs <= now / 1000; ++g_tickMs)
+            if(sc.tick)
+                sc.tick(g_tickMs);
+        kbsim::RunUntil(next);
+        g_daisy.AdvanceTo(kbsim::NowUs());
+    }
+}
+
+// ---- scenarios ----------------------------------------------------------
+
+void ChordSetup(uint64_t)
+{
+    // Gamepad A cycles single -> chord
+    kbsim::SetPadButton(kBtnA, true);
+}
+
+void FloodTick(uint64_t ms)
+{
+    // One detent per ms round the first four encoders, direction flipping
+    // every lap so the parameters hover instead of running to a limit
+    int enc = (int)(ms % 4);
+    kbsim::SpinEncoder(enc, ((ms / 4) % 2) ? 1 : -1);
+}
+
+void RedrawTick(uint64_t ms)
+{
+    // START+A toggles the debug page: a full-screen change every 40 ms
+    switch(ms % 40)
+    {
+        case 0: kbsim::SetPadButton(kBtnStart, true); break;
+        case 5: kbsim::SetPadButton(kBtnA, true); break;
+        case 10: kbsim::SetPadButton(kBtnA, false); break;
+        case 15: kbsim::SetPadButton(kBtnStart, false); break;
+        default: break;
+    }
+}
+
+const Scenario kScenarios[] = {
+    {"single", nullptr, nullptr},
+    {"chord", ChordSetup, nullptr},
+    {"encoder_flood", nullptr, FloodTick},
+    {"oled_redraw", nullptr, RedrawTick},
+};
+
+// ---- reporting ------------------------------------------------------------
+
+double Percentile(std::vector<double> v, double p)
+{
+    if(v.empty())
+        return 0.0;
+    std::sort(v.begin(), v.end());
+    size_t idx = (size_t)(p / 100.0 * (double)(v.size() - 1) + 0.5);
+    return v[idx];
+}
+
+void PrintRow(const char* label, const std::vector<double>& v)
+{
+    printf("  %-24s %8.0f %8.0f %8.0f %8.0f\n",
+           label,
+           Percentile(v, 50),
+           Percentile(v, 90),
+           Percentile(v, 99),
+           Percentile(v, 100));
+}
+
+void Report(const Scenario&           sc,
+            const std::vector<Trial>& trials,
+            const dsim::Config&       dcfg,
+            const std::string&        outDir)
+{
+    std::vector<double> scan, uart, rx, wait, out, total, all;
+    int                 missed = 0;
+    for(const Trial& t : trials)
+    {
+        if(t.notes == 0 || t.onsetUs == 0.0)
+        {
+            missed++;
+            continue;
+        }
+        scan.push_back((double)(t.queuedUs - t.pressUs));
+        uart.push_back((double)(t.wireUs - t.queuedUs));
+        rx.push_back((double)(t.deliverUs - t.wireUs));
+        wait.push_back((double)(t.blockUs - t.deliverUs));
+        out.push_back(t.onsetUs - (double)t.blockUs);
+        total.push_back(t.onsetUs - (double)t.pressUs);
+        all.push_back(t.allNotesUs - (double)t.pressUs);
+    }
+
+    printf("== %s: %zu trials, block %zu @ %.0f Hz, %d missed\n",
+           sc.name,
+           trials.size(),
+           dcfg.blockSize,
+           dcfg.sampleRate,
+           missed);
+    printf("  %-24s %8s %8s %8s %8s   (us)\n", "", "p50", "p90", "p99", "max");
+    PrintRow("key -> NoteOn queued", scan);
+    PrintRow("queued -> received", uart);
+    PrintRow("received -> parsed", rx);
+    PrintRow("parsed -> audio block", wait);
+    PrintRow("block -> first sound", out);
+    PrintRow("key -> first sound", total);
+    PrintRow("key -> all notes in", all);
+    printf("  daisy rx backlog max %zu bytes\n", g_daisy.MaxRxPending());
+    if(g_stamps)
+    {
+        const JitterBuffer::Stats& js = g_daisy.JitterStats();
+        printf("  jitter buffer: %u scheduled, %u late (max %u us), "
+               "delay spread %u us\n",
+               js.scheduled,
+               js.late,
+               js.maxLateUs,
+               js.maxSpreadUs);
+    }
+
+    if(outDir.empty())
+        return;
+    std::string path = outDir + "/latency_" + sc.name + ".csv";
+    FILE*       f    = fopen(path.c_str(), "w");
+    if(!f)
+    {
+        fprintf(stderr, "cannot write %s\n", path.c_str());
+        return;
+    }
+    fprintf(f, "key,press_us,queued_us,received_us,parsed_us,block_us,onset_us,all_notes_us,notes\n");
+    for(const Trial& t : trials)
+        fprintf(f,
+                "%d,%llu,%llu,%llu,%llu,%llu,%.1f,%.1f,%d\n",
+                t.key,
+                (unsigned long long)t.pressUs,
+                (unsigned long long)t.queuedUs,
+                (unsigned long long)t.wireUs,
+                (unsigned long long)t.deliverUs,
+                (unsigned long long)t.blockUs,
+                t.onsetUs,
+                t.allNotesUs,
+                t.notes);
+    fclose(f);
+}
+
+// ---- run --------------------------------------------------------------------
+
+void RunScenario(const Scenario&     sc,
+                 int                 numTrials,
+                 const dsim::Config& dcfg,
+                 uint32_t            seed,
+                 const std::string&  outDir)
+{
+    std::mt19937 rng(seed);
+
+    kbsim::Reset(kbsim::Config());
+    kbsim::SetUartSink(dsim::Daisy::UartSink, &g_daisy);
+    kbsim::Boot();
+    if(g_stamps)
+    {
+        // Before any scenario load: under the encoder flood the serial
+        // task is starved (the UART writes block the loop)
+        kbsim::SerialInput("t");
+        kbsim::RunUntil(kbsim::NowUs() + 100000);
+    }
+
+    uint64_t start = kbsim::NowUs();
+    g_tickMs       = start / 1000;
+    double   phase = std::uniform_real_distribution<double>(0.0, 1000.0)(rng);
+    g_daisy.Reset(dcfg, start, phase);
+    g_daisy.SetMessageSink(OnMessage, nullptr);
+    g_daisy.SetBlockSink(OnBlock, nullptr);
+
+    if(sc.setup)
+    {
+        sc.setup(start);
+        Advance(sc, start + 50000);
+        kbsim::SetPadButton(kBtnA, false);
+    }
+    Advance(sc, kbsim::NowUs() + 200000);
+
+    std::vector<Trial> trials(numTrials);
+    for(Trial& t : trials)
+    {
+        memset(&t, 0, sizeof(t));
+        InitSynth(dcfg.sampleRate);
+
+        uint64_t at = kbsim::NowUs() + 20000
+                      + std::uniform_int_distribution<uint64_t>(0, 9999)(rng);
+        t.key = std::uniform_int_distribution<int>(0, 19)(rng);
+        Advance(sc, at);
+
+        g_trial   = &t;
+        t.pressUs = kbsim::NowUs();
+        kbsim::SetKey(t.key, true);
+        Advance(sc, t.pressUs + 80000);
+        kbsim::SetKey(t.key, false);
+        g_trial = nullptr;
+        Advance(sc, kbsim::NowUs() + 60000);
+    }
+    kbsim::SetUartSink(nullptr, nullptr);
+
+    Report(sc, trials, dcfg, outDir);
+}
+
+void Usage()
+{
+    fprintf(stderr,
+            "usage: groovebox_latency [-n trials] [-b block] [-s seed] [-j] "
+            "[-o outdir] [scenario ...]\n");
+}
+} // namespace
+
+int main(int argc, char** argv)
+{
+    int                      numTrials = 200;
+    uint32_t                 seed      = 1;
+    std::string              outDir;
+    dsim::Config             dcfg;
+    std::vector<std::string> names;
+
+    for(int i = 1; i < argc; ++i)
+    {
+        bool more = i + 1 < argc;
+        if(strcmp(argv[i], "-n") == 0 && more)
+            numTrials = atoi(argv[++i]);
+        else if(strcmp(argv[i], "-b") == 0 && more)
+            dcfg.blockSize = (size_t)atoi(argv[++i]);
+        else if(strcmp(argv[i], "-s") == 0 && more)
+            seed = (uint32_t)strtoul(argv[++i], nullptr, 0);
+        else if(strcmp(argv[i], "-j") == 0)
+            g_stamps = true;
+        else if(strcmp(argv[i], "-o") == 0 && more)
+            outDir = argv[++i];
+        else if(argv[i][0] == '-')
+        {
+            Usage();
+            return 2;
+        }
+        else
+            names.push_back(argv[i]);
+    }
+    if(numTrials <= 0 || dcfg.blockSize == 0)
+    {
+        Usage();
+        return 2;
+    }
+
+    for(const Scenario& sc : kScenarios)
+    {
+        if(!names.empty() && std::find(names.begin(), names.end(), sc.name) == names.end())
+            continue;
+        // The sketch's globals only initialise once per process, so each
+        // scenario gets a fresh one
+        fflush(stdout);
+        pid_t pid = fork();
+        if(pid == 0)
+        {
+            RunScenario(sc, numTrials, dcfg, seed, outDir);
+            fflush(stdout);
+            _exit(0);
+        }
+        int status = 0;
+        if(pid < 0 || waitpid(pid, &status, 0) < 0 || status != 0)
+        {
+            fprintf(stderr, "scenario %s failed\n", sc.name);
+            return 1;
+        }
+    }
+    for(const std::string& n : names)
+    {
+        bool known = false;
+        for(const Scenario& sc : kScenarios)
+            known = known || n == sc.name;
+        if(!known)
+            fprintf(stderr, "unknown scenario '%s'\n", n.c_str());
+    }
+    return 0;
+}
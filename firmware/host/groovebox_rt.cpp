@@ -0,0 +1,716 @@
+// groovebox_rt: the Daisy engine run in real time on the host, with live
+// MIDI in and audio out, to audition it and soak it without hardware.
+//
+//   groovebox_rt [-p link | -m path] [-o out] [-f s16|f32] [-r rate]
+//                [-b block] [-t seconds] [-s interval] [-l log.csv]
+//                [-M misses] [-R]
+//
+// MIDI in, raw bytes as on the KB2040 link (send stamps included):
+//   -p link   a new pseudo-terminal, symlinked at link; anything writing
+//             raw MIDI to it connects, e.g. kb2040_sim -u link
+//   -m path   a FIFO, a serial port (put in raw mode) or a file
+// Audio out, interleaved stereo at the engine's rate, s16le (default) or
+// f32le (-f), to -o out, '-' for stdout:
+//   groovebox_rt -p /tmp/daisy -o - | aplay -f S16_LE -c 2 -r 48000
+//
+// The model is the firmware's: one audio callback per block on a fixed
+// grid (-r and -b from MidiAudio in midi_protocol.h, 48000 and 48 by
+// default), MIDI from a receive thread through the same decoder, stamped
+// notes through the jitter buffer, and the CPU governor setting the
+// engine quality from each block's load. Block k is due to start at
+// k * period and must be done (rendered and handed to the writer) by
+// (k + 1) * period, when the next one is due; its margin is what was
+// left. A block that misses its deadline makes the next one start late,
+// as the next DMA interrupt would; the grid itself never slips, so a run
+// catches up by rendering back to back. The audio thread does no I/O:
+// PCM goes through a ring to a writer thread (a full ring drops the
+// block and counts it), per-block records through another to the main
+// thread, which reports.
+//
+// Reports to stderr every -s seconds (default 1; 0 for none): blocks,
+// missed deadlines, margin min / 1st percentile / median, render time,
+// start lateness, quality level, MIDI messages. A summary at the end,
+// over the whole run. -l writes a CSV line per block. -R asks for
+// SCHED_FIFO and locked memory, and says if it didn't get them.
+//
+// Runs for -t seconds (default 10; 0 runs until SIGINT or SIGTERM).
+// Exits 1 if more than -M blocks missed their deadline (no limit by
+// default), 2 on a usage error.
+#include "groovebox_engine.h"
+#include "governor.h"
+#include "jitter_buffer.h"
+#include "midi_protocol.h"
+#include "midi_rx.h"
+
+#include <algorithm>
+#include <atomic>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <termios.h>
+#include <thread>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <xmmintrin.h>
+#endif
+
+namespace
+{
+struct Options
+{
+    std::string ptyLink;
+    std::string midiPath;
+    std::string outPath;
+    std::string logPath;
+    bool        f32      = false;
+    uint32_t    rate     = MidiAudio::SAMPLE_RATES[MidiAudio::DEFAULT_SAMPLE_RATE];
+    size_t      block    = MidiAudio::BLOCK_SIZES[MidiAudio::DEFAULT_BLOCK_SIZE];
+    double      seconds  = 10.0;
+    double      interval = 1.0;
+    long        maxMiss  = -1;
+    bool        realtime = false;
+};
+
+// What the audio thread did with one block
+struct BlockRecord
+{
+    uint64_t index;
+    int64_t  lateUs;   // start - due
+    uint32_t renderUs; // start to last sample
+    int64_t  marginUs; // deadline - done; negative: missed
+    uint8_t  level;    // quality for the next block
+    uint16_t midi;     // messages handled this block
+};
+
+std::atomic<bool> g_stop{false};
+std::atomic<bool> g_audioDone{false}; // its last record is in g_records
+
+void OnSignal(int)
+{
+    g_stop = true;
+}
+
+// ---- clock --------------------------------------------------------------
+//
+// Monotonic, from the start of the run. MidiRxEvent and the jitter buffer
+// keep 32-bit microseconds, as the Daisy's System::GetUs() does; they
+// handle the wrap.
+
+timespec g_t0;
+
+int64_t NowNs()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)(ts.tv_sec - g_t0.tv_sec) * 1000000000 + (ts.tv_nsec - g_t0.tv_nsec);
+}
+
+void SleepUntilNs(int64_t ns)
+{
+    timespec ts;
+    ts.tv_sec  = g_t0.tv_sec + (time_t)(ns / 1000000000);
+    ts.tv_nsec = g_t0.tv_nsec + (long)(ns % 1000000000);
+    if(ts.tv_nsec >= 1000000000)
+    {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000;
+    }
+    while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) == EINTR)
+        if(g_stop)
+            return;
+}
+
+// ---- MIDI in ------------------------------------------------------------
+
+SpscRing<MidiRxEvent, 512> g_midiQueue;
+
+void MakeRaw(int fd)
+{
+    termios tio;
+    if(tcgetattr(fd, &tio) != 0)
+        return;
+    cfmakeraw(&tio);
+    tcsetattr(fd, TCSANOW, &tio);
+}
+
+// A pseudo-terminal; returns the master and keeps the slave open, so the
+// master doesn't see a hangup each time a writer closes it
+int OpenPty(const std::string& link)
+{
+    int master = posix_openpt(O_RDWR | O_NOCTTY);
+    if(master < 0 || grantpt(master) != 0 || unlockpt(master) != 0)
+    {
+        perror("pty");
+        return -1;
+    }
+    const char* name  = ptsname(master);
+    int         slave = name ? open(name, O_RDWR | O_NOCTTY) : -1;
+    if(slave < 0)
+    {
+        perror("pty slave");
+        return -1;
+    }
+    MakeRaw(slave);
+    unlink(link.c_str());
+    if(symlink(name, link.c_str()) != 0)
+    {
+        fprintf(stderr, "cannot link %s to %s: %s\n", link.c_str(), name, strerror(errno));
+        return -1;
+    }
+    fprintf(stderr, "midi in: %s -> %s\n", link.c_str(), name);
+    return master;
+}
+
+// A FIFO is opened read-write so it doesn't hit end of file between
+// writers
+int OpenMidiPath(const std::string& path)
+{
+    struct stat st;
+    if(stat(path.c_str(), &st) != 0)
+    {
+        fprintf(stderr, "%s: %s\n", path.c_str(), strerror(errno));
+        return -1;
+    }
+    int fd = open(path.c_str(), S_ISFIFO(st.st_mode) ? O_RDWR : O_RDONLY | O_NOCTTY);
+    if(fd < 0)
+    {
+        fprintf(stderr, "%s: %s\n", path.c_str(), strerror(errno));
+        return -1;
+    }
+    if(isatty(fd))
+        MakeRaw(fd);
+    fprintf(stderr, "midi in: %s\n", path.c_str());
+    return fd;
+}
+
+// Stands in for the UART receive callback: bytes are decoded as they
+// arrive and stamped with the arrival time
+void ReadMidi(int fd, std::atomic<uint32_t>* bytes)
+{
+    MidiRxDecoder decoder;
+    uint8_t       buf[256];
+    while(!g_stop)
+    {
+        pollfd p = {fd, POLLIN, 0};
+        if(poll(&p, 1, 100) <= 0)
+            continue;
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if(n <= 0)
+        {
+            if(n < 0 && (errno == EINTR || errno == EAGAIN || errno == EIO))
+                continue;
+            return; // end of a plain file
+        }
+        uint32_t    now = (uint32_t)(NowNs() / 1000);
+        MidiRxEvent e;
+        for(ssize_t i = 0; i < n; i++)
+            if(decoder.Feed(buf[i], now, e))
+                g_midiQueue.Push(e);
+        *bytes += (uint32_t)n;
+    }
+}
+
+// The controllers main() takes for itself on the Daisy. Rate and block
+// are fixed by the command line here; spectrum, recorder and player
+// aren't modelled.
+bool IsFirmwareSwitch(const MidiRxEvent& e)
+{
+    if(e.status != (0xB0 | (MidiCh::SYNTH - 1)))
+        return false;
+    switch(e.data0)
+    {
+        case MidiCC::AUDIO_BLOCK_SIZE:
+        case MidiCC::AUDIO_SAMPLE_RATE:
+        case MidiCC::SPECTRUM:
+        case MidiCC::RECORD:
+        case MidiCC::SMF_PLAY: return true;
+        default: return false;
+    }
+}
+
+// ---- audio out ----------------------------------------------------------
+//
+// Block slots, one producer (the audio thread) and one consumer (the
+// writer). The counts only grow; slot = count % kSlots.
+
+struct PcmRing
+{
+    static const size_t kSlots = 256;
+
+    std::vector<uint8_t>  data;
+    size_t                slotBytes = 0;
+    std::atomic<uint64_t> head{0}, tail{0};
+    std::atomic<uint64_t> dropped{0};
+
+    void Init(size_t bytes)
+    {
+        slotBytes = bytes;
+        data.assign(kSlots * bytes, 0);
+    }
+    uint8_t* Slot(uint64_t n) { return &data[(n % kSlots) * slotBytes]; }
+};
+
+PcmRing g_pcm;
+
+void Interleave(float** in, size_t size, bool f32, uint8_t* dst)
+{
+    if(f32)
+    {
+        float* o = (float*)dst;
+        for(size_t i = 0; i < size; i++)
+        {
+            o[2 * i]     = in[0][i];
+            o[2 * i + 1] = in[1][i];
+        }
+        return;
+    }
+    int16_t* o = (int16_t*)dst;
+    for(size_t i = 0; i < size; i++)
+        for(int c = 0; c < 2; c++)
+        {
+            float x      = std::min(1.0f, std::max(-1.0f, in[c][i]));
+            o[2 * i + c] = (int16_t)lrintf(x * 32767.0f);
+        }
+}
+
+void WritePcm(int fd, int64_t periodNs)
+{
+    for(;;)
+    {
+        bool     done = g_audioDone; // read first: nothing follows it
+        uint64_t tail = g_pcm.tail.load(std::memory_order_relaxed);
+        if(tail == g_pcm.head.load(std::memory_order_acquire))
+        {
+            if(done)
+                return;
+            timespec ts = {0, (long)(periodNs / 2)};
+            nanosleep(&ts, nullptr);
+            continue;
+        }
+        const uint8_t* p    = g_pcm.Slot(tail);
+        size_t         left = g_pcm.slotBytes;
+        while(left > 0)
+        {
+            ssize_t n = write(fd, p, left);
+            if(n < 0 && errno == EINTR)
+                continue;
+            if(n <= 0)
+            {
+                fprintf(stderr, "audio out: %s\n", strerror(errno));
+                g_stop = true;
+                return;
+            }
+            p += n;
+            left -= (size_t)n;
+        }
+        g_pcm.tail.store(tail + 1, std::memory_order_release);
+    }
+}
+
+// ---- audio thread -------------------------------------------------------
+
+SpscRing<BlockRecord, 4096> g_records;
+
+JitterBuffer g_jitter;
+CpuGovernor  g_governor;
+
+// One block: ProcessMidi() and AudioCallback() from the firmware, back
+// to back, since only this thread may touch the engine
+void AudioThread(const Options& o, uint64_t blocks)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    _mm_setcsr(_mm_getcsr() | 0x8040); // FTZ | DAZ, see governor_sim
+#endif
+    if(o.realtime)
+    {
+        sched_param sp = {};
+        sp.sched_priority = sched_get_priority_max(SCHED_FIFO);
+        int err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &sp);
+        if(err != 0)
+            fprintf(stderr, "SCHED_FIFO: %s; running at normal priority\n", strerror(err));
+    }
+
+    MidiRxEvent        heldMidi; // refused by the jitter buffer, as in the firmware
+    bool               midiHeld = false;
+    std::vector<float> l(o.block), r(o.block);
+    float*             out[2]       = {l.data(), r.data()};
+    const float        samplesPerUs = (float)o.rate / 1e6f;
+
+    for(uint64_t k = 0; (blocks == 0 || k < blocks) && !g_stop; k++)
+    {
+        // Exact grid: block k is due at k * block / rate seconds
+        int64_t due      = (int64_t)(k * o.block * 1000000000ull / o.rate);
+        int64_t deadline = (int64_t)((k + 1) * o.block * 1000000000ull / o.rate);
+        if(NowNs() < due)
+            SleepUntilNs(due);
+        int64_t start = NowNs();
+
+        uint16_t    midi = 0;
+        MidiRxEvent e;
+        for(;;)
+        {
+            if(midiHeld)
+            {
+                e        = heldMidi;
+                midiHeld = false;
+            }
+            else if(!g_midiQueue.Pop(e))
+                break;
+            else
+            {
+                midi++;
+                if(IsFirmwareSwitch(e))
+                    continue;
+            }
+            if(!g_jitter.Push(e))
+            {
+                heldMidi = e;
+                midiHeld = true;
+                break;
+            }
+        }
+
+        g_jitter.Render(out, o.block, (uint32_t)(start / 1000));
+        int64_t rendered = NowNs();
+
+        uint64_t head = g_pcm.head.load(std::memory_order_relaxed);
+        if(head - g_pcm.tail.load(std::memory_order_acquire) < PcmRing::kSlots)
+        {
+            Interleave(out, o.block, o.f32, g_pcm.Slot(head));
+            g_pcm.head.store(head + 1, std::memory_order_release);
+        }
+        else
+            g_pcm.dropped++;
+        int64_t done = NowNs();
+
+        float   load  = (float)(done - start) / 1000.0f * samplesPerUs / (float)o.block;
+        uint8_t level = g_governor.Update(load);
+        SetEngineQuality((EngineQuality)level);
+
+        BlockRecord rec;
+        rec.index    = k;
+        rec.lateUs   = (start - due) / 1000;
+        rec.renderUs = (uint32_t)((rendered - start) / 1000);
+        rec.marginUs = (deadline - done) / 1000;
+        rec.level    = level;
+        rec.midi     = midi;
+        g_records.Push(rec); // a full ring drops it and counts it
+    }
+    g_stop      = true;
+    g_audioDone = true;
+}
+
+// ---- reports ------------------------------------------------------------
+
+// Margin histogram, 1 us buckets from -kMissSpan to the period; misses
+// further out land in the first
+class MarginHistogram
+{
+  public:
+    static const int64_t kMissSpan = 100000;
+
+    explicit MarginHistogram(int64_t periodUs)
+    : counts_((size_t)(kMissSpan + periodUs + 1), 0), periodUs_(periodUs)
+    {
+    }
+
+    void Add(int64_t marginUs)
+    {
+        int64_t i = std::min(std::max(marginUs, -kMissSpan), periodUs_) + kMissSpan;
+        counts_[(size_t)i]++;
+        total_++;
+    }
+
+    // The margin a fraction q of blocks stayed under
+    int64_t Quantile(double q) const
+    {
+        uint64_t want = (uint64_t)(q * (double)(total_ - 1)), seen = 0;
+        for(size_t i = 0; i < counts_.size(); i++)
+        {
+            seen += counts_[i];
+            if(seen > want)
+                return (int64_t)i - kMissSpan;
+        }
+        return periodUs_;
+    }
+
+  private:
+    std::vector<uint64_t> counts_;
+    int64_t               periodUs_;
+    uint64_t              total_ = 0;
+};
+
+struct Totals
+{
+    uint64_t blocks = 0, missed = 0, midi = 0;
+    int64_t  minMargin = INT64_MAX, maxLate = 0;
+    uint32_t maxRender = 0;
+    double   renderSum = 0.0;
+};
+
+void Accumulate(Totals& t, const BlockRecord& r)
+{
+    t.blocks++;
+    t.missed += r.marginUs < 0;
+    t.midi += r.midi;
+    t.minMargin = std::min(t.minMargin, r.marginUs);
+    t.maxLate   = std::max(t.maxLate, r.lateUs);
+    t.maxRender = std::max(t.maxRender, r.renderUs);
+    t.renderSum += r.renderUs;
+}
+
+void PrintInterval(double atS, const Totals& t, std::vector<int64_t>& margins, uint8_t level)
+{
+    if(t.blocks == 0)
+        return;
+    std::sort(margins.begin(), margins.end());
+    fprintf(stderr,
+            "%7.1f s  %6llu blocks  %4llu missed  margin %5lld / %5lld / %5lld us"
+            "  render %5.1f / %5u us  late %5lld us  q%u  %llu midi\n",
+            atS,
+            (unsigned long long)t.blocks,
+            (unsigned long long)t.missed,
+            (long long)margins.front(),
+            (long long)margins[margins.size() / 100],
+            (long long)margins[margins.size() / 2],
+            t.renderSum / (double)t.blocks,
+            t.maxRender,
+            (long long)t.maxLate,
+            level,
+            (unsigned long long)t.midi);
+}
+
+int OpenOutput(const std::string& path)
+{
+    if(path == "-")
+        return STDOUT_FILENO;
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0)
+        fprintf(stderr, "%s: %s\n", path.c_str(), strerror(errno));
+    return fd;
+}
+
+// One of the rates and block sizes the Daisy can boot with
+bool BootableAudio(uint32_t rate, size_t block)
+{
+    bool rateOk = false, blockOk = false;
+    for(uint32_t r : MidiAudio::SAMPLE_RATES)
+        rateOk |= r == rate;
+    for(uint16_t b : MidiAudio::BLOCK_SIZES)
+        blockOk |= b == block;
+    return rateOk && blockOk;
+}
+
+void Usage()
+{
+    fprintf(stderr,
+            "usage: groovebox_rt [-p link | -m path] [-o out] [-f s16|f32] [-r rate]\n"
+            "                    [-b block] [-t seconds] [-s interval] [-l log.csv]\n"
+            "                    [-M misses] [-R]\n");
+    exit(2);
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    Options o;
+    int     opt;
+    while((opt = getopt(argc, argv, "p:m:o:f:r:b:t:s:l:M:Rh")) != -1)
+    {
+        switch(opt)
+        {
+            case 'p': o.ptyLink = optarg; break;
+            case 'm': o.midiPath = optarg; break;
+            case 'o': o.outPath = optarg; break;
+            case 'f':
+                if(strcmp(optarg, "f32") != 0 && strcmp(optarg, "s16") != 0)
+                    Usage();
+                o.f32 = strcmp(optarg, "f32") == 0;
+                break;
+            case 'r': o.rate = (uint32_t)atol(optarg); break;
+            case 'b': o.block = (size_t)atol(optarg); break;
+            case 't': o.seconds = atof(optarg); break;
+            case 's': o.interval = atof(optarg); break;
+            case 'l': o.logPath = optarg; break;
+            case 'M': o.maxMiss = atol(optarg); break;
+            case 'R': o.realtime = true; break;
+            default: Usage();
+        }
+    }
+    if(optind != argc || (!o.ptyLink.empty() && !o.midiPath.empty()) || o.seconds < 0.0
+       || o.interval < 0.0 || !BootableAudio(o.rate, o.block))
+        Usage();
+
+    signal(SIGINT, OnSignal);
+    signal(SIGTERM, OnSignal);
+    signal(SIGPIPE, SIG_IGN); // a closed stdout shows up as a write error
+
+    if(o.realtime && mlockall(MCL_CURRENT | MCL_FUTURE) != 0)
+        fprintf(stderr, "mlockall: %s; memory not locked\n", strerror(errno));
+
+    int midiFd = -1;
+    if(!o.ptyLink.empty())
+        midiFd = OpenPty(o.ptyLink);
+    else if(!o.midiPath.empty())
+        midiFd = OpenMidiPath(o.midiPath);
+    if((!o.ptyLink.empty() || !o.midiPath.empty()) && midiFd < 0)
+        return 1;
+
+    int outFd = -1;
+    if(!o.outPath.empty() && (outFd = OpenOutput(o.outPath)) < 0)
+        return 1;
+
+    FILE* log = nullptr;
+    if(!o.logPath.empty())
+    {
+        if(!(log = fopen(o.logPath.c_str(), "w")))
+        {
+            fprintf(stderr, "%s: %s\n", o.logPath.c_str(), strerror(errno));
+            return 1;
+        }
+        fprintf(log, "block,late_us,render_us,margin_us,level,midi\n");
+    }
+
+    // As main() on the Daisy sets them up for this rate and block
+    const float samplerate = (float)o.rate;
+    const float blockUs    = 1e6f * (float)o.block / samplerate;
+    InitSynth(samplerate);
+
+    JitterBuffer::Config jitterConfig;
+    if(jitterConfig.latencyUs < (uint32_t)(2.0f * blockUs))
+        jitterConfig.latencyUs = (uint32_t)(2.0f * blockUs);
+    g_jitter.Init(jitterConfig, samplerate);
+
+    CpuGovernor::Config governorConfig;
+    uint32_t            hold = (uint32_t)(500000.0f / blockUs);
+    governorConfig.numLevels  = QUALITY_NUM_LEVELS;
+    governorConfig.holdBlocks = (uint16_t)(hold < 4000 ? hold : 4000);
+    governorConfig.maxHold    = (uint16_t)(governorConfig.holdBlocks * 16);
+    g_governor.Init(governorConfig);
+
+    g_pcm.Init(o.block * 2 * (o.f32 ? sizeof(float) : sizeof(int16_t)));
+
+    const int64_t  periodNs = (int64_t)(o.block * 1000000000ull / o.rate);
+    const uint64_t blocks   = (uint64_t)(o.seconds * (double)o.rate / (double)o.block);
+    fprintf(stderr,
+            "%u Hz, block %zu (%.3f ms), %s, ",
+            o.rate,
+            o.block,
+            blockUs / 1000.0f,
+            outFd < 0 ? "no audio out" : o.f32 ? "f32le out" : "s16le out");
+    if(blocks)
+        fprintf(stderr, "%.1f s\n", o.seconds);
+    else
+        fprintf(stderr, "until interrupted\n");
+
+    clock_gettime(CLOCK_MONOTONIC, &g_t0);
+    std::atomic<uint32_t> midiBytes{0};
+    std::thread           reader, writer;
+    if(midiFd >= 0)
+        reader = std::thread(ReadMidi, midiFd, &midiBytes);
+    if(outFd >= 0)
+        writer = std::thread(WritePcm, outFd, periodNs);
+    std::thread audio(AudioThread, std::cref(o), blocks);
+
+    // Drain the block records until the audio thread is done
+    MarginHistogram      histogram(periodNs / 1000);
+    Totals               total, interval;
+    std::vector<int64_t> margins;
+    uint8_t              level    = 0;
+    int64_t              nextNs   = (int64_t)(o.interval * 1e9);
+    bool                 finished = false;
+    while(!finished)
+    {
+        finished = g_audioDone;
+        BlockRecord r;
+        while(g_records.Pop(r))
+        {
+            Accumulate(total, r);
+            Accumulate(interval, r);
+            histogram.Add(r.marginUs);
+            margins.push_back(r.marginUs);
+            level = r.level;
+            if(log)
+                fprintf(log, "%llu,%lld,%u,%lld,%u,%u\n",
+                        (unsigned long long)r.index,
+                        (long long)r.lateUs,
+                        r.renderUs,
+                        (long long)r.marginUs,
+                        r.level,
+                        r.midi);
+        }
+        int64_t now = NowNs();
+        if(o.interval > 0.0 && now >= nextNs)
+        {
+            PrintInterval(now / 1e9, interval, margins, level);
+            interval = Totals();
+            margins.clear();
+            nextNs += (int64_t)(o.interval * 1e9);
+        }
+        if(!finished)
+        {
+            timespec ts = {0, 20000000};
+            nanosleep(&ts, nullptr);
+        }
+    }
+    audio.join();
+    if(writer.joinable())
+        writer.join();
+    if(reader.joinable())
+        reader.join();
+    if(log)
+        fclose(log);
+    if(!o.ptyLink.empty())
+        unlink(o.ptyLink.c_str());
+
+    const JitterBuffer::Stats& js = g_jitter.GetStats();
+    const CpuGovernor::Stats&  gs = g_governor.GetStats();
+    fprintf(stderr, "\n");
+    fprintf(stderr, "blocks          %llu in %.1f s, %llu records dropped\n",
+            (unsigned long long)total.blocks,
+            (double)total.blocks * (double)periodNs / 1e9,
+            (unsigned long long)g_records.Dropped());
+    if(total.blocks)
+    {
+        fprintf(stderr, "deadlines       %llu missed (%.3f%%)\n",
+                (unsigned long long)total.missed,
+                100.0 * (double)total.missed / (double)total.blocks);
+        fprintf(stderr, "margin          min %lld, p0.1 %lld, p1 %lld, p50 %lld us of %lld\n",
+                (long long)total.minMargin,
+                (long long)histogram.Quantile(0.001),
+                (long long)histogram.Quantile(0.01),
+                (long long)histogram.Quantile(0.5),
+                (long long)(periodNs / 1000));
+        fprintf(stderr, "render          avg %.1f, max %u us; start up to %lld us late\n",
+                total.renderSum / (double)total.blocks,
+                total.maxRender,
+                (long long)total.maxLate);
+    }
+    fprintf(stderr, "governor        %u steps down, %u up, max load %.2f, level %u\n",
+            gs.stepsDown, gs.stepsUp, gs.maxLoad, g_governor.Level());
+    fprintf(stderr, "midi            %u bytes, %llu messages, %u dropped\n",
+            midiBytes.load(),
+            (unsigned long long)total.midi,
+            (unsigned)g_midiQueue.Dropped());
+    fprintf(stderr, "stamped notes   %u scheduled, %u late (max %u us)\n",
+            js.scheduled, js.late, js.maxLateUs);
+    if(outFd >= 0)
+        fprintf(stderr, "audio out       %llu blocks written, %llu dropped\n",
+                (unsigned long long)g_pcm.tail.load(),
+                (unsigned long long)g_pcm.dropped.load());
+
+    return o.maxMiss >= 0 && total.missed > (uint64_t)o.maxMiss ? 1 : 0;
+}
@@ -0,0 +1,198 @@
+// jitter_check: the Daisy's jitter buffer (daisy/seed/kb2040_groovebox/
+// jitter_buffer.h) with more messages than it has room for.
+//
+//   jitter_check [-k block]
+//
+// main() is modelled as in the firmware: each pass, before a block, it
+// pushes what the receive queue holds until the buffer refuses one, which
+// it keeps and offers first next pass. The runs:
+//   stamped   a burst of stamped note on/off pairs, stamps one tick
+//             apart, arriving at once (main() held up by a flash write):
+//             more than the schedule holds
+//   unstamped a burst of unstamped controllers, more than the next
+//             block's queue holds
+//   mixed     both at once
+//
+// The engine is replaced by a recorder. Every message has to reach it,
+// once; the stamped ones in send order, so no note off overtakes its
+// note on, and the unstamped ones in arrival order. The buffer has to
+// have refused some, or the run didn't test anything. Exit status 1 if a
+// run fails.
+#include "groovebox_engine.h"
+#include "jitter_buffer.h"
+
+#include <deque>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+
+namespace
+{
+const float kSampleRate = 48000.0f;
+
+struct Received
+{
+    uint8_t status, data0, data1;
+};
+
+std::vector<Received> g_received;
+} // namespace
+
+// The engine, as far as the jitter buffer can tell
+void HandleMidiMessage(uint8_t status, uint8_t data0, uint8_t data1)
+{
+    g_received.push_back({status, data0, data1});
+}
+
+void RenderAudio(float** out, size_t size)
+{
+    memset(out[0], 0, size * sizeof(float));
+    memset(out[1], 0, size * sizeof(float));
+}
+
+namespace
+{
+struct Run
+{
+    const char* name;
+    int         stampedPairs; // note on/off pairs
+    int         unstamped;    // controllers
+};
+
+bool Same(const MidiRxEvent& e, const Received& r)
+{
+    return e.status == r.status && e.data0 == r.data0 && e.data1 == r.data1;
+}
+
+bool Check(const Run& run, size_t block)
+{
+    g_received.clear();
+    JitterBuffer jitter;
+    jitter.Init(JitterBuffer::Config(), kSampleRate);
+
+    // Warm the clock estimate up with one note, played out
+    const uint32_t start = 1000000;
+    MidiRxEvent    warm  = {0x90, 1, 1, 0, true, 0, start};
+    jitter.Push(warm);
+    warm.data1 = 0;
+    jitter.Push(warm);
+
+    // The burst, interleaved: stamped pairs as the KB2040 scans them,
+    // with a controller from the computer between each
+    std::deque<MidiRxEvent>  queue;
+    std::vector<MidiRxEvent> stamped, unstamped;
+    const uint32_t           arrival = start + 20000;
+    uint16_t                 stamp   = (uint16_t)(20000 >> MidiStamp::UNIT_SHIFT);
+    for(int k = 0; k < run.stampedPairs || k < run.unstamped; k++)
+    {
+        if(k < run.stampedPairs)
+        {
+            uint8_t     note = (uint8_t)(24 + k % 96);
+            MidiRxEvent on   = {0x90, note, 100, 0, true, stamp, arrival};
+            MidiRxEvent off  = {0x80, note, 0, 0, true, (uint16_t)(stamp + 1), arrival};
+            stamp            = (uint16_t)((stamp + 2) & MidiStamp::MASK);
+            queue.push_back(on);
+            queue.push_back(off);
+            stamped.push_back(on);
+            stamped.push_back(off);
+        }
+        if(k < run.unstamped)
+        {
+            MidiRxEvent cc = {0xB0, MidiCC::VOLUME, (uint8_t)(k & 127), 0, false, 0, arrival};
+            queue.push_back(cc);
+            unstamped.push_back(cc);
+        }
+    }
+
+    // Blocks until the warm-up note has played, then from the arrival
+    // on with main() pushing before each
+    std::vector<float> l(block), r(block);
+    float*             out[2]  = {l.data(), r.data()};
+    const uint32_t     blockUs = (uint32_t)(block * 1e6f / kSampleRate);
+    uint32_t           now     = start;
+    for(; (int32_t)(now - arrival) < 0; now += blockUs)
+        jitter.Render(out, block, now);
+    bool ok = g_received.size() == 2;
+    g_received.clear();
+    for(int b = 0; b < 100000 && !queue.empty(); b++, now += blockUs)
+    {
+        while(!queue.empty() && jitter.Push(queue.front()))
+            queue.pop_front();
+        jitter.Render(out, block, now);
+    }
+    for(int b = 0; b < 1000; b++, now += blockUs) // what is still scheduled
+        jitter.Render(out, block, now);
+    ok = ok && queue.empty();
+
+    // Split what the engine got back into the two streams
+    std::vector<Received> gotStamped, gotUnstamped;
+    for(const Received& m : g_received)
+        ((m.status & 0xF0) == 0xB0 ? gotUnstamped : gotStamped).push_back(m);
+    if(gotStamped.size() != stamped.size() || gotUnstamped.size() != unstamped.size())
+    {
+        fprintf(stderr, "  %s: %zu of %zu stamped and %zu of %zu unstamped handled\n", run.name,
+                gotStamped.size(), stamped.size(), gotUnstamped.size(), unstamped.size());
+        ok = false;
+    }
+    for(size_t k = 0; k < gotStamped.size() && k < stamped.size(); k++)
+        if(!Same(stamped[k], gotStamped[k]))
+        {
+            fprintf(stderr, "  %s: stamped message %zu out of send order (%02x %u)\n", run.name,
+                    k, gotStamped[k].status, gotStamped[k].data0);
+            ok = false;
+            break;
+        }
+    for(size_t k = 0; k < gotUnstamped.size() && k < unstamped.size(); k++)
+        if(!Same(unstamped[k], gotUnstamped[k]))
+        {
+            fprintf(stderr, "  %s: unstamped message %zu out of order\n", run.name, k);
+            ok = false;
+            break;
+        }
+
+    const JitterBuffer::Stats& st = jitter.GetStats();
+    if(!st.refused)
+    {
+        fprintf(stderr, "  %s: nothing refused, the queues never filled\n", run.name);
+        ok = false;
+    }
+    printf("%-10s %4zu stamped, %4zu unstamped, %4u refused, %4u late: %s\n", run.name,
+           stamped.size(), unstamped.size(), st.refused, st.late, ok ? "ok" : "FAIL");
+    return ok;
+}
+
+void Usage()
+{
+    fprintf(stderr, "usage: jitter_check [-k block]\n");
+    exit(2);
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    size_t block = 48;
+    int    c;
+    while((c = getopt(argc, argv, "k:h")) != -1)
+    {
+        switch(c)
+        {
+            case 'k': block = (size_t)atoi(optarg); break;
+            default: Usage();
+        }
+    }
+    if(optind != argc || block == 0)
+        Usage();
+
+    const Run runs[] = {
+        {"stamped", 200, 0},
+        {"unstamped", 0, 600},
+        {"mixed", 200, 400},
+    };
+    bool ok = true;
+    for(const Run& run : runs)
+        ok = Check(run, block) && ok;
+    return ok ? 0 : 1;
+}
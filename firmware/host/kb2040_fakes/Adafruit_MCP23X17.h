@@ -0,0 +1,15 @@
+// Host fake of Adafruit_MCP23X17, backed by the simulated MCP23017s.
+#pragma once
+#include "Arduino.h"
+
+class Adafruit_MCP23X17
+{
+  public:
+    bool     begin_I2C(uint8_t addr = 0x20);
+    void     pinMode(uint8_t pin, uint8_t mode);
+    uint8_t  digitalRead(uint8_t pin);
+    uint16_t readGPIOAB();
+
+  private:
+    uint8_t addr_ = 0;
+};
@@ -0,0 +1,25 @@
+// Host fake of the Adafruit TinyUSB MIDI device. Packets from the
+// computer are scripted and arrive in 1 ms frames, held off while the
+// device's receive FIFO is full as USB flow control would; packets to the
+// computer are logged with their time.
+#pragma once
+#include "Arduino.h"
+
+class Adafruit_USBD_MIDI
+{
+  public:
+    void setStringDescriptor(const char* s);
+    bool begin();
+    bool writePacket(const uint8_t packet[4]);
+    bool readPacket(uint8_t packet[4]);
+};
+
+class Adafruit_USBD_Device
+{
+  public:
+    bool mounted();
+    bool detach();
+    bool attach();
+};
+
+extern Adafruit_USBD_Device TinyUSBDevice;
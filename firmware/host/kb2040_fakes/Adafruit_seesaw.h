@@ -0,0 +1,76 @@
+// Host fake of Adafruit_seesaw, modelled at the register level the sketch
+// touches (GPIO bulk/interrupt flags, encoder deltas, ADC). Every call is
+// charged the bus time of the real library's I2C transactions, including
+// its read delays.
+#pragma once
+#include "Arduino.h"
+
+enum
+{
+    SEESAW_STATUS_BASE  = 0x00,
+    SEESAW_GPIO_BASE    = 0x01,
+    SEESAW_ADC_BASE     = 0x09,
+    SEESAW_ENCODER_BASE = 0x11,
+};
+
+enum
+{
+    SEESAW_GPIO_DIRSET_BULK = 0x02,
+    SEESAW_GPIO_DIRCLR_BULK = 0x03,
+    SEESAW_GPIO_BULK        = 0x04,
+    SEESAW_GPIO_BULK_SET    = 0x05,
+    SEESAW_GPIO_BULK_CLR    = 0x06,
+    SEESAW_GPIO_BULK_TOGGLE = 0x07,
+    SEESAW_GPIO_INTENSET    = 0x08,
+    SEESAW_GPIO_INTENCLR    = 0x09,
+    SEESAW_GPIO_INTFLAG     = 0x0A,
+    SEESAW_GPIO_PULLENSET   = 0x0B,
+    SEESAW_GPIO_PULLENCLR   = 0x0C,
+};
+
+enum
+{
+    SEESAW_ADC_CHANNEL_OFFSET = 0x07,
+};
+
+enum
+{
+    SEESAW_ENCODER_STATUS   = 0x00,
+    SEESAW_ENCODER_INTENSET = 0x10,
+    SEESAW_ENCODER_INTENCLR = 0x20,
+    SEESAW_ENCODER_POSITION = 0x30,
+    SEESAW_ENCODER_DELTA    = 0x40,
+};
+
+namespace kbsim
+{
+struct SeesawDevice;
+}
+
+class Adafruit_seesaw
+{
+  public:
+    bool     begin(uint8_t addr = 0x49, int8_t flow = -1, bool reset = true);
+    void     pinMode(uint8_t pin, uint8_t mode);
+    void     pinModeBulk(uint32_t pins, uint8_t mode);
+    bool     digitalRead(uint8_t pin);
+    uint32_t digitalReadBulk(uint32_t pins);
+    void     setGPIOInterrupts(uint32_t pins, bool enabled);
+    uint16_t analogRead(uint8_t pin);
+    int32_t  getEncoderPosition(uint8_t encoder = 0);
+    int32_t  getEncoderDelta(uint8_t encoder = 0);
+    bool     enableEncoderInterrupt(uint8_t encoder = 0);
+    bool     disableEncoderInterrupt(uint8_t encoder = 0);
+
+  protected:
+    bool read(uint8_t regHigh,
+              uint8_t regLow,
+              uint8_t* buf,
+              uint8_t  num,
+              uint16_t delay = 250);
+    bool write(uint8_t regHigh, uint8_t regLow, uint8_t* buf, uint8_t num);
+
+  private:
+    kbsim::SeesawDevice* dev_  = nullptr;
+    uint8_t              addr_ = 0;
+};
@@ -0,0 +1,76 @@
+// Host fake of the bits of the arduino-pico core the KB2040 sketch uses.
+// Time is simulated (see kb2040_sim.h): micros()/millis() read the sim
+// clock, and delay()/sleep_us() advance it.
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+
+using std::max;
+using std::min;
+
+typedef uint8_t byte;
+
+#define INPUT        0x0
+#define OUTPUT       0x1
+#define INPUT_PULLUP 0x2
+
+#define LOW  0x0
+#define HIGH 0x1
+
+#define PI 3.1415926535897932384626433832795
+
+// KB2040 pin names (GPIO numbers)
+#define LED_BUILTIN 17
+#define A0 26
+#define A1 27
+#define A2 28
+#define A3 29
+
+#define constrain(amt, low, high) \
+    ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+
+uint32_t millis();
+uint32_t micros();
+void     delay(uint32_t ms);
+void     delayMicroseconds(uint32_t us);
+
+void pinMode(int pin, int mode);
+int  digitalRead(int pin);
+void digitalWrite(int pin, int value);
+
+// Hardware UART (Serial1): bytes are timestamped by the sim's UART model;
+// received bytes are scripted.
+class SerialUART
+{
+  public:
+    void   setTX(int pin);
+    void   setRX(int pin);
+    bool   setFIFOSize(size_t size);
+    void   begin(unsigned long baud);
+    size_t write(uint8_t b);
+    int    availableForWrite();
+    int    available();
+    int    read();
+};
+
+// USB CDC (Serial): output goes to the sim's serial log, input is scripted.
+class SerialUSB
+{
+  public:
+    void   begin(unsigned long baud);
+    int    available();
+    int    read();
+    size_t write(uint8_t b);
+    size_t print(const char* s);
+    size_t println(const char* s = "");
+    size_t printf(const char* fmt, ...) __attribute__((format(printf, 2, 3)));
+    explicit operator bool() const { return true; }
+};
+
+extern SerialUART Serial1;
+extern SerialUSB  Serial;
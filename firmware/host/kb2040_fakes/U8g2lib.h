@@ -0,0 +1,47 @@
+// Host fake of the U8g2 full-buffer SSD1309 driver. Drawing goes into a
+// buffer with the real tile layout (so getBufferPtr() comparisons behave
+// the same); sendBuffer()/updateDisplayArea() copy into the simulated
+// panel and are charged I2C time. Text uses a built-in 5x7 font scaled to
+// each font's cell, so frame dumps are readable but not pixel exact.
+#pragma once
+#include "Arduino.h"
+
+#define U8G2_R0       0
+#define U8X8_PIN_NONE 255
+
+// Fonts are just {advance, height} here
+extern const uint8_t u8g2_font_4x6_tf[];
+extern const uint8_t u8g2_font_5x7_tf[];
+extern const uint8_t u8g2_font_6x10_tf[];
+extern const uint8_t u8g2_font_t0_16b_tf[];
+
+class U8G2_SSD1309_128X64_NONAME2_F_HW_I2C
+{
+  public:
+    U8G2_SSD1309_128X64_NONAME2_F_HW_I2C(int rotation, int reset);
+
+    void     setI2CAddress(uint8_t addr8);
+    bool     begin();
+    void     clearBuffer();
+    void     sendBuffer();
+    void     updateDisplayArea(uint8_t tx, uint8_t ty, uint8_t tw, uint8_t th);
+    uint8_t* getBufferPtr() { return buf_; }
+
+    void setFont(const uint8_t* font);
+    void setDrawColor(uint8_t color);
+    void drawPixel(int x, int y);
+    void drawHLine(int x, int y, int w);
+    void drawVLine(int x, int y, int h);
+    void drawBox(int x, int y, int w, int h);
+    void drawFrame(int x, int y, int w, int h);
+    void drawRBox(int x, int y, int w, int h, int r);
+    void drawRFrame(int x, int y, int w, int h, int r);
+    void drawDisc(int x0, int y0, int r);
+    int  drawStr(int x, int y, const char* s);
+
+  private:
+    uint8_t        buf_[128 * 64 / 8];
+    const uint8_t* font_  = u8g2_font_6x10_tf;
+    uint8_t        color_ = 1;
+    uint8_t        addr_  = 0x78;
+};
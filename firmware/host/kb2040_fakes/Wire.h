@@ -0,0 +1,27 @@
+// Host fake of the Arduino Wire (I2C master) API. Transactions are routed
+// to the simulated devices registered with kbsim and charged bus time.
+#pragma once
+#include "Arduino.h"
+
+class TwoWire
+{
+  public:
+    void    begin();
+    void    setClock(uint32_t hz);
+    void    beginTransmission(uint8_t addr);
+    size_t  write(uint8_t b);
+    uint8_t endTransmission(bool stop = true);
+    size_t  requestFrom(uint8_t addr, size_t count, bool stop = true);
+    int     available();
+    int     read();
+
+  private:
+    uint8_t txAddr_ = 0;
+    uint8_t txBuf_[64];
+    size_t  txLen_  = 0;
+    uint8_t rxBuf_[64];
+    size_t  rxLen_  = 0;
+    size_t  rxPos_  = 0;
+};
+
+extern TwoWire Wire;
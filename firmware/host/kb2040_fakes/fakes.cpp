@@ -0,0 +1,632 @@
+// Implementations of the KB2040 host fakes. Everything forwards into the
+// simulator in kb2040_sim.cpp, which owns the clock and device models.
+#include "Arduino.h"
+#include "Wire.h"
+#include "U8g2lib.h"
+#include "Adafruit_MCP23X17.h"
+#include "Adafruit_seesaw.h"
+#include "Adafruit_TinyUSB.h"
+#include "pico/time.h"
+
+#include "../kb2040_sim.h"
+
+#include <stdarg.h>
+
+SerialUART Serial1;
+SerialUSB  Serial;
+TwoWire    Wire;
+
+Adafruit_USBD_Device TinyUSBDevice;
+
+// ---- core -----------------------------------------------------------------
+
+uint32_t millis()
+{
+    return (uint32_t)(kbsim::NowUs() / 1000);
+}
+
+uint32_t micros()
+{
+    return (uint32_t)kbsim::NowUs();
+}
+
+void delay(uint32_t ms)
+{
+    kbsim::AdvanceUs((uint64_t)ms * 1000);
+}
+
+void delayMicroseconds(uint32_t us)
+{
+    kbsim::AdvanceUs(us);
+}
+
+void sleep_us(uint64_t us)
+{
+    kbsim::SleepUs(us);
+}
+
+void pinMode(int, int) {}
+
+int digitalRead(int pin)
+{
+    return kbsim::PinLevel(pin);
+}
+
+void digitalWrite(int, int) {}
+
+// ---- Serial1 (UART to the Daisy) ------------------------------------------
+
+void SerialUART::setTX(int) {}
+void SerialUART::setRX(int) {}
+bool SerialUART::setFIFOSize(size_t) { return true; }
+void SerialUART::begin(unsigned long) {}
+
+size_t SerialUART::write(uint8_t b)
+{
+    kbsim::UartWrite(b);
+    return 1;
+}
+
+int SerialUART::availableForWrite()
+{
+    return 32;
+}
+
+int SerialUART::available()
+{
+    return kbsim::UartRxAvailable();
+}
+
+int SerialUART::read()
+{
+    return kbsim::UartRxRead();
+}
+
+// ---- USB MIDI device -------------------------------------------------------
+
+void Adafruit_USBD_MIDI::setStringDescriptor(const char*) {}
+
+bool Adafruit_USBD_MIDI::begin()
+{
+    return true;
+}
+
+bool Adafruit_USBD_MIDI::writePacket(const uint8_t packet[4])
+{
+    return kbsim::UsbMidiWrite(packet);
+}
+
+bool Adafruit_USBD_MIDI::readPacket(uint8_t packet[4])
+{
+    return kbsim::UsbMidiRead(packet);
+}
+
+bool Adafruit_USBD_Device::mounted()
+{
+    return kbsim::UsbMounted();
+}
+
+bool Adafruit_USBD_Device::detach()
+{
+    return true;
+}
+
+bool Adafruit_USBD_Device::attach()
+{
+    return true;
+}
+
+// ---- Serial (USB CDC) -----------------------------------------------------
+
+void SerialUSB::begin(unsigned long) {}
+
+int SerialUSB::available()
+{
+    return kbsim::SerialAvailable();
+}
+
+int SerialUSB::read()
+{
+    return kbsim::SerialRead();
+}
+
+size_t SerialUSB::write(uint8_t b)
+{
+    char c = (char)b;
+    kbsim::SerialOut(&c, 1);
+    return 1;
+}
+
+size_t SerialUSB::print(const char* s)
+{
+    size_t n = strlen(s);
+    kbsim::SerialOut(s, n);
+    return n;
+}
+
+size_t SerialUSB::println(const char* s)
+{
+    size_t n = print(s);
+    kbsim::SerialOut("\n", 1);
+    return n + 1;
+}
+
+size_t SerialUSB::printf(const char* fmt, ...)
+{
+    char    buf[256];
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+    if(n < 0)
+        return 0;
+    if((size_t)n >= sizeof(buf))
+        n = sizeof(buf) - 1;
+    kbsim::SerialOut(buf, (size_t)n);
+    return (size_t)n;
+}
+
+// ---- Wire -----------------------------------------------------------------
+
+void TwoWire::begin() {}
+void TwoWire::setClock(uint32_t) {}
+
+void TwoWire::beginTransmission(uint8_t addr)
+{
+    txAddr_ = addr;
+    txLen_  = 0;
+}
+
+size_t TwoWire::write(uint8_t b)
+{
+    if(txLen_ >= sizeof(txBuf_))
+        return 0;
+    txBuf_[txLen_++] = b;
+    return 1;
+}
+
+uint8_t TwoWire::endTransmission(bool)
+{
+    bool ok = kbsim::I2cTransfer(txAddr_, txBuf_, txLen_, nullptr, 0);
+    txLen_  = 0;
+    return ok ? 0 : 2; // 2 = NACK on address
+}
+
+size_t TwoWire::requestFrom(uint8_t addr, size_t count, bool)
+{
+    if(count > sizeof(rxBuf_))
+        count = sizeof(rxBuf_);
+    rxPos_ = 0;
+    rxLen_ = 0;
+    if(!kbsim::I2cTransfer(addr, nullptr, 0, rxBuf_, count))
+        return 0;
+    rxLen_ = count;
+    return count;
+}
+
+int TwoWire::available()
+{
+    return (int)(rxLen_ - rxPos_);
+}
+
+int TwoWire::read()
+{
+    if(rxPos_ >= rxLen_)
+        return -1;
+    return rxBuf_[rxPos_++];
+}
+
+// ---- MCP23X17 ---------------------------------------------------------------
+
+bool Adafruit_MCP23X17::begin_I2C(uint8_t addr)
+{
+    addr_         = addr;
+    uint8_t iocon[2] = {0x0A, 0x00};
+    return kbsim::I2cTransfer(addr, iocon, sizeof(iocon), nullptr, 0);
+}
+
+void Adafruit_MCP23X17::pinMode(uint8_t pin, uint8_t)
+{
+    // Read-modify-write of IODIR and GPPU in the real library
+    uint8_t reg = (pin < 8) ? 0x00 : 0x01;
+    uint8_t rx[1];
+    kbsim::I2cTransfer(addr_, &reg, 1, rx, 1);
+    uint8_t wr[2] = {reg, 0xFF};
+    kbsim::I2cTransfer(addr_, wr, 2, nullptr, 0);
+    uint8_t pu = (pin < 8) ? 0x0C : 0x0D;
+    kbsim::I2cTransfer(addr_, &pu, 1, rx, 1);
+    uint8_t wp[2] = {pu, 0xFF};
+    kbsim::I2cTransfer(addr_, wp, 2, nullptr, 0);
+}
+
+uint8_t Adafruit_MCP23X17::digitalRead(uint8_t pin)
+{
+    uint8_t reg = (pin < 8) ? 0x12 : 0x13;
+    uint8_t v   = 0xFF;
+    kbsim::I2cTransfer(addr_, &reg, 1, &v, 1);
+    return (v >> (pin % 8)) & 1;
+}
+
+uint16_t Adafruit_MCP23X17::readGPIOAB()
+{
+    uint8_t reg   = 0x12;
+    uint8_t v[2]  = {0xFF, 0xFF};
+    kbsim::I2cTransfer(addr_, &reg, 1, v, 2);
+    return (uint16_t)(v[0] | (v[1] << 8));
+}
+
+// ---- seesaw -----------------------------------------------------------------
+
+namespace
+{
+// The library's read(): write the two register bytes, wait `delay` us for
+// the seesaw to prepare the answer, then read `num` bytes.
+bool seesawXfer(uint8_t addr, size_t txLen, uint16_t delayUs, size_t rxLen)
+{
+    uint8_t tx[8] = {0};
+    if(!kbsim::I2cTransfer(addr, tx, txLen, nullptr, 0))
+        return false;
+    if(rxLen == 0)
+        return true;
+    kbsim::AdvanceUs(delayUs);
+    uint8_t rx[8];
+    return kbsim::I2cTransfer(addr, nullptr, 0, rx, rxLen);
+}
+
+void put32(uint8_t* buf, uint32_t v)
+{
+    buf[0] = (uint8_t)(v >> 24);
+    buf[1] = (uint8_t)(v >> 16);
+    buf[2] = (uint8_t)(v >> 8);
+    buf[3] = (uint8_t)v;
+}
+} // namespace
+
+bool Adafruit_seesaw::begin(uint8_t addr, int8_t, bool reset)
+{
+    addr_ = addr;
+    dev_  = kbsim::FindSeesaw(addr);
+    if(reset)
+    {
+        seesawXfer(addr, 3, 0, 0);
+        kbsim::AdvanceUs(10000); // SWReset settle in the real library
+    }
+    // HW ID check
+    if(!seesawXfer(addr, 2, 250, 1))
+        return false;
+    return dev_ && dev_->present;
+}
+
+void Adafruit_seesaw::pinMode(uint8_t pin, uint8_t mode)
+{
+    pinModeBulk(1u << pin, mode);
+}
+
+void Adafruit_seesaw::pinModeBulk(uint32_t, uint8_t mode)
+{
+    // DIRCLR, then PULLENSET and BULK_SET for pull-ups
+    seesawXfer(addr_, 6, 0, 0);
+    if(mode == INPUT_PULLUP)
+    {
+        seesawXfer(addr_, 6, 0, 0);
+        seesawXfer(addr_, 6, 0, 0);
+    }
+}
+
+bool Adafruit_seesaw::digitalRead(uint8_t pin)
+{
+    return (digitalReadBulk(1u << pin) != 0);
+}
+
+uint32_t Adafruit_seesaw::digitalReadBulk(uint32_t pins)
+{
+    if(!seesawXfer(addr_, 2, 250, 4) || !dev_)
+        return 0;
+    return dev_->gpio & pins;
+}
+
+void Adafruit_seesaw::setGPIOInterrupts(uint32_t pins, bool enabled)
+{
+    seesawXfer(addr_, 6, 0, 0);
+    if(!dev_)
+        return;
+    if(enabled)
+        dev_->intEnable |= pins;
+    else
+        dev_->intEnable &= ~pins;
+}
+
+uint16_t Adafruit_seesaw::analogRead(uint8_t pin)
+{
+    if(!seesawXfer(addr_, 2, 500, 2) || !dev_ || pin >= 20)
+        return 0xFFFF;
+    return dev_->adc[pin];
+}
+
+int32_t Adafruit_seesaw::getEncoderPosition(uint8_t encoder)
+{
+    uint8_t buf[4];
+    if(!read(SEESAW_ENCODER_BASE, SEESAW_ENCODER_POSITION + encoder, buf, 4))
+        return 0;
+    return (int32_t)((buf[0] << 24) | (buf[1] << 16) | (buf[2] << 8) | buf[3]);
+}
+
+int32_t Adafruit_seesaw::getEncoderDelta(uint8_t encoder)
+{
+    uint8_t buf[4];
+    if(!read(SEESAW_ENCODER_BASE, SEESAW_ENCODER_DELTA + encoder, buf, 4))
+        return 0;
+    return (int32_t)((buf[0] << 24) | (buf[1] << 16) | (buf[2] << 8) | buf[3]);
+}
+
+bool Adafruit_seesaw::enableEncoderInterrupt(uint8_t encoder)
+{
+    bool ok = seesawXfer(addr_, 3, 0, 0);
+    if(ok && dev_ && encoder < 4)
+        dev_->encIntEnable[encoder] = true;
+    return ok;
+}
+
+bool Adafruit_seesaw::disableEncoderInterrupt(uint8_t encoder)
+{
+    bool ok = seesawXfer(addr_, 3, 0, 0);
+    if(ok && dev_ && encoder < 4)
+        dev_->encIntEnable[encoder] = false;
+    return ok;
+}
+
+bool Adafruit_seesaw::read(uint8_t  regHigh,
+                           uint8_t  regLow,
+                           uint8_t* buf,
+                           uint8_t  num,
+                           uint16_t delay)
+{
+    memset(buf, 0, num);
+    if(!seesawXfer(addr_, 2, delay, num) || !dev_)
+        return false;
+
+    uint8_t tmp[4] = {0};
+    if(regHigh == SEESAW_GPIO_BASE && regLow == SEESAW_GPIO_INTFLAG)
+    {
+        put32(tmp, dev_->intFlags);
+        dev_->intFlags = 0;
+    }
+    else if(regHigh == SEESAW_GPIO_BASE && regLow == SEESAW_GPIO_BULK)
+    {
+        put32(tmp, dev_->gpio);
+    }
+    else if(regHigh == SEESAW_ENCODER_BASE
+            && regLow >= SEESAW_ENCODER_DELTA && regLow < SEESAW_ENCODER_DELTA + 4)
+    {
+        int e = regLow - SEESAW_ENCODER_DELTA;
+        put32(tmp, (uint32_t)dev_->encDelta[e]);
+        dev_->encDelta[e]      = 0;
+        dev_->encIntPending[e] = false;
+    }
+    else if(regHigh == SEESAW_ENCODER_BASE
+            && regLow >= SEESAW_ENCODER_POSITION
+            && regLow < SEESAW_ENCODER_POSITION + 4)
+    {
+        int e = regLow - SEESAW_ENCODER_POSITION;
+        put32(tmp, (uint32_t)dev_->encPos[e]);
+        dev_->encIntPending[e] = false;
+    }
+    memcpy(buf, tmp, num < 4 ? num : 4);
+    return true;
+}
+
+bool Adafruit_seesaw::write(uint8_t, uint8_t, uint8_t*, uint8_t num)
+{
+    return seesawXfer(addr_, 2 + num, 0, 0);
+}
+
+// ---- U8g2 -------------------------------------------------------------------
+
+const uint8_t u8g2_font_4x6_tf[]    = {4, 6};
+const uint8_t u8g2_font_5x7_tf[]    = {5, 7};
+const uint8_t u8g2_font_6x10_tf[]   = {6, 10};
+const uint8_t u8g2_font_t0_16b_tf[] = {8, 16};
+
+namespace
+{
+// Classic 5x7 ASCII font, 0x20..0x7E, one byte per column, LSB = top row
+const uint8_t kFont5x7[95][5] = {
+    {0x00, 0x00, 0x00, 0x00, 0x00}, {0x00, 0x00, 0x5F, 0x00, 0x00},
+    {0x00, 0x07, 0x00, 0x07, 0x00}, {0x14, 0x7F, 0x14, 0x7F, 0x14},
+    {0x24, 0x2A, 0x7F, 0x2A, 0x12}, {0x23, 0x13, 0x08, 0x64, 0x62},
+    {0x36, 0x49, 0x55, 0x22, 0x50}, {0x00, 0x05, 0x03, 0x00, 0x00},
+    {0x00, 0x1C, 0x22, 0x41, 0x00}, {0x00, 0x41, 0x22, 0x1C, 0x00},
+    {0x14, 0x08, 0x3E, 0x08, 0x14}, {0x08, 0x08, 0x3E, 0x08, 0x08},
+    {0x00, 0x50, 0x30, 0x00, 0x00}, {0x08, 0x08, 0x08, 0x08, 0x08},
+    {0x00, 0x60, 0x60, 0x00, 0x00}, {0x20, 0x10, 0x08, 0x04, 0x02},
+    {0x3E, 0x51, 0x49, 0x45, 0x3E}, {0x00, 0x42, 0x7F, 0x40, 0x00},
+    {0x42, 0x61, 0x51, 0x49, 0x46}, {0x21, 0x41, 0x45, 0x4B, 0x31},
+    {0x18, 0x14, 0x12, 0x7F, 0x10}, {0x27, 0x45, 0x45, 0x45, 0x39},
+    {0x3C, 0x4A, 0x49, 0x49, 0x30}, {0x01, 0x71, 0x09, 0x05, 0x03},
+    {0x36, 0x49, 0x49, 0x49, 0x36}, {0x06, 0x49, 0x49, 0x29, 0x1E},
+    {0x00, 0x36, 0x36, 0x00, 0x00}, {0x00, 0x56, 0x36, 0x00, 0x00},
+    {0x08, 0x14, 0x22, 0x41, 0x00}, {0x14, 0x14, 0x14, 0x14, 0x14},
+    {0x00, 0x41, 0x22, 0x14, 0x08}, {0x02, 0x01, 0x51, 0x09, 0x06},
+    {0x32, 0x49, 0x79, 0x41, 0x3E}, {0x7E, 0x11, 0x11, 0x11, 0x7E},
+    {0x7F, 0x49, 0x49, 0x49, 0x36}, {0x3E, 0x41, 0x41, 0x41, 0x22},
+    {0x7F, 0x41, 0x41, 0x22, 0x1C}, {0x7F, 0x49, 0x49, 0x49, 0x41},
+    {0x7F, 0x09, 0x09, 0x09, 0x01}, {0x3E, 0x41, 0x49, 0x49, 0x7A},
+    {0x7F, 0x08, 0x08, 0x08, 0x7F}, {0x00, 0x41, 0x7F, 0x41, 0x00},
+    {0x20, 0x40, 0x41, 0x3F, 0x01}, {0x7F, 0x08, 0x14, 0x22, 0x41},
+    {0x7F, 0x40, 0x40, 0x40, 0x40}, {0x7F, 0x02, 0x0C, 0x02, 0x7F},
+    {0x7F, 0x04, 0x08, 0x10, 0x7F}, {0x3E, 0x41, 0x41, 0x41, 0x3E},
+    {0x7F, 0x09, 0x09, 0x09, 0x06}, {0x3E, 0x41, 0x51, 0x21, 0x5E},
+    {0x7F, 0x09, 0x19, 0x29, 0x46}, {0x46, 0x49, 0x49, 0x49, 0x31},
+    {0x01, 0x01, 0x7F, 0x01, 0x01}, {0x3F, 0x40, 0x40, 0x40, 0x3F},
+    {0x1F, 0x20, 0x40, 0x20, 0x1F}, {0x3F, 0x40, 0x38, 0x40, 0x3F},
+    {0x63, 0x14, 0x08, 0x14, 0x63}, {0x07, 0x08, 0x70, 0x08, 0x07},
+    {0x61, 0x51, 0x49, 0x45, 0x43}, {0x00, 0x7F, 0x41, 0x41, 0x00},
+    {0x02, 0x04, 0x08, 0x10, 0x20}, {0x00, 0x41, 0x41, 0x7F, 0x00},
+    {0x04, 0x02, 0x01, 0x02, 0x04}, {0x40, 0x40, 0x40, 0x40, 0x40},
+    {0x00, 0x01, 0x02, 0x04, 0x00}, {0x20, 0x54, 0x54, 0x54, 0x78},
+    {0x7F, 0x48, 0x44, 0x44, 0x38}, {0x38, 0x44, 0x44, 0x44, 0x20},
+    {0x38, 0x44, 0x44, 0x48, 0x7F}, {0x38, 0x54, 0x54, 0x54, 0x18},
+    {0x08, 0x7E, 0x09, 0x01, 0x02}, {0x0C, 0x52, 0x52, 0x52, 0x3E},
+    {0x7F, 0x08, 0x04, 0x04, 0x78}, {0x00, 0x44, 0x7D, 0x40, 0x00},
+    {0x20, 0x40, 0x44, 0x3D, 0x00}, {0x7F, 0x10, 0x28, 0x44, 0x00},
+    {0x00, 0x41, 0x7F, 0x40, 0x00}, {0x7C, 0x04, 0x18, 0x04, 0x78},
+    {0x7C, 0x08, 0x04, 0x04, 0x78}, {0x38, 0x44, 0x44, 0x44, 0x38},
+    {0x7C, 0x14, 0x14, 0x14, 0x08}, {0x08, 0x14, 0x14, 0x18, 0x7C},
+    {0x7C, 0x08, 0x04, 0x04, 0x08}, {0x48, 0x54, 0x54, 0x54, 0x20},
+    {0x04, 0x3F, 0x44, 0x40, 0x20}, {0x3C, 0x40, 0x40, 0x20, 0x7C},
+    {0x1C, 0x20, 0x40, 0x20, 0x1C}, {0x3C, 0x40, 0x30, 0x40, 0x3C},
+    {0x44, 0x28, 0x10, 0x28, 0x44}, {0x0C, 0x50, 0x50, 0x50, 0x3C},
+    {0x44, 0x64, 0x54, 0x4C, 0x44}, {0x00, 0x08, 0x36, 0x41, 0x00},
+    {0x00, 0x00, 0x7F, 0x00, 0x00}, {0x00, 0x41, 0x36, 0x08, 0x00},
+    {0x10, 0x08, 0x08, 0x10, 0x08},
+};
+} // namespace
+
+U8G2_SSD1309_128X64_NONAME2_F_HW_I2C::U8G2_SSD1309_128X64_NONAME2_F_HW_I2C(int,
+                                                                           int)
+{
+    memset(buf_, 0, sizeof(buf_));
+}
+
+void U8G2_SSD1309_128X64_NONAME2_F_HW_I2C::setI2CAddress(uint8_t addr8)
+{
+    addr_ = addr8;
+}
+
+bool U8G2_SSD1309_128X64_NONAME2_F_HW_I2C::begin()
+{
+    // Init sequence (~25 command bytes), then clear the panel
+    kbsim::ChargeI2c(1 + 1 + 25);
+    clearBuffer();
+    sendBuffer();
+    return true;
+}
+
+void U8G2_SSD1309_128X64_NONAME2_F_HW_I2C::clearBuffer()
+{
+    memset(buf_, 0, sizeof(buf_));
+}
+
+void U8G2_SSD1309_128X64_NONAME2_F_HW_I2C::sendBuffer()
+{
+    updateDisplayArea(0, 0, 16, 8);
+}
+
+void U8G2_SSD1309_128X64_NONAME2_F_HW_I2C::updateDisplayArea(uint8_t tx,
+                                                             uint8_t ty,
+                                                             uint8_t tw,
+                                                             uint8_t th)
+{
+    kbsim::PanelUpdate(buf_, tx, ty, tw, th);
+}
+
+void U8G2_SSD1309_128X64_NONAME2_F_HW_I2C::setFont(const uint8_t* font)
+{
+    font_ = font;
+}
+
+void U8G2_SSD1309_128X64_NONAME2_F_HW_I2C::setDrawColor(uint8_t color)
+{
+    color_ = color;
+}
+
+void U8G2_SSD1309_128X64_NONAME2_F_HW_I2C::drawPixel(int x, int y)
+{
+    if(x < 0 || x >= 128 || y < 0 || y >= 64)
+        return;
+    uint8_t& b   = buf_[(y / 8) * 128 + x];
+    uint8_t  bit = (uint8_t)(1u << (y % 8));
+    if(color_ == 0)
+        b &= (uint8_t)~bit;
+    else if(color_ == 2)
+        b ^= bit;
+    else
+        b |= bit;
+}
+
+void U8G2_SSD1309_128X64_NONAME2_F_HW_I2C::drawHLine(int x, int y, int w)
+{
+    for(int i = 0; i < w; ++i)
+        drawPixel(x + i, y);
+}
+
+void U8G2_SSD1309_128X64_NONAME2_F_HW_I2C::drawVLine(int x, int y, int h)
+{
+    for(int i = 0; i < h; ++i)
+        drawPixel(x, y + i);
+}
+
+void U8G2_SSD1309_128X64_NONAME2_F_HW_I2C::drawBox(int x, int y, int w, int h)
+{
+    for(int j = 0; j < h; ++j)
+        drawHLine(x, y + j, w);
+}
+
+void U8G2_SSD1309_128X64_NONAME2_F_HW_I2C::drawFrame(int x, int y, int w, int h)
+{
+    drawHLine(x, y, w);
+    drawHLine(x, y + h - 1, w);
+    drawVLine(x, y, h);
+    drawVLine(x + w - 1, y, h);
+}
+
+void U8G2_SSD1309_128X64_NONAME2_F_HW_I2C::drawRBox(int x, int y, int w, int h, int)
+{
+    drawBox(x, y, w, h);
+}
+
+void U8G2_SSD1309_128X64_NONAME2_F_HW_I2C::drawRFrame(int x,
+                                                      int y,
+                                                      int w,
+                                                      int h,
+                                                      int)
+{
+    drawFrame(x, y, w, h);
+}
+
+void U8G2_SSD1309_128X64_NONAME2_F_HW_I2C::drawDisc(int x0, int y0, int r)
+{
+    for(int dy = -r; dy <= r; ++dy)
+        for(int dx = -r; dx <= r; ++dx)
+            if(dx * dx + dy * dy <= r * r + r)
+                drawPixel(x0 + dx, y0 + dy);
+}
+
+int U8G2_SSD1309_128X64_NONAME2_F_HW_I2C::drawStr(int x, int y, const char* s)
+{
+    kbsim::ChargeCpu(kbsim::DrawStrCpuUs());
+
+    // The 5x7 glyph is resampled into the font's glyph box (cell minus one
+    // pixel of spacing), OR-ing source pixels that fold together.
+    const int adv    = font_[0];
+    const int height = font_[1];
+    const int sy     = (height >= 14) ? 2 : 1;
+    const int gw     = std::min(adv - 1, 5);
+    const int gh     = std::min(height / sy - 1, 7);
+    const int top    = y - gh * sy;
+    int       cx     = x;
+
+    for(; *s; ++s, cx += adv)
+    {
+        unsigned char c = (unsigned char)*s;
+        if(c < 0x20 || c > 0x7E)
+            c = '?';
+        const uint8_t* g = kFont5x7[c - 0x20];
+        for(int col = 0; col < gw; ++col)
+        {
+            uint8_t bits = 0;
+            for(int sc = col * 5 / gw; sc < (col + 1) * 5 / gw; ++sc)
+                bits |= g[sc];
+            for(int row = 0; row < gh; ++row)
+            {
+                bool on = false;
+                for(int sr = row * 7 / gh; sr < (row + 1) * 7 / gh; ++sr)
+                    on = on || ((bits >> sr) & 1);
+                if(on)
+                    for(int k = 0; k < sy; ++k)
+                        drawPixel(cx + col, top + row * sy + k);
+            }
+        }
+    }
+    return cx - x;
+}
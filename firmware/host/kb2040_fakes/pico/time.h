@@ -0,0 +1,5 @@
+// Host fake of pico/time.h: sleeping advances the simulated clock.
+#pragma once
+#include <stdint.h>
+
+void sleep_us(uint64_t us);
@@ -0,0 +1,583 @@
+#include "kb2040_sim.h"
+
+#include <algorithm>
+#include <deque>
+#include <stdio.h>
+#include <string.h>
+
+namespace kbsim
+{
+namespace
+{
+    // MCP23017 register model: only what the sketch and the Adafruit
+    // library touch (IODIR/GPPU writes are accepted and ignored).
+    struct McpDevice
+    {
+        uint8_t  addr;
+        bool     present;
+        uint8_t  reg;       // register pointer
+        uint16_t gpio;      // pin levels, 1 = released (pull-up)
+        int      failNext;
+    };
+
+    Config       g_cfg;
+    Wiring       g_wiring;
+    uint64_t     g_nowUs;
+    uint64_t     g_runUntilUs = UINT64_MAX; // RunUntil()'s end, while in it
+    McpDevice    g_mcp[2];
+    SeesawDevice g_pad;
+    SeesawDevice g_enc[2];
+    bool         g_bootDown;
+
+    std::vector<UartByte> g_uart;
+    uint64_t              g_uartLineFreeUs;
+    std::deque<UartByte>  g_uartRx;       // wireUs = when the byte is readable
+    uint64_t              g_uartRxFreeUs;
+    UartSink              g_uartSink;
+    void*                 g_uartSinkCtx;
+
+    std::deque<UsbPacket>  g_usbHost;    // queued by the computer
+    std::deque<UsbPacket>  g_usbRx;      // in the device's receive FIFO
+    uint64_t               g_usbFrameUs; // next frame to deliver
+    std::vector<UsbPacket> g_usbIn;
+    std::vector<UsbPacket> g_usbOut;
+
+    std::string g_serialOut;
+    std::string g_serialIn;
+
+    uint8_t  g_panel[128 * 8];
+    BusStats g_stats;
+
+    uint64_t I2cUs(size_t bytes)
+    {
+        // 9 clocks per byte (8 data + ACK) plus start and stop
+        uint64_t bits = (uint64_t)bytes * 9 + 2;
+        return (bits * 1000000ull + g_cfg.i2cHz - 1) / g_cfg.i2cHz;
+    }
+
+    void InitSeesaw(SeesawDevice& d, uint8_t addr, bool present, int intPin)
+    {
+        memset(&d, 0, sizeof(d));
+        d.addr    = addr;
+        d.present = present;
+        d.intPin  = intPin;
+        d.gpio    = 0xFFFFFFFFu;
+        for(int i = 0; i < 20; ++i)
+            d.adc[i] = 512;
+    }
+
+    McpDevice* FindMcp(uint8_t addr)
+    {
+        for(int i = 0; i < 2; ++i)
+            if(g_mcp[i].addr == addr)
+                return &g_mcp[i];
+        return nullptr;
+    }
+
+    // Encoder index 0..7 -> board and encoder on that board
+    SeesawDevice& EncBoard(int enc) { return g_enc[(enc / 4) & 1]; }
+
+} // namespace
+
+// ---- SeesawDevice -------------------------------------------------------
+
+bool SeesawDevice::IntAsserted() const
+{
+    if(!present)
+        return false;
+    if(intFlags & intEnable)
+        return true;
+    for(int e = 0; e < 4; ++e)
+        if(encIntEnable[e] && encIntPending[e])
+            return true;
+    return false;
+}
+
+void SeesawDevice::SetGpio(uint32_t mask, bool high)
+{
+    uint32_t old = gpio;
+    if(high)
+        gpio |= mask;
+    else
+        gpio &= ~mask;
+    intFlags |= (old ^ gpio) & intEnable;
+}
+
+SeesawDevice* FindSeesaw(uint8_t addr)
+{
+    if(g_pad.addr == addr)
+        return &g_pad;
+    for(int i = 0; i < 2; ++i)
+        if(g_enc[i].addr == addr)
+            return &g_enc[i];
+    return nullptr;
+}
+
+// ---- clock --------------------------------------------------------------
+
+uint64_t NowUs()
+{
+    return g_nowUs;
+}
+
+void AdvanceUs(uint64_t us)
+{
+    g_nowUs += us;
+}
+
+void SleepUs(uint64_t us)
+{
+    g_nowUs += std::min(us, g_runUntilUs > g_nowUs ? g_runUntilUs - g_nowUs : 0);
+}
+
+void ChargeCpu(uint32_t us)
+{
+    g_nowUs += us;
+}
+
+uint32_t DrawStrCpuUs()
+{
+    return g_cfg.drawStrCpuUs;
+}
+
+// ---- lifecycle ----------------------------------------------------------
+
+void Reset(const Config& cfg)
+{
+    g_cfg    = cfg;
+    g_nowUs  = 0;
+    g_wiring = sketch::GetWiring();
+
+    for(int i = 0; i < 2; ++i)
+    {
+        g_mcp[i].addr     = g_wiring.mcpAddr[i];
+        g_mcp[i].present  = cfg.mcpPresent[i];
+        g_mcp[i].reg      = 0;
+        g_mcp[i].gpio     = 0xFFFF;
+        g_mcp[i].failNext = 0;
+        InitSeesaw(g_enc[i],
+                   g_wiring.encAddr[i],
+                   cfg.encPresent[i],
+                   g_wiring.encIntPins[i]);
+    }
+    InitSeesaw(g_pad, g_wiring.padAddr, cfg.padPresent, g_wiring.padIntPin);
+    g_bootDown = false;
+
+    g_uart.clear();
+    g_uartLineFreeUs = 0;
+    g_uartRx.clear();
+    g_uartRxFreeUs = 0;
+    g_usbHost.clear();
+    g_usbRx.clear();
+    g_usbFrameUs = 0;
+    g_usbIn.clear();
+    g_usbOut.clear();
+    g_serialOut.clear();
+    g_serialIn.clear();
+    memset(g_panel, 0, sizeof(g_panel));
+    memset(&g_stats, 0, sizeof(g_stats));
+}
+
+void Boot()
+{
+    sketch::Setup();
+}
+
+void RunUntil(uint64_t us)
+{
+    g_runUntilUs = us;
+    while(g_nowUs < us)
+    {
+        sketch::Loop();
+        g_stats.loopPasses++;
+        ChargeCpu(g_cfg.loopCpuUs);
+    }
+    g_runUntilUs = UINT64_MAX;
+}
+
+// ---- inputs -------------------------------------------------------------
+
+void SetKey(int idx, bool down)
+{
+    if(idx < 0 || idx >= 20)
+        return;
+    McpDevice& m   = g_mcp[idx / 10];
+    uint16_t   bit = (uint16_t)(1u << g_wiring.mcpPins[idx % 10]);
+    if(down)
+        m.gpio &= ~bit;
+    else
+        m.gpio |= bit;
+}
+
+void SpinEncoder(int enc, int32_t detents)
+{
+    if(enc < 0 || enc >= 8 || detents == 0)
+        return;
+    SeesawDevice& d = EncBoard(enc);
+    int           e = enc % 4;
+    d.encPos[e] += detents;
+    d.encDelta[e] += detents;
+    d.encIntPending[e] = true;
+}
+
+void SetEncoderSwitch(int enc, bool down)
+{
+    if(enc < 0 || enc >= 8)
+        return;
+    EncBoard(enc).SetGpio(1u << g_wiring.encSwitchPins[enc % 4], !down);
+}
+
+void SetJoystick(int rawX, int rawY)
+{
+    // Gamepad QT: X on ADC pin 14, Y on 15
+    g_pad.adc[14] = (uint16_t)rawX;
+    g_pad.adc[15] = (uint16_t)rawY;
+}
+
+void SetPadButton(uint32_t seesawMask, bool down)
+{
+    g_pad.SetGpio(seesawMask, !down);
+}
+
+void SetBootButton(bool down)
+{
+    g_bootDown = down;
+}
+
+void SerialInput(const std::string& text)
+{
+    g_serialIn += text;
+}
+
+void UartReceive(const std::vector<uint8_t>& bytes)
+{
+    const uint64_t byteUs = (10ull * 1000000ull) / g_cfg.uartBaud;
+    uint64_t       start  = g_nowUs > g_uartRxFreeUs ? g_nowUs : g_uartRxFreeUs;
+    for(uint8_t b : bytes)
+    {
+        start += byteUs;
+        g_uartRx.push_back({g_nowUs, start, b});
+    }
+    g_uartRxFreeUs = start;
+}
+
+void FailI2c(uint8_t addr, int transactions)
+{
+    if(McpDevice* m = FindMcp(addr))
+        m->failNext += transactions;
+    else if(SeesawDevice* s = FindSeesaw(addr))
+        s->failNext += transactions;
+}
+
+void UsbMidiSend(const uint8_t packet[4])
+{
+    UsbPacket up = {g_nowUs, 0, 0, {packet[0], packet[1], packet[2], packet[3]}};
+    g_usbHost.push_back(up);
+}
+
+// ---- outputs ------------------------------------------------------------
+
+void SetUartSink(UartSink sink, void* ctx)
+{
+    g_uartSink    = sink;
+    g_uartSinkCtx = ctx;
+}
+
+const std::vector<UartByte>& UartLog()
+{
+    return g_uart;
+}
+
+const std::vector<UsbPacket>& UsbMidiInLog()
+{
+    return g_usbIn;
+}
+
+const std::vector<UsbPacket>& UsbMidiOutLog()
+{
+    return g_usbOut;
+}
+
+const std::string& SerialLog()
+{
+    return g_serialOut;
+}
+
+const BusStats& Stats()
+{
+    return g_stats;
+}
+
+const Wiring& GetWiring()
+{
+    return g_wiring;
+}
+
+const uint8_t* Panel()
+{
+    return g_panel;
+}
+
+bool PanelPixel(int x, int y)
+{
+    if(x < 0 || x >= 128 || y < 0 || y >= 64)
+        return false;
+    return (g_panel[(y / 8) * 128 + x] >> (y % 8)) & 1;
+}
+
+bool WritePanelPbm(const std::string& path)
+{
+    FILE* f = fopen(path.c_str(), "w");
+    if(!f)
+        return false;
+    fprintf(f, "P1\n128 64\n");
+    for(int y = 0; y < 64; ++y)
+    {
+        for(int x = 0; x < 128; ++x)
+            fputc(PanelPixel(x, y) ? '1' : '0', f);
+        fputc('\n', f);
+    }
+    fclose(f);
+    return true;
+}
+
+// ---- peripherals --------------------------------------------------------
+
+void ChargeI2c(size_t bytesIncludingAddr)
+{
+    uint64_t us = I2cUs(bytesIncludingAddr);
+    g_nowUs += us;
+    g_stats.i2cBusyUs += us;
+    g_stats.i2cTransactions++;
+}
+
+bool I2cTransfer(uint8_t        addr,
+                 const uint8_t* tx,
+                 size_t         txLen,
+                 uint8_t*       rx,
+                 size_t         rxLen)
+{
+    McpDevice* m = FindMcp(addr);
+    int*       failNext = nullptr;
+    bool       present  = false;
+    if(m)
+    {
+        failNext = &m->failNext;
+        present  = m->present;
+    }
+    else if(SeesawDevice* s = FindSeesaw(addr))
+    {
+        failNext = &s->failNext;
+        present  = s->present;
+    }
+    else if(addr == g_wiring.oledAddr)
+    {
+        present = true;
+    }
+
+    if(!present || (failNext && *failNext > 0))
+    {
+        if(failNext && *failNext > 0)
+            (*failNext)--;
+        ChargeI2c(1); // address byte, NACKed
+        g_stats.i2cNacks++;
+        return false;
+    }
+
+    if(txLen > 0)
+        ChargeI2c(1 + txLen);
+    if(rxLen > 0)
+        ChargeI2c(1 + rxLen);
+
+    if(!m)
+    {
+        if(rx)
+            memset(rx, 0, rxLen);
+        return true;
+    }
+
+    // MCP23017, IOCON.BANK = 0: sequential access walks A/B register pairs
+    if(txLen > 0)
+        m->reg = tx[0];
+    for(size_t i = 0; i < rxLen; ++i)
+    {
+        uint8_t v = 0;
+        if(m->reg == 0x12)
+            v = (uint8_t)(m->gpio & 0xFF);
+        else if(m->reg == 0x13)
+            v = (uint8_t)(m->gpio >> 8);
+        rx[i]  = v;
+        m->reg = (uint8_t)((m->reg + 1) % 0x16);
+    }
+    return true;
+}
+
+int PinLevel(int pin)
+{
+    if(pin < 0)
+        return 1;
+    if(pin == g_wiring.bootPin)
+        return g_bootDown ? 0 : 1;
+    if(pin == g_pad.intPin)
+        return g_pad.IntAsserted() ? 0 : 1;
+    for(int i = 0; i < 2; ++i)
+        if(pin == g_enc[i].intPin)
+            return g_enc[i].IntAsserted() ? 0 : 1;
+    return 1;
+}
+
+void UartWrite(uint8_t b)
+{
+    const uint64_t byteUs = (10ull * 1000000ull) / g_cfg.uartBaud;
+
+    // Bytes that haven't started shifting out still occupy the FIFO; the
+    // real write() spins until there is room.
+    for(;;)
+    {
+        uint32_t waiting = 0;
+        uint64_t oldestStart = 0;
+        for(size_t i = g_uart.size(); i-- > 0;)
+        {
+            uint64_t start = g_uart[i].wireUs - byteUs;
+            if(start <= g_nowUs)
+                break;
+            waiting++;
+            oldestStart = start;
+        }
+        if(waiting < g_cfg.uartFifo)
+            break;
+        g_stats.uartBlockedUs += oldestStart - g_nowUs;
+        g_nowUs = oldestStart;
+    }
+
+    uint64_t start   = g_nowUs > g_uartLineFreeUs ? g_nowUs : g_uartLineFreeUs;
+    UartByte ub      = {g_nowUs, start + byteUs, b};
+    g_uartLineFreeUs = ub.wireUs;
+    g_uart.push_back(ub);
+    g_stats.uartBytes++;
+    if(g_uartSink)
+        g_uartSink(ub, g_uartSinkCtx);
+}
+
+int UartRxAvailable()
+{
+    int n = 0;
+    for(const UartByte& ub : g_uartRx)
+    {
+        if(ub.wireUs > g_nowUs)
+            break;
+        n++;
+    }
+    return n;
+}
+
+namespace
+{
+// Frames up to now: each carries what the computer had queued at its
+// start, as much as fits in the device FIFO
+void UsbFrames()
+{
+    for(; g_usbFrameUs <= g_nowUs; g_usbFrameUs += 1000)
+    {
+        if(g_usbHost.empty())
+        {
+            g_usbFrameUs = g_nowUs - g_nowUs % 1000;
+            continue;
+        }
+        for(uint32_t n = 0; n < g_cfg.usbPacketsPerFrame && !g_usbHost.empty()
+                            && g_usbHost.front().sentUs <= g_usbFrameUs
+                            && g_usbRx.size() < g_cfg.usbMidiFifo;
+            ++n)
+        {
+            UsbPacket up  = g_usbHost.front();
+            up.acceptedUs = g_usbFrameUs;
+            g_usbHost.pop_front();
+            g_usbRx.push_back(up);
+        }
+    }
+}
+} // namespace
+
+bool UsbMidiRead(uint8_t packet[4])
+{
+    if(!g_cfg.usbMounted)
+        return false;
+    UsbFrames();
+    if(g_usbRx.empty())
+        return false;
+    UsbPacket up = g_usbRx.front();
+    g_usbRx.pop_front();
+    up.readUs = g_nowUs;
+    g_usbIn.push_back(up);
+    memcpy(packet, up.p, 4);
+    return true;
+}
+
+bool UsbMidiWrite(const uint8_t packet[4])
+{
+    if(!g_cfg.usbMounted)
+        return false;
+    UsbPacket up = {g_nowUs, 0, 0, {packet[0], packet[1], packet[2], packet[3]}};
+    g_usbOut.push_back(up);
+    return true;
+}
+
+bool UsbMounted()
+{
+    return g_cfg.usbMounted;
+}
+
+int UartRxRead()
+{
+    if(g_uartRx.empty() || g_uartRx.front().wireUs > g_nowUs)
+        return -1;
+    int b = g_uartRx.front().byte;
+    g_uartRx.pop_front();
+    return b;
+}
+
+void PanelUpdate(const uint8_t* frame, int tx, int ty, int tw, int th)
+{
+    for(int row = ty; row < ty + th && row < 8; ++row)
+    {
+        int x0 = tx * 8;
+        int n  = tw * 8;
+        if(x0 + n > 128)
+            n = 128 - x0;
+        if(n <= 0)
+            continue;
+        memcpy(g_panel + row * 128 + x0, frame + row * 128 + x0, n);
+
+        // SSD13xx over I2C: a short command transfer to set the column and
+        // page, then the data in chunks of up to 31 bytes behind a control
+        // byte (the Arduino Wire buffer is 32 bytes).
+        ChargeI2c(1 + 1 + 4);
+        for(int sent = 0; sent < n; sent += 31)
+        {
+            int chunk = (n - sent) < 31 ? (n - sent) : 31;
+            ChargeI2c(1 + 1 + chunk);
+        }
+        g_stats.panelBytes += n;
+    }
+}
+
+void SerialOut(const char* s, size_t n)
+{
+    g_serialOut.append(s, n);
+}
+
+int SerialAvailable()
+{
+    return (int)g_serialIn.size();
+}
+
+int SerialRead()
+{
+    if(g_serialIn.empty())
+        return -1;
+    int c = (uint8_t)g_serialIn[0];
+    g_serialIn.erase(0, 1);
+    return c;
+}
+
+} // namespace kbsim
@@ -0,0 +1,176 @@
+// Host simulator for the KB2040 UI firmware.
+//
+// The sketch is compiled unmodified against the fakes in kb2040_fakes/.
+// Those fakes route every peripheral access here, where it is charged
+// modelled bus time on a simulated microsecond clock:
+//   - I2C at the configured clock: 9 bits per byte plus start/stop, and
+//     seesaw read delays are included;
+//   - UART TX at 31250 baud, 10 bits per byte, with the RP2040's 32-byte
+//     FIFO (write() blocks while it is full); scripted RX bytes arrive at
+//     the same rate;
+//   - USB MIDI in 1 ms full-speed frames of up to 16 packets; the
+//     computer is held off while the device's receive FIFO is full;
+//   - a small fixed CPU cost per loop() pass and per text draw.
+// Scripted inputs (keys, encoders, joystick, buttons) change the simulated
+// devices; outputs are timestamped UART bytes and the simulated OLED panel.
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+namespace kbsim
+{
+struct Config
+{
+    uint32_t i2cHz       = 400000;
+    uint32_t uartBaud    = 31250;
+    uint32_t uartFifo    = 32;  // RP2040 UART TX FIFO depth
+    uint32_t loopCpuUs   = 2;   // charged per loop() pass
+    uint32_t drawStrCpuUs = 20; // charged per OLED text draw
+    uint32_t usbMidiFifo  = 16; // device receive FIFO, packets (64 bytes)
+    uint32_t usbPacketsPerFrame = 16;
+    bool     usbMounted   = true;
+    bool     mcpPresent[2] = {true, true};
+    bool     encPresent[2] = {true, true};
+    bool     padPresent    = true;
+};
+
+// One byte through the UART: when the sketch queued it, and when its stop
+// bit left the wire.
+struct UartByte
+{
+    uint64_t queuedUs;
+    uint64_t wireUs;
+    uint8_t  byte;
+};
+
+// One USB MIDI event packet (cable/CIN header and three bytes)
+struct UsbPacket
+{
+    uint64_t sentUs;     // the computer queued it / the sketch wrote it
+    uint64_t acceptedUs; // in the device's FIFO (to the KB2040 only)
+    uint64_t readUs;     // the sketch read it (to the KB2040 only)
+    uint8_t  p[4];
+};
+
+struct BusStats
+{
+    uint64_t i2cBusyUs;       // time the I2C bus was driven
+    uint64_t i2cTransactions;
+    uint64_t i2cNacks;
+    uint64_t uartBytes;
+    uint64_t uartBlockedUs;   // time write() spent waiting for FIFO space
+    uint64_t panelBytes;      // OLED payload bytes sent
+    uint64_t loopPasses;
+};
+
+// Wiring constants pulled from the sketch itself (kb2040_sketch.cpp)
+struct Wiring
+{
+    uint8_t  mcpAddr[2];
+    uint8_t  mcpPins[10];     // key i of a bank -> MCP pin
+    uint8_t  padAddr;
+    uint8_t  encAddr[2];
+    int      padIntPin;
+    int      encIntPins[2];
+    uint8_t  encSwitchPins[4];
+    int      bootPin;
+    uint8_t  oledAddr;
+    uint32_t txAheadUs;       // MIDI line time the UART FIFO may hold
+};
+
+// ---- clock ------------------------------------------------------------
+uint64_t NowUs();
+void     AdvanceUs(uint64_t us);
+
+// ---- lifecycle ----------------------------------------------------------
+void Reset(const Config& cfg);
+void Boot();                    // runs setup()
+void RunUntil(uint64_t us);     // runs loop() passes up to the given time;
+                                // sleep_us() wakes there, so inputs set
+                                // between calls land on time
+
+// ---- inputs -------------------------------------------------------------
+void SetKey(int idx, bool down);              // 0..9 bottom, 10..19 top row
+void SpinEncoder(int enc, int32_t detents);   // enc 0..7
+void SetEncoderSwitch(int enc, bool down);
+void SetJoystick(int rawX, int rawY);         // seesaw ADC counts 0..1023
+void SetPadButton(uint32_t seesawMask, bool down);
+void SetBootButton(bool down);
+void SerialInput(const std::string& text);
+void UartReceive(const std::vector<uint8_t>& bytes); // on the wire from now
+void FailI2c(uint8_t addr, int transactions); // NACK the next N transactions
+void UsbMidiSend(const uint8_t packet[4]);    // from the computer, from now
+
+// ---- outputs ------------------------------------------------------------
+typedef void (*UartSink)(const UartByte& b, void* ctx);
+void SetUartSink(UartSink sink, void* ctx);   // called as bytes are queued
+
+const std::vector<UartByte>& UartLog();
+const std::vector<UsbPacket>& UsbMidiInLog();  // packets the sketch read
+const std::vector<UsbPacket>& UsbMidiOutLog(); // packets to the computer
+const std::string&           SerialLog();
+const BusStats&              Stats();
+const Wiring&                GetWiring();
+
+// Panel contents in the SSD1309 page layout (128 x 8 pages)
+const uint8_t* Panel();
+bool           PanelPixel(int x, int y);
+bool           WritePanelPbm(const std::string& path);
+
+// ---- internals used by the fakes ---------------------------------------
+struct SeesawDevice
+{
+    uint8_t  addr;
+    bool     present;
+    int      intPin;
+    uint32_t gpio;          // pin levels, 1 = high (pull-ups)
+    uint32_t intEnable;
+    uint32_t intFlags;
+    int32_t  encPos[4];
+    int32_t  encDelta[4];
+    bool     encIntEnable[4];
+    bool     encIntPending[4];
+    uint16_t adc[20];
+    int      failNext;
+
+    bool IntAsserted() const;
+    void SetGpio(uint32_t mask, bool high);
+};
+
+SeesawDevice* FindSeesaw(uint8_t addr);
+
+// A full I2C transfer (write then optional repeated-start read). Returns
+// false on NACK. Bus time is charged either way.
+bool I2cTransfer(uint8_t addr,
+                 const uint8_t* tx,
+                 size_t         txLen,
+                 uint8_t*       rx,
+                 size_t         rxLen);
+void ChargeI2c(size_t bytesIncludingAddr);
+
+int  PinLevel(int pin);
+void UartWrite(uint8_t b);
+int  UartRxAvailable();
+int  UartRxRead();
+bool UsbMidiRead(uint8_t packet[4]);
+bool UsbMidiWrite(const uint8_t packet[4]);
+bool UsbMounted();
+void PanelUpdate(const uint8_t* frame, int tx, int ty, int tw, int th);
+void SerialOut(const char* s, size_t n);
+int  SerialAvailable();
+int  SerialRead();
+void ChargeCpu(uint32_t us);
+void SleepUs(uint64_t us); // cut short at RunUntil()'s end
+uint32_t DrawStrCpuUs();
+
+namespace sketch
+{
+void   Setup();
+void   Loop();
+Wiring GetWiring();
+} // namespace sketch
+
+} // namespace kbsim
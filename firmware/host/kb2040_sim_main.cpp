@@ -0,0 +1,378 @@
+// kb2040_sim: runs the KB2040 UI sketch against scripted input.
+//
+//   kb2040_sim [-o outdir] [-u path] scenario.txt
+//
+// Writes to outdir (default "."):
+//   midi.log         one line per MIDI message: queued and on-wire time
+//                    (us), raw bytes, decoded message
+//   serial.log       everything the sketch printed over USB serial
+//   frame_<n>.pbm    OLED panel at each 'frame' command
+// and prints a bus/latency summary to stdout.
+//
+// -u replays everything the sketch sent on Serial1, boot included, into
+// path (a FIFO, a serial port, or groovebox_rt's pseudo-terminal) at the
+// times the bytes left the wire, once the run is simulated. The Daisy
+// engine then plays the scenario live.
+#include "kb2040_sim.h"
+#include "sim_script.h"
+#include "../midi_protocol.h"
+
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+namespace
+{
+struct MidiMsg
+{
+    uint64_t queuedUs; // first byte handed to the UART
+    uint64_t wireUs;   // last byte off the wire
+    uint8_t  bytes[3];
+    int      len;
+};
+
+int MidiDataLen(uint8_t status)
+{
+    switch(status & 0xF0)
+    {
+        case 0xC0:
+        case 0xD0: return 1;
+        case 0xF0:
+            if(status == 0xF1 || status == 0xF3)
+                return 1;
+            if(status == 0xF2 || status == MidiStamp::STATUS)
+                return 2;
+            return 0;
+        default: return 2;
+    }
+}
+
+// Splits the UART byte stream into messages (running status supported,
+// SysEx bodies skipped).
+std::vector<MidiMsg> DecodeMidi(const std::vector<kbsim::UartByte>& log)
+{
+    std::vector<MidiMsg> out;
+    MidiMsg              cur     = {};
+    uint8_t              running = 0;
+    int                  need    = 0;
+    bool                 sysex   = false;
+
+    for(const kbsim::UartByte& ub : log)
+    {
+        uint8_t b = ub.byte;
+        if(b >= 0xF8)
+        {
+            MidiMsg rt = {ub.queuedUs, ub.wireUs, {b, 0, 0}, 1};
+            out.push_back(rt);
+            continue;
+        }
+        if(b & 0x80)
+        {
+            sysex = (b == 0xF0);
+            if(sysex || b == 0xF7)
+                continue;
+            running      = (b < 0xF0) ? b : 0;
+            cur.queuedUs = ub.queuedUs;
+            cur.bytes[0] = b;
+            cur.len      = 1;
+            need         = MidiDataLen(b);
+        }
+        else
+        {
+            if(sysex)
+                continue;
+            if(need == 0)
+            {
+                if(!running)
+                    continue;
+                cur.queuedUs = ub.queuedUs;
+                cur.bytes[0] = running;
+                cur.len      = 1;
+                need         = MidiDataLen(running);
+            }
+            cur.bytes[cur.len++] = b;
+            need--;
+        }
+        if(need == 0)
+        {
+            cur.wireUs = ub.wireUs;
+            out.push_back(cur);
+            cur.len = 0;
+        }
+    }
+    return out;
+}
+
+std::string Describe(const MidiMsg& m)
+{
+    char    buf[64];
+    uint8_t st = m.bytes[0];
+    int     ch = (st & 0x0F) + 1;
+    switch(st & 0xF0)
+    {
+        case 0x80: snprintf(buf, sizeof(buf), "NoteOff ch%d %d %d", ch, m.bytes[1], m.bytes[2]); break;
+        case 0x90:
+            snprintf(buf, sizeof(buf), "%s ch%d %d %d", m.bytes[2] ? "NoteOn" : "NoteOff", ch, m.bytes[1], m.bytes[2]);
+            break;
+        case 0xB0: snprintf(buf, sizeof(buf), "CC ch%d %d %d", ch, m.bytes[1], m.bytes[2]); break;
+        case 0xC0: snprintf(buf, sizeof(buf), "Program ch%d %d", ch, m.bytes[1]); break;
+        case 0xE0:
+            snprintf(buf, sizeof(buf), "PitchBend ch%d %d", ch, ((m.bytes[2] << 7) | m.bytes[1]) - 8192);
+            break;
+        default:
+            if(st == MidiStamp::STATUS)
+                snprintf(buf,
+                         sizeof(buf),
+                         "Stamp %u us",
+                         (unsigned)((m.bytes[2] << 7) | m.bytes[1]) << MidiStamp::UNIT_SHIFT);
+            else
+                snprintf(buf, sizeof(buf), "System %02X", st);
+            break;
+    }
+    return buf;
+}
+
+bool IsNoteOn(const MidiMsg& m)
+{
+    return m.len == 3 && (m.bytes[0] & 0xF0) == 0x90 && m.bytes[2] != 0;
+}
+
+double Percentile(std::vector<uint64_t> v, double p)
+{
+    if(v.empty())
+        return 0.0;
+    std::sort(v.begin(), v.end());
+    size_t idx = (size_t)(p / 100.0 * (double)(v.size() - 1) + 0.5);
+    return (double)v[idx];
+}
+
+void PrintLatency(const char* label, const std::vector<uint64_t>& v)
+{
+    if(v.empty())
+    {
+        printf("%-22s n=0\n", label);
+        return;
+    }
+    printf("%-22s n=%zu p50=%.0f p90=%.0f p99=%.0f max=%.0f us\n",
+           label,
+           v.size(),
+           Percentile(v, 50),
+           Percentile(v, 90),
+           Percentile(v, 99),
+           Percentile(v, 100));
+}
+
+// Bytes due within a millisecond of each other go in one write
+bool ReplayUart(const std::vector<kbsim::UartByte>& tx, const std::string& path)
+{
+    int fd = open(path.c_str(), O_WRONLY | O_NOCTTY);
+    if(fd < 0)
+    {
+        fprintf(stderr, "%s: %s\n", path.c_str(), strerror(errno));
+        return false;
+    }
+    timespec t0;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for(size_t i = 0; i < tx.size();)
+    {
+        uint64_t atUs = tx[i].wireUs - tx[0].wireUs;
+        timespec ts;
+        ts.tv_sec  = t0.tv_sec + (time_t)(atUs / 1000000);
+        ts.tv_nsec = t0.tv_nsec + (long)(atUs % 1000000) * 1000;
+        if(ts.tv_nsec >= 1000000000)
+        {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000;
+        }
+        while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) == EINTR)
+        {
+        }
+
+        uint8_t buf[64];
+        size_t  n = 0;
+        while(i < tx.size() && n < sizeof(buf) && tx[i].wireUs - tx[0].wireUs < atUs + 1000)
+            buf[n++] = tx[i++].byte;
+        if(write(fd, buf, n) != (ssize_t)n)
+        {
+            fprintf(stderr, "%s: %s\n", path.c_str(), strerror(errno));
+            close(fd);
+            return false;
+        }
+    }
+    close(fd);
+    return true;
+}
+
+void Usage()
+{
+    fprintf(stderr, "usage: kb2040_sim [-o outdir] [-u path] scenario.txt\n");
+}
+} // namespace
+
+int main(int argc, char** argv)
+{
+    std::string outDir = ".";
+    std::string scriptPath;
+    std::string replayPath;
+    for(int i = 1; i < argc; ++i)
+    {
+        if(strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+            outDir = argv[++i];
+        else if(strcmp(argv[i], "-u") == 0 && i + 1 < argc)
+            replayPath = argv[++i];
+        else if(argv[i][0] == '-')
+        {
+            Usage();
+            return 2;
+        }
+        else
+            scriptPath = argv[i];
+    }
+    if(scriptPath.empty())
+    {
+        Usage();
+        return 2;
+    }
+
+    std::vector<kbsim::ScriptAction> script;
+    std::string                      err;
+    if(!kbsim::LoadScript(scriptPath, script, err))
+    {
+        fprintf(stderr, "%s\n", err.c_str());
+        return 1;
+    }
+
+    kbsim::Reset(kbsim::Config());
+    kbsim::Boot();
+    const uint64_t bootUs  = kbsim::NowUs();
+    const size_t   bootTx  = kbsim::UartLog().size();
+    const auto     bootBus = kbsim::Stats();
+
+    // Key presses in order, for latency matching below
+    std::vector<uint64_t> pressUs;
+    uint64_t              endUs = bootUs;
+
+    for(const kbsim::ScriptAction& act : script)
+    {
+        uint64_t t = bootUs + act.tUs;
+        kbsim::RunUntil(t);
+        endUs = kbsim::NowUs();
+        if(act.kind == kbsim::ScriptAction::END)
+            break;
+        if(act.kind == kbsim::ScriptAction::FRAME)
+        {
+            std::string path = outDir + "/frame_" + act.text + ".pbm";
+            if(!kbsim::WritePanelPbm(path))
+                fprintf(stderr, "cannot write %s\n", path.c_str());
+            continue;
+        }
+        if(act.kind == kbsim::ScriptAction::KEY && act.b)
+            pressUs.push_back(kbsim::NowUs());
+        kbsim::ApplyAction(act);
+    }
+
+    // ---- logs ---------------------------------------------------------
+    std::vector<kbsim::UartByte> tx(kbsim::UartLog().begin() + bootTx,
+                                    kbsim::UartLog().end());
+    std::vector<MidiMsg>         msgs = DecodeMidi(tx);
+
+    if(FILE* f = fopen((outDir + "/midi.log").c_str(), "w"))
+    {
+        for(const MidiMsg& m : msgs)
+        {
+            fprintf(f, "%10llu %10llu ", (unsigned long long)(m.queuedUs - bootUs), (unsigned long long)(m.wireUs - bootUs));
+            for(int i = 0; i < 3; ++i)
+                if(i < m.len)
+                    fprintf(f, " %02X", m.bytes[i]);
+                else
+                    fprintf(f, "   ");
+            fprintf(f, "  %s\n", Describe(m).c_str());
+        }
+        fclose(f);
+    }
+    if(FILE* f = fopen((outDir + "/serial.log").c_str(), "w"))
+    {
+        fputs(kbsim::SerialLog().c_str(), f);
+        fclose(f);
+    }
+
+    // ---- summary ------------------------------------------------------
+    const kbsim::BusStats& s      = kbsim::Stats();
+    const double           spanUs = (double)(endUs - bootUs);
+    const double           spanS  = spanUs / 1e6;
+
+    int notesOn = 0, notesOff = 0, ccs = 0, bends = 0, other = 0;
+    for(const MidiMsg& m : msgs)
+    {
+        switch(m.bytes[0] & 0xF0)
+        {
+            case 0x90: (m.bytes[2] ? notesOn : notesOff)++; break;
+            case 0x80: notesOff++; break;
+            case 0xB0: ccs++; break;
+            case 0xE0: bends++; break;
+            default: other++; break;
+        }
+    }
+
+    printf("setup              %.1f ms\n", bootUs / 1000.0);
+    printf("simulated          %.1f ms, %llu loop passes\n",
+           spanUs / 1000.0,
+           (unsigned long long)(s.loopPasses - bootBus.loopPasses));
+    if(spanS > 0)
+    {
+        printf("i2c                %.1f%% busy, %.0f transactions/s, %llu nacks\n",
+               100.0 * (double)(s.i2cBusyUs - bootBus.i2cBusyUs) / spanUs,
+               (double)(s.i2cTransactions - bootBus.i2cTransactions) / spanS,
+               (unsigned long long)(s.i2cNacks - bootBus.i2cNacks));
+        printf("oled               %.0f bytes/s\n",
+               (double)(s.panelBytes - bootBus.panelBytes) / spanS);
+        printf("uart               %zu bytes, %.1f%% of line, %llu us blocked\n",
+               tx.size(),
+               100.0 * (double)tx.size() * 320.0 / spanUs,
+               (unsigned long long)(s.uartBlockedUs - bootBus.uartBlockedUs));
+    }
+    printf("midi               %zu msgs: %d note on, %d note off, %d cc, %d bend, %d other\n",
+           msgs.size(),
+           notesOn,
+           notesOff,
+           ccs,
+           bends,
+           other);
+
+    // Greedy: each press takes the first unclaimed NoteOn queued after it
+    std::vector<uint64_t> queuedLat, wireLat;
+    size_t                next = 0;
+    for(uint64_t p : pressUs)
+    {
+        while(next < msgs.size() && (!IsNoteOn(msgs[next]) || msgs[next].queuedUs < p))
+            next++;
+        if(next >= msgs.size())
+            break;
+        queuedLat.push_back(msgs[next].queuedUs - p);
+        wireLat.push_back(msgs[next].wireUs - p);
+        next++;
+    }
+    printf("key presses        %zu, %zu matched to a NoteOn\n", pressUs.size(), queuedLat.size());
+    PrintLatency("key -> uart queued", queuedLat);
+    PrintLatency("key -> on wire", wireLat);
+
+    if(!replayPath.empty())
+    {
+        printf("replaying %zu bytes into %s, %.1f s\n",
+               kbsim::UartLog().size(),
+               replayPath.c_str(),
+               kbsim::UartLog().empty()
+                   ? 0.0
+                   : (kbsim::UartLog().back().wireUs - kbsim::UartLog().front().wireUs) / 1e6);
+        fflush(stdout);
+        if(!ReplayUart(kbsim::UartLog(), replayPath))
+            return 1;
+    }
+    return 0;
+}
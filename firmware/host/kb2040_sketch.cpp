@@ -0,0 +1,58 @@
+// Builds the KB2040 sketch, unmodified, against the host fakes.
+//
+// The fakes and the shared protocol header are included first so the
+// sketch's own #includes are no-ops; the sketch itself lands in a
+// namespace so it can be linked next to other firmware (the Daisy engine)
+// without name clashes.
+#include "Arduino.h"
+#include "Wire.h"
+#include "U8g2lib.h"
+#include "Adafruit_MCP23X17.h"
+#include "Adafruit_seesaw.h"
+#include "Adafruit_TinyUSB.h"
+#include "pico/time.h"
+#include "midi_protocol.h"
+
+#include "kb2040_sim.h"
+
+namespace kb2040_sketch
+{
+#include "kb2040_groovebox_ui.ino"
+} // namespace kb2040_sketch
+
+namespace kbsim
+{
+namespace sketch
+{
+    void Setup()
+    {
+        kb2040_sketch::setup();
+    }
+
+    void Loop()
+    {
+        kb2040_sketch::loop();
+    }
+
+    Wiring GetWiring()
+    {
+        Wiring w;
+        w.mcpAddr[0] = MCP1_ADDR;
+        w.mcpAddr[1] = MCP2_ADDR;
+        for(int i = 0; i < 10; ++i)
+            w.mcpPins[i] = kb2040_sketch::MCP_PINS[i];
+        w.padAddr       = GAMEPAD_ADDR;
+        w.encAddr[0]    = ENC1_ADDR;
+        w.encAddr[1]    = ENC2_ADDR;
+        w.padIntPin     = kb2040_sketch::PAD_INT_PIN;
+        w.encIntPins[0] = kb2040_sketch::ENC_INT_PINS[0];
+        w.encIntPins[1] = kb2040_sketch::ENC_INT_PINS[1];
+        for(int i = 0; i < 4; ++i)
+            w.encSwitchPins[i] = kb2040_sketch::ENC_SWITCH_PINS[i];
+        w.bootPin  = kb2040_sketch::BOOT_SW_PIN;
+        w.oledAddr = OLED_ADDR;
+        w.txAheadUs = kb2040_sketch::TX_AHEAD_US;
+        return w;
+    }
+} // namespace sketch
+} // namespace kbsim
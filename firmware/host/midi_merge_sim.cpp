@@ -0,0 +1,649 @@
+// midi_merge_sim: ordering and throughput of the Daisy's merged MIDI input
+// (MidiMergeQueue, daisy/seed/kb2040_groovebox/midi_rx.h) with fake UART
+// and USB transports.
+//
+//   midi_merge_sim [-t seconds] [-s stall_ms] [-l audio load %] [scenario ...]
+//
+// Both transports deliver bytes to the firmware's parser and queue from
+// their receive callbacks, on a model clock:
+//   UART   the KB2040 at 31250 baud. The DMA callback fires when the line
+//          has been idle for a character, or every 128 bytes of a
+//          continuous stream (half the DMA buffer).
+//   USB    a computer. Messages go out in 1 ms full-speed frames, up to
+//          16 four-byte event packets (one 64-byte bulk packet) each; the
+//          callback fires as the frame's packet lands.
+// Callbacks, and the 1 ms audio block, are interrupts: each runs to the
+// end before the next starts, and they take their time out of main().
+// main() pops one message at a time (each costs a few µs to handle) and
+// sleeps while the queue is empty. Every 100 ms it is held up for -s ms
+// (a background slice, a flash write). The clock wraps its 32 bits
+// partway through.
+//
+// Scenarios (default: all):
+//   keys    a player on the KB2040, nothing on USB; the KB2040 sets the
+//           block size once
+//   daw     a DAW sequencing over USB; its CCs on channel 2 are filtered
+//           out by the USB channel mask. Now and then it sends the
+//           Daisy's own block size and sample rate controllers too
+//   mixed   both at once
+//   flood   a computer sending a full frame every frame, with the player
+//   stall   the flood with main() held up past the USB ring: the USB
+//           source drops, the KB2040's keys must not
+//
+// Checks: main() pops in arrival order across sources and in order within
+// each; every message that wasn't filtered or dropped arrives unchanged;
+// filter counts match the masks; drops only where the scenario allows.
+// main() applies the audio setup controllers as the firmware does
+// (IsForeignDaisyCommand(), AudioConfig): the KB2040's block size has to
+// take, and nothing from USB may change the setup.
+// Then the queue's own cost, pushing and popping on this machine.
+//
+// Exits 1 if a check fails.
+#include "audio_config.h"
+#include "midi_rx.h"
+
+#include <algorithm>
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+namespace
+{
+const double   kUartCharUs   = 10.0 * 1e6 / 31250.0;
+const uint32_t kUartDmaHalf  = 128;
+const double   kUsbFrameUs   = 1000.0;
+const int      kUsbPerFrame  = 16;
+const double   kUsbIsrUs     = 20.0; // frame start to the callback
+const double   kCallbackUs   = 1.5;  // interrupt entry and exit
+const double   kParseByteUs  = 0.1;
+const double   kHandleUs     = 4.0;  // main(): one message into the engine
+const double   kBlockUs      = 1000.0;
+const double   kStallPeriod  = 100000.0;
+const uint32_t kClockStartUs = 0xFFFFFFFFu - 1500000u; // wraps 1.5 s in
+
+struct Options
+{
+    double seconds = 4.0;
+    double stallMs = 2.0;
+    double load    = 0.45;
+};
+
+struct Msg
+{
+    double  sendUs; // handed to the transport
+    uint8_t status, data0, data1;
+};
+
+// One receive callback's bytes, and the message each completes
+struct Callback
+{
+    double               us;
+    int                  source; // MidiSource, or -1 for the audio block
+    std::vector<uint8_t> bytes;
+    std::vector<double>  wireUs; // per byte: landed in the Daisy's buffer
+};
+
+struct Rng
+{
+    uint32_t s = 0x2545F491u;
+    uint32_t Next()
+    {
+        s ^= s << 13;
+        s ^= s >> 17;
+        s ^= s << 5;
+        return s;
+    }
+    int Range(int lo, int hi) { return lo + (int)(Next() % (uint32_t)(hi - lo + 1)); }
+};
+
+int DataBytes(uint8_t status)
+{
+    return ((status & 0xE0) == 0xC0) ? 1 : 2;
+}
+
+void Sort(std::vector<Msg>& m)
+{
+    std::stable_sort(m.begin(), m.end(), [](const Msg& a, const Msg& b) {
+        return a.sendUs < b.sendUs;
+    });
+}
+
+// ----------------------------------------------------------------------
+// Traffic
+// ----------------------------------------------------------------------
+
+const uint8_t kSynthCC     = 0xB0 | (MidiCh::SYNTH - 1);
+const uint8_t kPlayerBlock = 7; // the KB2040's block size setting
+
+// Chords and single notes every 80-200 ms, a joystick sweep now and then;
+// the block size set from the menu at the start
+std::vector<Msg> Player(double seconds, Rng& rng)
+{
+    std::vector<Msg> m;
+    m.push_back({20000.0, kSynthCC, MidiCC::AUDIO_BLOCK_SIZE, kPlayerBlock});
+    for(double t = 50000.0; t < seconds * 1e6; t += rng.Range(80, 200) * 1000.0)
+    {
+        int notes = rng.Range(1, 3);
+        for(int i = 0; i < notes; i++)
+        {
+            uint8_t note = (uint8_t)rng.Range(48, 84);
+            m.push_back({t, 0x90, note, (uint8_t)rng.Range(40, 127)});
+            m.push_back({t + rng.Range(30, 150) * 1000.0, 0x80, note, 0});
+        }
+        if(rng.Range(0, 7) == 0)
+            for(int i = 0; i < 16; i++)
+                m.push_back({t + i * 4000.0, 0xE0, 0, (uint8_t)(64 + i * 3)});
+    }
+    Sort(m);
+    return m;
+}
+
+// 16ths at 120 BPM, four-note chords, volume automation on channel 1
+// and mod wheel on channel 2 (not for the groovebox); every half second
+// the Daisy's audio setup controllers, which it must ignore
+std::vector<Msg> Daw(double seconds, Rng& rng)
+{
+    std::vector<Msg> m;
+    for(double t = 0.0; t < seconds * 1e6; t += 125000.0)
+    {
+        uint8_t root = (uint8_t)rng.Range(48, 60);
+        for(uint8_t n : {root, (uint8_t)(root + 4), (uint8_t)(root + 7), (uint8_t)(root + 12)})
+        {
+            m.push_back({t, 0x90, n, 100});
+            m.push_back({t + 100000.0, 0x80, n, 0});
+        }
+    }
+    for(double t = 0.0; t < seconds * 1e6; t += 20000.0)
+        m.push_back({t, 0xB0, 7, (uint8_t)((int)(t / 20000.0) & 127)});
+    for(double t = 5000.0; t < seconds * 1e6; t += 10000.0)
+        m.push_back({t, 0xB1, 1, (uint8_t)((int)(t / 10000.0) & 127)});
+    for(double t = 250000.0; t < seconds * 1e6; t += 500000.0)
+    {
+        m.push_back({t, kSynthCC, MidiCC::AUDIO_BLOCK_SIZE, 0});
+        m.push_back({t, kSynthCC, MidiCC::AUDIO_SAMPLE_RATE, 2});
+    }
+    Sort(m);
+    return m;
+}
+
+// As much as USB carries: a full frame of pitch bends every frame
+std::vector<Msg> Flood(double seconds)
+{
+    std::vector<Msg> m;
+    double           step = kUsbFrameUs / kUsbPerFrame;
+    for(double t = 0.0; t < seconds * 1e6; t += step)
+        m.push_back({t, 0xE0, (uint8_t)((int)(t / step) & 127), 64});
+    return m;
+}
+
+// ----------------------------------------------------------------------
+// Fake transports: messages -> receive callbacks
+// ----------------------------------------------------------------------
+
+std::vector<Callback> UartCallbacks(const std::vector<Msg>& msgs)
+{
+    struct Byte
+    {
+        double  endUs;
+        uint8_t b;
+    };
+    std::vector<Byte> bytes;
+    double            lineFree = 0.0;
+    for(const Msg& m : msgs)
+    {
+        uint8_t raw[3] = {m.status, m.data0, m.data1};
+        for(int i = 0; i <= DataBytes(m.status); i++)
+        {
+            double start = std::max(m.sendUs, lineFree);
+            lineFree     = start + kUartCharUs;
+            bytes.push_back({lineFree, raw[i]});
+        }
+    }
+
+    std::vector<Callback> out;
+    Callback              cb;
+    uint32_t              dmaPos = 0;
+    for(size_t i = 0; i < bytes.size(); i++)
+    {
+        cb.bytes.push_back(bytes[i].b);
+        cb.wireUs.push_back(bytes[i].endUs);
+        dmaPos = (dmaPos + 1) % (2 * kUartDmaHalf);
+        bool idle = i + 1 == bytes.size()
+                    || bytes[i + 1].endUs - kUartCharUs > bytes[i].endUs + kUartCharUs;
+        if(dmaPos % kUartDmaHalf == 0 || idle)
+        {
+            cb.us     = bytes[i].endUs + (dmaPos % kUartDmaHalf == 0 ? 0.0 : kUartCharUs);
+            cb.source = MIDI_SOURCE_UART;
+            out.push_back(cb);
+            cb = Callback();
+        }
+    }
+    return out;
+}
+
+std::vector<Callback> UsbCallbacks(const std::vector<Msg>& msgs)
+{
+    std::vector<Callback> out;
+    size_t                next = 0;
+    for(double frame = kUsbFrameUs; next < msgs.size(); frame += kUsbFrameUs)
+    {
+        Callback cb;
+        cb.us     = frame + kUsbIsrUs;
+        cb.source = MIDI_SOURCE_USB;
+        for(int n = 0; n < kUsbPerFrame && next < msgs.size() && msgs[next].sendUs < frame;
+            n++, next++)
+        {
+            const Msg& m      = msgs[next];
+            uint8_t    raw[3] = {m.status, m.data0, m.data1};
+            for(int i = 0; i <= DataBytes(m.status); i++)
+            {
+                cb.bytes.push_back(raw[i]);
+                cb.wireUs.push_back(frame);
+            }
+        }
+        if(!cb.bytes.empty())
+            out.push_back(cb);
+    }
+    return out;
+}
+
+// ----------------------------------------------------------------------
+// The Daisy: interrupts and main()
+// ----------------------------------------------------------------------
+
+struct Scenario
+{
+    const char* name;
+    bool        keys, daw, flood;
+    double      stallMs; // < 0: the command line's
+    bool        usbMayDrop;
+};
+
+struct SourceRun
+{
+    std::vector<Msg>    sent;
+    std::vector<bool>   accepted;  // passed the channel filter
+    std::vector<bool>   dropped;   // ring full
+    std::vector<double> wireUs;    // per message: last byte landed
+    std::vector<double> handledUs; // per message: main() handled it
+    size_t              decoded = 0;
+    size_t              next    = 0; // next message main() should pop
+    uint32_t            expectFiltered = 0;
+};
+
+class Sim
+{
+  public:
+    Sim(const Scenario& sc, const Options& opt) : sc_(sc), opt_(opt) {}
+
+    bool Run();
+
+  private:
+    void   Interrupt(const Callback& cb);
+    void   Spend(double us);
+    bool   PopOne();
+    double Now32(double us) const { return (uint32_t)(kClockStartUs + (uint64_t)us); }
+    bool   Check();
+    void   Report(int s, const char* label) const;
+
+    Scenario              sc_;
+    Options               opt_;
+    MidiMergeQueue<256>   queue_;
+    MidiRxDecoder         decoders_[MIDI_NUM_SOURCES];
+    SourceRun             src_[MIDI_NUM_SOURCES];
+    std::vector<Callback> irqs_;
+    size_t                nextIrq_ = 0;
+    double                now_     = 0.0;
+    double                isrFree_ = 0.0; // the running interrupt ends
+    uint32_t              lastPop_ = 0;
+    bool                  havePop_ = false;
+    int                   errors_  = 0;
+    double                busyUs_  = 0.0;
+    AudioConfig           audio_;
+    uint32_t              foreign_ = 0; // Daisy controllers from USB, dropped
+};
+
+// Runs the callback's parser and queue pushes, as the firmware does, with
+// the clock read on entry
+void Sim::Interrupt(const Callback& cb)
+{
+    double start = std::max(cb.us, isrFree_);
+    if(cb.source < 0)
+    {
+        isrFree_ = start + kBlockUs * opt_.load;
+        busyUs_ += isrFree_ - start;
+        return;
+    }
+    MidiSource  source = (MidiSource)cb.source;
+    SourceRun&  r      = src_[source];
+    uint32_t    stamp  = (uint32_t)Now32(start);
+    MidiRxEvent e;
+    for(size_t i = 0; i < cb.bytes.size(); i++)
+    {
+        if(!decoders_[source].Feed(cb.bytes[i], stamp, e))
+            continue;
+        size_t k = r.decoded++;
+        if(k >= r.sent.size() || e.status != r.sent[k].status || e.data0 != r.sent[k].data0
+           || (DataBytes(e.status) == 2 && e.data1 != r.sent[k].data1))
+        {
+            fprintf(stderr, "  %s: source %d message %zu garbled\n", sc_.name, cb.source, k);
+            errors_++;
+            continue;
+        }
+        r.wireUs[k]   = cb.wireUs[i];
+        bool accepted = queue_.Accepts(source, e.status);
+        bool queued   = queue_.Push(source, e);
+        r.accepted[k] = accepted;
+        r.dropped[k]  = accepted && !queued;
+    }
+    isrFree_ = start + kCallbackUs + kParseByteUs * cb.bytes.size();
+    busyUs_ += isrFree_ - start;
+}
+
+// main() runs for `us`; interrupts that fall due take their time from it
+void Sim::Spend(double us)
+{
+    double end = now_ + us;
+    while(nextIrq_ < irqs_.size() && irqs_[nextIrq_].us <= end)
+    {
+        const Callback& cb = irqs_[nextIrq_++];
+        double          before = isrFree_;
+        Interrupt(cb);
+        end += isrFree_ - std::max(cb.us, before);
+    }
+    now_ = std::max(end, isrFree_);
+}
+
+bool Sim::PopOne()
+{
+    MidiRxEvent e;
+    if(!queue_.Pop(e))
+        return false;
+    if(havePop_ && (int32_t)(e.arrivalUs - lastPop_) < 0)
+    {
+        fprintf(stderr, "  %s: popped out of arrival order (%u after %u)\n", sc_.name,
+                e.arrivalUs, lastPop_);
+        errors_++;
+    }
+    havePop_ = true;
+    lastPop_ = e.arrivalUs;
+
+    SourceRun& r = src_[e.source];
+    while(r.next < r.decoded && (!r.accepted[r.next] || r.dropped[r.next]))
+        r.next++;
+    const Msg* want = r.next < r.sent.size() ? &r.sent[r.next] : nullptr;
+    if(!want || want->status != e.status || want->data0 != e.data0)
+    {
+        fprintf(stderr, "  %s: source %u popped out of order\n", sc_.name, e.source);
+        errors_++;
+    }
+    else
+        r.handledUs[r.next++] = now_ + kHandleUs;
+    if(IsForeignDaisyCommand(e))
+        foreign_++;
+    else if(e.status == kSynthCC)
+        audio_.ApplyCC(e.data0, e.data1);
+    Spend(kHandleUs);
+    return true;
+}
+
+bool Sim::Run()
+{
+    Rng rng;
+    if(sc_.keys)
+        src_[MIDI_SOURCE_UART].sent = Player(opt_.seconds, rng);
+    if(sc_.daw)
+        src_[MIDI_SOURCE_USB].sent = Daw(opt_.seconds, rng);
+    if(sc_.flood)
+    {
+        std::vector<Msg> f = Flood(opt_.seconds);
+        src_[MIDI_SOURCE_USB].sent.insert(src_[MIDI_SOURCE_USB].sent.end(), f.begin(), f.end());
+        Sort(src_[MIDI_SOURCE_USB].sent);
+    }
+
+    // The groovebox's own channels on the KB2040; a DAW gets channel 1
+    queue_.SetChannels(MIDI_SOURCE_UART, 0xFFFF);
+    queue_.SetChannels(MIDI_SOURCE_USB, 0x0001);
+    for(const Msg& m : src_[MIDI_SOURCE_USB].sent)
+        if(m.status & 0x0F)
+            src_[MIDI_SOURCE_USB].expectFiltered++;
+
+    for(SourceRun& r : src_)
+    {
+        r.accepted.assign(r.sent.size(), false);
+        r.dropped.assign(r.sent.size(), false);
+        r.wireUs.assign(r.sent.size(), 0.0);
+        r.handledUs.assign(r.sent.size(), -1.0);
+    }
+
+    irqs_ = UartCallbacks(src_[MIDI_SOURCE_UART].sent);
+    std::vector<Callback> usb = UsbCallbacks(src_[MIDI_SOURCE_USB].sent);
+    irqs_.insert(irqs_.end(), usb.begin(), usb.end());
+    double endUs = opt_.seconds * 1e6 + 100000.0;
+    for(double t = kBlockUs; t < endUs; t += kBlockUs)
+    {
+        Callback audio;
+        audio.us     = t;
+        audio.source = -1;
+        irqs_.push_back(audio);
+    }
+    std::stable_sort(irqs_.begin(), irqs_.end(), [](const Callback& a, const Callback& b) {
+        return a.us < b.us;
+    });
+
+    double stallMs   = sc_.stallMs >= 0.0 ? sc_.stallMs : opt_.stallMs;
+    double nextStall = kStallPeriod / 2;
+    while(now_ < endUs)
+    {
+        if(now_ >= nextStall)
+        {
+            Spend(stallMs * 1000.0);
+            nextStall += kStallPeriod;
+            continue;
+        }
+        if(PopOne())
+            continue;
+        // WFI: the next interrupt, or the stall's turn
+        double wake = std::min(nextStall, endUs);
+        if(nextIrq_ < irqs_.size())
+            wake = std::min(wake, std::max(irqs_[nextIrq_].us, isrFree_));
+        Spend(std::max(wake - now_, 0.0));
+    }
+    while(PopOne())
+    {
+    }
+    return Check();
+}
+
+void Sim::Report(int s, const char* label) const
+{
+    const SourceRun& r = src_[s];
+    std::vector<double> wire, total;
+    for(size_t k = 0; k < r.sent.size(); k++)
+        if(r.handledUs[k] >= 0.0)
+        {
+            wire.push_back(r.handledUs[k] - r.wireUs[k]);
+            total.push_back(r.handledUs[k] - r.sent[k].sendUs);
+        }
+    MidiMergeQueue<256>::SourceStats st = queue_.GetStats((MidiSource)s);
+    printf("  %-4s %6zu sent %6u queued %5u filtered %5u dropped  ring peak %3u",
+           label,
+           r.sent.size(),
+           st.queued,
+           st.filtered,
+           st.dropped,
+           st.highWater);
+    if(wire.empty())
+    {
+        printf("\n");
+        return;
+    }
+    std::sort(wire.begin(), wire.end());
+    std::sort(total.begin(), total.end());
+    double mean = 0.0;
+    for(double w : wire)
+        mean += w;
+    mean /= wire.size();
+    printf("\n       received->handled mean %.0f us, 99%% %.0f us, max %.0f us;"
+           " sent->handled max %.0f us\n",
+           mean,
+           wire[wire.size() * 99 / 100],
+           wire.back(),
+           total.back());
+}
+
+bool Sim::Check()
+{
+    for(int s = 0; s < MIDI_NUM_SOURCES; s++)
+    {
+        const SourceRun& r = src_[s];
+        MidiMergeQueue<256>::SourceStats st = queue_.GetStats((MidiSource)s);
+        if(r.decoded != r.sent.size())
+        {
+            fprintf(stderr, "  %s: source %d decoded %zu of %zu\n", sc_.name, s, r.decoded,
+                    r.sent.size());
+            errors_++;
+        }
+        if(st.filtered != r.expectFiltered)
+        {
+            fprintf(stderr, "  %s: source %d filtered %u, expected %u\n", sc_.name, s,
+                    st.filtered, r.expectFiltered);
+            errors_++;
+        }
+        bool mayDrop = s == MIDI_SOURCE_USB && sc_.usbMayDrop;
+        if(st.dropped && !mayDrop)
+        {
+            fprintf(stderr, "  %s: source %d dropped %u\n", sc_.name, s, st.dropped);
+            errors_++;
+        }
+        for(size_t k = 0; k < r.sent.size(); k++)
+            if(r.accepted[k] && !r.dropped[k] && r.handledUs[k] < 0.0)
+            {
+                fprintf(stderr, "  %s: source %d message %zu never handled\n", sc_.name, s, k);
+                errors_++;
+                break;
+            }
+    }
+
+    AudioConfig want;
+    if(sc_.keys)
+        want.blockIndex = kPlayerBlock;
+    if(audio_ != want)
+    {
+        fprintf(stderr, "  %s: audio setup block %u rate %u, expected block %u rate %u\n",
+                sc_.name, audio_.blockIndex, audio_.rateIndex, want.blockIndex, want.rateIndex);
+        errors_++;
+    }
+    if(sc_.daw && !foreign_)
+    {
+        fprintf(stderr, "  %s: no Daisy controller came in on USB\n", sc_.name);
+        errors_++;
+    }
+
+    printf("%s: interrupts took %.1f%% of the CPU\n", sc_.name,
+           100.0 * busyUs_ / (opt_.seconds * 1e6 + 100000.0));
+    Report(MIDI_SOURCE_UART, "uart");
+    Report(MIDI_SOURCE_USB, "usb");
+    if(foreign_)
+        printf("  usb  %u Daisy controllers dropped, audio setup block %u rate %u\n", foreign_,
+               audio_.blockIndex, audio_.rateIndex);
+    printf("  %s\n", errors_ ? "FAIL" : "ok");
+    return errors_ == 0;
+}
+
+// The queue itself: both sources pushing in turn, main() popping
+void Throughput()
+{
+    const uint32_t      kEvents = 20000000;
+    MidiMergeQueue<256> q;
+    MidiRxEvent         e = {0x90, 60, 100, 0, false, 0, 0};
+    uint32_t            popped = 0, sum = 0;
+    auto                t0 = std::chrono::steady_clock::now();
+    for(uint32_t i = 0; i < kEvents; i += 64)
+    {
+        for(uint32_t j = 0; j < 64; j++)
+        {
+            e.arrivalUs = i + j;
+            q.Push((MidiSource)(j & 1), e);
+        }
+        MidiRxEvent out;
+        while(q.Pop(out))
+        {
+            popped++;
+            sum += out.arrivalUs;
+        }
+    }
+    double s = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    printf("queue: %u events pushed and popped in %.3f s, %.1f ns each (%08x)\n",
+           popped,
+           s,
+           s * 1e9 / popped,
+           sum);
+}
+
+void Usage()
+{
+    fprintf(stderr,
+            "usage: midi_merge_sim [-t seconds] [-s stall_ms] [-l audio load %%]"
+            " [keys|daw|mixed|flood|stall ...]\n");
+    exit(2);
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    Options opt;
+    int     opt_c;
+    while((opt_c = getopt(argc, argv, "t:s:l:h")) != -1)
+    {
+        switch(opt_c)
+        {
+            case 't': opt.seconds = atof(optarg); break;
+            case 's': opt.stallMs = atof(optarg); break;
+            case 'l': opt.load = atof(optarg) / 100.0; break;
+            default: Usage();
+        }
+    }
+    if(opt.seconds <= 0.0 || opt.load < 0.0 || opt.load >= 0.95)
+        Usage();
+
+    const Scenario all[] = {
+        {"keys", true, false, false, -1.0, false},
+        {"daw", false, true, false, -1.0, false},
+        {"mixed", true, true, false, -1.0, false},
+        {"flood", true, true, true, -1.0, false},
+        {"stall", true, false, true, 25.0, true},
+    };
+    std::vector<Scenario> run;
+    for(int i = optind; i < argc; i++)
+    {
+        const Scenario* found = nullptr;
+        for(const Scenario& s : all)
+            if(!strcmp(argv[i], s.name))
+                found = &s;
+        if(!found)
+            Usage();
+        run.push_back(*found);
+    }
+    if(run.empty())
+        run.assign(all, all + sizeof(all) / sizeof(all[0]));
+
+    printf("%.1f s each, main() held up %.1f ms every %.0f ms, audio load %.0f%%\n",
+           opt.seconds,
+           opt.stallMs,
+           kStallPeriod / 1000.0,
+           opt.load * 100.0);
+    bool ok = true;
+    for(const Scenario& s : run)
+    {
+        Sim sim(s, opt);
+        ok = sim.Run() && ok;
+    }
+    Throughput();
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,325 @@
+// q15_check: checks the fixed-point voices (voice_q15.h) and the DSP
+// extension emulation under them (dsp_simd.h).
+//
+//   q15_check [-n chunks] [-s seed]
+//
+// Checks:
+//   - each emulated instruction gives the result the Armv7-M pseudocode
+//     does, on cases picked for saturation, wrap and rounding
+//   - the packed render (two voices a word) is bit-identical to the
+//     scalar model, voice by voice, through a random schedule of notes,
+//     releases, steals, sheds, envelope changes, single-oscillator
+//     quality and chunk sizes
+//   - against the same voices in double precision (exact phases, float
+//     envelope coefficients), the fixed-point mix is within 70 dB SNR
+//
+// Exits 1 if a check fails.
+#include "voice_q15.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+
+namespace
+{
+// ---- instructions -------------------------------------------------------
+
+struct Case
+{
+    const char* what;
+    int64_t     got, want;
+};
+
+bool CheckInstructions()
+{
+    using namespace dsp;
+    const Case cases[] = {
+        // QADD16 saturates each lane on its own
+        {"qadd16 lane 1 high", Qadd16(0x7FFF0001, 0x00010001), 0x7FFF0002},
+        {"qadd16 both low", Qadd16((int32_t)0x80008000, (int32_t)0xFFFFFFFF), (int32_t)0x80008000},
+        {"qadd16 plain", Qadd16(0x12345678, 0x11111111), 0x23456789},
+        {"qadd16 opposite", Qadd16(0x7FFF8000, (int32_t)0x80007FFF), -1},
+        // SMLALD: where SMLAD would wrap, the long form doesn't
+        {"smlald -1.0 squared twice", Smlald((int32_t)0x80008000, (int32_t)0x80008000, 0),
+         2147483648LL},
+        {"smlald signs", Smlald(0x00027FFF, (int32_t)0xFFFF7FFF, -5), 1073676282LL},
+        // SMULWB: bits 47:16 of the 48-bit product, lane 0 signed
+        {"smulwb", Smulwb(0x40000000, 0x00004000), 0x10000000},
+        {"smulwb floors", Smulwb(-1, 1), -1},
+        {"smulwb lane 0 only", Smulwb(0x12345678, (int32_t)0xABCD8000), -152709948},
+        // SMMULR: top word of the 64-bit product plus 2^31
+        {"smmulr", Smmulr(0x40000000, 0x40000000), 0x10000000},
+        {"smmulr rounds down", Smmulr(1, 0x7FFFFFFF), 0},
+        {"smmulr rounds up", Smmulr(-1, INT32_MIN), 1},
+        {"smmulr largest", Smmulr(0x7FFFFFFF, 0x7FFFFFFF), 0x3FFFFFFF},
+        // PKHBT keeps the low halfword of each
+        {"pack", Pack(-1, 1), 0x0001FFFF},
+        {"pack truncates", Pack(0x12345, -2), (int32_t)0xFFFE2345},
+    };
+    bool ok = true;
+    for(const Case& c : cases)
+        if(c.got != c.want)
+        {
+            printf("  FAIL: %s: %lld, want %lld\n", c.what, (long long)c.got, (long long)c.want);
+            ok = false;
+        }
+    printf("instructions     %zu cases%s\n", sizeof(cases) / sizeof(cases[0]), ok ? "" : ", FAILED");
+    return ok;
+}
+
+// ---- packed against scalar ----------------------------------------------
+
+uint32_t g_rand = 1;
+
+uint32_t Rand(uint32_t n)
+{
+    g_rand = g_rand * 1664525u + 1013904223u;
+    return (g_rand >> 8) % n;
+}
+
+// The engine's side of a voice, enough to drive both banks alike
+struct Voice
+{
+    bool  on, gate, shedding;
+    int   note;
+    float vel;
+};
+
+void Controls(VoiceBankQ15& bank, const Voice* voices, float bend, VoiceBankQ15::Control* ctl)
+{
+    for(int v = 0; v < VoiceBankQ15::kMaxVoices; v++)
+    {
+        const Voice& s = voices[v];
+        ctl[v]         = VoiceBankQ15::Control();
+        ctl[v].on      = s.on;
+        if(!s.on)
+            continue;
+        float hz        = 440.0f * powf(2.0f, ((float)s.note + bend - 69.0f) / 12.0f);
+        ctl[v].gate     = s.gate;
+        ctl[v].shedding = s.shedding;
+        ctl[v].note     = s.note;
+        ctl[v].inc1     = bank.Increment(hz);
+        ctl[v].inc2     = bank.Increment(hz * 1.0046f);
+        ctl[v].amp      = (int16_t)(s.vel * 32767.0f);
+    }
+}
+
+bool CheckPacked(long chunks)
+{
+    const int    n = VoiceBankQ15::kMaxVoices;
+    VoiceBankQ15 packed, scalar;
+    packed.Init(n, 48000.0f);
+    scalar.Init(n, 48000.0f);
+    packed.SetFadeTime(0.005f);
+    scalar.SetFadeTime(0.005f);
+
+    Voice  voices[n] = {};
+    bool   twoOsc    = true;
+    float  bend      = 0.0f;
+    long   sounding  = 0;
+    size_t samples   = 0;
+    for(long k = 0; k < chunks; k++)
+    {
+        // Something happens to one voice in four chunks
+        if(Rand(4) == 0)
+        {
+            Voice& s = voices[Rand(n)];
+            switch(Rand(6))
+            {
+                case 0:
+                case 1: // note on, or a steal
+                    s.on       = true;
+                    s.gate     = true;
+                    s.shedding = false;
+                    s.note     = 24 + (int)Rand(84);
+                    s.vel      = (float)(1 + Rand(127)) / 127.0f;
+                    break;
+                case 2:
+                case 3: s.gate = false; break;
+                case 4: s.shedding = s.on; break;
+                default: // a held note after a steal: no rising edge
+                    s.gate = s.on;
+                    break;
+            }
+        }
+        if(Rand(200) == 0)
+            twoOsc = !twoOsc;
+        if(Rand(50) == 0)
+            bend = ((float)Rand(401) - 200.0f) / 100.0f;
+        if(Rand(500) == 0)
+        {
+            // Includes zero times and a zero sustain
+            float a = (float)Rand(4) * 0.02f, d = (float)Rand(4) * 0.1f;
+            float s = (float)Rand(5) * 0.25f, r = (float)Rand(4) * 0.15f;
+            packed.SetEnvelope(a, d, s, r);
+            scalar.SetEnvelope(a, d, s, r);
+        }
+
+        size_t                len = 1 + Rand(VoiceBankQ15::kChunk);
+        VoiceBankQ15::Control ctl[n];
+        Controls(packed, voices, bend, ctl);
+        int64_t a[VoiceBankQ15::kChunk] = {}, b[VoiceBankQ15::kChunk] = {};
+        packed.Render(ctl, twoOsc, a, len);
+        scalar.RenderScalar(ctl, twoOsc, b, len);
+
+        for(size_t i = 0; i < len; i++)
+            if(a[i] != b[i])
+            {
+                printf("  FAIL: chunk %ld sample %zu: packed %lld, scalar %lld\n",
+                       k, i, (long long)a[i], (long long)b[i]);
+                return false;
+            }
+        for(int v = 0; v < n; v++)
+        {
+            if(packed.Done(v) != scalar.Done(v) || packed.Envelope(v) != scalar.Envelope(v)
+               || packed.InAttack(v) != scalar.InAttack(v))
+            {
+                printf("  FAIL: chunk %ld voice %d: state differs\n", k, v);
+                return false;
+            }
+            if(ctl[v].on && packed.Done(v))
+                voices[v] = Voice();
+            sounding += voices[v].on;
+        }
+        samples += len;
+    }
+    printf("packed = scalar  %ld chunks, %zu samples, %.1f voices on average\n",
+           chunks, samples, (double)sounding / (double)chunks);
+    return true;
+}
+
+// ---- precision ----------------------------------------------------------
+
+// The bank's voice in double precision: its phases (exact anyway), its
+// envelope coefficients before they are rounded to Q31
+struct DoubleVoice
+{
+    double x = 0.0;
+    int    mode = 0; // 0 idle, 1 attack, 2 decay, 3 release
+    bool   gate = false;
+
+    double Step(bool g, double a, double d, double r, double sustain)
+    {
+        if(g && !gate)
+            mode = 1;
+        else if(!g && gate)
+            mode = 3;
+        gate = g;
+        switch(mode)
+        {
+            case 1:
+                x += a * (1.01 - x);
+                if(x > 1.0)
+                {
+                    mode = 2;
+                    x    = 1.0;
+                }
+                break;
+            case 2:
+            case 3:
+                x += (mode == 2 ? d : r) * ((mode == 2 ? sustain : -0.01) - x);
+                if(x < 0.0)
+                {
+                    mode = 0;
+                    x    = 0.0;
+                }
+                break;
+            default: return 0.0;
+        }
+        return x;
+    }
+};
+
+bool CheckPrecision()
+{
+    const float  rate = 48000.0f, attack = 0.01f, decay = 0.25f, sustain = 0.8f, release = 0.4f;
+    const int    n    = 6;
+    VoiceBankQ15 bank;
+    bank.Init(n, rate);
+    bank.SetEnvelope(attack, decay, sustain, release);
+
+    const double a = 1.0f - expf(logf(1.0f - 1.0f / 1.01f) / (attack * rate));
+    const double d = 1.0f - expf(-1.0f / (decay * rate));
+    const double r = 1.0f - expf(-1.0f / (release * rate));
+
+    // A chord, released after a second, a chunk at a time
+    static const int kNotes[n] = {48, 55, 60, 64, 67, 72};
+    DoubleVoice      model[n];
+    uint32_t         phase1[n] = {}, phase2[n] = {};
+    double           signal = 0.0, noise = 0.0, worst = 0.0;
+    for(size_t t = 0; t < (size_t)(2 * rate); t += VoiceBankQ15::kChunk)
+    {
+        bool                  gate = t < (size_t)rate;
+        VoiceBankQ15::Control ctl[n];
+        for(int v = 0; v < n; v++)
+        {
+            float hz    = 440.0f * powf(2.0f, ((float)kNotes[v] - 69.0f) / 12.0f);
+            ctl[v]      = VoiceBankQ15::Control();
+            ctl[v].on   = true;
+            ctl[v].gate = gate;
+            ctl[v].note = kNotes[v];
+            ctl[v].inc1 = bank.Increment(hz);
+            ctl[v].inc2 = bank.Increment(hz * 1.0046f);
+            ctl[v].amp  = (int16_t)(0.6f * 0.8f * 32767.0f);
+        }
+        int64_t mix[VoiceBankQ15::kChunk] = {};
+        bank.Render(ctl, true, mix, VoiceBankQ15::kChunk);
+
+        for(size_t i = 0; i < VoiceBankQ15::kChunk; i++)
+        {
+            double want = 0.0;
+            for(int v = 0; v < n; v++)
+            {
+                double env = model[v].Step(gate, a, d, r, sustain);
+                double p1 = phase1[v] / 4294967296.0, p2 = phase2[v] / 4294967296.0;
+                double saw = 0.5 - p1, tri = fabs(2.0 * p2 - 1.0) - 0.5;
+                want += fmin(saw + tri, 1.0) * env * ctl[v].amp / 32768.0;
+                phase1[v] += ctl[v].inc1;
+                phase2[v] += ctl[v].inc2;
+            }
+            double got = (double)mix[i] / 1073741824.0;
+            signal += want * want;
+            noise += (got - want) * (got - want);
+            worst = fmax(worst, fabs(got - want));
+        }
+    }
+    double snr = 10.0 * log10(signal / noise);
+    bool   ok  = snr >= 70.0;
+    printf("precision        %.1f dB SNR against double, worst error %.1f dB%s\n",
+           snr, 20.0 * log10(worst), ok ? "" : ", FAILED (70 dB)");
+    return ok;
+}
+
+void Usage()
+{
+    fprintf(stderr, "usage: q15_check [-n chunks] [-s seed]\n");
+    exit(2);
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    long chunks = 200000;
+    int  opt;
+    while((opt = getopt(argc, argv, "n:s:h")) != -1)
+    {
+        switch(opt)
+        {
+            case 'n': chunks = atol(optarg); break;
+            case 's': g_rand = (uint32_t)strtoul(optarg, nullptr, 0); break;
+            default: Usage();
+        }
+    }
+    if(optind != argc || chunks < 1)
+        Usage();
+
+    bool ok = CheckInstructions();
+    ok      = CheckPacked(chunks) && ok;
+    ok      = CheckPrecision() && ok;
+    printf("%s\n", ok ? "ok" : "FAIL");
+    return ok ? 0 : 1;
+}
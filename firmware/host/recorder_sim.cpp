@@ -0,0 +1,378 @@
+// recorder_sim: the Daisy's SD recorder (daisy/seed/kb2040_groovebox/
+// recorder.h) recording the engine for a whole take, on a file.
+//
+//   recorder_sim [-t seconds] [-b bits] [-k block] [-w MB/s] [-s stall_ms]
+//                [-e every_ms] [-m ring_KB] [-o outdir]
+//
+// The engine plays a heavy patch and every block goes through
+// WavRecorder::Push() as in the audio callback. main() runs the recorder
+// job whenever it has a chunk, and otherwise sleeps to the next block.
+// Writes go to a real file, timed by a model of the card: -w MB/s, plus
+// a stall of -s ms (the card erasing) on the first write after every -e
+// ms. Audio blocks fall due during a write and run at once, as the audio
+// interrupt preempts the blocking FatFs call, so they see the ring before
+// the write frees its chunk.
+//
+// The report gives the card's busy time, the longest write, the ring's
+// peak fill, the blocks dropped for a full ring and the host cost of
+// each Push() against the block period; Push() never waits on main(). The
+// file is then read back: the header has to carry the final sizes and,
+// unless blocks were dropped, the samples have to be the engine's output.
+// Exit status 1 if either check fails.
+#include "groovebox_engine.h"
+#include "recorder.h"
+
+#include <algorithm>
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <unistd.h>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <xmmintrin.h>
+#endif
+
+namespace
+{
+const float kSampleRate = 48000.0f;
+
+struct Options
+{
+    double      seconds  = 30.0;
+    int         bits     = 24;
+    size_t      block    = 48;
+    double      cardMBps = 4.0;
+    double      stallMs  = 250.0;
+    double      everyMs  = 2000.0;
+    uint32_t    ringKB   = 8192; // as on the Seed
+    std::string outDir   = ".";
+};
+
+class Model;
+
+// A file, with the card's write time on the model clock
+class FileStorage : public RecorderStorage
+{
+  public:
+    explicit FileStorage(Model& model) : model_(model) {}
+
+    bool Open(const char* name) override
+    {
+        file_ = fopen(name, "w+b");
+        return file_ != nullptr;
+    }
+    bool Write(const uint8_t* data, uint32_t bytes) override;
+    bool Rewrite(uint32_t offset, const uint8_t* data, uint32_t bytes) override
+    {
+        long end = ftell(file_);
+        return fseek(file_, (long)offset, SEEK_SET) == 0
+               && fwrite(data, 1, bytes, file_) == bytes
+               && fseek(file_, end, SEEK_SET) == 0;
+    }
+    bool Close() override
+    {
+        bool ok = fclose(file_) == 0;
+        file_   = nullptr;
+        return ok;
+    }
+
+    double busyUs     = 0.0;
+    double maxWriteUs = 0.0;
+    double hostUs     = 0.0; // wall time in fwrite
+    double bytes      = 0.0;
+
+  private:
+    Model& model_;
+    FILE*  file_ = nullptr;
+};
+
+class Model
+{
+  public:
+    Model(const Options& o, WavRecorder& recorder)
+    : o_(o), recorder_(recorder), l_(o.block), r_(o.block)
+    {
+        periodUs_    = 1e6 * (double)o.block / kSampleRate;
+        totalBlocks_ = (size_t)(o.seconds * kSampleRate / (double)o.block);
+        nextStallUs_ = o.everyMs * 1e3;
+    }
+
+    double NowUs() const { return nowUs_; }
+    bool   Done() const { return blocks_ >= totalBlocks_; }
+
+    // Every block due up to t runs, then the clock stands at t
+    void RunUntil(double t)
+    {
+        while(nextBlockUs_ <= t && !Done())
+        {
+            nowUs_ = nextBlockUs_;
+            AudioBlock();
+            nextBlockUs_ += periodUs_;
+        }
+        if(t > nowUs_)
+            nowUs_ = t;
+    }
+
+    // main() with nothing to do sleeps until the next interrupt
+    void Sleep() { RunUntil(nextBlockUs_); }
+
+    // Card time for a write starting now
+    double WriteUs(uint32_t bytes)
+    {
+        double us = (double)bytes / o_.cardMBps;
+        if(o_.stallMs > 0.0 && nowUs_ >= nextStallUs_)
+        {
+            us += o_.stallMs * 1e3;
+            nextStallUs_ = nowUs_ + o_.everyMs * 1e3;
+        }
+        return us;
+    }
+
+    double PeriodUs() const { return periodUs_; }
+    double PushMaxUs() const { return pushMaxUs_; }
+    double PushMeanUs() const { return blocks_ ? pushSumUs_ / (double)blocks_ : 0.0; }
+
+    // The host can preempt any one call, so the max says little; the
+    // 99.9th percentile is the recorder's own worst case
+    double PushP999Us() const
+    {
+        std::vector<double> us = pushUs_;
+        if(us.empty())
+            return 0.0;
+        size_t k = us.size() * 999 / 1000;
+        std::nth_element(us.begin(), us.begin() + k, us.end());
+        return us[k];
+    }
+
+    std::vector<float> left, right; // the engine's output while armed
+
+  private:
+    void AudioBlock()
+    {
+        static const uint8_t kSetup[][3] = {
+            {0xB0, 78, 100}, {0xB0, 79, 96}, {0xB0, 80, 96},  {0xB0, 81, 112},
+            {0xB0, 84, 64},  {0xB0, 85, 64}, {0x90, 48, 100}, {0x90, 55, 100},
+            {0x90, 60, 100}, {0x90, 64, 100}, {0x90, 67, 100}, {0x90, 72, 100},
+        };
+        if(blocks_ == 0)
+            for(const auto& m : kSetup)
+                HandleMidiMessage(m[0], m[1], m[2]);
+        // A chord change every second keeps the patch busy
+        if(blocks_ % (size_t)(kSampleRate / (float)o_.block) == 0)
+            HandleMidiMessage(0x90, (uint8_t)(50 + blocks_ % 17), 100);
+
+        float* out[2] = {l_.data(), r_.data()};
+        RenderAudio(out, o_.block);
+        if(recorder_.Recording())
+        {
+            left.insert(left.end(), l_.begin(), l_.end());
+            right.insert(right.end(), r_.begin(), r_.end());
+        }
+
+        auto   t0 = std::chrono::steady_clock::now();
+        recorder_.Push(l_.data(), r_.data(), o_.block);
+        double us = std::chrono::duration<double, std::micro>(
+                        std::chrono::steady_clock::now() - t0)
+                        .count();
+        pushUs_.push_back(us);
+        pushSumUs_ += us;
+        if(us > pushMaxUs_)
+            pushMaxUs_ = us;
+        blocks_++;
+    }
+
+    const Options&      o_;
+    WavRecorder&        recorder_;
+    std::vector<float>  l_, r_;
+    double              periodUs_    = 1000.0;
+    size_t              totalBlocks_ = 0;
+    size_t              blocks_      = 0;
+    double              nowUs_       = 0.0;
+    double              nextBlockUs_ = 0.0;
+    double              nextStallUs_ = 0.0;
+    std::vector<double> pushUs_;
+    double              pushSumUs_ = 0.0;
+    double              pushMaxUs_ = 0.0;
+};
+
+bool FileStorage::Write(const uint8_t* data, uint32_t n)
+{
+    auto t0 = std::chrono::steady_clock::now();
+    bool ok = fwrite(data, 1, n, file_) == n;
+    hostUs += std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - t0)
+                  .count();
+    double us = model_.WriteUs(n);
+    busyUs += us;
+    bytes += n;
+    if(us > maxWriteUs)
+        maxWriteUs = us;
+    model_.RunUntil(model_.NowUs() + us);
+    return ok;
+}
+
+uint32_t Get32(const uint8_t* p)
+{
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+int32_t Pcm(float x, float scale)
+{
+    x       = x > 1.0f ? 1.0f : (x < -1.0f ? -1.0f : x);
+    float s = x * scale;
+    return (int32_t)(s < 0.0f ? s - 0.5f : s + 0.5f);
+}
+
+// Header sizes against the file, samples against the engine's output
+bool CheckFile(const char*             path,
+               int                     bits,
+               const Model&            model,
+               const WavRecorder::Stats& st)
+{
+    FILE* f = fopen(path, "rb");
+    if(!f)
+        return false;
+    std::vector<uint8_t> wav;
+    uint8_t              buf[65536];
+    size_t               n;
+    while((n = fread(buf, 1, sizeof(buf), f)) > 0)
+        wav.insert(wav.end(), buf, buf + n);
+    fclose(f);
+
+    const uint32_t hb = WavRecorder::kHeaderBytes;
+    if(wav.size() < hb || memcmp(wav.data(), "RIFF", 4) || memcmp(wav.data() + 8, "WAVE", 4)
+       || memcmp(wav.data() + hb - 8, "data", 4))
+    {
+        printf("file  %s: not a WAV with the data at %u\n", path, hb);
+        return false;
+    }
+    uint32_t riff = Get32(wav.data() + 4);
+    uint32_t data = Get32(wav.data() + hb - 4);
+    bool     ok   = riff == wav.size() - 8 && data == wav.size() - hb && data == st.dataBytes;
+    printf("file  %s: RIFF %u, data %u, file %zu bytes: %s\n",
+           path,
+           riff,
+           data,
+           wav.size(),
+           ok ? "header ok" : "HEADER WRONG");
+    if(!ok || st.droppedBlocks)
+        return ok;
+
+    const int    bytes = bits / 8;
+    const float  scale = bits == 16 ? 32767.0f : 8388607.0f;
+    const size_t frames = data / (2 * bytes);
+    const uint8_t* p    = wav.data() + hb;
+    for(size_t i = 0; i < frames && ok; i++)
+        for(int c = 0; c < 2; c++)
+        {
+            int32_t v = Pcm((c ? model.right : model.left)[i], scale);
+            for(int b = 0; b < bytes; b++)
+                ok = ok && *p++ == (uint8_t)(v >> (8 * b));
+        }
+    ok = ok && frames == model.left.size();
+    printf("      %zu frames: %s\n", frames, ok ? "samples match the engine" : "SAMPLES DIFFER");
+    return ok;
+}
+
+void Usage()
+{
+    fprintf(stderr,
+            "usage: recorder_sim [-t seconds] [-b bits] [-k block] [-w MB/s] "
+            "[-s stall_ms] [-e every_ms] [-m ring_KB] [-o outdir]\n");
+    exit(2);
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    Options o;
+    int     opt;
+    while((opt = getopt(argc, argv, "t:b:k:w:s:e:m:o:h")) != -1)
+    {
+        switch(opt)
+        {
+            case 't': o.seconds = atof(optarg); break;
+            case 'b': o.bits = atoi(optarg); break;
+            case 'k': o.block = (size_t)atoi(optarg); break;
+            case 'w': o.cardMBps = atof(optarg); break;
+            case 's': o.stallMs = atof(optarg); break;
+            case 'e': o.everyMs = atof(optarg); break;
+            case 'm': o.ringKB = (uint32_t)atoi(optarg); break;
+            case 'o': o.outDir = optarg; break;
+            default: Usage();
+        }
+    }
+    uint32_t ringBytes = o.ringKB * 1024;
+    if(optind != argc || o.seconds <= 0.0 || (o.bits != 16 && o.bits != 24) || o.block == 0
+       || o.cardMBps <= 0.0 || ringBytes < WavRecorder::kChunkBytes
+       || (ringBytes & (ringBytes - 1)))
+        Usage();
+
+#if defined(__x86_64__) || defined(__i386__)
+    _mm_setcsr(_mm_getcsr() | 0x8040); // FTZ | DAZ, see governor_sim
+#endif
+
+    InitSynth(kSampleRate);
+    std::vector<uint8_t> ring(ringBytes);
+    WavRecorder          recorder;
+    Model                model(o, recorder);
+    FileStorage          storage(model);
+    recorder.Init(ring.data(), ringBytes, kSampleRate, &storage);
+
+    std::string path = o.outDir + "/take.wav";
+    if(!recorder.Start(path.c_str(), o.bits))
+    {
+        fprintf(stderr, "cannot write %s\n", path.c_str());
+        return 1;
+    }
+    while(!model.Done())
+    {
+        if(recorder.Pending())
+            recorder.Service();
+        else
+            model.Sleep();
+    }
+    recorder.Stop();
+    while(recorder.Busy())
+        recorder.Service();
+
+    const WavRecorder::Stats st    = recorder.GetStats();
+    const double             takeS = model.NowUs() / 1e6;
+    const double             need  = kSampleRate * o.bits / 8 * 2 / 1e6;
+    printf("%d-bit %.0f Hz, %.1f s take: %.2f MB (%.3f MB/s) in %u writes of %u KB\n",
+           o.bits,
+           kSampleRate,
+           (double)recorder.Seconds(),
+           storage.bytes / 1e6,
+           need,
+           st.writes,
+           WavRecorder::kChunkBytes / 1024);
+    printf("card  %.1f MB/s, %.0f ms stall every %.0f ms: busy %.1f%% of the take, "
+           "longest write %.1f ms\n",
+           o.cardMBps,
+           o.stallMs,
+           o.everyMs,
+           100.0 * storage.busyUs / (takeS * 1e6),
+           storage.maxWriteUs / 1e3);
+    printf("ring  %u KB (%.1f s): peak %u KB (%.1f%%), dropped %u blocks / %u frames\n",
+           o.ringKB,
+           ringBytes / (need * 1e6),
+           st.maxFill / 1024,
+           100.0 * st.maxFill / ringBytes,
+           st.droppedBlocks,
+           st.droppedFrames);
+    printf("push  per %zu-frame block: mean %.2f us, 99.9%% %.2f us (%.2f%% of the %.0f us "
+           "period), max %.0f us with host preemption; never waits\n",
+           o.block,
+           model.PushMeanUs(),
+           model.PushP999Us(),
+           100.0 * model.PushP999Us() / model.PeriodUs(),
+           model.PeriodUs(),
+           model.PushMaxUs());
+    printf("host  fwrite %.0f MB/s\n",
+           storage.hostUs > 0.0 ? storage.bytes / storage.hostUs : 0.0);
+
+    return CheckFile(path.c_str(), o.bits, model, st) && !st.writeError ? 0 : 1;
+}
@@ -0,0 +1,266 @@
+#include "sim_script.h"
+#include "kb2040_sim.h"
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <stdlib.h>
+
+namespace kbsim
+{
+namespace
+{
+    // Gamepad QT button bits (seesaw GPIO numbers)
+    struct ButtonName
+    {
+        const char* name;
+        uint32_t    mask;
+    };
+    const ButtonName kButtons[] = {
+        {"x", 1u << 6},
+        {"y", 1u << 2},
+        {"a", 1u << 5},
+        {"b", 1u << 1},
+        {"select", 1u << 0},
+        {"start", 1u << 16},
+    };
+
+    bool ParseUpDown(const std::string& s, int& out)
+    {
+        if(s == "down")
+            out = 1;
+        else if(s == "up")
+            out = 0;
+        else
+            return false;
+        return true;
+    }
+
+    bool ParseInt(const std::string& s, int& out)
+    {
+        if(s.empty())
+            return false;
+        char* end = nullptr;
+        long  v   = strtol(s.c_str(), &end, 0);
+        if(*end != '\0')
+            return false;
+        out = (int)v;
+        return true;
+    }
+
+    bool ParseHexByte(const std::string& s, int& out)
+    {
+        if(s.empty() || s.size() > 2)
+            return false;
+        char* end = nullptr;
+        long  v   = strtol(s.c_str(), &end, 16);
+        if(*end != '\0')
+            return false;
+        out = (int)v;
+        return true;
+    }
+
+    ScriptAction Make(ScriptAction::Kind kind, uint64_t tUs, int a = 0, int b = 0)
+    {
+        ScriptAction act;
+        act.kind = kind;
+        act.tUs  = tUs;
+        act.a    = a;
+        act.b    = b;
+        return act;
+    }
+
+    bool ParseLine(const std::string&         line,
+                   std::vector<ScriptAction>& out,
+                   std::string&               err)
+    {
+        std::istringstream       in(line);
+        std::vector<std::string> tok;
+        std::string              t;
+        while(in >> t)
+        {
+            if(t[0] == '#')
+                break;
+            tok.push_back(t);
+        }
+        if(tok.empty())
+            return true;
+
+        int ms = 0;
+        if(tok.size() < 2 || !ParseInt(tok[0], ms) || ms < 0)
+        {
+            err = "expected '<t_ms> <command> ...'";
+            return false;
+        }
+        const uint64_t     tUs  = (uint64_t)ms * 1000;
+        const std::string& cmd  = tok[1];
+        const size_t       argc = tok.size() - 2;
+        int                a = 0, b = 0, c = 0, d = 0, e = 0;
+
+        if(cmd == "key" && argc == 2 && ParseInt(tok[2], a) && ParseUpDown(tok[3], b)
+           && a >= 0 && a < 20)
+        {
+            out.push_back(Make(ScriptAction::KEY, tUs, a, b));
+        }
+        else if(cmd == "enc" && (argc == 2 || argc == 3) && ParseInt(tok[2], a)
+                && ParseInt(tok[3], b) && a >= 0 && a < 8)
+        {
+            int over = 0;
+            if(argc == 3 && (!ParseInt(tok[4], over) || over < 0))
+            {
+                err = "bad enc duration";
+                return false;
+            }
+            if(over <= 1)
+            {
+                out.push_back(Make(ScriptAction::ENC, tUs, a, b));
+                return true;
+            }
+            // Spread the detents evenly, one step per millisecond
+            int done = 0;
+            for(int i = 1; i <= over; ++i)
+            {
+                int target = (int)((int64_t)b * i / over);
+                if(target != done)
+                    out.push_back(Make(ScriptAction::ENC,
+                                       tUs + (uint64_t)(i - 1) * 1000,
+                                       a,
+                                       target - done));
+                done = target;
+            }
+        }
+        else if(cmd == "encsw" && argc == 2 && ParseInt(tok[2], a)
+                && ParseUpDown(tok[3], b) && a >= 0 && a < 8)
+        {
+            out.push_back(Make(ScriptAction::ENC_SWITCH, tUs, a, b));
+        }
+        else if(cmd == "joy" && argc == 2 && ParseInt(tok[2], a) && ParseInt(tok[3], b))
+        {
+            out.push_back(Make(ScriptAction::JOY, tUs, a, b));
+        }
+        else if(cmd == "joysweep" && argc == 5 && ParseInt(tok[2], a)
+                && ParseInt(tok[3], b) && ParseInt(tok[4], c) && ParseInt(tok[5], d)
+                && ParseInt(tok[6], e) && e >= 0)
+        {
+            for(int i = 0; i <= e; ++i)
+            {
+                int x = e ? a + (c - a) * i / e : c;
+                int y = e ? b + (d - b) * i / e : d;
+                out.push_back(
+                    Make(ScriptAction::JOY, tUs + (uint64_t)i * 1000, x, y));
+            }
+        }
+        else if(cmd == "btn" && argc == 2 && ParseUpDown(tok[3], b))
+        {
+            for(const ButtonName& bn : kButtons)
+            {
+                if(tok[2] == bn.name)
+                {
+                    out.push_back(Make(ScriptAction::BUTTON, tUs, (int)bn.mask, b));
+                    return true;
+                }
+            }
+            err = "unknown button '" + tok[2] + "'";
+            return false;
+        }
+        else if(cmd == "boot" && argc == 1 && ParseUpDown(tok[2], b))
+        {
+            out.push_back(Make(ScriptAction::BOOT, tUs, 0, b));
+        }
+        else if(cmd == "serial" && argc >= 1)
+        {
+            ScriptAction act = Make(ScriptAction::SERIAL, tUs);
+            for(size_t i = 2; i < tok.size(); ++i)
+                act.text += (i > 2 ? " " : "") + tok[i];
+            out.push_back(act);
+        }
+        else if(cmd == "uartrx" && argc >= 1)
+        {
+            ScriptAction act = Make(ScriptAction::UART_RX, tUs);
+            for(size_t i = 2; i < tok.size(); ++i)
+            {
+                int v;
+                if(!ParseHexByte(tok[i], v))
+                {
+                    err = "bad byte '" + tok[i] + "'";
+                    return false;
+                }
+                act.text += (char)v;
+            }
+            out.push_back(act);
+        }
+        else if(cmd == "i2cfail" && argc == 2 && ParseInt(tok[2], a) && ParseInt(tok[3], b))
+        {
+            out.push_back(Make(ScriptAction::I2C_FAIL, tUs, a, b));
+        }
+        else if(cmd == "frame" && argc == 1)
+        {
+            ScriptAction act = Make(ScriptAction::FRAME, tUs);
+            act.text         = tok[2];
+            out.push_back(act);
+        }
+        else if(cmd == "end" && argc == 0)
+        {
+            out.push_back(Make(ScriptAction::END, tUs));
+        }
+        else
+        {
+            err = "bad command '" + cmd + "'";
+            return false;
+        }
+        return true;
+    }
+} // namespace
+
+bool LoadScript(const std::string&         path,
+                std::vector<ScriptAction>& out,
+                std::string&               err)
+{
+    std::ifstream f(path);
+    if(!f)
+    {
+        err = "cannot open " + path;
+        return false;
+    }
+    out.clear();
+    std::string line;
+    int         lineNo = 0;
+    while(std::getline(f, line))
+    {
+        lineNo++;
+        std::string why;
+        if(!ParseLine(line, out, why))
+        {
+            err = path + ":" + std::to_string(lineNo) + ": " + why;
+            return false;
+        }
+    }
+    std::stable_sort(out.begin(),
+                     out.end(),
+                     [](const ScriptAction& x, const ScriptAction& y) {
+                         return x.tUs < y.tUs;
+                     });
+    return true;
+}
+
+void ApplyAction(const ScriptAction& act)
+{
+    switch(act.kind)
+    {
+        case ScriptAction::KEY: SetKey(act.a, act.b != 0); break;
+        case ScriptAction::ENC: SpinEncoder(act.a, act.b); break;
+        case ScriptAction::ENC_SWITCH: SetEncoderSwitch(act.a, act.b != 0); break;
+        case ScriptAction::JOY: SetJoystick(act.a, act.b); break;
+        case ScriptAction::BUTTON: SetPadButton((uint32_t)act.a, act.b != 0); break;
+        case ScriptAction::BOOT: SetBootButton(act.b != 0); break;
+        case ScriptAction::SERIAL: SerialInput(act.text); break;
+        case ScriptAction::UART_RX:
+            UartReceive(std::vector<uint8_t>(act.text.begin(), act.text.end()));
+            break;
+        case ScriptAction::I2C_FAIL: FailI2c((uint8_t)act.a, act.b); break;
+        case ScriptAction::FRAME:
+        case ScriptAction::END: break;
+    }
+}
+
+} // namespace kbsim
@@ -0,0 +1,61 @@
+// Scripted input for the host simulators.
+//
+// One command per line, '#' starts a comment:
+//   <t_ms> key <0..19> down|up
+//   <t_ms> enc <0..7> <detents> [over_ms]
+//   <t_ms> encsw <0..7> down|up
+//   <t_ms> joy <x> <y>                       (raw seesaw ADC, 0..1023)
+//   <t_ms> joysweep <x0> <y0> <x1> <y1> <ms>
+//   <t_ms> btn x|y|a|b|select|start down|up
+//   <t_ms> boot down|up
+//   <t_ms> serial <text>                     (sent to the USB serial port)
+//   <t_ms> uartrx <hex bytes...>             (into Serial1 RX at the baud rate)
+//   <t_ms> i2cfail <addr> <count>            (NACK the next transactions)
+//   <t_ms> frame <name>                      (dump the OLED panel)
+//   <t_ms> end
+// Times are milliseconds after setup() returns. Spread commands (enc with
+// over_ms, joysweep) are expanded into 1 ms steps when loaded.
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace kbsim
+{
+struct ScriptAction
+{
+    enum Kind
+    {
+        KEY,
+        ENC,
+        ENC_SWITCH,
+        JOY,
+        BUTTON,
+        BOOT,
+        SERIAL,
+        UART_RX,
+        I2C_FAIL,
+        FRAME,
+        END,
+    };
+
+    Kind        kind;
+    uint64_t    tUs;
+    int         a;
+    int         b;
+    std::string text;
+};
+
+// Parses a script file. Actions come back sorted by time (stable, so
+// commands at the same time keep file order). On failure `err` names the
+// offending line.
+bool LoadScript(const std::string&         path,
+                std::vector<ScriptAction>& out,
+                std::string&               err);
+
+// Applies an input action to the simulated devices. FRAME and END are
+// left to the caller.
+void ApplyAction(const ScriptAction& act);
+
+} // namespace kbsim
@@ -0,0 +1,623 @@
+// smf_check: event timing of the Daisy's MIDI file player
+// (daisy/seed/kb2040_groovebox/smf_player.h) against known files.
+//
+//   smf_check [-k block] [-s stall_ms] [-o outdir]   built-in files
+//   smf_check [-k block] file.mid                    prints a file's timeline
+//
+// The built-in files are written to outdir first and played from there
+// through a stdio source, so the player streams them as it would from the
+// SD card. They cover format 0 and 1, tempo maps (a conductor track
+// ramping every beat), SMPTE division, running status, meta and sysex
+// events longer than a track's read-ahead buffer, coincident ticks across
+// tracks, filtered channels and controllers, looping and stopping.
+//
+// The engine is replaced by a recorder of which sample each message
+// reached it at; blocks render in order and main() parses ahead between
+// them, except that every second it is held up for -s ms (a flash write,
+// say). Each event has to arrive at the sample a whole-file reference
+// computes from the same ticks and tempo map, within one sample for
+// rounding, and none late. After a stop, every note the file left on has
+// to be released. Exit status 1 if any file fails.
+#include "groovebox_engine.h"
+#include "smf_player.h"
+
+#include <algorithm>
+#include <map>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+namespace
+{
+const float kSampleRate = 48000.0f;
+
+struct Received
+{
+    uint64_t sample;
+    uint8_t  status, data0, data1;
+};
+
+uint64_t              g_sample = 0; // rendered so far
+std::vector<Received> g_received;
+} // namespace
+
+// The engine, as far as the player can tell
+void HandleMidiMessage(uint8_t status, uint8_t data0, uint8_t data1)
+{
+    g_received.push_back({g_sample, status, data0, data1});
+}
+
+void RenderAudio(float** out, size_t size)
+{
+    memset(out[0], 0, size * sizeof(float));
+    memset(out[1], 0, size * sizeof(float));
+    g_sample += size;
+}
+
+namespace
+{
+class FileSource : public SmfSource
+{
+  public:
+    explicit FileSource(FILE* f) : f_(f) {}
+    uint32_t Read(uint32_t offset, uint8_t* buf, uint32_t len) override
+    {
+        if(fseek(f_, (long)offset, SEEK_SET) != 0)
+            return 0;
+        return (uint32_t)fread(buf, 1, len, f_);
+    }
+
+  private:
+    FILE* f_;
+};
+
+// ---------------------------------------------------------------------
+// Writing test files
+// ---------------------------------------------------------------------
+struct Ev
+{
+    uint32_t             tick;
+    std::vector<uint8_t> bytes; // status and data, or FF / F0 with length
+};
+
+struct Song
+{
+    std::string                  name;
+    uint16_t                     format   = 1;
+    uint16_t                     division = 96;
+    std::vector<std::vector<Ev>> tracks;
+    std::vector<uint32_t>        eot; // end of each track
+    bool                         loop        = false;
+    double                       stopSeconds = 0.0; // 0: play to the end
+};
+
+void PutVarLen(std::vector<uint8_t>& out, uint32_t v)
+{
+    uint8_t tmp[5];
+    int     n = 0;
+    do
+    {
+        tmp[n++] = v & 0x7F;
+        v >>= 7;
+    } while(v);
+    while(n--)
+        out.push_back(tmp[n] | (n ? 0x80 : 0));
+}
+
+void Put32(std::vector<uint8_t>& out, uint32_t v)
+{
+    for(int s = 24; s >= 0; s -= 8)
+        out.push_back((uint8_t)(v >> s));
+}
+
+Ev Meta(uint32_t tick, uint8_t type, const std::vector<uint8_t>& data)
+{
+    Ev e{tick, {0xFF, type}};
+    PutVarLen(e.bytes, (uint32_t)data.size());
+    e.bytes.insert(e.bytes.end(), data.begin(), data.end());
+    return e;
+}
+
+Ev Tempo(uint32_t tick, uint32_t us)
+{
+    return Meta(tick, 0x51, {(uint8_t)(us >> 16), (uint8_t)(us >> 8), (uint8_t)us});
+}
+
+Ev Text(uint32_t tick, size_t len)
+{
+    return Meta(tick, 0x01, std::vector<uint8_t>(len, 'x'));
+}
+
+Ev Sysex(uint32_t tick, size_t len)
+{
+    Ev e{tick, {0xF0}};
+    PutVarLen(e.bytes, (uint32_t)len);
+    for(size_t i = 0; i + 1 < len; i++)
+        e.bytes.push_back((uint8_t)(i & 0x7F));
+    e.bytes.push_back(0xF7);
+    return e;
+}
+
+Ev Msg(uint32_t tick, uint8_t status, uint8_t d0, uint8_t d1)
+{
+    uint8_t kind = status & 0xF0;
+    if(kind == 0xC0 || kind == 0xD0)
+        return Ev{tick, {status, d0}};
+    return Ev{tick, {status, d0, d1}};
+}
+
+// Running status wherever the status repeats; meta and sysex cancel it
+std::vector<uint8_t> TrackChunk(std::vector<Ev> evs, uint32_t eot)
+{
+    std::stable_sort(evs.begin(), evs.end(), [](const Ev& a, const Ev& b) {
+        return a.tick < b.tick;
+    });
+    evs.push_back(Meta(eot, 0x2F, {}));
+    std::vector<uint8_t> data;
+    uint32_t             last    = 0;
+    uint8_t              running = 0;
+    for(const Ev& e : evs)
+    {
+        PutVarLen(data, e.tick - last);
+        last      = e.tick;
+        uint8_t s = e.bytes[0];
+        if(s >= 0xF0)
+        {
+            running = 0;
+            data.insert(data.end(), e.bytes.begin(), e.bytes.end());
+        }
+        else
+        {
+            data.insert(data.end(), e.bytes.begin() + (s == running ? 1 : 0), e.bytes.end());
+            running = s;
+        }
+    }
+    std::vector<uint8_t> chunk = {'M', 'T', 'r', 'k'};
+    Put32(chunk, (uint32_t)data.size());
+    chunk.insert(chunk.end(), data.begin(), data.end());
+    return chunk;
+}
+
+bool WriteSong(const Song& s, const std::string& path)
+{
+    std::vector<uint8_t> file = {'M', 'T', 'h', 'd', 0, 0, 0, 6};
+    file.push_back(0);
+    file.push_back((uint8_t)s.format);
+    file.push_back(0);
+    file.push_back((uint8_t)s.tracks.size());
+    file.push_back((uint8_t)(s.division >> 8));
+    file.push_back((uint8_t)s.division);
+    // A chunk of an unknown type, which players skip
+    std::vector<uint8_t> junk = {'X', 'y', 'z', 'w', 0, 0, 0, 5, 1, 2, 3, 4, 5};
+    file.insert(file.end(), junk.begin(), junk.end());
+    for(size_t t = 0; t < s.tracks.size(); t++)
+    {
+        std::vector<uint8_t> c = TrackChunk(s.tracks[t], s.eot[t]);
+        file.insert(file.end(), c.begin(), c.end());
+    }
+    FILE* f = fopen(path.c_str(), "wb");
+    if(!f)
+        return false;
+    bool ok = fwrite(file.data(), 1, file.size(), f) == file.size();
+    return fclose(f) == 0 && ok;
+}
+
+// ---------------------------------------------------------------------
+// The reference: the whole file at once, in seconds
+// ---------------------------------------------------------------------
+struct Expected
+{
+    double  sample; // unrounded
+    uint8_t status, data0, data1;
+};
+
+bool Played(const std::vector<uint8_t>& b)
+{
+    uint8_t kind = b[0] & 0xF0;
+    if(b[0] >= 0xF0 || (b[0] & 0x0F) == 9)
+        return false;
+    if(kind == 0xB0)
+        return b[1] == 1 || b[1] == 33 || b[1] == 7 || b[1] == 64;
+    return kind == 0x80 || kind == 0x90 || kind == 0xE0;
+}
+
+double Seconds(const Song& s, const std::map<uint32_t, uint32_t>& tempo, uint32_t tick)
+{
+    if(s.division & 0x8000)
+    {
+        int    fps  = -(int8_t)(s.division >> 8);
+        double rate = fps == 29 ? 29.97 : fps;
+        return tick / (rate * (s.division & 0xFF));
+    }
+    double   sec = 0.0;
+    uint32_t at  = 0;
+    uint32_t us  = 500000;
+    for(const auto& t : tempo)
+    {
+        if(t.first >= tick)
+            break;
+        sec += (double)(t.first - at) * us / (1e6 * s.division);
+        at = t.first;
+        us = t.second;
+    }
+    return sec + (double)(tick - at) * us / (1e6 * s.division);
+}
+
+std::vector<Expected> Reference(const Song& s, int passes)
+{
+    std::map<uint32_t, uint32_t> tempo;
+    struct Key
+    {
+        uint32_t tick;
+        size_t   track, seq;
+        const Ev* ev;
+    };
+    std::vector<Key> all;
+    uint32_t         end = 0;
+    for(size_t t = 0; t < s.tracks.size(); t++)
+    {
+        for(size_t i = 0; i < s.tracks[t].size(); i++)
+        {
+            const Ev& e = s.tracks[t][i];
+            if(e.bytes[0] == 0xFF && e.bytes[1] == 0x51)
+                tempo[e.tick] = e.bytes[3] << 16 | e.bytes[4] << 8 | e.bytes[5];
+        }
+        end = std::max(end, s.eot[t]);
+    }
+    for(size_t t = 0; t < s.tracks.size(); t++)
+        for(size_t i = 0; i < s.tracks[t].size(); i++)
+            all.push_back({s.tracks[t][i].tick, t, i, &s.tracks[t][i]});
+    std::stable_sort(all.begin(), all.end(), [](const Key& a, const Key& b) {
+        return a.tick != b.tick ? a.tick < b.tick : a.track < b.track;
+    });
+
+    std::vector<Expected> out;
+    const double          pass = Seconds(s, tempo, end) * kSampleRate;
+    for(int p = 0; p < passes; p++)
+        for(const Key& k : all)
+        {
+            const std::vector<uint8_t>& b = k.ev->bytes;
+            if(!Played(b))
+                continue;
+            double at = p * pass + Seconds(s, tempo, k.tick) * kSampleRate;
+            out.push_back({at, (uint8_t)(b[0] & 0xF0), b[1], b.size() > 2 ? b[2] : (uint8_t)0});
+        }
+    out.push_back({passes * pass, 0, 0, 0}); // the end
+    return out;
+}
+
+// ---------------------------------------------------------------------
+// The songs
+// ---------------------------------------------------------------------
+Song TempoChanges()
+{
+    Song s;
+    s.name     = "format0_tempo";
+    s.format   = 0;
+    s.division = 96;
+    std::vector<Ev> t;
+    t.push_back(Text(0, 300)); // longer than the read-ahead buffer
+    t.push_back(Tempo(0, 500000));
+    t.push_back(Tempo(384, 666667));
+    t.push_back(Tempo(768, 300000));
+    t.push_back(Tempo(1000, 1000000)); // between notes
+    t.push_back(Sysex(500, 200));
+    for(uint32_t tick = 0; tick < 1536; tick += 48)
+    {
+        uint8_t note = (uint8_t)(48 + (tick / 48) % 24);
+        t.push_back(Msg(tick, 0x90, note, 100));
+        t.push_back(Msg(tick + 40, 0x90, note, 0)); // off as a zero-velocity on
+    }
+    s.tracks = {t};
+    s.eot    = {1536};
+    return s;
+}
+
+Song Merge()
+{
+    Song s;
+    s.name     = "format1_merge";
+    s.division = 480;
+
+    // Conductor: a tempo ramp from 90 to 180 bpm, a change every beat
+    std::vector<Ev> conductor;
+    conductor.push_back(Text(0, 1000));
+    for(uint32_t beat = 0; beat < 64; beat++)
+        conductor.push_back(Tempo(beat * 480, (uint32_t)(60e6 / (90.0 + 90.0 * beat / 63))));
+    s.tracks.push_back(conductor);
+
+    const uint32_t steps[] = {120, 160, 240, 360}; // 16ths, triplets, 8ths, dotted 8ths
+    for(int v = 0; v < 4; v++)
+    {
+        std::vector<Ev> t;
+        uint8_t         ch = (uint8_t)v; // channels 1-4, all to the synth
+        for(uint32_t tick = 0, i = 0; tick + steps[v] <= 64 * 480; tick += steps[v], i++)
+        {
+            uint8_t note = (uint8_t)(36 + 12 * v + (i * 7) % 12);
+            t.push_back(Msg(tick, 0x90 | ch, note, (uint8_t)(60 + i % 60)));
+            t.push_back(Msg(tick + steps[v] - 10, 0x80 | ch, note, 64));
+            if(i % 8 == 0)
+                t.push_back(Msg(tick, 0xE0 | ch, 0, (uint8_t)(0x40 + i % 16)));
+            if(i % 16 == 5)
+                t.push_back(Sysex(tick, 150));
+        }
+        s.tracks.push_back(t);
+    }
+
+    // GM drums and GM controllers that mean something else here
+    std::vector<Ev> extra;
+    for(uint32_t tick = 0; tick < 64 * 480; tick += 240)
+    {
+        extra.push_back(Msg(tick, 0x99, 36, 100));
+        extra.push_back(Msg(tick + 100, 0x89, 36, 0));
+        extra.push_back(Msg(tick, 0xB0, 91, 40));
+        extra.push_back(Msg(tick, 0xB1, 7, (uint8_t)(tick / 240 % 128)));
+        extra.push_back(Msg(tick, 0xC0, 5, 0));
+    }
+    extra.push_back(Msg(960, 0xB0, 64, 127));
+    extra.push_back(Msg(1920, 0xB0, 64, 0));
+    s.tracks.push_back(extra);
+    s.eot = {64 * 480, 64 * 480, 64 * 480, 64 * 480, 64 * 480, 64 * 480};
+    return s;
+}
+
+Song Smpte()
+{
+    Song s;
+    s.name     = "smpte_25fps";
+    s.format   = 0;
+    s.division = 0xE728; // -25 fps, 40 ticks per frame: ms resolution
+    std::vector<Ev> t;
+    t.push_back(Tempo(0, 250000)); // ignored under SMPTE
+    for(uint32_t ms = 0; ms < 4000; ms += 37)
+    {
+        t.push_back(Msg(ms, 0x90, (uint8_t)(60 + ms % 12), 90));
+        t.push_back(Msg(ms + 30, 0x80, (uint8_t)(60 + ms % 12), 0));
+    }
+    s.tracks = {t};
+    s.eot    = {4100};
+    return s;
+}
+
+Song Loop()
+{
+    Song s;
+    s.name     = "format0_loop";
+    s.format   = 0;
+    s.division = 96;
+    s.loop     = true;
+    std::vector<Ev> t;
+    t.push_back(Tempo(0, 400000));
+    t.push_back(Tempo(192, 600000));
+    for(uint32_t tick = 0; tick < 384; tick += 32)
+    {
+        t.push_back(Msg(tick, 0x90, (uint8_t)(50 + tick / 32), 100));
+        t.push_back(Msg(tick + 24, 0x80, (uint8_t)(50 + tick / 32), 0));
+    }
+    s.tracks = {t};
+    s.eot    = {400}; // a little rest before it comes round
+    return s;
+}
+
+Song Stopped()
+{
+    Song s        = Merge();
+    s.name        = "format1_stop";
+    s.stopSeconds = 3.0;
+    return s;
+}
+
+// ---------------------------------------------------------------------
+// Playing
+// ---------------------------------------------------------------------
+struct Run
+{
+    size_t           block      = 48;
+    double           stallMs    = 150.0;
+    SmfPlayer::Stats stats      = {};
+    uint64_t         stopSample = 0; // where Play() stopped the player
+};
+
+// Plays until the player goes idle, or stops it at stopSeconds (if set)
+// or maxSeconds
+bool Play(SmfSource& src, bool loop, double stopSeconds, double maxSeconds, Run& run)
+{
+    static SmfPlayer  player; // big; as on the Seed, not on the stack
+    SmfPlayer::Config cfg;
+    cfg.loop = loop;
+    if(!player.Load(&src, kSampleRate, cfg) || !player.Play())
+        return false;
+
+    g_sample = 0;
+    g_received.clear();
+    std::vector<float> l(run.block), r(run.block);
+    float*             out[2] = {l.data(), r.data()};
+    const uint64_t     second = (uint64_t)kSampleRate;
+    const uint64_t     stall  = (uint64_t)(run.stallMs * kSampleRate / 1000.0);
+    const uint64_t     until  = (uint64_t)(maxSeconds * kSampleRate);
+    run.stopSample = 0;
+    while(player.Busy())
+    {
+        if(g_sample >= until || (stopSeconds > 0.0 && g_sample >= stopSeconds * kSampleRate))
+        {
+            if(!run.stopSample)
+                run.stopSample = g_sample;
+            player.Stop();
+        }
+        // main() is held up from half a second into every second
+        uint64_t phase = g_sample % second;
+        if(phase < second / 2 || phase >= second / 2 + stall)
+            while(player.NeedsFill())
+                player.Fill();
+        player.Render(out, run.block);
+    }
+    run.stats = player.GetStats();
+    return true;
+}
+
+bool CheckSong(const Song& s, const std::string& dir, Run& run)
+{
+    std::string path = dir + "/" + s.name + ".mid";
+    if(!WriteSong(s, path))
+    {
+        printf("%-16s cannot write %s\n", s.name.c_str(), path.c_str());
+        return false;
+    }
+    FILE* f = fopen(path.c_str(), "rb");
+    if(!f)
+        return false;
+    FileSource src(f);
+    const int  passes = s.loop ? 3 : 1;
+    std::vector<Expected> want = Reference(s, passes);
+    // A loop is stopped just before its last pass ends
+    double maxSeconds = s.loop ? (want.back().sample - 1.0) / kSampleRate : 1e9;
+    bool ok = Play(src, s.loop, s.stopSeconds, maxSeconds, run);
+    fclose(f);
+    if(!ok)
+    {
+        printf("%-16s not loaded\n", s.name.c_str());
+        return false;
+    }
+
+    // Up to the stop (or the end of the last pass), the file's own events
+    // in order at the reference's samples
+    uint64_t cut = run.stopSample ? run.stopSample : (uint64_t)-1;
+    size_t   n   = 0;
+    double   err = 0.0;
+    bool     match = true;
+    for(const Received& r : g_received)
+    {
+        if(r.sample >= cut || n >= want.size() - 1)
+            break;
+        const Expected& e = want[n++];
+        err = std::max(err, fabs((double)r.sample - e.sample));
+        if(r.status != e.status || r.data0 != e.data0 || r.data1 != e.data1
+           || fabs((double)r.sample - e.sample) > 1.0)
+        {
+            if(match)
+                printf("%-16s event %zu: got %02X %02X %02X at %llu, want %02X %02X %02X at %.2f\n",
+                       s.name.c_str(),
+                       n - 1,
+                       r.status,
+                       r.data0,
+                       r.data1,
+                       (unsigned long long)r.sample,
+                       e.status,
+                       e.data0,
+                       e.data1,
+                       e.sample);
+            match = false;
+        }
+    }
+    size_t expectedCount = want.size() - 1;
+    if(run.stopSample)
+    {
+        // Cut short: as many as the reference has before the cut
+        expectedCount = 0;
+        while(expectedCount < want.size() - 1
+              && want[expectedCount].sample + 0.5 < (double)cut)
+            expectedCount++;
+    }
+    if(n != expectedCount)
+        match = false;
+
+    // Nothing the file left on stays on
+    int held[128] = {};
+    for(const Received& r : g_received)
+    {
+        if((r.status & 0xF0) == 0x90 && r.data1)
+            held[r.data0] = 1;
+        else if((r.status & 0xF0) == 0x80 || (r.status & 0xF0) == 0x90)
+            held[r.data0] = 0;
+    }
+    int hanging = 0;
+    for(int h : held)
+        hanging += h;
+
+    bool pass = match && run.stats.late == 0 && hanging == 0;
+    printf("%-16s %5zu events%s, max error %.2f samples, %u late, %u reads, %u loops, "
+           "%d hanging: %s\n",
+           s.name.c_str(),
+           n,
+           run.stopSample ? " to the stop" : "",
+           err,
+           run.stats.late,
+           run.stats.reads,
+           run.stats.loops,
+           hanging,
+           pass ? "ok" : "FAIL");
+    return pass;
+}
+
+int PrintTimeline(const char* path, Run& run)
+{
+    FILE* f = fopen(path, "rb");
+    if(!f)
+    {
+        fprintf(stderr, "cannot read %s\n", path);
+        return 1;
+    }
+    FileSource src(f);
+    bool       ok = Play(src, false, 0.0, 3600.0, run);
+    fclose(f);
+    if(!ok)
+    {
+        fprintf(stderr, "%s: not a playable MIDI file\n", path);
+        return 1;
+    }
+    for(const Received& r : g_received)
+        printf("%10.3f ms  %02X %02X %02X\n",
+               (double)r.sample * 1000.0 / kSampleRate,
+               r.status,
+               r.data0,
+               r.data1);
+    printf("# %u events, %u skipped, %u late (max %u samples), %u reads\n",
+           run.stats.events,
+           run.stats.skipped,
+           run.stats.late,
+           run.stats.maxLateSamples,
+           run.stats.reads);
+    return 0;
+}
+
+void Usage()
+{
+    fprintf(stderr, "usage: smf_check [-k block] [-s stall_ms] [-o outdir] [file.mid]\n");
+    exit(2);
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    Run         run;
+    std::string outDir = ".";
+    int         opt;
+    while((opt = getopt(argc, argv, "k:s:o:h")) != -1)
+    {
+        switch(opt)
+        {
+            case 'k': run.block = (size_t)atoi(optarg); break;
+            case 's': run.stallMs = atof(optarg); break;
+            case 'o': outDir = optarg; break;
+            default: Usage();
+        }
+    }
+    if(run.block == 0 || argc - optind > 1)
+        Usage();
+    if(optind < argc)
+        return PrintTimeline(argv[optind], run);
+
+    printf("block %zu, main() held up %.0f ms every second, lookahead %u ms\n",
+           run.block,
+           run.stallMs,
+           SmfPlayer::Config().lookaheadMs);
+    bool ok = true;
+    for(const Song& s : {TempoChanges(), Merge(), Smpte(), Loop(), Stopped()})
+        ok = CheckSong(s, outDir, run) && ok;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,407 @@
+// trace_decode: timelines from a Daisy trace dump (daisy/seed/
+// kb2040_groovebox/trace.h).
+//
+//   trace_decode [-a] [-w ms] [-j out.json] dump.txt
+//
+// The dump is what the Daisy prints on its USB serial port after a 'd'
+// (capture it with any terminal program, e.g. "cat /dev/ttyACM0 >
+// dump.txt"), or a trace_<storm>.txt from groovebox_flood. Other lines
+// around it are ignored; with several dumps in the file the last one is
+// used.
+//
+// Prints a summary (audio callback durations and period, overruns, MIDI
+// handler durations, arrival -> handled latency, steals, shedding and
+// quality changes), then the timeline around each overrun (-w ms either
+// side, default 2), or the whole ring with -a. -j writes the trace in
+// Chrome trace-event format, for chrome://tracing or ui.perfetto.dev:
+// callbacks and handlers as spans, MIDI and engine events as instants,
+// load as a counter.
+#include "trace.h"
+
+#include <algorithm>
+#include <deque>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+namespace
+{
+const char* const kLevelNames[] = {
+    "full", "shed_tails", "single_osc", "cheap_fx", "min_voices"};
+const int kNumLevelNames = sizeof(kLevelNames) / sizeof(kLevelNames[0]);
+
+struct Event
+{
+    double   us; // since the oldest record
+    uint8_t  type;
+    uint8_t  arg0;
+    uint16_t arg1;
+    double   durUs; // BEGIN records: until the matching END, -1 if none
+};
+
+struct Dump
+{
+    uint32_t           hz = 0;
+    std::vector<Event> events;
+};
+
+// Finds the last complete dump and puts its records in time order
+bool ReadDump(FILE* f, Dump& d)
+{
+    std::vector<TraceRecord> recs, cur;
+    uint32_t                 hz = 0, curHz = 0;
+    bool                     in = false, found = false;
+    char                     line[256];
+    while(fgets(line, sizeof(line), f))
+    {
+        unsigned long h;
+        unsigned      t, type, a0, a1;
+        if(sscanf(line, "# groovebox trace hz=%lu", &h) == 1)
+        {
+            in    = true;
+            curHz = (uint32_t)h;
+            cur.clear();
+        }
+        else if(in && strncmp(line, "# end", 5) == 0)
+        {
+            in    = false;
+            found = true;
+            recs.swap(cur);
+            hz = curHz;
+        }
+        else if(in && sscanf(line, "%x %x %x %x", &t, &type, &a0, &a1) == 4)
+            cur.push_back({(uint32_t)t, (uint8_t)type, (uint8_t)a0, (uint16_t)a1});
+    }
+    if(!found || hz == 0)
+        return false;
+
+    // Records are in index order, which is time order except where a
+    // writer was preempted; signed differences unwrap the 32-bit clock
+    d.hz = hz;
+    d.events.clear();
+    int64_t ticks = 0;
+    for(size_t i = 0; i < recs.size(); i++)
+    {
+        if(i > 0)
+            ticks += (int32_t)(recs[i].time - recs[i - 1].time);
+        d.events.push_back({(double)ticks * 1e6 / hz, recs[i].type, recs[i].arg0, recs[i].arg1, -1.0});
+    }
+    std::stable_sort(d.events.begin(), d.events.end(), [](const Event& a, const Event& b) {
+        return a.us < b.us;
+    });
+    if(!d.events.empty())
+    {
+        double t0 = d.events[0].us;
+        for(Event& e : d.events)
+            e.us -= t0;
+    }
+    return true;
+}
+
+const char* MidiName(uint8_t status)
+{
+    switch(status & 0xF0)
+    {
+        case 0x80: return "note off";
+        case 0x90: return "note on";
+        case 0xA0: return "aftertouch";
+        case 0xB0: return "cc";
+        case 0xC0: return "program";
+        case 0xD0: return "pressure";
+        case 0xE0: return "bend";
+        default: return "system";
+    }
+}
+
+const char* LevelName(uint8_t level)
+{
+    return level < kNumLevelNames ? kLevelNames[level] : "?";
+}
+
+double Percentile(std::vector<double> v, double p)
+{
+    if(v.empty())
+        return 0.0;
+    std::sort(v.begin(), v.end());
+    size_t idx = (size_t)(p / 100.0 * (double)(v.size() - 1) + 0.5);
+    return v[idx];
+}
+
+void PrintSpread(const char* name, const std::vector<double>& v, const char* unit)
+{
+    printf("  %-10s n %zu, p50 %.1f p99 %.1f max %.1f %s\n",
+           name,
+           v.size(),
+           Percentile(v, 50),
+           Percentile(v, 99),
+           Percentile(v, 100),
+           unit);
+}
+
+// Pairs BEGIN records with their END and prints the summary
+void Analyze(Dump& d)
+{
+    std::vector<Event>& ev = d.events;
+    std::vector<double> callbackUs, periodUs, handlerUs, latencyUs, load;
+    std::deque<size_t>  rx; // MIDI_RX not yet handled
+    size_t              counts[TRACE_NUM_TYPES] = {};
+    long                callback = -1, handler = -1;
+    double              lastBegin = -1.0;
+    for(size_t i = 0; i < ev.size(); i++)
+    {
+        Event& e = ev[i];
+        if(e.type < TRACE_NUM_TYPES)
+            counts[e.type]++;
+        switch(e.type)
+        {
+            case TRACE_MIDI_RX:
+                rx.push_back(i);
+                if(rx.size() > 1024) // never handled (the ring wrapped mid-way)
+                    rx.pop_front();
+                break;
+            case TRACE_HANDLER_BEGIN:
+                handler = (long)i;
+                for(auto it = rx.begin(); it != rx.end(); ++it)
+                {
+                    const Event& r = ev[*it];
+                    if(r.arg0 == e.arg0 && r.arg1 == e.arg1)
+                    {
+                        latencyUs.push_back(e.us - r.us);
+                        rx.erase(it);
+                        break;
+                    }
+                }
+                break;
+            case TRACE_HANDLER_END:
+                if(handler >= 0)
+                {
+                    ev[handler].durUs = e.us - ev[handler].us;
+                    handlerUs.push_back(ev[handler].durUs);
+                    handler = -1;
+                }
+                break;
+            case TRACE_CALLBACK_BEGIN:
+                if(lastBegin >= 0.0)
+                    periodUs.push_back(e.us - lastBegin);
+                lastBegin = e.us;
+                callback  = (long)i;
+                break;
+            case TRACE_CALLBACK_END:
+                load.push_back(e.arg1 / 10.0);
+                if(callback >= 0)
+                {
+                    ev[callback].durUs = e.us - ev[callback].us;
+                    callbackUs.push_back(ev[callback].durUs);
+                    callback = -1;
+                }
+                break;
+        }
+    }
+
+    double span = ev.empty() ? 0.0 : ev.back().us;
+    printf("== %zu records over %.3f ms (%u ticks/s)\n", ev.size(), span / 1e3, d.hz);
+    PrintSpread("callback", callbackUs, "us");
+    PrintSpread("period", periodUs, "us");
+    PrintSpread("load", load, "%");
+    printf("  overruns   %zu\n", counts[TRACE_OVERRUN]);
+    printf("  midi       %zu received, %zu dropped\n",
+           counts[TRACE_MIDI_RX],
+           counts[TRACE_MIDI_DROP]);
+    PrintSpread("handler", handlerUs, "us");
+    PrintSpread("rx->engine", latencyUs, "us"); // DMA callback to handler
+    printf("  voices     %zu stolen, %zu tails shed, %zu voices shed\n",
+           counts[TRACE_VOICE_STEAL],
+           counts[TRACE_SHED_TAIL],
+           counts[TRACE_SHED_VOICE]);
+    printf("  quality    %zu changes\n", counts[TRACE_QUALITY]);
+}
+
+void PrintEvent(const Event& e)
+{
+    char what[96] = "";
+    switch(e.type)
+    {
+        case TRACE_MIDI_RX:
+        case TRACE_MIDI_DROP:
+        case TRACE_HANDLER_BEGIN:
+            snprintf(what, sizeof(what), "%02x %02x %02x %s",
+                     e.arg0, e.arg1 & 0xFF, e.arg1 >> 8, MidiName(e.arg0));
+            if(e.type == TRACE_HANDLER_BEGIN && e.durUs >= 0.0)
+                snprintf(what + strlen(what), sizeof(what) - strlen(what), ", %.1f us", e.durUs);
+            break;
+        case TRACE_CALLBACK_BEGIN:
+            snprintf(what, sizeof(what), "%u samples", e.arg1);
+            if(e.durUs >= 0.0)
+                snprintf(what + strlen(what), sizeof(what) - strlen(what), ", %.1f us", e.durUs);
+            break;
+        case TRACE_CALLBACK_END:
+            snprintf(what, sizeof(what), "load %.1f%%, next %s", e.arg1 / 10.0, LevelName(e.arg0));
+            break;
+        case TRACE_OVERRUN:
+            snprintf(what, sizeof(what), "last block ran %u us over its period", e.arg1);
+            break;
+        case TRACE_VOICE_STEAL:
+        case TRACE_SHED_TAIL:
+        case TRACE_SHED_VOICE:
+            snprintf(what, sizeof(what), "voice %u, note %u", e.arg0, e.arg1);
+            break;
+        case TRACE_QUALITY:
+            snprintf(what, sizeof(what), "-> %s at load %.1f%%", LevelName(e.arg0), e.arg1 / 10.0);
+            break;
+    }
+    static const char* const kNames[TRACE_NUM_TYPES] = {
+        "?", "midi rx", "MIDI DROP", "handler", "handler end", "callback", "callback end",
+        "OVERRUN", "steal", "shed tail", "shed voice", "quality", "dump"};
+    // Ends are folded into their begin lines
+    if(e.type == TRACE_HANDLER_END)
+        return;
+    printf("  %12.3f ms  %-12s %s\n",
+           e.us / 1e3,
+           e.type < TRACE_NUM_TYPES ? kNames[e.type] : "?",
+           what);
+}
+
+void PrintTimeline(const Dump& d, bool all, double windowMs)
+{
+    const std::vector<Event>& ev = d.events;
+    if(all)
+    {
+        printf("\n== timeline\n");
+        for(const Event& e : ev)
+            PrintEvent(e);
+        return;
+    }
+    double shownTo = -1.0;
+    for(size_t i = 0; i < ev.size(); i++)
+    {
+        if(ev[i].type != TRACE_OVERRUN)
+            continue;
+        double from = ev[i].us - windowMs * 1e3, to = ev[i].us + windowMs * 1e3;
+        if(from <= shownTo)
+            from = shownTo + 1e-9; // overlaps the last window; carry on from it
+        else
+            printf("\n== overrun at %.3f ms\n", ev[i].us / 1e3);
+        for(const Event& e : ev)
+            if(e.us >= from && e.us <= to)
+                PrintEvent(e);
+        shownTo = std::max(shownTo, to);
+    }
+}
+
+bool WriteJson(const Dump& d, const char* path)
+{
+    FILE* f = fopen(path, "w");
+    if(!f)
+        return false;
+    enum
+    {
+        TID_AUDIO = 1,
+        TID_UART,
+        TID_ENGINE,
+    };
+    fprintf(f, "{\"traceEvents\":[\n");
+    fprintf(f, "{\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"name\":\"thread_name\",\"args\":{\"name\":\"audio callback\"}},\n", TID_AUDIO);
+    fprintf(f, "{\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"name\":\"thread_name\",\"args\":{\"name\":\"uart rx\"}},\n", TID_UART);
+    fprintf(f, "{\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"name\":\"thread_name\",\"args\":{\"name\":\"engine\"}}", TID_ENGINE);
+    for(const Event& e : d.events)
+    {
+        switch(e.type)
+        {
+            case TRACE_CALLBACK_BEGIN:
+                if(e.durUs >= 0.0)
+                    fprintf(f, ",\n{\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,\"name\":\"block\",\"args\":{\"samples\":%u}}",
+                            TID_AUDIO, e.us, e.durUs, e.arg1);
+                break;
+            case TRACE_CALLBACK_END:
+                fprintf(f, ",\n{\"ph\":\"C\",\"pid\":1,\"ts\":%.3f,\"name\":\"load %%\",\"args\":{\"load\":%.1f}}",
+                        e.us, e.arg1 / 10.0);
+                break;
+            case TRACE_HANDLER_BEGIN:
+                if(e.durUs >= 0.0)
+                    fprintf(f, ",\n{\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,\"name\":\"%s\",\"args\":{\"bytes\":\"%02x %02x %02x\"}}",
+                            TID_AUDIO, e.us, e.durUs, MidiName(e.arg0), e.arg0, e.arg1 & 0xFF, e.arg1 >> 8);
+                break;
+            case TRACE_MIDI_RX:
+            case TRACE_MIDI_DROP:
+                fprintf(f, ",\n{\"ph\":\"i\",\"s\":\"t\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"name\":\"%s%s\",\"args\":{\"bytes\":\"%02x %02x %02x\"}}",
+                        TID_UART, e.us, e.type == TRACE_MIDI_DROP ? "DROP " : "", MidiName(e.arg0),
+                        e.arg0, e.arg1 & 0xFF, e.arg1 >> 8);
+                break;
+            case TRACE_OVERRUN:
+                fprintf(f, ",\n{\"ph\":\"i\",\"s\":\"p\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"name\":\"OVERRUN\",\"args\":{\"late_us\":%u}}",
+                        TID_AUDIO, e.us, e.arg1);
+                break;
+            case TRACE_VOICE_STEAL:
+            case TRACE_SHED_TAIL:
+            case TRACE_SHED_VOICE:
+                fprintf(f, ",\n{\"ph\":\"i\",\"s\":\"t\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"name\":\"%s\",\"args\":{\"voice\":%u,\"note\":%u}}",
+                        TID_ENGINE, e.us,
+                        e.type == TRACE_VOICE_STEAL ? "steal" : e.type == TRACE_SHED_TAIL ? "shed tail" : "shed voice",
+                        e.arg0, e.arg1);
+                break;
+            case TRACE_QUALITY:
+                fprintf(f, ",\n{\"ph\":\"i\",\"s\":\"p\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"name\":\"quality %s\"}",
+                        TID_ENGINE, e.us, LevelName(e.arg0));
+                break;
+        }
+    }
+    fprintf(f, "\n]}\n");
+    fclose(f);
+    return true;
+}
+
+void Usage()
+{
+    fprintf(stderr, "usage: trace_decode [-a] [-w ms] [-j out.json] dump.txt\n");
+    exit(2);
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    bool        all      = false;
+    double      windowMs = 2.0;
+    const char* json     = nullptr;
+    int         opt;
+    while((opt = getopt(argc, argv, "aw:j:h")) != -1)
+    {
+        switch(opt)
+        {
+            case 'a': all = true; break;
+            case 'w': windowMs = atof(optarg); break;
+            case 'j': json = optarg; break;
+            default: Usage();
+        }
+    }
+    if(optind + 1 != argc)
+        Usage();
+
+    FILE* f = strcmp(argv[optind], "-") == 0 ? stdin : fopen(argv[optind], "r");
+    if(!f)
+    {
+        fprintf(stderr, "cannot read %s\n", argv[optind]);
+        return 1;
+    }
+    Dump d;
+    bool ok = ReadDump(f, d);
+    if(f != stdin)
+        fclose(f);
+    if(!ok)
+    {
+        fprintf(stderr, "no complete trace dump in %s\n", argv[optind]);
+        return 1;
+    }
+
+    Analyze(d);
+    PrintTimeline(d, all, windowMs);
+    if(json && !WriteJson(d, json))
+    {
+        fprintf(stderr, "cannot write %s\n", json);
+        return 1;
+    }
+    return 0;
+}
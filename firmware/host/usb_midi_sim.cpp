@@ -0,0 +1,560 @@
+// usb_midi_sim: the KB2040's USB MIDI merge into the Daisy link.
+//
+//   usb_midi_sim [-t seconds] [-s seed] [scenario ...]
+//
+// The sketch runs in the host simulator (kb2040_sim.h) with a computer on
+// its USB MIDI port. The same key presses are played in every scenario,
+// one key at a time in single-note mode:
+//   keys      the keys alone: the reference for every other scenario
+//   joystick  the joystick circling as well (bend and mod wheel, coalesced)
+//   computer  plus a DAW: a note on or off every 2 ms below the KB2040's
+//             range, and volume (CC 7) automation every 1 ms
+//   stamps    the same with send stamps on (serial 't'), which double a
+//             note's bytes, so the DAW plays half as many
+//   flood     the joystick and a computer sending a full USB frame every
+//             frame, far more than the 31250 baud link carries
+//
+// Checks:
+//   - every key's note on reaches the wire no later than it did with the
+//     keys alone, plus what the sketch lets the UART hold ahead of it
+//     (Wiring::txAheadUs) and one stamped message already on the wire
+//   - with a computer, no later than in the same run without it plus one
+//     computer message (and its stamp): the sketch never lets the UART
+//     hold more than one
+//   - the KB2040's notes go out in the same order in every scenario, and
+//     the same ones go to the computer
+//   - none of the KB2040's own commands (CC 102 and up: audio setup,
+//     recorder, player, return line) the computer sends reach the wire
+//   - the computer's notes reach the wire in the order sent, none lost
+//     (all of them once the traffic stops, except under the flood, which
+//     only has to be an in-order prefix), and its volume automation ends
+//     at the last value sent
+//
+// Each run is its own process, since the sketch keeps its state in
+// globals.
+//
+// Exits 1 if a check fails.
+#include "kb2040_sim.h"
+
+#include <algorithm>
+#include <math.h>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+namespace
+{
+const uint64_t kByteUs         = 320;  // 31250 baud
+const uint8_t  kComputerNotes  = 40;   // computer notes are below this
+const uint8_t  kVolume         = 7;
+const uint32_t kStampStatus    = 0xF4; // MidiStamp::STATUS
+const uint8_t  kDaisyOnly      = 102;  // MidiCC::AUDIO_BLOCK_SIZE and up
+
+struct Options
+{
+    double   seconds = 4.0;
+    uint32_t seed    = 1;
+};
+
+struct Scenario
+{
+    const char* name;
+    bool        joystick;
+    bool        computer;
+    bool        stamps;
+    bool        flood;
+    uint64_t    noteEveryUs; // the computer's notes, outside the flood
+};
+
+struct Press
+{
+    uint64_t atUs; // after boot
+    uint64_t holdUs;
+    int      key;
+};
+
+struct Packet
+{
+    uint64_t atUs; // after boot
+    uint8_t  p[4];
+};
+
+// A channel message as it left the KB2040
+struct WireMsg
+{
+    uint64_t wireUs; // last byte
+    uint8_t  status, d1, d2;
+};
+
+struct Result
+{
+    std::vector<uint64_t> keyDelayUs; // press -> note on's last byte
+    std::vector<WireMsg>  localNotes;
+    std::vector<WireMsg>  usbNotes;   // local notes sent to the computer
+    std::vector<WireMsg>  computerNotes;
+    std::vector<uint8_t>  volumes;
+    std::vector<uint64_t> computerDelayUs; // into the device FIFO -> wire
+    uint64_t              maxBacklogUs = 0; // queued by the computer -> wire
+    uint64_t              computerNotesIn = 0;
+    uint64_t              daisyOnly = 0; // Daisy-only controllers on the wire
+    uint64_t              uartBytes = 0;
+    uint64_t              uartBlockedUs = 0;
+    uint64_t              simulatedUs = 0;
+    bool                  ok = true;
+};
+
+bool IsNote(uint8_t status)
+{
+    return (status & 0xE0) == 0x80;
+}
+
+bool IsNoteOn(const WireMsg& m)
+{
+    return (m.status & 0xF0) == 0x90 && m.d2 > 0;
+}
+
+std::vector<Press> MakePresses(const Options& opt)
+{
+    std::mt19937       rng(opt.seed);
+    std::vector<Press> presses;
+    uint64_t           t = 100000;
+    while(t < (uint64_t)(opt.seconds * 1e6))
+    {
+        Press p;
+        p.atUs   = t + std::uniform_int_distribution<uint64_t>(0, 999)(rng);
+        p.holdUs = std::uniform_int_distribution<uint64_t>(30000, 120000)(rng);
+        p.key    = std::uniform_int_distribution<int>(0, 19)(rng);
+        presses.push_back(p);
+        t = p.atUs + p.holdUs + std::uniform_int_distribution<uint64_t>(10000, 60000)(rng);
+    }
+    return presses;
+}
+
+std::vector<Packet> MakeComputer(const Scenario& sc, const Options& opt)
+{
+    std::vector<Packet> out;
+    uint64_t            end = (uint64_t)(opt.seconds * 1e6);
+    uint8_t             n   = 0;
+    if(sc.flood)
+    {
+        for(uint64_t t = 0; t < end; t += 1000)
+            for(int i = 0; i < 8; ++i, n = (uint8_t)((n + 1) % kComputerNotes))
+            {
+                out.push_back({t, {0x09, 0x90, n, 100}});
+                out.push_back({t, {0x08, 0x80, n, 0}});
+            }
+        return out;
+    }
+    for(uint64_t t = 0; t < end; t += sc.noteEveryUs, n = (uint8_t)((n + 1) % kComputerNotes))
+    {
+        out.push_back({t, {0x09, 0x90, n, 100}});
+        out.push_back({t + sc.noteEveryUs / 2, {0x08, 0x80, n, 0}});
+    }
+    for(uint64_t t = 500; t < end; t += 1000)
+        out.push_back({t, {0x0B, 0xB0, kVolume, (uint8_t)((t / 1000) & 127)}});
+    for(uint8_t cc = kDaisyOnly; cc < 110; ++cc) // the KB2040's commands
+        out.push_back({end / 2 + cc, {0x0B, 0xB0, cc, 127}});
+    std::stable_sort(out.begin(), out.end(), [](const Packet& a, const Packet& b) {
+        return a.atUs < b.atUs;
+    });
+    return out;
+}
+
+// The UART bytes back into messages; stamps are skipped
+std::vector<WireMsg> ParseUart(const std::vector<kbsim::UartByte>& log, size_t from)
+{
+    std::vector<WireMsg> out;
+    uint8_t              status = 0, data[2];
+    int                  have = 0, need = 0;
+    for(size_t i = from; i < log.size(); ++i)
+    {
+        uint8_t b = log[i].byte;
+        if(b & 0x80)
+        {
+            status = b;
+            have   = 0;
+            need   = (b == kStampStatus) ? 2 : ((b & 0xE0) == 0xC0) ? 1 : 2;
+            continue;
+        }
+        if(!status)
+            continue;
+        data[have++] = b;
+        if(have < need)
+            continue;
+        have = 0;
+        if(status != kStampStatus)
+            out.push_back({log[i].wireUs, status, data[0], need == 2 ? data[1] : (uint8_t)0});
+    }
+    return out;
+}
+
+Result Run(const Scenario& sc, const Options& opt, const std::vector<Press>& presses)
+{
+    Result r;
+    kbsim::Reset(kbsim::Config());
+    kbsim::Boot();
+    if(sc.stamps)
+    {
+        kbsim::SerialInput("t");
+        kbsim::RunUntil(kbsim::NowUs() + 100000);
+    }
+    size_t   uartFrom = kbsim::UartLog().size();
+    size_t   usbFrom  = kbsim::UsbMidiOutLog().size();
+    uint64_t start    = kbsim::NowUs();
+
+    std::vector<Packet> computer;
+    if(sc.computer)
+        computer = MakeComputer(sc, opt);
+
+    // Inputs in 1 ms steps
+    uint64_t end  = start + (uint64_t)(opt.seconds * 1e6);
+    size_t   next = 0, press = 0;
+    bool     down = false;
+    while(kbsim::NowUs() < end + 1000000)
+    {
+        uint64_t now = kbsim::NowUs();
+        uint64_t t   = now - start;
+        for(; next < computer.size() && computer[next].atUs <= t; ++next)
+            kbsim::UsbMidiSend(computer[next].p);
+        if(press < presses.size())
+        {
+            const Press& p = presses[press];
+            if(!down && t >= p.atUs)
+            {
+                kbsim::SetKey(p.key, true);
+                down = true;
+            }
+            else if(down && t >= p.atUs + p.holdUs)
+            {
+                kbsim::SetKey(p.key, false);
+                down = false;
+                press++;
+            }
+        }
+        if(sc.joystick && now < end)
+        {
+            double ph = 2.0 * M_PI * (double)t / 700000.0;
+            kbsim::SetJoystick(512 + (int)(400.0 * sin(ph)), 512 + (int)(400.0 * cos(ph)));
+        }
+        else if(sc.joystick)
+            kbsim::SetJoystick(512, 512);
+        kbsim::RunUntil((now / 1000 + 1) * 1000);
+    }
+
+    // What went out
+    std::vector<WireMsg> wire = ParseUart(kbsim::UartLog(), uartFrom);
+    for(const WireMsg& m : wire)
+    {
+        if(IsNote(m.status) && m.d1 >= kComputerNotes)
+            r.localNotes.push_back(m);
+        else if(IsNote(m.status))
+            r.computerNotes.push_back(m);
+        else if((m.status & 0xF0) == 0xB0 && m.d1 == kVolume)
+            r.volumes.push_back(m.d2);
+        else if((m.status & 0xF0) == 0xB0 && m.d1 >= kDaisyOnly && !r.daisyOnly++)
+            fprintf(stderr, "  %s: CC %u reached the Daisy\n", sc.name, m.d1);
+    }
+    if(r.daisyOnly)
+        r.ok = false;
+    const std::vector<kbsim::UsbPacket>& out = kbsim::UsbMidiOutLog();
+    for(size_t i = usbFrom; i < out.size(); ++i)
+        if(IsNote(out[i].p[1]))
+            r.usbNotes.push_back({out[i].sentUs, out[i].p[1], out[i].p[2], out[i].p[3]});
+
+    size_t on = 0;
+    for(const WireMsg& m : r.localNotes)
+    {
+        if(!IsNoteOn(m))
+            continue;
+        if(on < presses.size())
+            r.keyDelayUs.push_back(m.wireUs - (start + presses[on].atUs));
+        on++;
+    }
+    if(on != presses.size())
+    {
+        fprintf(stderr, "  %s: %zu note ons for %zu presses\n", sc.name, on, presses.size());
+        r.ok = false;
+    }
+
+    // The computer's notes against what it sent
+    std::vector<kbsim::UsbPacket> sentNotes;
+    for(const kbsim::UsbPacket& p : kbsim::UsbMidiInLog())
+        if(IsNote(p.p[1]))
+            sentNotes.push_back(p);
+    r.computerNotesIn = sentNotes.size();
+    std::vector<Packet> allSent;
+    for(const Packet& p : computer)
+        if(IsNote(p.p[1]))
+            allSent.push_back(p);
+    for(size_t k = 0; k < r.computerNotes.size(); ++k)
+    {
+        const WireMsg& m = r.computerNotes[k];
+        if(k >= allSent.size() || m.status != allSent[k].p[1] || m.d1 != allSent[k].p[2]
+           || m.d2 != allSent[k].p[3])
+        {
+            fprintf(stderr, "  %s: computer note %zu out of order or changed\n", sc.name, k);
+            r.ok = false;
+            break;
+        }
+        if(k < sentNotes.size())
+            r.computerDelayUs.push_back(m.wireUs - sentNotes[k].acceptedUs);
+        r.maxBacklogUs = std::max(r.maxBacklogUs, m.wireUs - (start + allSent[k].atUs));
+    }
+    if(!sc.flood && r.computerNotes.size() != allSent.size())
+    {
+        fprintf(stderr, "  %s: %zu of %zu computer notes reached the Daisy\n", sc.name,
+                r.computerNotes.size(), allSent.size());
+        r.ok = false;
+    }
+    if(sc.computer && !sc.flood)
+    {
+        uint8_t last = 0;
+        for(const Packet& p : computer)
+            if(p.p[1] == 0xB0)
+                last = p.p[3];
+        if(r.volumes.empty() || r.volumes.back() != last)
+        {
+            fprintf(stderr, "  %s: volume ended at %d, the computer's last was %u\n", sc.name,
+                    r.volumes.empty() ? -1 : r.volumes.back(), last);
+            r.ok = false;
+        }
+    }
+    r.uartBytes     = kbsim::Stats().uartBytes;
+    r.uartBlockedUs = kbsim::Stats().uartBlockedUs;
+    r.simulatedUs   = kbsim::NowUs();
+    return r;
+}
+
+// ---- one process per run ------------------------------------------------
+
+template <typename T>
+void PutVec(FILE* f, const std::vector<T>& v)
+{
+    uint64_t n = v.size();
+    fwrite(&n, sizeof(n), 1, f);
+    fwrite(v.data(), sizeof(T), v.size(), f);
+}
+
+template <typename T>
+bool GetVec(FILE* f, std::vector<T>& v)
+{
+    uint64_t n;
+    if(fread(&n, sizeof(n), 1, f) != 1)
+        return false;
+    v.resize(n);
+    return fread(v.data(), sizeof(T), n, f) == n;
+}
+
+bool RunForked(const Scenario& sc, const Options& opt, const std::vector<Press>& presses, Result& r)
+{
+    int fd[2];
+    if(pipe(fd) < 0)
+        return false;
+    fflush(stdout);
+    pid_t pid = fork();
+    if(pid == 0)
+    {
+        close(fd[0]);
+        Result res = Run(sc, opt, presses);
+        FILE*  f   = fdopen(fd[1], "wb");
+        PutVec(f, res.keyDelayUs);
+        PutVec(f, res.localNotes);
+        PutVec(f, res.usbNotes);
+        PutVec(f, res.computerNotes);
+        PutVec(f, res.volumes);
+        PutVec(f, res.computerDelayUs);
+        uint64_t v[6] = {res.maxBacklogUs, res.computerNotesIn, res.uartBytes,
+                         res.uartBlockedUs, res.simulatedUs, res.ok ? 1u : 0u};
+        fwrite(v, sizeof(v), 1, f);
+        fclose(f);
+        _exit(0);
+    }
+    close(fd[1]);
+    FILE*    f = fdopen(fd[0], "rb");
+    uint64_t v[6];
+    bool     ok = pid > 0 && GetVec(f, r.keyDelayUs) && GetVec(f, r.localNotes)
+              && GetVec(f, r.usbNotes) && GetVec(f, r.computerNotes) && GetVec(f, r.volumes)
+              && GetVec(f, r.computerDelayUs) && fread(v, sizeof(v), 1, f) == 1;
+    fclose(f);
+    int status = 0;
+    if(pid > 0)
+        waitpid(pid, &status, 0);
+    if(!ok || status != 0)
+    {
+        fprintf(stderr, "  %s: run failed\n", sc.name);
+        return false;
+    }
+    r.maxBacklogUs    = v[0];
+    r.computerNotesIn = v[1];
+    r.uartBytes       = v[2];
+    r.uartBlockedUs   = v[3];
+    r.simulatedUs     = v[4];
+    r.ok              = v[5] != 0;
+    return true;
+}
+
+bool SameNotes(const std::vector<WireMsg>& a, const std::vector<WireMsg>& b)
+{
+    if(a.size() != b.size())
+        return false;
+    for(size_t i = 0; i < a.size(); ++i)
+        if(a[i].status != b[i].status || a[i].d1 != b[i].d1 || a[i].d2 != b[i].d2)
+            return false;
+    return true;
+}
+
+uint64_t Percentile(std::vector<uint64_t> v, int p)
+{
+    if(v.empty())
+        return 0;
+    std::sort(v.begin(), v.end());
+    return v[std::min(v.size() - 1, v.size() * (size_t)p / 100)];
+}
+
+// What the computer may add to a key: one message on the line, with its
+// stamp. Without a computer, against the keys alone: what the sketch lets
+// the UART hold, plus one stamped message already on the wire, plus this
+// note's own stamp.
+uint64_t Slack(const Scenario& sc)
+{
+    if(sc.computer)
+        return (sc.stamps ? 6 : 3) * kByteUs;
+    return kbsim::GetWiring().txAheadUs + 6 * kByteUs + (sc.stamps ? 3 * kByteUs : 0);
+}
+
+bool Check(const Scenario& sc, Result& r, const Result& ref)
+{
+    uint64_t slack = Slack(sc);
+    uint64_t worst = 0;
+    for(size_t i = 0; i < r.keyDelayUs.size() && i < ref.keyDelayUs.size(); ++i)
+    {
+        if(r.keyDelayUs[i] > ref.keyDelayUs[i] + slack)
+        {
+            fprintf(stderr, "  %s: key %zu took %llu us, %llu alone\n", sc.name, i,
+                    (unsigned long long)r.keyDelayUs[i],
+                    (unsigned long long)ref.keyDelayUs[i]);
+            r.ok = false;
+        }
+        if(r.keyDelayUs[i] > ref.keyDelayUs[i])
+            worst = std::max(worst, r.keyDelayUs[i] - ref.keyDelayUs[i]);
+    }
+    if(!SameNotes(r.localNotes, ref.localNotes))
+    {
+        fprintf(stderr, "  %s: the KB2040's notes differ from the keys alone\n", sc.name);
+        r.ok = false;
+    }
+    if(!SameNotes(r.usbNotes, r.localNotes))
+    {
+        fprintf(stderr, "  %s: the computer got different notes than the Daisy\n", sc.name);
+        r.ok = false;
+    }
+
+    printf("%s:\n", sc.name);
+    printf("  keys      %zu presses, press -> wire p50 %llu p99 %llu max %llu us;"
+           " worst added %llu us (bound %llu)\n",
+           r.keyDelayUs.size(),
+           (unsigned long long)Percentile(r.keyDelayUs, 50),
+           (unsigned long long)Percentile(r.keyDelayUs, 99),
+           (unsigned long long)Percentile(r.keyDelayUs, 100),
+           (unsigned long long)worst,
+           (unsigned long long)slack);
+    if(sc.computer)
+        printf("  computer  %llu notes in, %zu on the wire, %zu volume values;"
+               " USB -> wire p50 %llu max %llu us, queued -> wire max %llu us\n",
+               (unsigned long long)r.computerNotesIn,
+               r.computerNotes.size(),
+               r.volumes.size(),
+               (unsigned long long)Percentile(r.computerDelayUs, 50),
+               (unsigned long long)Percentile(r.computerDelayUs, 100),
+               (unsigned long long)r.maxBacklogUs);
+    printf("  uart      %llu bytes, %.1f%% of the line, %llu us blocked\n",
+           (unsigned long long)r.uartBytes,
+           100.0 * (double)(r.uartBytes * kByteUs) / (double)r.simulatedUs,
+           (unsigned long long)r.uartBlockedUs);
+    printf("  %s\n", r.ok ? "ok" : "FAIL");
+    return r.ok;
+}
+
+void Usage()
+{
+    fprintf(stderr,
+            "usage: usb_midi_sim [-t seconds] [-s seed]"
+            " [keys|joystick|computer|stamps|flood ...]\n");
+    exit(2);
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    Options opt;
+    int     c;
+    while((c = getopt(argc, argv, "t:s:h")) != -1)
+    {
+        switch(c)
+        {
+            case 't': opt.seconds = atof(optarg); break;
+            case 's': opt.seed = (uint32_t)strtoul(optarg, nullptr, 0); break;
+            default: Usage();
+        }
+    }
+    if(opt.seconds <= 0.0)
+        Usage();
+
+    const Scenario all[] = {
+        {"keys", false, false, false, false, 0},
+        {"joystick", true, false, false, false, 0},
+        {"computer", true, true, false, false, 4000},
+        {"stamps", true, true, true, false, 8000},
+        {"flood", true, true, false, true, 0},
+    };
+    std::vector<Scenario> run;
+    for(int i = optind; i < argc; ++i)
+    {
+        const Scenario* found = nullptr;
+        for(const Scenario& s : all)
+            if(!strcmp(argv[i], s.name))
+                found = &s;
+        if(!found)
+            Usage();
+        run.push_back(*found);
+    }
+    if(run.empty())
+        run.assign(all, all + sizeof(all) / sizeof(all[0]));
+
+    kbsim::Reset(kbsim::Config()); // the sketch's wiring, for the bound
+    std::vector<Press> presses = MakePresses(opt);
+    Result             keys;
+    if(!RunForked(all[0], opt, presses, keys))
+        return 1;
+    bool ok = keys.ok;
+    for(const Scenario& sc : run)
+    {
+        // A computer is measured against the same run without it
+        Result ref = keys;
+        if(sc.computer)
+        {
+            Scenario quiet = sc;
+            quiet.computer = false;
+            quiet.flood    = false;
+            if(!RunForked(quiet, opt, presses, ref))
+            {
+                ok = false;
+                continue;
+            }
+        }
+        Result r = keys;
+        if(strcmp(sc.name, "keys") && !RunForked(sc, opt, presses, r))
+        {
+            ok = false;
+            continue;
+        }
+        ok = Check(sc, r, ref) && ok;
+    }
+    return ok ? 0 : 1;
+}
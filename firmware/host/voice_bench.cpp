@@ -0,0 +1,151 @@
+// voice_bench: what the synth voices cost on the host, for the voices the
+// engine was built with: float (voice_bench) or fixed point
+// (voice_bench_q15, voice_q15.h, built with twelve voices).
+//
+//   voice_bench [-t seconds] [-B ns]
+//
+// Renders the engine holding 0, 1, 2 ... all its voices' worth of notes,
+// mod wheel up so vibrato bends every voice's pitch, FX chain as the
+// defaults leave it. The tone and FX run whatever is held, so the time
+// over 0 notes is the voices'. CPU is thread time, best of three runs.
+// Prints ns per sample for each count, and the left output's level, so
+// the two builds' loudness can be compared note count for note count.
+//
+// -B takes a budget in ns per sample (the float build's full polyphony,
+// say) and says how many of these voices fit in it. Host numbers only
+// show the trend; bench/ in the Daisy app counts M7 instructions
+// (make q15 there).
+#include "engine.h"
+
+#include <algorithm>
+#include <math.h>
+#include <memory>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <xmmintrin.h>
+#endif
+
+namespace
+{
+const float  kRate  = 48000.0f;
+const size_t kBlock = 48;
+const int    kRuns  = 3; // best of
+
+#ifdef GROOVEBOX_Q15_VOICES
+const char kVoices[] = "fixed-point";
+#else
+const char kVoices[] = "float";
+#endif
+
+double CpuNs()
+{
+    timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+struct Run
+{
+    double nsPerSample;
+    double rmsDb;
+};
+
+// `notes` held, spread over five octaves so no two voices share a pitch
+Run Measure(int notes, double seconds)
+{
+    std::unique_ptr<Engine> engine(new Engine);
+    std::vector<uint8_t>    memory(Engine::ArenaBytes(kRate));
+    EngineArena             arena(memory.data(), memory.size());
+    engine->Init(kRate, arena);
+    engine->HandleMidiMessage(0xB0, MidiCC::MODWHEEL, 96);
+    for(int k = 0; k < notes; k++)
+        engine->HandleMidiMessage(0x90, (uint8_t)(36 + (k * 5) % 60), 100);
+
+    std::vector<float> l(kBlock), r(kBlock);
+    float*             out[2] = {l.data(), r.data()};
+    for(int b = 0; b < 200; b++) // attack and decay over
+        engine->Render(out, kBlock);
+
+    size_t blocks = (size_t)(seconds * kRate / (float)kBlock);
+    double sumSq  = 0.0;
+    double start  = CpuNs();
+    for(size_t b = 0; b < blocks; b++)
+    {
+        engine->Render(out, kBlock);
+        for(size_t i = 0; i < kBlock; i++)
+            sumSq += (double)l[i] * l[i];
+    }
+    double ns = CpuNs() - start;
+
+    Run run;
+    run.nsPerSample = ns / (double)(blocks * kBlock);
+    run.rmsDb       = 10.0 * log10(sumSq / (double)(blocks * kBlock) + 1e-20);
+    return run;
+}
+
+void Usage()
+{
+    fprintf(stderr, "usage: voice_bench [-t seconds] [-B ns]\n");
+    exit(2);
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    double seconds = 2.0;
+    double budget  = 0.0;
+    int    opt;
+    while((opt = getopt(argc, argv, "t:B:h")) != -1)
+    {
+        switch(opt)
+        {
+            case 't': seconds = atof(optarg); break;
+            case 'B': budget = atof(optarg); break;
+            default: Usage();
+        }
+    }
+    if(optind != argc || seconds <= 0.0 || budget < 0.0)
+        Usage();
+
+#if defined(__x86_64__) || defined(__i386__)
+    _mm_setcsr(_mm_getcsr() | 0x8040); // FTZ | DAZ, see governor_sim
+#endif
+
+    const int           maxNotes = Engine::kNumVoices;
+    std::vector<double> best(maxNotes + 1, 0.0), level(maxNotes + 1, 0.0);
+    for(int run = 0; run < kRuns; run++)
+        for(int n = 0; n <= maxNotes; n++)
+        {
+            Run r = Measure(n, seconds);
+            if(run == 0 || r.nsPerSample < best[n])
+                best[n] = r.nsPerSample;
+            level[n] = r.rmsDb; // the same every run
+        }
+
+    printf("%s voices, %d of them, %.0f Hz\n", kVoices, maxNotes, kRate);
+    printf("notes   voice ns/sample   per voice   output dB rms\n");
+    for(int n = 1; n <= maxNotes; n++)
+    {
+        double voices = std::max(0.0, best[n] - best[0]);
+        printf("%5d   %15.1f   %9.1f   %13.1f\n", n, voices, voices / n, level[n]);
+    }
+    printf("full polyphony %.1f ns/sample\n", std::max(0.0, best[maxNotes] - best[0]));
+
+    if(budget > 0.0)
+    {
+        int fit = 0;
+        for(int n = 1; n <= maxNotes; n++)
+            if(best[n] - best[0] <= budget)
+                fit = n;
+        printf("in %.1f ns/sample: %d voices%s\n",
+               budget,
+               fit,
+               fit == maxNotes ? " (all of them)" : "");
+    }
+    return 0;
+}
@@ -3,6 +3,8 @@
 #include <U8g2lib.h>
 #include <Adafruit_MCP23X17.h>
 #include <Adafruit_seesaw.h>
+#include <Adafruit_TinyUSB.h>
+#include <pico/time.h>
 
 #include "midi_protocol.h"
 
@@ -39,9 +41,74 @@ Adafruit_MCP23X17 mcp2;
 // 10 pins per MCP for keys
 const uint8_t MCP_PINS[10] = {7,6,5,4,3, 8,9,10,11,12};
 
+// Both GPIO ports of an MCP23017 in one transaction (IOCON.BANK=0, so GPIOB
+// follows GPIOA). Bit n of the result is MCP pin n, high = released.
+const uint8_t MCP_REG_GPIOA = 0x12;
+
+static bool mcpReadGPIOAB(uint8_t addr, uint16_t &out)
+{
+  Wire.beginTransmission(addr);
+  Wire.write(MCP_REG_GPIOA);
+  if (Wire.endTransmission(false) != 0)
+    return false;
+  if (Wire.requestFrom(addr, (uint8_t)2) != 2)
+    return false;
+  uint8_t a = Wire.read();
+  uint8_t b = Wire.read();
+  out = (uint16_t)a | ((uint16_t)b << 8);
+  return true;
+}
+
+// ------------------------- seesaw boards -----------------------------
+// Thin wrapper so we can issue raw register reads (interrupt flags, encoder
+// deltas) and see whether the I2C transaction actually succeeded.
+class SeesawBoard : public Adafruit_seesaw {
+public:
+  using Adafruit_seesaw::read;
+};
+
+// A seesaw INT output (open drain, active low) can go to a KB2040 GPIO.
+// The line stays low until we read the flagged state, so a cheap local
+// digitalRead tells us whether a board has anything new. The wires are
+// optional (README.md): a pin left at -1 polls that board in slow
+// batches instead. Only set a pin that is actually wired; an unwired
+// pull-up reads high forever and the board is never read.
+const int      PAD_INT_PIN     = -1;        // e.g. KB2040 D5 <- gamepad INT
+const int      ENC_INT_PINS[2] = {-1, -1};  // e.g. D6/D7 <- encoder INTs
+const uint32_t SEESAW_POLL_MS  = 20;        // fallback poll for unwired INT
+
+static inline bool seesawIntAsserted(int pin)
+{
+  return digitalRead(pin) == LOW;
+}
+
+// Read-and-clear the GPIO interrupt flags of a seesaw board.
+static bool seesawReadIntFlags(SeesawBoard &ss, uint32_t &flags)
+{
+  uint8_t buf[4];
+  if (!ss.read(SEESAW_GPIO_BASE, SEESAW_GPIO_INTFLAG, buf, 4))
+    return false;
+  flags = ((uint32_t)buf[0] << 24) | ((uint32_t)buf[1] << 16) |
+          ((uint32_t)buf[2] << 8)  |  (uint32_t)buf[3];
+  return true;
+}
+
+// Read-and-clear the accumulated delta of one encoder (also clears its INT).
+static bool seesawReadEncoderDelta(SeesawBoard &ss, uint8_t enc, int32_t &delta)
+{
+  uint8_t buf[4];
+  if (!ss.read(SEESAW_ENCODER_BASE, SEESAW_ENCODER_DELTA + enc, buf, 4))
+    return false;
+  delta = (int32_t)(((uint32_t)buf[0] << 24) | ((uint32_t)buf[1] << 16) |
+                    ((uint32_t)buf[2] << 8)  |  (uint32_t)buf[3]);
+  return true;
+}
+
 // ------------------------- seesaw Gamepad ----------------------------
-Adafruit_seesaw pad;
-bool            padOK = false;
+SeesawBoard pad;
+bool        padOK = false;
+uint32_t    padButtons    = 0;  // last bulk read, active low
+uint32_t    padLastPollMs = 0;
 
 const uint32_t BTN_X      = (1u << 6);
 const uint32_t BTN_Y      = (1u << 2);
@@ -56,14 +123,18 @@ int joyCenterX = 512;
 int joyCenterY = 512;
 
 // ------------------------- NeoRotary4 encoders -----------------------
-Adafruit_seesaw encBoard[2];
-bool            encBoardOK[2] = {false, false};
+SeesawBoard encBoard[2];
+bool        encBoardOK[2] = {false, false};
 
 // Pushbutton pins on each quad encoder board
-const uint8_t ENC_SWITCH_PINS[4] = {12, 14, 17, 9};
+const uint8_t  ENC_SWITCH_PINS[4] = {12, 14, 17, 9};
+const uint32_t ENC_SWITCH_MASK    = (1u << 12) | (1u << 14) | (1u << 17) | (1u << 9);
+
+// Guard against a corrupted delta read turning into a full-range jump.
+const int32_t  ENC_MAX_DELTA      = 16;
 
-int32_t encPos[2][4];
-bool    encPressed[2][4];
+bool     encPressed[2][4];
+uint32_t encLastPollMs[2] = {0, 0};
 
 // ------------------------- Key order & labels ------------------------
 // bottom row L->R: 4 3 2 1 5 15 14 13 12 11
@@ -87,11 +158,268 @@ static inline uint8_t statusByte(uint8_t base)
   return (uint8_t)(base | ((MidiCh::SYNTH - 1) & 0x0F));
 }
 
-static inline void midiSend3(uint8_t status, uint8_t d1, uint8_t d2)
+// Send stamps for the Daisy's constant-latency mode (MidiStamp in
+// midi_protocol.h). Notes carry the time their key scan read the MCP; a
+// stamp goes out ahead of a note only when it changed, or before the
+// Daisy would consider the last one stale.
+bool     g_sendStamps     = false;
+uint32_t g_stampUs        = 0;      // scan time of the keys being handled
+uint16_t g_lastStamp      = 0xFFFF; // never a valid stamp
+uint32_t g_lastStampTxUs  = 0;
+
+static inline void midiStampAt(uint32_t scanUs)
+{
+  g_stampUs = scanUs;
+}
+
+// Returns the bytes written
+static inline uint8_t midiSendStamp(uint32_t stampUs)
+{
+  uint16_t ticks = (uint16_t)((stampUs >> MidiStamp::UNIT_SHIFT) & MidiStamp::MASK);
+  uint32_t now   = micros();
+  if (ticks == g_lastStamp && now - g_lastStampTxUs < MidiStamp::STALE_US / 2)
+    return 0;
+  Serial1.write(MidiStamp::STATUS);
+  Serial1.write(ticks & 0x7F);
+  Serial1.write((ticks >> 7) & 0x7F);
+  g_lastStamp     = ticks;
+  g_lastStampTxUs = now;
+  return 3;
+}
+
+// ------------------------- USB MIDI device ---------------------------
+// The KB2040 is also a class-compliant MIDI device (Tools > USB Stack:
+// Adafruit TinyUSB), next to the CDC serial port. Keys, encoders and the
+// joystick go to the computer as well as to the Daisy; what the computer
+// sends is merged into the Daisy stream by the transmit queue below.
+Adafruit_USBD_MIDI usbMidi;
+
+struct UsbMidiStats {
+  uint32_t in;          // channel messages from the computer
+  uint32_t inDaisyOnly; // of those, Daisy-only controllers, dropped
+  uint32_t outDrops;    // computer not reading
+};
+UsbMidiStats usbMidiStats = {};
+
+static inline uint8_t midiDataBytes(uint8_t status)
+{
+  return ((status & 0xE0) == 0xC0) ? 1 : 2;  // Cn/Dn take one data byte
+}
+
+static void usbMidiSend(uint8_t status, uint8_t d1, uint8_t d2)
+{
+  if (!TinyUSBDevice.mounted())
+    return;
+  uint8_t packet[4] = {(uint8_t)(status >> 4), status, d1, d2};  // cable 0
+  if (!usbMidi.writePacket(packet))
+    usbMidiStats.outDrops++;
+}
+
+// ------------------------- MIDI transmit queue -----------------------
+// Everything for the Daisy goes through here, in three classes:
+//   local     notes and one-shot controllers (sustain, modes, commands)
+//             from the KB2040 itself: straight to the UART, in order
+//   controls  the KB2040's continuous controllers and bend; a new value
+//             for one that is still waiting replaces it
+//   computer  USB MIDI, in order, its continuous controllers coalesced
+//             the same way in place
+// Controls, then computer messages, are fed to the UART only while it
+// holds less than TX_AHEAD_US of line time, and a computer message only
+// once the last one has left the line. A key press therefore waits behind
+// at most that plus one control, and one computer message (960 us, twice
+// that stamped), however much is queued; computer traffic only fills what
+// the KB2040 leaves idle.
+const uint32_t UART_BYTE_US      = 320;  // 10 bits at 31250 baud
+const uint32_t TX_AHEAD_US       = 400;
+const uint8_t  TX_CONTROL_SLOTS  = 24;
+const uint16_t TX_COMPUTER_SIZE  = 64;   // power of two
+
+struct TxMsg {
+  uint8_t  status, d1, d2;
+  uint32_t stampUs;  // notes: scan (or USB receive) time for the send stamp
+};
+
+TxMsg    txControls[TX_CONTROL_SLOTS];  // oldest first
+uint8_t  txNumControls = 0;
+TxMsg    txComputer[TX_COMPUTER_SIZE];
+uint16_t txComputerHead = 0, txComputerTail = 0;
+uint32_t txLineFreeUs = 0;  // the UART has sent everything written by then
+uint32_t txComputerFreeUs = 0;  // the last computer message has left by then
+
+struct TxStats {
+  uint32_t sent;
+  uint32_t coalesced;          // local values replaced while waiting
+  uint32_t computerCoalesced;
+  uint32_t maxComputerWait;    // messages
+};
+TxStats txStats = {};
+
+// Continuous controllers and bend: only the latest value matters
+static bool txCoalesces(uint8_t status, uint8_t d1)
+{
+  uint8_t kind = status & 0xF0;
+  if (kind == 0xE0 || kind == 0xD0)
+    return true;
+  if (kind != 0xB0)
+    return false;
+  if (d1 == MidiCC::MODWHEEL || d1 == MidiCC::MODWHEEL_LSB || d1 == MidiCC::VOLUME)
+    return true;
+  return d1 >= MidiCC::CUTOFF && d1 <= MidiCC::LOOPER_LEVEL &&
+         d1 != MidiCC::INSTRUMENT_MODE && d1 != MidiCC::LOOPER_CONTROL;
+}
+
+static inline bool txSameControl(const TxMsg &m, uint8_t status, uint8_t d1)
+{
+  return m.status == status && ((status & 0xF0) != 0xB0 || m.d1 == d1);
+}
+
+static void txWrite(const TxMsg &m)
+{
+  uint8_t bytes = 0;
+  if (g_sendStamps && (m.status & 0xE0) == 0x80)  // note on / off
+    bytes += midiSendStamp(m.stampUs);
+  Serial1.write(m.status);
+  Serial1.write(m.d1);
+  if (midiDataBytes(m.status) == 2)
+    Serial1.write(m.d2);
+  bytes += 1 + midiDataBytes(m.status);
+
+  uint32_t now = micros();
+  if ((int32_t)(txLineFreeUs - now) < 0)
+    txLineFreeUs = now;
+  txLineFreeUs += bytes * UART_BYTE_US;
+  txStats.sent++;
+}
+
+static TxMsg txPopControl()
+{
+  TxMsg m = txControls[0];
+  txNumControls--;
+  memmove(txControls, txControls + 1, txNumControls * sizeof(TxMsg));
+  return m;
+}
+
+// The next queued message by class; false if nothing is waiting
+static bool txTake(TxMsg &m)
+{
+  if (txNumControls) {
+    m = txPopControl();
+    return true;
+  }
+  if (txComputerTail != txComputerHead) {
+    m = txComputer[txComputerTail++ & (TX_COMPUTER_SIZE - 1)];
+    return true;
+  }
+  return false;
+}
+
+static inline bool txPending()
+{
+  return txNumControls || txComputerTail != txComputerHead;
+}
+
+// Feeds the UART up to TX_AHEAD_US of line time, one computer message at
+// a time
+void txPump()
+{
+  while ((int32_t)(txLineFreeUs - micros()) <= (int32_t)TX_AHEAD_US) {
+    if (txNumControls) {
+      txWrite(txPopControl());
+    } else if (txComputerTail != txComputerHead &&
+               (int32_t)(txComputerFreeUs - micros()) <= 0) {
+      txWrite(txComputer[txComputerTail++ & (TX_COMPUTER_SIZE - 1)]);
+      txComputerFreeUs = txLineFreeUs;
+    } else {
+      return;
+    }
+  }
+}
+
+// How long until txPump() has something to do (INT32_MAX: nothing queued)
+int32_t txWaitUs(uint32_t nowUs)
 {
-  Serial1.write(status);
-  Serial1.write(d1);
-  Serial1.write(d2);
+  if (!txPending())
+    return INT32_MAX;
+  int32_t wait = (int32_t)(txLineFreeUs - nowUs) - (int32_t)TX_AHEAD_US;
+  if (!txNumControls && (int32_t)(txComputerFreeUs - nowUs) > wait)
+    wait = (int32_t)(txComputerFreeUs - nowUs);
+  return wait > 0 ? wait : 0;
+}
+
+// Everything out now, waiting on the UART FIFO (setup only)
+void txFlushAll()
+{
+  TxMsg m;
+  while (txTake(m))
+    txWrite(m);
+}
+
+// Local messages. The Daisy-only controllers (audio setup, return line,
+// recorder, player) don't go to the computer.
+static void midiSend3(uint8_t status, uint8_t d1, uint8_t d2)
+{
+  TxMsg m = {status, d1, d2, g_stampUs};
+  if (txCoalesces(status, d1)) {
+    bool replaced = false;
+    for (uint8_t i = 0; i < txNumControls && !replaced; ++i) {
+      if (txSameControl(txControls[i], status, d1)) {
+        txControls[i] = m;
+        txStats.coalesced++;
+        replaced = true;
+      }
+    }
+    if (!replaced) {
+      if (txNumControls == TX_CONTROL_SLOTS)
+        txWrite(txPopControl());
+      txControls[txNumControls++] = m;
+    }
+  } else {
+    txWrite(m);
+  }
+
+  if ((status & 0xF0) != 0xB0 || d1 < MidiCC::AUDIO_BLOCK_SIZE)
+    usbMidiSend(status, d1, d2);
+  txPump();
+}
+
+// MIDI from the computer, behind everything local. Packets are only taken
+// while there is room, so a computer sending faster than the line is held
+// off by USB flow control rather than losing messages. Notes are stamped
+// with the time they came in. The Daisy-only controllers are the KB2040's
+// own commands (audio setup, recorder, player, return line): the
+// computer's are dropped, as the KB2040's don't go to the computer.
+void usbMidiPoll(uint32_t nowUs)
+{
+  uint8_t packet[4];
+  while ((uint16_t)(txComputerHead - txComputerTail) < TX_COMPUTER_SIZE &&
+         usbMidi.readPacket(packet)) {
+    uint8_t cin = packet[0] & 0x0F;
+    if (cin < 0x8 || cin > 0xE)
+      continue;  // sysex, system common and real-time
+    usbMidiStats.in++;
+    if ((packet[1] & 0xF0) == 0xB0 && packet[2] >= MidiCC::AUDIO_BLOCK_SIZE) {
+      usbMidiStats.inDaisyOnly++;
+      continue;
+    }
+    TxMsg m = {packet[1], packet[2], packet[3], nowUs};
+
+    bool replaced = false;
+    if (txCoalesces(m.status, m.d1)) {
+      for (uint16_t i = txComputerTail; i != txComputerHead && !replaced; ++i) {
+        TxMsg &w = txComputer[i & (TX_COMPUTER_SIZE - 1)];
+        if (txSameControl(w, m.status, m.d1)) {
+          w = m;
+          txStats.computerCoalesced++;
+          replaced = true;
+        }
+      }
+    }
+    if (!replaced)
+      txComputer[txComputerHead++ & (TX_COMPUTER_SIZE - 1)] = m;
+    uint16_t waiting = (uint16_t)(txComputerHead - txComputerTail);
+    if (waiting > txStats.maxComputerWait)
+      txStats.maxComputerWait = waiting;
+  }
 }
 
 static inline void sendNoteOn(uint8_t note, uint8_t vel)
@@ -117,18 +445,126 @@ static inline void sendPitchBend(int16_t value14)
   midiSend3(statusByte(0xE0), lsb, msb);
 }
 
-// Map analog joystick value to pitchbend 0..16383 around a calibrated center
-int16_t pbFromAnalog(int v, int center, int dead) {
-  int d = v - center;
-  if (abs(d) <= dead)
-    return 8192; // exact center
+// 14-bit mod wheel: CC1 carries the MSB, CC33 the LSB (sent second)
+static inline void sendModWheel(uint16_t value14)
+{
+  value14 = constrain(value14, 0, 16383);
+  sendCC(MidiCC::MODWHEEL,     (value14 >> 7) & 0x7F);
+  sendCC(MidiCC::MODWHEEL_LSB, value14 & 0x7F);
+}
+
+// ------------------------- Joystick pipeline -------------------------
+// Axes are sampled at a fixed rate, smoothed with a one-euro filter (heavy
+// smoothing at rest, almost no lag on fast moves), then mapped to 14-bit
+// pitch bend / mod wheel. Sends are rate limited so bends stay smooth
+// without crowding notes off the 31250 baud link.
+const uint32_t JOY_SAMPLE_US       = 4000;  // 250 Hz
+const int      JOY_DEAD            = 40;    // raw ADC units around center
+const uint32_t PB_MIN_INTERVAL_US  = 8000;
+const int      PB_MIN_CHANGE       = 4;     // 14-bit units
+const uint32_t MOD_MIN_INTERVAL_US = 16000;
+const int      MOD_MIN_CHANGE      = 16;    // 14-bit units
+
+struct OneEuroFilter {
+  float minCutoff;  // Hz, cutoff when the stick is still
+  float beta;       // how fast the cutoff opens up with speed
+  float dCutoff;    // Hz, smoothing of the speed estimate
+  float x;
+  float dx;
+  bool  primed;
+
+  static float alpha(float cutoff, float dt)
+  {
+    float tau = 1.0f / (2.0f * (float)PI * cutoff);
+    return 1.0f / (1.0f + tau / dt);
+  }
+
+  void reset(float v)
+  {
+    x      = v;
+    dx     = 0.0f;
+    primed = true;
+  }
+
+  float filter(float v, float dt)
+  {
+    if (!primed || dt <= 0.0f) {
+      reset(v);
+      return x;
+    }
+    float rawDx = (v - x) / dt;
+    dx += alpha(dCutoff, dt) * (rawDx - dx);
+    float cutoff = minCutoff + beta * fabsf(dx);
+    x += alpha(cutoff, dt) * (v - x);
+    return x;
+  }
+};
+
+OneEuroFilter joyFiltX = {1.5f, 0.01f, 1.0f, 512.0f, 0.0f, false};
+OneEuroFilter joyFiltY = {1.5f, 0.01f, 1.0f, 512.0f, 0.0f, false};
 
-  long out = (long)d * 8192 / 512 + 8192;
-  return (int16_t)constrain(out, 0, 16383);
+uint32_t joyLastSampleUs = 0;
+int16_t  pbLastSent      = 8192;
+uint32_t pbLastSendUs    = 0;
+uint16_t modLastSent     = 0;
+uint32_t modLastSendUs   = 0;
+
+// Filtered axis value -> -1..+1 around a calibrated center. The dead zone
+// is subtracted rather than snapped so leaving it doesn't jump.
+float joyNorm(float v, int center, int dead)
+{
+  float d = v - (float)center;
+  if (fabsf(d) <= (float)dead)
+    return 0.0f;
+  float span = (d > 0.0f) ? (float)(1023 - center - dead) : (float)(center - dead);
+  if (span < 1.0f)
+    return 0.0f;
+  float n = (d > 0.0f ? d - dead : d + dead) / span;
+  return constrain(n, -1.0f, 1.0f);
 }
 
-// ------------------------- Key scan state ----------------------------
-uint16_t prev1 = 0xFFFF, prev2 = 0xFFFF;
+int16_t pbFromNorm(float n)
+{
+  if (n >= 0.0f)
+    return (int16_t)(8192 + (int)(n * 8191.0f + 0.5f));
+  return (int16_t)(8192 - (int)(-n * 8192.0f + 0.5f));
+}
+
+void sampleJoystick(uint32_t nowUs)
+{
+  float dt = (float)(nowUs - joyLastSampleUs) * 1.0e-6f;
+  joyLastSampleUs = nowUs;
+
+  int rawX = 1023 - pad.analogRead(14);
+  int rawY = 1023 - pad.analogRead(15);
+
+  float fx = joyFiltX.filter((float)rawX, dt);
+  float fy = joyFiltY.filter((float)rawY, dt);
+
+  // Pitch bend (X). Returning to center is always sent immediately so the
+  // synth lands exactly in tune.
+  int16_t pb = pbFromNorm(joyNorm(fx, joyCenterX, JOY_DEAD));
+  bool pbCenter = (pb == 8192 && pbLastSent != 8192);
+  if (pbCenter ||
+      (abs(pb - pbLastSent) >= PB_MIN_CHANGE &&
+       nowUs - pbLastSendUs >= PB_MIN_INTERVAL_US)) {
+    sendPitchBend(pb);
+    pbLastSent   = pb;
+    pbLastSendUs = nowUs;
+  }
+
+  // Mod wheel (Y), either direction opens it
+  float    ny  = fabsf(joyNorm(fy, joyCenterY, JOY_DEAD));
+  uint16_t mod = (uint16_t)(ny * 16383.0f + 0.5f);
+  bool modZero = (mod == 0 && modLastSent != 0);
+  if (modZero ||
+      (abs((int)mod - (int)modLastSent) >= MOD_MIN_CHANGE &&
+       nowUs - modLastSendUs >= MOD_MIN_INTERVAL_US)) {
+    sendModWheel(mod);
+    modLastSent   = mod;
+    modLastSendUs = nowUs;
+  }
+}
 
 // ------------------------- Encoder parameter map ---------------------
 const int NUM_ENCODERS        = 8;
@@ -321,10 +757,184 @@ void releaseKey(uint8_t idx)
   ks.pressed = false;
 }
 
+// ------------------------- Return line from the Daisy ---------------
+// The Daisy sends level frames (MidiMeter in midi_protocol.h) about 30
+// times a second on the line back to GP1, and spectrum frames
+// (MidiSpectrum) while the analyzer page has asked for them. taskUI
+// drains the line before each frame. drawMeters() puts the levels in the
+// top-right corner, so only the few OLED chunks under the bars change
+// from one frame to the next. Anything else on the line is skipped.
+const uint32_t METER_STALE_US     = 500000;  // hide the bars after this without a frame
+const uint32_t METER_CLIP_HOLD_US = 1000000; // clip box stays lit this long
+
+uint8_t  meterLevel[2 * MidiMeter::NUM_CHANNELS]; // peak, rms per channel
+uint32_t meterLastUs   = 0;
+uint32_t meterClipUs[2] = {0, 0};                 // last clip on L / R
+bool     meterValid    = false;
+
+uint8_t  spectrumLevel[MidiSpectrum::NUM_BINS];
+uint32_t spectrumLastUs = 0;
+bool     spectrumValid  = false;
+
+uint8_t rxBuf[MidiSpectrum::FRAME_LEN]; // the longer frame
+uint8_t rxLen  = 0; // bytes of the frame so far, 0 = waiting for F0
+uint8_t rxWant = 0; // its length, known from the type byte
+
+void returnFrame(uint32_t nowUs)
+{
+  if (rxBuf[2] == MidiSpectrum::TYPE) {
+    memcpy(spectrumLevel, rxBuf + 3, sizeof(spectrumLevel));
+    spectrumLastUs = nowUs;
+    spectrumValid  = true;
+    return;
+  }
+  memcpy(meterLevel, rxBuf + MidiMeter::HEADER_LEN, sizeof(meterLevel));
+  for (int c = 0; c < 2; ++c) {
+    if (rxBuf[3] & (1u << c))
+      meterClipUs[c] = nowUs;
+  }
+  meterLastUs = nowUs;
+  meterValid  = true;
+}
+
+void returnFeed(uint8_t b, uint32_t nowUs)
+{
+  if (b >= 0xF8)
+    return; // real-time bytes may appear anywhere
+  if (b == 0xF0) {
+    rxBuf[0] = b;
+    rxLen    = 1;
+    return;
+  }
+  if (rxLen == 0)
+    return;
+  rxBuf[rxLen++] = b;
+  if (rxLen == 3) {
+    rxWant = b == MidiMeter::TYPE    ? MidiMeter::FRAME_LEN
+           : b == MidiSpectrum::TYPE ? MidiSpectrum::FRAME_LEN
+                                     : 0;
+  }
+  if (rxLen < 3 || rxLen < rxWant) {
+    if ((b & 0x80) || (rxLen == 2 && b != MidiMeter::SYSEX_ID) ||
+        (rxLen == 3 && rxWant == 0))
+      rxLen = 0;
+    return;
+  }
+  rxLen = 0;
+  if (b == 0xF7)
+    returnFrame(nowUs);
+}
+
+void returnLinePoll(uint32_t nowUs)
+{
+  while (Serial1.available() > 0)
+    returnFeed((uint8_t)Serial1.read(), nowUs);
+}
+
+// In the note card right of the K / N labels, x 93..125: a row per
+// channel, L and R on top, then synth, drums, delay, reverb and looper.
+// Each row is filled to the RMS level with a dot at the peak, 2 dB per
+// pixel over the top 60 dB. A mark left of L / R holds a clip.
+const uint8_t METER_X = 96;
+const uint8_t METER_W = 30;
+
+uint8_t meterPx(uint8_t level)
+{
+  return level > 7 ? (level - 7) / 4 : 0; // 127 (0 dBFS) -> METER_W
+}
+
+void drawMeters(uint32_t nowUs)
+{
+  if (!meterValid || nowUs - meterLastUs > METER_STALE_US)
+    return;
+
+  static const uint8_t y[MidiMeter::NUM_CHANNELS] = {2, 4, 7, 9, 11, 13, 15};
+  for (int c = 0; c < MidiMeter::NUM_CHANNELS; ++c) {
+    uint8_t peak = meterPx(meterLevel[2 * c]);
+    uint8_t rms  = meterPx(meterLevel[2 * c + 1]);
+    if (rms > 0)
+      u8g2.drawHLine(METER_X, y[c], rms);
+    if (peak > 0)
+      u8g2.drawPixel(METER_X + peak - 1, y[c]);
+    if (c < 2 && meterClipUs[c] && nowUs - meterClipUs[c] < METER_CLIP_HOLD_US)
+      u8g2.drawHLine(METER_X - 3, y[c], 2);
+  }
+}
+
+// Analyzer page (START + SELECT). The Daisy only runs its FFT while the
+// page asks for it; the request is repeated if frames stop coming, e.g.
+// after the Daisy was reset.
+const uint32_t SPECTRUM_RETRY_US = 1000000;
+
+bool     spectrumPage      = false;
+uint32_t spectrumRequestUs = 0;
+uint8_t  spectrumHold[MidiSpectrum::NUM_BINS]; // peak-hold dots, px
+
+void setSpectrumPage(bool on)
+{
+  spectrumPage  = on;
+  spectrumValid = false;
+  memset(spectrumHold, 0, sizeof(spectrumHold));
+  sendCC(MidiCC::SPECTRUM, on ? 127 : 0);
+  spectrumRequestUs = micros();
+}
+
+void spectrumKeepAlive(uint32_t nowUs)
+{
+  if (!spectrumPage || nowUs - spectrumRequestUs < SPECTRUM_RETRY_US)
+    return;
+  if (spectrumValid && nowUs - spectrumLastUs < METER_STALE_US)
+    return;
+  sendCC(MidiCC::SPECTRUM, 127);
+  spectrumRequestUs = nowUs;
+}
+
+// x of the low edge of a frequency on the bar graph
+int spectrumX(float hz)
+{
+  float b = MidiSpectrum::NUM_BINS * logf(hz / MidiSpectrum::LOW_HZ) /
+            logf(MidiSpectrum::HIGH_HZ / MidiSpectrum::LOW_HZ);
+  return 4 + (int)(b * 3.0f);
+}
+
+// A 2 px bar per band, 3 px apart, over the top 60 dB (1.25 dB per
+// pixel), with a dot that holds the peak and falls 1 px a frame
+void drawSpectrumPage(uint32_t nowUs)
+{
+  u8g2.clearBuffer();
+  u8g2.setFont(u8g2_font_4x6_tf);
+  u8g2.drawStr(0, 6, "SPECTRUM");
+
+  if (!spectrumValid || nowUs - spectrumLastUs > METER_STALE_US) {
+    u8g2.drawStr(48, 34, "no data");
+    return;
+  }
+
+  const uint8_t bottom = 56;
+  for (int b = 0; b < MidiSpectrum::NUM_BINS; ++b) {
+    uint8_t level = spectrumLevel[b];
+    uint8_t h     = level > 67 ? (level - 67) * 4 / 5 : 0; // 0..48 px
+    int     x     = 4 + 3 * b;
+    if (h > 0)
+      u8g2.drawBox(x, bottom - h, 2, h);
+    if (h >= spectrumHold[b])
+      spectrumHold[b] = h;
+    else
+      spectrumHold[b]--;
+    if (spectrumHold[b] > 0)
+      u8g2.drawHLine(x, bottom - spectrumHold[b] - 1, 2);
+  }
+  u8g2.drawHLine(0, bottom + 1, 128);
+  u8g2.drawStr(spectrumX(100.0f) - 2, 64, "100");
+  u8g2.drawStr(spectrumX(1000.0f) - 2, 64, "1k");
+  u8g2.drawStr(spectrumX(10000.0f) - 6, 64, "10k");
+}
+
 // ------------------------- OLED UI -----------------------------------
 bool looperRecordingUI = false;
 bool looperPlayingUI   = false;
 bool looperHasLoopUI   = false;
+bool recordingUI       = false; // Daisy's SD recorder (START + Y)
 
 void drawUI(bool keyActive, uint8_t keyLabel, uint8_t midiNote)
 {
@@ -359,6 +969,7 @@ void drawUI(bool keyActive, uint8_t keyLabel, uint8_t midiNote)
     u8g2.drawStr(68, 12, "K--");
     u8g2.drawStr(68, 16, "N---");
   }
+  drawMeters(micros());
 
   // DFU / RST flash inside the note card, top-right
   if (dfuFlash) {
@@ -398,6 +1009,8 @@ void drawUI(bool keyActive, uint8_t keyLabel, uint8_t midiNote)
 
   snprintf(line, sizeof(line), "M:%s V:%s L:%s", mname, varName, loopState);
   u8g2.drawStr(2, 28, line);
+  if (recordingUI)
+    u8g2.drawDisc(125, 23, 2);
 
   // --- Parameters grid (4 rows x 2 params) ---------------------------
   int y = 38;
@@ -424,8 +1037,55 @@ void drawUI(bool keyActive, uint8_t keyLabel, uint8_t midiNote)
     u8g2.drawStr(2, y, line);
     y += dy;
   }
+}
 
-  u8g2.sendBuffer();
+// The full 1 KB buffer takes ~25 ms to clock out at 400 kHz, which would
+// stall key scanning. Instead the frame goes out in small chunks, one per
+// scheduler slot, and only chunks that differ from what the panel already
+// shows are sent at all. A mostly static screen costs almost no bus time.
+const uint8_t  OLED_TILES_W     = 16;  // 128 px / 8
+const uint8_t  OLED_TILES_H     = 8;   //  64 px / 8
+const uint8_t  OLED_CHUNK_TILES = 4;   // 32 bytes, well under 1 ms on the bus
+const uint16_t OLED_NUM_CHUNKS  = (OLED_TILES_W / OLED_CHUNK_TILES) * OLED_TILES_H;
+
+uint8_t  oledShadow[OLED_TILES_W * OLED_TILES_H * 8]; // what the panel shows
+uint16_t oledFlushChunkIdx = OLED_NUM_CHUNKS;         // == done
+
+bool oledFlushPending()
+{
+  return oledFlushChunkIdx < OLED_NUM_CHUNKS;
+}
+
+void oledStartFlush()
+{
+  oledFlushChunkIdx = 0;
+}
+
+// Sync the shadow after a blocking full sendBuffer()
+void oledSyncShadow()
+{
+  memcpy(oledShadow, u8g2.getBufferPtr(), sizeof(oledShadow));
+  oledFlushChunkIdx = OLED_NUM_CHUNKS;
+}
+
+// Send the next dirty chunk of the current frame, if any
+void oledFlushChunk()
+{
+  const uint8_t *buf = u8g2.getBufferPtr();
+  const uint16_t chunkBytes = OLED_CHUNK_TILES * 8;
+
+  while (oledFlushPending()) {
+    uint16_t c  = oledFlushChunkIdx++;
+    uint8_t  ty = c / (OLED_TILES_W / OLED_CHUNK_TILES);
+    uint8_t  tx = (c % (OLED_TILES_W / OLED_CHUNK_TILES)) * OLED_CHUNK_TILES;
+    // Full-buffer layout: one 128-byte row per tile row, 8 bytes per tile
+    uint16_t off = (uint16_t)ty * OLED_TILES_W * 8 + (uint16_t)tx * 8;
+    if (memcmp(buf + off, oledShadow + off, chunkBytes) == 0)
+      continue;
+    u8g2.updateDisplayArea(tx, ty, OLED_CHUNK_TILES, 1);
+    memcpy(oledShadow + off, buf + off, chunkBytes);
+    return;
+  }
 }
 
 // ------------------------- Gamepad button edge tracking --------------
@@ -440,200 +1100,196 @@ bool     startPressing     = false;
 uint32_t startPressStartMs = 0;
 const uint32_t LOOP_CLEAR_MS = 700;
 
-// ------------------------- setup() -----------------------------------
-void setup()
-{
-  Serial1.setTX(0);       // GP0 TX -> Daisy D14 (USART1 RX)
-  Serial1.setRX(1);       // GP1 RX (unused)
-  Serial1.begin(31250);   // MIDI baud
-
-  pinMode(BOOT_SW_PIN, INPUT_PULLUP);
-  pinMode(DAISY_RST_PIN,  INPUT);
-  pinMode(DAISY_BOOT_PIN, INPUT);
-  pinMode(LED_BUILTIN,    OUTPUT);
-  digitalWrite(LED_BUILTIN, LOW);
+// ------------------------- Instrumentation ---------------------------
+// Cheap always-on counters and log2 histograms, in microseconds from
+// micros(). Shown on the debug page (hold START, press A) and dumped over
+// USB serial ('d' = dump, 'r' = reset).
+const uint8_t HIST_BUCKETS = 16; // bucket i = [2^i, 2^(i+1)) us, last is open
 
-  Wire.begin();
-  Wire.setClock(400000);
+struct Histogram {
+  uint32_t bucket[HIST_BUCKETS];
+  uint32_t count;
+  uint32_t maxUs;
 
-  for (int i = 0; i < 20; ++i) {
-    keyState[i].pressed = false;
-    keyState[i].count   = 0;
+  void reset()
+  {
+    memset(bucket, 0, sizeof(bucket));
+    count = 0;
+    maxUs = 0;
   }
-  updateNoteMap();
-
-  u8g2.setI2CAddress(OLED_ADDR << 1);
-  u8g2.begin();
-  u8g2.clearBuffer();
-  u8g2.setFont(u8g2_font_6x10_tf);
-  u8g2.drawStr(0, 12, "Init KB2040 POLY");
-  u8g2.sendBuffer();
-  delay(300);
 
-  // MCPs (keys)
-  if (mcp1.begin_I2C(MCP1_ADDR)) {
-    for (uint8_t i = 0; i < 10; i++)
-      mcp1.pinMode(MCP_PINS[i], INPUT_PULLUP);
-  }
-  if (mcp2.begin_I2C(MCP2_ADDR)) {
-    for (uint8_t i = 0; i < 10; i++)
-      mcp2.pinMode(MCP_PINS[i], INPUT_PULLUP);
+  void add(uint32_t us)
+  {
+    int b = us ? 31 - __builtin_clz(us) : 0;
+    if (b >= HIST_BUCKETS) b = HIST_BUCKETS - 1;
+    bucket[b]++;
+    count++;
+    if (us > maxUs) maxUs = us;
   }
 
-  // Gamepad
-  if (pad.begin(GAMEPAD_ADDR)) {
-    pad.pinModeBulk(BUTTON_MASK, INPUT_PULLUP);
-    padOK = true;
-
-    long sumX = 0;
-    long sumY = 0;
-    const int samples = 64;
-    for (int i = 0; i < samples; ++i) {
-      int rawX = 1023 - pad.analogRead(14);
-      int rawY = 1023 - pad.analogRead(15);
-      sumX += rawX;
-      sumY += rawY;
-      delay(2);
+  // Upper edge of the bucket holding the p-th percentile (p = 0..100)
+  uint32_t percentileUs(uint8_t p) const
+  {
+    if (count == 0) return 0;
+    uint32_t target = (count * p + 99) / 100;
+    uint32_t seen   = 0;
+    for (int b = 0; b < HIST_BUCKETS - 1; ++b) {
+      seen += bucket[b];
+      if (seen >= target && seen > 0)
+        return min((uint32_t)1u << (b + 1), maxUs);
     }
-    joyCenterX = (int)(sumX / samples);
-    joyCenterY = (int)(sumY / samples);
-
-    // Initialize button prev states (not pressed = false because we use "nowX" as active state)
-    btnPrevX     = false;
-    btnPrevY     = false;
-    btnPrevA     = false;
-    btnPrevB     = false;
-    btnPrevSEL   = false;
-    btnPrevSTART = false;
-  } else {
-    padOK = false;
+    return maxUs;
   }
+};
 
-  // Encoders
-  if (encBoard[0].begin(ENC1_ADDR)) {
-    encBoardOK[0] = true;
-    for (int i = 0; i < 4; i++) {
-      encBoard[0].pinMode(ENC_SWITCH_PINS[i], INPUT_PULLUP);
-      encPressed[0][i] = false;
-    }
-    for (int e = 0; e < 4; e++)
-      encPos[0][e] = encBoard[0].getEncoderPosition(e);
-  }
+Histogram histScanPeriod;   // key scan start -> next key scan start
+Histogram histKeyLatency;   // scan read start -> last MIDI byte queued
 
-  if (encBoard[1].begin(ENC2_ADDR)) {
-    encBoardOK[1] = true;
-    for (int i = 0; i < 4; i++) {
-      encBoard[1].pinMode(ENC_SWITCH_PINS[i], INPUT_PULLUP);
-      encPressed[1][i] = false;
-    }
-    for (int e = 0; e < 4; e++)
-      encPos[1][e] = encBoard[1].getEncoderPosition(e);
-  }
+// Failed I2C transactions per device
+struct I2cErrors {
+  uint32_t mcp[2];
+  uint32_t enc[2];
+  uint32_t pad;
+};
+I2cErrors i2cErrors = {};
 
-  // Initial param CCs
-  for (int enc = 0; enc < NUM_ENCODERS; ++enc) {
-    for (int slot = 0; slot < PARAMS_PER_ENCODER; ++slot)
-      sendCC(encoderParams[enc].cc[slot], encoderParams[enc].value[slot]);
-  }
+bool debugPage = false;
 
-  // Ensure synth starts in voice mode
-  sendCC(MidiCC::INSTRUMENT_MODE, 0);
-  sendCC(MidiCC::LOOPER_CONTROL, 0);
+// ------------------------- Tasks -------------------------------------
+// Everything the UI does is a periodic task run by the small cooperative
+// scheduler below. Tasks must return quickly (no delay(), no full-screen
+// OLED sends) so the key scan can hold its 1 kHz rate.
 
-  delay(200);
-  pulseDaisyReset();
-}
+// Keys via MCPs: one two-byte read per chip
+uint16_t prev1 = 0xFFFF, prev2 = 0xFFFF;
 
-// ------------------------- loop() ------------------------------------
-void loop()
+void scanKeyBank(uint16_t now, uint16_t prev, uint8_t firstIdx, uint32_t readStartUs)
 {
-  uint32_t nowMs = millis();
-
-  // -------- Keys via MCPs --------
-  uint16_t mask1 = 0, mask2 = 0;
-  for (uint8_t i = 0; i < 10; i++) {
-    bool s1 = mcp1.digitalRead(MCP_PINS[i]); // high = released
-    bool s2 = mcp2.digitalRead(MCP_PINS[i]);
-    if (s1) mask1 |= (1u << i);
-    if (s2) mask2 |= (1u << i);
-  }
-
-  // MCP1 -> indices 0..9 (bottom row)
   for (uint8_t i = 0; i < 10; i++) {
-    bool nowPressed  = ((mask1 & (1u << i)) == 0);
-    bool prevPressed = ((prev1 & (1u << i)) == 0);
+    uint16_t bit     = (uint16_t)(1u << MCP_PINS[i]);
+    bool nowPressed  = ((now  & bit) == 0);
+    bool prevPressed = ((prev & bit) == 0);
+    uint8_t idx = firstIdx + i;
     if (nowPressed && !prevPressed) {
-      uint8_t idx = i;
       lastKeyIdx  = idx;
       lastKeyMidi = noteForIndex[idx];
+      midiStampAt(readStartUs);
       playKey(idx, 100);
+      // The press itself happened up to one scan period before the read
+      histKeyLatency.add(micros() - readStartUs);
     } else if (!nowPressed && prevPressed) {
-      uint8_t idx = i;
+      midiStampAt(readStartUs);
       releaseKey(idx);
     }
   }
+}
 
-  // MCP2 -> indices 10..19 (top row)
-  for (uint8_t i = 0; i < 10; i++) {
-    bool nowPressed  = ((mask2 & (1u << i)) == 0);
-    bool prevPressed = ((prev2 & (1u << i)) == 0);
-    if (nowPressed && !prevPressed) {
-      uint8_t idx = 10 + i;
-      lastKeyIdx  = idx;
-      lastKeyMidi = noteForIndex[idx];
-      playKey(idx, 100);
-    } else if (!nowPressed && prevPressed) {
-      uint8_t idx = 10 + i;
-      releaseKey(idx);
-    }
+void taskKeys(uint32_t nowUs)
+{
+  static uint32_t lastScanUs = 0;
+  if (lastScanUs != 0)
+    histScanPeriod.add(nowUs - lastScanUs);
+  lastScanUs = nowUs;
+
+  uint16_t gpio;
+  uint32_t t0;
+
+  // A failed read keeps the previous state rather than faking releases.
+  // MCP1 -> indices 0..9 (bottom row), MCP2 -> 10..19 (top row)
+  t0 = micros();
+  if (mcpReadGPIOAB(MCP1_ADDR, gpio)) {
+    scanKeyBank(gpio, prev1, 0, t0);
+    prev1 = gpio;
+  } else {
+    i2cErrors.mcp[0]++;
   }
+  t0 = micros();
+  if (mcpReadGPIOAB(MCP2_ADDR, gpio)) {
+    scanKeyBank(gpio, prev2, 10, t0);
+    prev2 = gpio;
+  } else {
+    i2cErrors.mcp[1]++;
+  }
+}
+
+// Encoders -> CC params
+void taskEncoders(uint32_t nowUs)
+{
+  (void)nowUs;
+  uint32_t nowMs = millis();
 
-  prev1 = mask1;
-  prev2 = mask2;
+  // One batch per board, and only when its INT line says something moved:
+  // four delta reads (each clears that encoder's flag), the GPIO flags, and
+  // one bulk switch read if a switch changed. A board without the INT wire
+  // gets the same batch every SEESAW_POLL_MS, one such board per pass so
+  // the key scan isn't held up behind both.
+  bool polled = false;
+  for (int b = 0; b < 2; ++b) {
+    if (!encBoardOK[b]) continue;
 
-  // -------- Gamepad (joystick + buttons) --------
-  int      joyX  = joyCenterX;
-  int      joyY  = joyCenterY;
-  uint32_t bmask = BUTTON_MASK;
+    bool due = (ENC_INT_PINS[b] >= 0) ? seesawIntAsserted(ENC_INT_PINS[b])
+                                      : (!polled && nowMs - encLastPollMs[b] >= SEESAW_POLL_MS);
+    if (!due) continue;
+    encLastPollMs[b] = nowMs;
+    polled = polled || ENC_INT_PINS[b] < 0;
 
-  if (padOK) {
-    joyX  = 1023 - pad.analogRead(14);
-    joyY  = 1023 - pad.analogRead(15);
-    bmask = pad.digitalReadBulk(BUTTON_MASK);
-  }
+    for (int e = 0; e < 4; ++e) {
+      int32_t delta = 0;
+      if (!seesawReadEncoderDelta(encBoard[b], e, delta)) {
+        i2cErrors.enc[b]++;
+        continue;
+      }
+      if (delta == 0)
+        continue;
+      // Keep the whole delta: a fast spin moves the value proportionally
+      // instead of being squashed to a single step per pass.
+      delta = constrain(delta, -ENC_MAX_DELTA, ENC_MAX_DELTA);
+      bumpEncoderValue(b * 4 + e, (int)delta);
+    }
 
-  // Pitch bend with calibrated center + deadzone
-  static int16_t lastPB = 8192;
-  int16_t pb = 8192;
-  if (padOK) {
-    const int deadX = 40;
-    pb = pbFromAnalog(joyX, joyCenterX, deadX);
-  }
-  if (abs(pb - lastPB) > 32) {
-    sendPitchBend(pb);
-    lastPB = pb;
-  }
+    uint32_t flags = 0;
+    if (!seesawReadIntFlags(encBoard[b], flags))
+      i2cErrors.enc[b]++;
+    else if (!(flags & ENC_SWITCH_MASK))
+      continue;
 
-  // Mod wheel (CC1) from Y, centered deadzone
-  static uint8_t lastMod = 255;
-  uint8_t mod = 0;
-  if (padOK) {
-    int dy = joyY - joyCenterY;
-    const int deadY = 40;
-    if (abs(dy) <= deadY) {
-      mod = 0;
-    } else {
-      float norm = (float)(abs(dy) - deadY) /
-                   (float)(1023 - joyCenterY - deadY);
-      if (norm < 0.0f) norm = 0.0f;
-      if (norm > 1.0f) norm = 1.0f;
-      mod = (uint8_t)(norm * 127.0f + 0.5f);
+    uint32_t sw = encBoard[b].digitalReadBulk(ENC_SWITCH_MASK);
+    for (int e = 0; e < 4; ++e) {
+      bool pressed = !(sw & (1u << ENC_SWITCH_PINS[e]));
+      if (pressed && !encPressed[b][e]) {
+        encPressed[b][e] = true;
+        int p = b * 4 + e;
+        EncoderParam &cfg = encoderParams[p];
+        cfg.active = (cfg.active + 1) % PARAMS_PER_ENCODER;
+        sendCC(cfg.cc[cfg.active], cfg.value[cfg.active]);
+      } else if (!pressed && encPressed[b][e]) {
+        encPressed[b][e] = false;
+      }
     }
   }
-  if (abs((int)mod - (int)lastMod) > 2) {
-    sendCC(MidiCC::MODWHEEL, mod);
-    lastMod = mod;
-  }
+}
+
+// Gamepad: joystick pipeline + buttons
+void taskGamepad(uint32_t nowUs)
+{
+  if (!padOK)
+    return;
+
+  uint32_t nowMs = millis();
+  sampleJoystick(nowUs);
+
+  // Buttons: only touch the bus when the pad flags a change (or on the
+  // slow fallback poll if its INT line isn't wired).
+  bool due = (PAD_INT_PIN >= 0) ? seesawIntAsserted(PAD_INT_PIN)
+                                : (nowMs - padLastPollMs >= SEESAW_POLL_MS);
+  if (!due)
+    return;
+  uint32_t flags;
+  if (!seesawReadIntFlags(pad, flags))
+    i2cErrors.pad++;
+  padButtons    = pad.digitalReadBulk(BUTTON_MASK);
+  padLastPollMs = nowMs;
+  uint32_t bmask = padButtons;
 
   // Buttons active-low -> "now pressed" flags
   bool nowX     = !(bmask & BTN_X);
@@ -647,12 +1303,29 @@ void loop()
   if (nowX && !btnPrevX) {
     sendCC(MidiCC::SUSTAIN_PEDAL, 127);
   }
-  if (nowYb && !btnPrevY) {
+  // START held + Y: start/stop recording master out to the Daisy's SD
+  // card (24-bit WAV), instead of sustain off
+  if (nowYb && !btnPrevY && nowStart) {
+    recordingUI   = !recordingUI;
+    startPressing = false;
+    sendCC(MidiCC::RECORD, recordingUI ? 127 : 0);
+  } else if (nowYb && !btnPrevY) {
     sendCC(MidiCC::SUSTAIN_PEDAL, 0);
   }
 
+  // START held + A: toggle the debug page (and swallow both actions)
+  if (nowA && !btnPrevA && nowStart) {
+    debugPage     = !debugPage;
+    startPressing = false;
+  }
+  // START held + B: toggle send stamps (constant-latency mode on the Daisy)
+  else if (nowB && !btnPrevB && nowStart) {
+    g_sendStamps  = !g_sendStamps;
+    startPressing = false;
+    btnPrevB      = true; // not also a chord/scale change below
+  }
   // A: cycle play modes (single -> chord -> scale -> drum)
-  if (nowA && !btnPrevA) {
+  else if (nowA && !btnPrevA) {
     g_playMode = (PlayMode)((((int)g_playMode) + 1) % NUM_PLAY_MODES);
     updateNoteMap();
     lastKeyIdx  = -1;
@@ -675,6 +1348,14 @@ void loop()
     }
   }
 
+  // START held + SELECT: toggle the analyzer page (not also a looper
+  // record)
+  if (nowSel && !btnPrevSEL && nowStart) {
+    setSpectrumPage(!spectrumPage);
+    startPressing = false;
+    btnPrevSEL    = true;
+  }
+
   // SELECT: toggle looper record
   if (nowSel && !btnPrevSEL) {
     if (!looperRecordingUI) {
@@ -719,34 +1400,14 @@ void loop()
   btnPrevB     = nowB;
   btnPrevSEL   = nowSel;
   btnPrevSTART = nowStart;
+}
 
-  // -------- Encoders -> CC params --------
-  for (int b = 0; b < 2; ++b) {
-    if (!encBoardOK[b]) continue;
-    for (int e = 0; e < 4; ++e) {
-      int32_t newPos = encBoard[b].getEncoderPosition(e);
-      int32_t delta  = newPos - encPos[b][e];
-      if (delta != 0) {
-        encPos[b][e] = newPos;
-        int step = (delta > 0) ? 1 : -1;
-        int p    = b * 4 + e; // 0..7
-        bumpEncoderValue(p, step);
-      }
-
-      bool pressed = !encBoard[b].digitalRead(ENC_SWITCH_PINS[e]);
-      if (pressed && !encPressed[b][e]) {
-        encPressed[b][e] = true;
-        int p = b * 4 + e;
-        EncoderParam &cfg = encoderParams[p];
-        cfg.active = (cfg.active + 1) % PARAMS_PER_ENCODER;
-        sendCC(cfg.cc[cfg.active], cfg.value[cfg.active]);
-      } else if (!pressed && encPressed[b][e]) {
-        encPressed[b][e] = false;
-      }
-    }
-  }
+// A1 short/long: short = Daisy reset, long = Daisy DFU
+void taskBootButton(uint32_t nowUs)
+{
+  (void)nowUs;
+  uint32_t nowMs = millis();
 
-  // -------- A1 short/long: short = Daisy reset, long = Daisy DFU --------
   bool bootNowLow = (digitalRead(BOOT_SW_PIN) == LOW);
 
   if (bootNowLow && !bootPressed) {
@@ -770,15 +1431,403 @@ void loop()
     }
     bootPressed = false;
   }
+}
 
-  // -------- OLED --------
-  bool    hasKey  = (lastKeyIdx >= 0);
-  uint8_t klabel  = hasKey ? displayLabels[lastKeyIdx] : 0;
-  uint8_t kmidi   = hasKey ? lastKeyMidi               : 0;
-  drawUI(hasKey, klabel, kmidi);
+// OLED: render a frame into the buffer; the flush task clocks it out
+void drawDebugPage();
+
+void taskUI(uint32_t nowUs)
+{
+  returnLinePoll(nowUs);
+  spectrumKeepAlive(nowUs);
+  if (oledFlushPending())
+    return; // previous frame still going out, skip this one
+
+  if (debugPage) {
+    drawDebugPage();
+  } else if (spectrumPage) {
+    drawSpectrumPage(nowUs);
+  } else {
+    bool    hasKey  = (lastKeyIdx >= 0);
+    uint8_t klabel  = hasKey ? displayLabels[lastKeyIdx] : 0;
+    uint8_t kmidi   = hasKey ? lastKeyMidi               : 0;
+    drawUI(hasKey, klabel, kmidi);
+  }
+  oledStartFlush();
 
   dfuFlash = false;
   rstFlash = false;
+}
+
+void taskOledFlush(uint32_t nowUs)
+{
+  (void)nowUs;
+  oledFlushChunk();
+}
+
+// USB serial commands: 'd' dumps the stats, 'r' resets them, 't' toggles
+// send stamps, 'b' / 's' step the Daisy's audio block size / sample rate
+// (MidiAudio; the Daisy stores them and uses them from its next boot)
+void dumpStats();
+void resetStats();
+
+uint8_t g_audioBlock = MidiAudio::DEFAULT_BLOCK_SIZE;
+uint8_t g_audioRate  = MidiAudio::DEFAULT_SAMPLE_RATE;
+
+void sendAudioSetup()
+{
+  sendCC(MidiCC::AUDIO_BLOCK_SIZE, g_audioBlock);
+  sendCC(MidiCC::AUDIO_SAMPLE_RATE, g_audioRate);
+  Serial.printf("daisy audio block=%u rate=%lu (after its next reset)\n",
+                (unsigned)MidiAudio::BLOCK_SIZES[g_audioBlock],
+                (unsigned long)MidiAudio::SAMPLE_RATES[g_audioRate]);
+}
 
-  delay(6);
+void taskSerial(uint32_t nowUs)
+{
+  (void)nowUs;
+  while (Serial.available() > 0) {
+    int c = Serial.read();
+    if (c == 'd')
+      dumpStats();
+    else if (c == 'r')
+      resetStats();
+    else if (c == 't') {
+      g_sendStamps = !g_sendStamps;
+      Serial.printf("stamps %s\n", g_sendStamps ? "on" : "off");
+    }
+    else if (c == 'b') {
+      g_audioBlock = (g_audioBlock + 1) % MidiAudio::NUM_BLOCK_SIZES;
+      sendAudioSetup();
+    }
+    else if (c == 's') {
+      g_audioRate = (g_audioRate + 1) % MidiAudio::NUM_SAMPLE_RATES;
+      sendAudioSetup();
+    }
+  }
+}
+
+// ------------------------- Scheduler ---------------------------------
+// Fixed-rate tasks in priority order. Each pass runs the most urgent task
+// that is due, so a slow task never delays the key scan by more than its
+// own run time. A task that starts a whole period late has missed its
+// deadline; it is counted and its release is resynchronised instead of
+// bursting to catch up. The MIDI line is fed (txPump) after every task;
+// with nothing due, computer MIDI is picked up as well, then the core
+// sleeps until the next release or until the line runs low. The key scan
+// guarantees a pass at least every millisecond, the USB frame rate.
+struct Task {
+  const char* name;
+  void      (*fn)(uint32_t nowUs);
+  uint32_t    periodUs;
+  uint32_t    nextUs;
+  uint32_t    misses;     // releases started >= one period late
+  uint32_t    maxLateUs;  // worst start lateness seen
+  uint32_t    runs;
+  uint32_t    totalRunUs;
+  uint32_t    maxRunUs;
+};
+
+Task tasks[] = {
+  { "keys",  taskKeys,        1000,  0, 0, 0, 0, 0, 0 },  // 1 kHz
+  { "enc",   taskEncoders,    2000,  0, 0, 0, 0, 0, 0 },  // 500 Hz
+  { "joy",   taskGamepad,     JOY_SAMPLE_US, 0, 0, 0, 0, 0, 0 },  // 250 Hz
+  { "boot",  taskBootButton,  20000, 0, 0, 0, 0, 0, 0 },  // 50 Hz
+  { "flush", taskOledFlush,   1000,  0, 0, 0, 0, 0, 0 },  // one dirty OLED chunk per ms
+  { "ui",    taskUI,          33333, 0, 0, 0, 0, 0, 0 },  // 30 Hz
+  { "ser",   taskSerial,      50000, 0, 0, 0, 0, 0, 0 },  // 20 Hz
+};
+const int NUM_TASKS = sizeof(tasks) / sizeof(tasks[0]);
+
+// Don't bother sleeping for less than this; the wake-up costs more.
+const uint32_t SCHED_MIN_SLEEP_US = 50;
+
+void schedulerResetStats()
+{
+  for (int t = 0; t < NUM_TASKS; ++t) {
+    tasks[t].misses     = 0;
+    tasks[t].maxLateUs  = 0;
+    tasks[t].runs       = 0;
+    tasks[t].totalRunUs = 0;
+    tasks[t].maxRunUs   = 0;
+  }
+}
+
+void schedulerStart(uint32_t nowUs)
+{
+  for (int t = 0; t < NUM_TASKS; ++t)
+    tasks[t].nextUs = nowUs;
+  schedulerResetStats();
+}
+
+void schedulerRunOnce()
+{
+  uint32_t nowUs = micros();
+
+  for (int t = 0; t < NUM_TASKS; ++t) {
+    Task &task = tasks[t];
+    int32_t late = (int32_t)(nowUs - task.nextUs);
+    if (late < 0)
+      continue;
+
+    if ((uint32_t)late > task.maxLateUs)
+      task.maxLateUs = (uint32_t)late;
+    if ((uint32_t)late >= task.periodUs) {
+      task.misses++;
+      task.nextUs = nowUs + task.periodUs;
+    } else {
+      task.nextUs += task.periodUs;
+    }
+
+    task.fn(nowUs);
+
+    uint32_t run = micros() - nowUs;
+    task.runs++;
+    task.totalRunUs += run;
+    if (run > task.maxRunUs) task.maxRunUs = run;
+    txPump();
+    return;
+  }
+
+  // Nothing due: feed the line, then sleep until the earliest release or
+  // until the line wants more
+  usbMidiPoll(nowUs);
+  txPump();
+  int32_t wait = txWaitUs(micros());
+  for (int t = 0; t < NUM_TASKS; ++t) {
+    int32_t d = (int32_t)(tasks[t].nextUs - nowUs);
+    if (d < wait) wait = d;
+  }
+  if (wait >= (int32_t)SCHED_MIN_SLEEP_US)
+    sleep_us((uint64_t)wait);
+}
+
+// ------------------------- Debug page & stats dump -------------------
+void resetStats()
+{
+  histScanPeriod.reset();
+  histKeyLatency.reset();
+  memset(&i2cErrors, 0, sizeof(i2cErrors));
+  memset(&txStats, 0, sizeof(txStats));
+  memset(&usbMidiStats, 0, sizeof(usbMidiStats));
+  schedulerResetStats();
+}
+
+void drawDebugPage()
+{
+  u8g2.clearBuffer();
+  u8g2.setFont(u8g2_font_4x6_tf);
+  char line[80];  // every counter at its widest; the panel clips at 32
+  int  y = 6;
+
+  u8g2.drawStr(0, y, "task   avg   max  late miss");
+  y += 6;
+  for (int t = 0; t < NUM_TASKS; ++t) {
+    const Task &task = tasks[t];
+    unsigned long avg = task.runs ? task.totalRunUs / task.runs : 0;
+    snprintf(line, sizeof(line), "%-5.5s %5lu %5lu %5lu %4lu", task.name, avg,
+             (unsigned long)task.maxRunUs, (unsigned long)task.maxLateUs,
+             (unsigned long)task.misses);
+    u8g2.drawStr(0, y, line);
+    y += 6;
+  }
+
+  // p50 / p99 upper bounds
+  snprintf(line, sizeof(line), "scan<%lu/%lu key>midi<%lu/%lu",
+           (unsigned long)histScanPeriod.percentileUs(50),
+           (unsigned long)histScanPeriod.percentileUs(99),
+           (unsigned long)histKeyLatency.percentileUs(50),
+           (unsigned long)histKeyLatency.percentileUs(99));
+  u8g2.drawStr(0, y, line);
+  y += 6;
+
+  snprintf(line, sizeof(line), "i2c err mcp %lu/%lu enc %lu/%lu pad %lu",
+           (unsigned long)i2cErrors.mcp[0], (unsigned long)i2cErrors.mcp[1],
+           (unsigned long)i2cErrors.enc[0], (unsigned long)i2cErrors.enc[1],
+           (unsigned long)i2cErrors.pad);
+  u8g2.drawStr(0, y, line);
+}
+
+void dumpHistogram(const char* name, const Histogram &h)
+{
+  Serial.printf("hist %s count=%lu max=%lu p50<%lu p90<%lu p99<%lu\n", name,
+                (unsigned long)h.count, (unsigned long)h.maxUs,
+                (unsigned long)h.percentileUs(50),
+                (unsigned long)h.percentileUs(90),
+                (unsigned long)h.percentileUs(99));
+  for (int b = 0; b < HIST_BUCKETS; ++b) {
+    if (h.bucket[b] == 0) continue;
+    Serial.printf("  [%lu..%lu) %lu\n", 1ul << b, 1ul << (b + 1),
+                  (unsigned long)h.bucket[b]);
+  }
+}
+
+// One line per item, easy to grep / paste into a spreadsheet
+void dumpStats()
+{
+  Serial.printf("t_ms=%lu stamps=%s\n", (unsigned long)millis(),
+                g_sendStamps ? "on" : "off");
+  for (int t = 0; t < NUM_TASKS; ++t) {
+    const Task &task = tasks[t];
+    Serial.printf("task %s period=%lu runs=%lu avg=%lu max=%lu maxlate=%lu miss=%lu\n",
+                  task.name, (unsigned long)task.periodUs,
+                  (unsigned long)task.runs,
+                  (unsigned long)(task.runs ? task.totalRunUs / task.runs : 0),
+                  (unsigned long)task.maxRunUs, (unsigned long)task.maxLateUs,
+                  (unsigned long)task.misses);
+  }
+  dumpHistogram("scan_period_us", histScanPeriod);
+  dumpHistogram("key_to_midi_us", histKeyLatency);
+  Serial.printf("i2c_err mcp1=%lu mcp2=%lu enc1=%lu enc2=%lu pad=%lu\n",
+                (unsigned long)i2cErrors.mcp[0], (unsigned long)i2cErrors.mcp[1],
+                (unsigned long)i2cErrors.enc[0], (unsigned long)i2cErrors.enc[1],
+                (unsigned long)i2cErrors.pad);
+  Serial.printf("midi_tx sent=%lu coalesced=%lu computer_coalesced=%lu max_computer=%lu\n",
+                (unsigned long)txStats.sent, (unsigned long)txStats.coalesced,
+                (unsigned long)txStats.computerCoalesced,
+                (unsigned long)txStats.maxComputerWait);
+  Serial.printf("usb_midi mounted=%d in=%lu in_daisy_only=%lu out_drops=%lu\n",
+                TinyUSBDevice.mounted() ? 1 : 0, (unsigned long)usbMidiStats.in,
+                (unsigned long)usbMidiStats.inDaisyOnly,
+                (unsigned long)usbMidiStats.outDrops);
+}
+
+// ------------------------- setup() -----------------------------------
+void setup()
+{
+  Serial1.setTX(0);       // GP0 TX -> Daisy D14 (USART1 RX)
+  Serial1.setRX(1);       // GP1 RX <- Daisy D13 (USART1 TX), level meters
+  Serial1.setFIFOSize(256); // a UI frame's worth of meter bytes, with room
+  Serial1.begin(31250);   // MIDI baud
+
+  // USB MIDI next to the CDC port. The core has already enumerated by the
+  // time setup() runs, so re-attach for the host to see the new interface.
+  usbMidi.setStringDescriptor("KB2040 Groovebox");
+  usbMidi.begin();
+  Serial.begin(115200);   // USB CDC, stats dump only
+  if (TinyUSBDevice.mounted()) {
+    TinyUSBDevice.detach();
+    delay(10);
+    TinyUSBDevice.attach();
+  }
+
+  pinMode(BOOT_SW_PIN, INPUT_PULLUP);
+  pinMode(DAISY_RST_PIN,  INPUT);
+  pinMode(DAISY_BOOT_PIN, INPUT);
+  pinMode(LED_BUILTIN,    OUTPUT);
+  digitalWrite(LED_BUILTIN, LOW);
+
+  Wire.begin();
+  Wire.setClock(400000);
+
+  for (int i = 0; i < 20; ++i) {
+    keyState[i].pressed = false;
+    keyState[i].count   = 0;
+  }
+  updateNoteMap();
+
+  u8g2.setI2CAddress(OLED_ADDR << 1);
+  u8g2.begin();
+  u8g2.clearBuffer();
+  u8g2.setFont(u8g2_font_6x10_tf);
+  u8g2.drawStr(0, 12, "Init KB2040 POLY");
+  u8g2.sendBuffer();
+  oledSyncShadow();
+  delay(300);
+
+  // MCPs (keys)
+  if (mcp1.begin_I2C(MCP1_ADDR)) {
+    for (uint8_t i = 0; i < 10; i++)
+      mcp1.pinMode(MCP_PINS[i], INPUT_PULLUP);
+  }
+  if (mcp2.begin_I2C(MCP2_ADDR)) {
+    for (uint8_t i = 0; i < 10; i++)
+      mcp2.pinMode(MCP_PINS[i], INPUT_PULLUP);
+  }
+
+  // seesaw INT lines (open drain, active low)
+  if (PAD_INT_PIN >= 0)
+    pinMode(PAD_INT_PIN, INPUT_PULLUP);
+  for (int b = 0; b < 2; ++b) {
+    if (ENC_INT_PINS[b] >= 0)
+      pinMode(ENC_INT_PINS[b], INPUT_PULLUP);
+  }
+
+  // Gamepad
+  if (pad.begin(GAMEPAD_ADDR)) {
+    pad.pinModeBulk(BUTTON_MASK, INPUT_PULLUP);
+    pad.setGPIOInterrupts(BUTTON_MASK, true);
+    padOK = true;
+
+    long sumX = 0;
+    long sumY = 0;
+    const int samples = 64;
+    for (int i = 0; i < samples; ++i) {
+      int rawX = 1023 - pad.analogRead(14);
+      int rawY = 1023 - pad.analogRead(15);
+      sumX += rawX;
+      sumY += rawY;
+      delay(2);
+    }
+    joyCenterX = (int)(sumX / samples);
+    joyCenterY = (int)(sumY / samples);
+    joyFiltX.reset((float)joyCenterX);
+    joyFiltY.reset((float)joyCenterY);
+    joyLastSampleUs = micros();
+
+    // Initialize button prev states (not pressed = false because we use "nowX" as active state)
+    btnPrevX     = false;
+    btnPrevY     = false;
+    btnPrevA     = false;
+    btnPrevB     = false;
+    btnPrevSEL   = false;
+    btnPrevSTART = false;
+
+    // Prime the button state and clear anything flagged during init
+    uint32_t flags;
+    seesawReadIntFlags(pad, flags);
+    padButtons = pad.digitalReadBulk(BUTTON_MASK);
+  } else {
+    padOK = false;
+  }
+
+  // Encoders
+  const uint8_t encAddr[2] = {ENC1_ADDR, ENC2_ADDR};
+  for (int b = 0; b < 2; ++b) {
+    if (!encBoard[b].begin(encAddr[b]))
+      continue;
+    encBoardOK[b] = true;
+    encBoard[b].pinModeBulk(ENC_SWITCH_MASK, INPUT_PULLUP);
+    encBoard[b].setGPIOInterrupts(ENC_SWITCH_MASK, true);
+    for (int e = 0; e < 4; e++) {
+      encPressed[b][e] = false;
+      encBoard[b].enableEncoderInterrupt(e);
+      int32_t discard;
+      seesawReadEncoderDelta(encBoard[b], e, discard);
+    }
+    uint32_t flags;
+    seesawReadIntFlags(encBoard[b], flags);
+  }
+
+  // Initial param CCs
+  for (int enc = 0; enc < NUM_ENCODERS; ++enc) {
+    for (int slot = 0; slot < PARAMS_PER_ENCODER; ++slot)
+      sendCC(encoderParams[enc].cc[slot], encoderParams[enc].value[slot]);
+  }
+
+  // Ensure synth starts in voice mode
+  sendCC(MidiCC::INSTRUMENT_MODE, 0);
+  sendCC(MidiCC::LOOPER_CONTROL, 0);
+  txFlushAll();
+
+  delay(200);
+  pulseDaisyReset();
+
+  schedulerStart(micros());
+}
+
+// ------------------------- loop() ------------------------------------
+void loop()
+{
+  schedulerRunOnce();
 }
@@ -21,7 +21,8 @@ namespace MidiCh
 namespace MidiCC
 {
     // Joystick / expression
-    constexpr uint8_t MODWHEEL      = 1;   // joystick Y -> mod wheel
+    constexpr uint8_t MODWHEEL      = 1;   // joystick Y -> mod wheel (MSB)
+    constexpr uint8_t MODWHEEL_LSB  = 33;  // mod wheel fine (LSB, follows CC1)
     constexpr uint8_t VOLUME        = 7;   // master volume (encoder alt)
 
     // Sustain
@@ -47,4 +48,92 @@ namespace MidiCC
     // Instrument / looper control
     constexpr uint8_t INSTRUMENT_MODE = 90; // 0=synth, >=64=drum kit
     constexpr uint8_t LOOPER_CONTROL  = 91; // values: <20 stop, ~40 record toggle, ~80 play toggle
+
+    // Daisy audio setup, stored and applied at its next boot (MidiAudio)
+    constexpr uint8_t AUDIO_BLOCK_SIZE  = 102; // value = index into MidiAudio::BLOCK_SIZES
+    constexpr uint8_t AUDIO_SAMPLE_RATE = 103; // value = index into MidiAudio::SAMPLE_RATES
+
+    // Return line (MidiMeter, MidiSpectrum)
+    constexpr uint8_t SPECTRUM = 104; // >=64: send spectrum frames (analyzer page open)
+
+    // Master-out recorder on the Daisy's SD card
+    constexpr uint8_t RECORD = 105; // <64 stop, 64-95 record 16-bit WAV, >=96 record 24-bit
+
+    // MIDI file player on the Daisy
+    constexpr uint8_t SMF_PLAY = 106; // <64 stop, 64 the QSPI demo, 65+n SONGnnn.MID on SD
+}
+
+// Values for the AUDIO_* controllers. Smaller blocks and lower rates cut
+// latency; larger blocks leave more CPU for voices and FX.
+namespace MidiAudio
+{
+    constexpr uint16_t BLOCK_SIZES[]   = {8, 16, 24, 32, 48, 64, 96, 128, 192, 256};
+    constexpr uint8_t  NUM_BLOCK_SIZES = sizeof(BLOCK_SIZES) / sizeof(BLOCK_SIZES[0]);
+    constexpr uint32_t SAMPLE_RATES[]  = {32000, 48000, 96000};
+    constexpr uint8_t  NUM_SAMPLE_RATES = sizeof(SAMPLE_RATES) / sizeof(SAMPLE_RATES[0]);
+
+    constexpr uint8_t DEFAULT_BLOCK_SIZE  = 4; // 48
+    constexpr uint8_t DEFAULT_SAMPLE_RATE = 1; // 48 kHz
+}
+
+// Send timestamps for the Daisy's constant-latency mode (KB2040 -> Daisy).
+// F4 lsb msb carries the 14-bit scan time of the key scan that produced
+// the note on/off messages after it (CCs and bends are never stamped). A
+// stamp is only sent when it changes, and the Daisy stops applying one
+// that is older than STALE_US. 0xF4 is an undefined System Common status,
+// so other MIDI gear ignores it.
+namespace MidiStamp
+{
+    constexpr uint8_t  STATUS     = 0xF4;
+    constexpr uint8_t  UNIT_SHIFT = 6;                // 64 us ticks: micros() >> 6
+    constexpr uint32_t UNIT_US    = 1u << UNIT_SHIFT;
+    constexpr uint16_t MASK       = 0x3FFF;           // wraps every ~1.05 s
+    constexpr uint32_t STALE_US   = 100000;
+}
+
+// Level meters, Daisy -> KB2040 on the otherwise unused return line
+// (Daisy D13 USART1 TX -> KB2040 GP1 RX), about 30 frames a second:
+//   F0 7D 01 <clip> <peak rms> x NUM_CHANNELS F7
+// Levels are 0..127 in half-dB steps, 127 = 0 dBFS, 0 = -63.5 dB or
+// below; rms is the mean over the frame, peak the largest sample. Bit n of
+// clip is set when channel n reached full scale during the frame. 0x7D is
+// the non-commercial SysEx ID.
+namespace MidiMeter
+{
+    constexpr uint8_t SYSEX_ID = 0x7D;
+    constexpr uint8_t TYPE     = 0x01;
+
+    enum Channel : uint8_t
+    {
+        OUT_L = 0,
+        OUT_R,
+        SYNTH,  // voices, before the filter
+        DRUMS,  // drum kit, before the filter
+        DELAY,  // delay return
+        REVERB, // reverb return (left)
+        LOOPER, // loop playback (left)
+        NUM_CHANNELS,
+    };
+
+    constexpr uint8_t  HEADER_LEN = 4; // F0 7D 01 clip
+    constexpr uint8_t  FRAME_LEN  = HEADER_LEN + 2 * NUM_CHANNELS + 1;
+    constexpr uint32_t FRAME_US   = 33333;
+    constexpr uint8_t  LEVEL_MAX  = 127;
+}
+
+// Spectrum frames, Daisy -> KB2040 on the same line as the meters, about
+// 15 a second while MidiCC::SPECTRUM is on:
+//   F0 7D 02 <level> x NUM_BINS F7        (7D = MidiMeter::SYSEX_ID)
+// Bin b covers LOW_HZ * (HIGH_HZ / LOW_HZ)^(b / NUM_BINS) up to the next
+// edge; its level is the strongest component in it, 0..127 in 1 dB
+// steps, 127 = a full-scale sine.
+namespace MidiSpectrum
+{
+    constexpr uint8_t  TYPE      = 0x02;
+    constexpr uint8_t  NUM_BINS  = 40;
+    constexpr float    LOW_HZ    = 40.0f;
+    constexpr float    HIGH_HZ   = 12000.0f;
+    constexpr uint8_t  FRAME_LEN = 3 + NUM_BINS + 1;
+    constexpr uint32_t FRAME_US  = 66667;
+    constexpr uint8_t  LEVEL_MAX = 127;
 }